@@ -22,6 +22,7 @@ GNU General Public License for more details.
 #include "app_util.h"
 
 #include "editor.h"
+#include "frameimporter.h"
 #include "predefinedsetmodel.h"
 #include "viewmanager.h"
 
@@ -162,20 +163,14 @@ void ImportImageSeqDialog::setSpace(int number)
 void ImportImageSeqDialog::importArbitrarySequence()
 {
     QStringList files = getFilePaths();
-    int number = getSpace();
+    int number = qMax(1, getSpace());
 
-    // Show a progress dialog, as this can take a while if you have lots of images.
-    QProgressDialog progress(tr("Importing image sequence..."), tr("Abort"), 0, 100, mParent);
-    hideQuestionMark(progress);
-    progress.setWindowModality(Qt::WindowModal);
-    progress.show();
-
-    int totalImagesToImport = files.count();
-    int imagesImportedSoFar = 0;
-    progress.setMaximum(totalImagesToImport);
+    // Each image goes number frames after the one before it
+    QStringList imageFiles;
+    QList<int> positions;
+    int position = mEditor->currentFrame();
 
     QString failedFiles;
-    bool failedImport = false;
     for (const QString& strImgFile : files)
     {
         QString strImgFileLower = strImgFile.toLower();
@@ -187,44 +182,66 @@ void ImportImageSeqDialog::importArbitrarySequence()
             strImgFileLower.endsWith(".tif") ||
             strImgFileLower.endsWith(".tiff"))
         {
-            mEditor->importImage(strImgFile);
-
-            imagesImportedSoFar++;
-            progress.setValue(imagesImportedSoFar);
-            QApplication::processEvents(QEventLoop::ExcludeUserInputEvents);  // Required to make progress bar update
-
-            if (progress.wasCanceled())
-            {
-                break;
-            }
+            imageFiles.append(strImgFile);
+            positions.append(position);
+            position += number;
         }
         else
         {
             failedFiles += strImgFile + "\n";
-            if (!failedImport)
-            {
-                failedImport = true;
-            }
         }
+    }
 
-        for (int i = 1; i < number; i++)
+    // The images are decoded on worker threads while the ones before them are pasted
+    FrameImporter frames;
+    frames.startImages(imageFiles, positions);
+
+    // Show a progress dialog, as this can take a while if you have lots of images.
+    QProgressDialog progress(tr("Importing image sequence..."), tr("Abort"), 0, imageFiles.count(), mParent);
+    hideQuestionMark(progress);
+    progress.setWindowModality(Qt::WindowModal);
+    progress.show();
+
+    Status st = mEditor->importBitmapFrames(frames, [&progress, &frames](int imported)
+    {
+        progress.setValue(imported);
+        QApplication::processEvents(QEventLoop::ExcludeUserInputEvents);  // Required to make progress bar update
+
+        if (progress.wasCanceled())
         {
-            mEditor->scrubForward();
+            frames.cancel();
         }
+    });
+    progress.close();
+
+    for (const QString& strImgFile : frames.failedFiles())
+    {
+        failedFiles += strImgFile + "\n";
     }
 
-    if (failedImport)
+    if (!st.ok())
     {
         QMessageBox::warning(mParent,
                              tr("Warning"),
-                             tr("was unable to import") + failedFiles,
+                             st.title(),
                              QMessageBox::Ok,
                              QMessageBox::Ok);
+        return;
     }
 
+    // Ready for the next sequence
+    mEditor->scrubTo(position);
+
+    if (!failedFiles.isEmpty())
+    {
+        QMessageBox::warning(mParent,
+                             tr("Warning"),
+                             tr("was unable to import") + failedFiles,
+                             QMessageBox::Ok,
+                             QMessageBox::Ok);
+    }
 
     emit notifyAnimationLengthChanged();
-    progress.close();
 }
 
 const PredefinedKeySetParams ImportImageSeqDialog::predefinedKeySetParams() const
@@ -302,36 +319,59 @@ void ImportImageSeqDialog::importPredefinedSet()
 {
     PredefinedKeySet keySet = generatePredefinedKeySet();
 
+    QStringList imageFiles;
+    QList<int> positions;
+    for (int i = 0; i < keySet.size(); i++)
+    {
+        positions.append(keySet.keyFrameIndexAt(i));
+        imageFiles.append(keySet.filePathAt(i));
+    }
+
+    FrameImporter frames;
+    frames.startImages(imageFiles, positions);
+
     // Show a progress dialog, as this can take a while if you have lots of images.
-    QProgressDialog progress(tr("Importing images..."), tr("Abort"), 0, 100, mParent);
+    QProgressDialog progress(tr("Importing images..."), tr("Abort"), 0, keySet.size(), mParent);
     hideQuestionMark(progress);
     progress.setWindowModality(Qt::WindowModal);
     progress.show();
 
-    int totalImagesToImport = keySet.size();
-    int imagesImportedSoFar = 0;
-    progress.setMaximum(totalImagesToImport);
-
     mEditor->createNewBitmapLayer(keySet.layerName());
 
-    for (int i = 0; i < keySet.size(); i++)
+    Status st = mEditor->importBitmapFrames(frames, [&progress, &frames](int imported)
     {
-        const int& frameIndex = keySet.keyFrameIndexAt(i);
-        const QString& filePath = keySet.filePathAt(i);
-
-        mEditor->scrubTo(frameIndex);
-        bool ok = mEditor->importImage(filePath);
-        imagesImportedSoFar++;
-
-        progress.setValue(imagesImportedSoFar);
+        progress.setValue(imported);
         QApplication::processEvents(QEventLoop::ExcludeUserInputEvents);  // Required to make progress bar update
 
         if (progress.wasCanceled())
         {
-            break;
+            frames.cancel();
         }
+    });
+    progress.close();
 
-        if (!ok) { return;}
+    if (!st.ok())
+    {
+        QMessageBox::warning(mParent,
+                             tr("Warning"),
+                             st.title(),
+                             QMessageBox::Ok,
+                             QMessageBox::Ok);
+        return;
+    }
+
+    QString failedFiles;
+    for (const QString& strImgFile : frames.failedFiles())
+    {
+        failedFiles += strImgFile + "\n";
+    }
+    if (!failedFiles.isEmpty())
+    {
+        QMessageBox::warning(mParent,
+                             tr("Warning"),
+                             tr("was unable to import") + failedFiles,
+                             QMessageBox::Ok,
+                             QMessageBox::Ok);
     }
 
     emit notifyAnimationLengthChanged();
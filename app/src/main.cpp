@@ -27,8 +27,8 @@ GNU General Public License for more details.
 #include "editor.h"
 #include "mainwindow2.h"
 #include "pencilapplication.h"
-#include "layermanager.h"
 #include "layercamera.h"
+#include "renderjob.h"
 #include "platformhandler.h"
 
 
@@ -65,7 +65,6 @@ int handleArguments(PencilApplication& app)
     QStringList args = PencilApplication::arguments();
     QString inputPath;
     QStringList outputPaths;
-    LayerCamera* cameraLayer = nullptr;
     int width = -1, height = -1, startFrame = 1, endFrame = -1;
     bool transparency = false;
 
@@ -122,6 +121,10 @@ int handleArguments(PencilApplication& app)
                                           QObject::tr("Render transparency when possible"));
     parser.addOption(transparencyOption);
 
+    QCommandLineOption statsOption(QStringList() << "stats",
+                                   QObject::tr("Print how long rendering and writing the frames took"));
+    parser.addOption(statsOption);
+
     parser.process(args);
 
     QStringList posArgs = parser.positionalArguments();
@@ -217,14 +220,14 @@ int handleArguments(PencilApplication& app)
         }
     }
 
-    // Now that (almost) all possible user errors are handled, the actual program can be initialized
-    MainWindow2 mainWindow;
-    QObject::connect(&app, &PencilApplication::openFileRequested, &mainWindow, &MainWindow2::openFile);
-    app.emitOpenFileRequest();
-
     // If there are no output paths, open up the GUI (to the input path if there is one)
     if (outputPaths.isEmpty())
     {
+        // Now that (almost) all possible user errors are handled, the actual program can be initialized
+        MainWindow2 mainWindow;
+        QObject::connect(&app, &PencilApplication::openFileRequested, &mainWindow, &MainWindow2::openFile);
+        app.emitOpenFileRequest();
+
         PlatformHandler::configurePlatformSpecificSettings();
         mainWindow.show();
         if (!inputPath.isEmpty())
@@ -234,79 +237,60 @@ int handleArguments(PencilApplication& app)
         return PencilApplication::exec();
     }
 
-    mainWindow.openFile(inputPath);
-
-    if (!parser.value(cameraOption).isEmpty())
+    // Exporting does not need the main window, each output is rendered by a RenderJob
+    for (int i = 0; i < outputPaths.length(); i++)
     {
-        cameraLayer = dynamic_cast<LayerCamera*>(mainWindow.mEditor->layers()->findLayerByName(parser.value(cameraOption), Layer::CAMERA));
-        if (cameraLayer == nullptr)
+        const QString outputPath = outputPaths[i];
+        const QString extension = QFileInfo(outputPath).suffix().toLower();
+        const QStringList imageExtensions{ "png", "jpg", "jpeg", "tif", "tiff", "bmp" };
+        if (!RenderJob::isMovieFile(outputPath) && !imageExtensions.contains(extension))
         {
-            err << QObject::tr("Warning: the specified camera layer %1 was not found, ignoring.").arg(parser.value(cameraOption)) << endl;
+            err << QObject::tr("Warning: Output format is not specified or unsupported. Using PNG.", "Command line warning") << endl;
         }
-    }
-    if (cameraLayer == nullptr)
-    {
-        cameraLayer = dynamic_cast<LayerCamera*>(mainWindow.mEditor->layers()->getLastCameraLayer());
-    }
 
-    for (int i = 0; i < outputPaths.length(); i++)
-    {
-        // Detect format
-        QString format;
-        QMap<QString, QString> extensionMapping
-        {
-            { "png",  "PNG" },
-            { "jpg" , "JPG" },
-            { "jpeg", "JPG" },
-            { "tif",  "TIF" },
-            { "tiff", "TIF" },
-            { "bmp",  "BMP" },
-            { "mp4",  "MP4" },
-            { "avi",  "AVI" },
-            { "gif",  "GIF" },
-            { "webm", "WEBM" },
-            { "apng", "APNG" },
-        };
-        QString extension = outputPaths[i].mid(outputPaths[i].lastIndexOf(".") + 1).toLower();
-        if (inputPath.contains(".") && extensionMapping.contains(extension))
+        RenderJobDesc desc;
+        desc.projectFile = inputPath;
+        desc.outputFile = outputPath;
+        desc.cameraName = parser.value(cameraOption);
+        desc.startFrame = startFrame;
+        desc.endFrame = endFrame;
+        desc.exportSize = QSize(width, height);
+        desc.transparency = transparency;
+
+        RenderJob job(desc);
+        Status st = job.load();
+        if (!st.ok())
         {
-            format = extensionMapping[extension];
+            err << QObject::tr("Error: could not open '%1'", "Command line error").arg(inputPath) << endl;
+            return 1;
         }
-        else
+        if (!desc.cameraName.isEmpty() && job.camera()->name() != desc.cameraName)
         {
-            err << QObject::tr("Warning: Output format is not specified or unsupported. Using PNG.", "Command line warning") << endl;
-            format = "PNG";
+            err << QObject::tr("Warning: the specified camera layer %1 was not found, ignoring.").arg(desc.cameraName) << endl;
         }
 
-        QMap<QString, bool> formatMapping
-        {
-            { "PNG", false },
-            { "JPG", false },
-            { "TIF", false },
-            { "BMP", false },
-            { "MP4",  true },
-            { "AVI",  true },
-            { "GIF",  true },
-            { "WEBM", true },
-            { "APNG", true },
-        };
-        bool asMovie = formatMapping[format];
-
-        if (asMovie)
+        if (RenderJob::isMovieFile(outputPath))
         {
             if (transparency)
             {
                 err << QObject::tr("Warning: Transparency is not currently supported in movie files", "Command line warning") << endl;
             }
             out << QObject::tr("Exporting movie...", "Command line task progress") << endl;
-            mainWindow.mEditor->exportMovieCLI(outputPaths[i], cameraLayer, width, height, startFrame, endFrame);
-            out << QObject::tr("Done.", "Command line task done") << endl;
         }
-        else {
+        else
+        {
             out << QObject::tr("Exporting image sequence...", "Command line task progress") << endl;
-            mainWindow.mEditor->exportSeqCLI(outputPaths[i], cameraLayer, format, width, height, startFrame, endFrame, transparency);
-            out << QObject::tr("Done.", "Command line task done") << endl;
         }
+        if (!job.run().ok())
+        {
+            err << QObject::tr("Error: could not export '%1'", "Command line error").arg(outputPath) << endl;
+            return 1;
+        }
+        if (parser.isSet(statsOption))
+        {
+            out << job.stats().toString() << endl;
+        }
+        out << QObject::tr("Done.", "Command line task done") << endl;
     }
 
     return 0;
@@ -48,6 +48,7 @@ GNU General Public License for more details.
 #include "fileformat.h"     //contains constants used by Pencil File Format
 #include "util.h"
 #include "backupelement.h"
+#include "frameimporter.h"
 
 // app headers
 #include "colorbox.h"
@@ -978,7 +979,36 @@ void MainWindow2::importMovie()
     {
         return;
     }
-    mEditor->importMovie(filePath, mEditor->playback()->fps());
+
+    // ffmpeg decodes the movie into a pipe, the frames are pasted as they come
+    FrameImporter frames;
+    Status st = frames.startMovie(filePath, mEditor->playback()->fps(), mEditor->currentFrame());
+    if (st.ok())
+    {
+        QProgressDialog progress(tr("Importing movie..."), tr("Abort"), 0, frames.frameCount(), this);
+        hideQuestionMark(progress);
+        progress.setWindowModality(Qt::WindowModal);
+        progress.show();
+
+        st = mEditor->importBitmapFrames(frames, [&progress, &frames](int imported)
+        {
+            progress.setMaximum(frames.frameCount());
+            progress.setValue(imported);
+            QApplication::processEvents(QEventLoop::ExcludeUserInputEvents);  // Required to make progress bar update
+
+            if (progress.wasCanceled())
+            {
+                frames.cancel();
+            }
+        });
+        progress.close();
+    }
+
+    if (!st.ok())
+    {
+        ErrorDialog errorDialog(st.title(), st.description(), st.details().html());
+        errorDialog.exec();
+    }
 }
 
 void MainWindow2::lockWidgets(bool shouldLock)
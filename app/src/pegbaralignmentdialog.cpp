@@ -1,11 +1,14 @@
 #include "pegbaralignmentdialog.h"
 #include "ui_pegbaralignmentdialog.h"
 
+#include <QLineF>
 #include <QListWidget>
 #include <QListWidgetItem>
 #include <QMessageBox>
+#include "object.h"
 #include "layermanager.h"
 #include "selectionmanager.h"
+#include "pegbaraligner.h"
 
 PegBarAlignmentDialog::PegBarAlignmentDialog(Editor *editor, QWidget *parent) :
     QDialog(parent),
@@ -138,14 +141,41 @@ void PegBarAlignmentDialog::alignPegs()
     }
     else
     {
-        Status::StatusInt statusint = mEditor->pegBarAlignment(bitmaplayers);
-        if (statusint.errorcode == Status::FAIL)
+        std::vector<PegRegistration> registrations;
+        Status st = mEditor->findPegBarOffsets(bitmaplayers, ui->cbSubPixel->isChecked(), registrations);
+        if (!st.ok())
         {
             QMessageBox::information(this, nullptr,
                                      tr("Peg hole not found!\nCheck selection, and please try again."),
                                      QMessageBox::Ok);
             return;
         }
+
+        // Every offset is shown before anything moves
+        QString details;
+        qreal largest = 0;
+        for (const PegRegistration& registration : registrations)
+        {
+            details += QString("%1 - %2: %3, %4\n")
+                .arg(mEditor->object()->getLayer(registration.layer)->name())
+                .arg(registration.frame)
+                .arg(registration.offset.x(), 0, 'f', 2)
+                .arg(registration.offset.y(), 0, 'f', 2);
+            largest = qMax(largest, QLineF(QPointF(), registration.offset).length());
+        }
+
+        QMessageBox confirm(QMessageBox::Question, windowTitle(),
+                            tr("%1 keyframes will move by up to %2 pixels.")
+                                .arg(registrations.size())
+                                .arg(largest, 0, 'f', 2),
+                            QMessageBox::Ok | QMessageBox::Cancel, this);
+        confirm.setDetailedText(details);
+        if (confirm.exec() != QMessageBox::Ok)
+        {
+            return;
+        }
+
+        mEditor->applyPegBarOffsets(registrations);
         emit closedialog();
     }
 }
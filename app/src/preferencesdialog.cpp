@@ -169,7 +169,7 @@ GeneralPage::GeneralPage() : ui(new Ui::GeneralPage)
     connect(ui->titleSafeInput, spinValueChanged, this, &GeneralPage::titleSafeAreaChanged);
     connect(ui->safeHelperTextCheckbox, &QCheckBox::stateChanged, this, &GeneralPage::SafeAreaHelperTextCheckBoxStateChanged);
     connect(ui->gridCheckBox, &QCheckBox::stateChanged, this, &GeneralPage::gridCheckBoxStateChanged);
-    connect(ui->framePoolSizeSpin, spinValueChanged, this, &GeneralPage::frameCacheNumberChanged);
+    connect(ui->framePoolSizeSpin, spinValueChanged, this, &GeneralPage::frameCacheBudgetChanged);
 }
 
 GeneralPage::~GeneralPage()
@@ -227,7 +227,7 @@ void GeneralPage::updateValues()
     QString bgName = mManager->getString(SETTING::BACKGROUND_STYLE);
 
     SignalBlocker b12(ui->framePoolSizeSpin);
-    ui->framePoolSizeSpin->setValue(mManager->getInt(SETTING::FRAME_POOL_SIZE));
+    ui->framePoolSizeSpin->setValue(mManager->getInt(SETTING::FRAME_POOL_MEMORY_BUDGET));
 
     int buttonIdx = 1;
     if (bgName == "checkerboard") buttonIdx = 1;
@@ -349,9 +349,9 @@ void GeneralPage::gridCheckBoxStateChanged(int b)
     mManager->set(SETTING::GRID, b != Qt::Unchecked);
 }
 
-void GeneralPage::frameCacheNumberChanged(int value)
+void GeneralPage::frameCacheBudgetChanged(int value)
 {
-    mManager->set(SETTING::FRAME_POOL_SIZE, value);
+    mManager->set(SETTING::FRAME_POOL_MEMORY_BUDGET, value);
 }
 
 TimelinePage::TimelinePage()
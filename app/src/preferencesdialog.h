@@ -96,7 +96,7 @@ private slots:
     void gridCheckBoxStateChanged(int b);
     void curveSmoothingChanged(int value);
     void backgroundChanged(int value);
-    void frameCacheNumberChanged(int value);
+    void frameCacheBudgetChanged(int value);
 
 private:
 
@@ -0,0 +1,48 @@
+#-------------------------------------------------
+#
+# Pencil2D headless renderer
+#
+#-------------------------------------------------
+
+! include( ../common.pri ) { error( Could not find the common.pri file! ) }
+
+QT += core widgets gui xml multimedia svg
+
+TEMPLATE = app
+TARGET = pencil2d-render
+
+CONFIG   += console
+CONFIG   -= app_bundle
+
+DESTDIR = ../bin
+
+MOC_DIR = .moc
+OBJECTS_DIR = .obj
+
+INCLUDEPATH += \
+    ../core_lib/src/graphics \
+    ../core_lib/src/graphics/bitmap \
+    ../core_lib/src/graphics/vector \
+    ../core_lib/src/interface \
+    ../core_lib/src/structure \
+    ../core_lib/src/tool \
+    ../core_lib/src/util \
+    ../core_lib/src/managers
+
+SOURCES += \
+    src/main.cpp
+
+# --- core_lib ---
+win32:CONFIG(release, debug|release): LIBS += -L$$OUT_PWD/../core_lib/release/ -lcore_lib
+else:win32:CONFIG(debug, debug|release): LIBS += -L$$OUT_PWD/../core_lib/debug/ -lcore_lib
+else:unix: LIBS += -L$$OUT_PWD/../core_lib/ -lcore_lib
+
+INCLUDEPATH += $$PWD/../core_lib/src
+
+win32-g++:CONFIG(release, debug|release): PRE_TARGETDEPS += $$OUT_PWD/../core_lib/release/libcore_lib.a
+else:win32-g++:CONFIG(debug, debug|release): PRE_TARGETDEPS += $$OUT_PWD/../core_lib/debug/libcore_lib.a
+else:win32:!win32-g++:CONFIG(release, debug|release): PRE_TARGETDEPS += $$OUT_PWD/../core_lib/release/core_lib.lib
+else:win32:!win32-g++:CONFIG(debug, debug|release): PRE_TARGETDEPS += $$OUT_PWD/../core_lib/debug/core_lib.lib
+else:unix: PRE_TARGETDEPS += $$OUT_PWD/../core_lib/libcore_lib.a
+
+macx: LIBS += -framework AppKit
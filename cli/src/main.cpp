@@ -0,0 +1,182 @@
+/*
+
+Pencil - Traditional Animation Software
+Copyright (C) 2012-2018 Matthew Chiawen Chang
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+*/
+
+#include <atomic>
+#include <clocale>
+#include <QGuiApplication>
+#include <QCommandLineParser>
+#include <QCommandLineOption>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QRunnable>
+#include <QTextStream>
+#include <QThread>
+#include <QThreadPool>
+
+#include "renderjob.h"
+
+
+namespace
+{
+    QMutex outputMutex;
+
+    void report(const QString& line)
+    {
+        QMutexLocker locker(&outputMutex);
+        QTextStream(stdout) << line << endl;
+    }
+
+    /** Loads and renders one shot on a thread of the shot pool */
+    class ShotTask : public QRunnable
+    {
+    public:
+        ShotTask(const RenderJobDesc& desc, bool printStats, std::atomic<int>* failures)
+            : mDesc(desc), mPrintStats(printStats), mFailures(failures) {}
+
+        void run() override
+        {
+            QElapsedTimer timer;
+            timer.start();
+
+            RenderJob job(mDesc);
+            Status st = job.load();
+            if (st.ok())
+            {
+                if (!mDesc.cameraName.isEmpty() && job.camera()->name() != mDesc.cameraName)
+                {
+                    report(QString("Warning: camera layer %1 not found in %2, using %3")
+                           .arg(mDesc.cameraName, mDesc.projectFile, job.camera()->name()));
+                }
+                st = job.run();
+            }
+            if (!st.ok())
+            {
+                (*mFailures)++;
+                report(QString("FAILED %1 -> %2: %3").arg(mDesc.projectFile, mDesc.outputFile, st.msg()));
+                return;
+            }
+            report(QString("Rendered %1 -> %2, frames %3 to %4 in %5 ms")
+                   .arg(mDesc.projectFile, mDesc.outputFile)
+                   .arg(job.firstFrame()).arg(job.lastFrame())
+                   .arg(timer.elapsed()));
+            if (mPrintStats)
+            {
+                report(job.stats().toString());
+            }
+        }
+
+    private:
+        RenderJobDesc mDesc;
+        bool mPrintStats = false;
+        std::atomic<int>* mFailures;
+    };
+}
+
+int main(int argc, char* argv[])
+{
+    // Same as the application, some localizations use a comma as decimal separator
+    std::setlocale(LC_NUMERIC, "en_US.UTF-8");
+
+    // Nothing is shown, so no display is needed either
+    if (!qEnvironmentVariableIsSet("QT_QPA_PLATFORM"))
+    {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+
+    QGuiApplication app(argc, argv);
+    QGuiApplication::setApplicationName("pencil2d-render");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Renders Pencil2D projects to image sequences or movies without opening the editor. "
+                                     "Every <input> <output> pair is a shot, the shots are rendered concurrently.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("input", "Path to a pencil file.");
+    parser.addPositionalArgument("output", "Path to render it to, the extension picks the format.");
+
+    QCommandLineOption cameraOption("camera", "Name of the camera layer to use", "layer_name");
+    QCommandLineOption widthOption("width", "Width of the output frames", "integer");
+    QCommandLineOption heightOption("height", "Height of the output frames", "integer");
+    QCommandLineOption startOption("start", "The first frame to render", "frame", "1");
+    QCommandLineOption endOption("end", "The last frame to render, or last or last-sound", "frame", "last");
+    QCommandLineOption transparencyOption("transparency", "Render transparency when possible");
+    QCommandLineOption jobsOption("jobs", "Number of shots rendered at the same time, all of them by default", "integer");
+    QCommandLineOption threadsOption("threads", "Render threads per shot, the cores are shared out by default", "integer");
+    QCommandLineOption statsOption("stats", "Print how long rendering and writing the frames of each shot took");
+    parser.addOptions({ cameraOption, widthOption, heightOption, startOption, endOption,
+                        transparencyOption, jobsOption, threadsOption, statsOption });
+    parser.process(app);
+
+    QTextStream err(stderr);
+
+    const QStringList posArgs = parser.positionalArguments();
+    if (posArgs.isEmpty() || posArgs.size() % 2 != 0)
+    {
+        err << "Error: expected pairs of input and output paths." << endl;
+        parser.showHelp(1);
+    }
+    const int shotCount = posArgs.size() / 2;
+
+    RenderJobDesc common;
+    common.cameraName = parser.value(cameraOption);
+    common.exportSize = QSize(parser.value(widthOption).toInt(), parser.value(heightOption).toInt());
+    if (!parser.isSet(widthOption)) common.exportSize.setWidth(-1);
+    if (!parser.isSet(heightOption)) common.exportSize.setHeight(-1);
+    common.startFrame = qMax(1, parser.value(startOption).toInt());
+    common.transparency = parser.isSet(transparencyOption);
+
+    const QString end = parser.value(endOption);
+    if (end == "last")
+    {
+        common.endFrame = -1;
+    }
+    else if (end == "last-sound")
+    {
+        common.endFrame = -2;
+    }
+    else
+    {
+        bool ok = false;
+        common.endFrame = end.toInt(&ok);
+        if (!ok || common.endFrame < common.startFrame)
+        {
+            err << QString("Error: invalid end frame %1.").arg(end) << endl;
+            return 1;
+        }
+    }
+
+    int jobs = parser.isSet(jobsOption) ? parser.value(jobsOption).toInt() : shotCount;
+    jobs = qBound(1, jobs, shotCount);
+
+    // Each shot has its own pipeline, so the cores are split between the shots running together
+    common.renderThreads = parser.isSet(threadsOption)
+        ? qMax(1, parser.value(threadsOption).toInt())
+        : qMax(1, QThread::idealThreadCount() / jobs);
+
+    QThreadPool shots;
+    shots.setMaxThreadCount(jobs);
+
+    std::atomic<int> failures{ 0 };
+    for (int i = 0; i < shotCount; i++)
+    {
+        RenderJobDesc desc = common;
+        desc.projectFile = posArgs[2 * i];
+        desc.outputFile = posArgs[2 * i + 1];
+        shots.start(new ShotTask(desc, parser.isSet(statsOption), &failures));
+    }
+    shots.waitForDone();
+
+    return (failures == 0) ? 0 : 1;
+}
@@ -31,10 +31,17 @@ INCLUDEPATH += src \
 # Input
 HEADERS +=  \
     src/graphics/bitmap/bitmapimage.h \
+    src/graphics/bitmap/tiledimage.h \
+    src/graphics/bitmap/pixelkernels.h \
+    src/graphics/bitmap/mipmappyramid.h \
+    src/graphics/bitmap/transformsession.h \
+    src/graphics/bitmap/brushdab.h \
+    src/graphics/bitmap/smudgeengine.h \
     src/graphics/vector/bezierarea.h \
     src/graphics/vector/beziercurve.h \
     src/graphics/vector/colourref.h \
     src/graphics/vector/vectorimage.h \
+    src/graphics/vector/vectorspatialindex.h \
     src/graphics/vector/vectorselection.h \
     src/graphics/vector/vertexref.h \
     src/interface/backupelement.h \
@@ -58,6 +65,7 @@ HEADERS +=  \
     src/managers/soundmanager.h \
     src/structure/camera.h \
     src/structure/keyframe.h \
+    src/structure/keyframeindex.h \
     src/structure/layer.h \
     src/structure/layerbitmap.h \
     src/structure/layercamera.h \
@@ -67,6 +75,7 @@ HEADERS +=  \
     src/structure/object.h \
     src/structure/objectdata.h \
     src/structure/filemanager.h \
+    src/structure/projectarchive.h \
     src/tool/basetool.h \
     src/tool/brushtool.h \
     src/tool/buckettool.h \
@@ -93,10 +102,16 @@ HEADERS +=  \
     src/util/movemode.h \
     src/canvaspainter.h \
     src/soundplayer.h \
+    src/framerenderpipeline.h \
     src/movieexporter.h \
+    src/frameimporter.h \
+    src/pegbaraligner.h \
+    src/renderjob.h \
     src/miniz.h \
     src/qminiz.h \
     src/activeframepool.h \
+    src/frameprefetcher.h \
+    src/onionskincache.h \
     src/external/platformhandler.h \
     src/external/macosx/macosxnative.h \
     src/util/pointerevent.h \
@@ -104,10 +119,17 @@ HEADERS +=  \
 
 
 SOURCES +=  src/graphics/bitmap/bitmapimage.cpp \
+    src/graphics/bitmap/tiledimage.cpp \
+    src/graphics/bitmap/pixelkernels.cpp \
+    src/graphics/bitmap/mipmappyramid.cpp \
+    src/graphics/bitmap/transformsession.cpp \
+    src/graphics/bitmap/brushdab.cpp \
+    src/graphics/bitmap/smudgeengine.cpp \
     src/graphics/vector/bezierarea.cpp \
     src/graphics/vector/beziercurve.cpp \
     src/graphics/vector/colourref.cpp \
     src/graphics/vector/vectorimage.cpp \
+    src/graphics/vector/vectorspatialindex.cpp \
     src/graphics/vector/vectorselection.cpp \
     src/graphics/vector/vertexref.cpp \
     src/interface/editor.cpp \
@@ -129,6 +151,7 @@ SOURCES +=  src/graphics/bitmap/bitmapimage.cpp \
     src/managers/viewmanager.cpp \
     src/structure/camera.cpp \
     src/structure/keyframe.cpp \
+    src/structure/keyframeindex.cpp \
     src/structure/layer.cpp \
     src/structure/layerbitmap.cpp \
     src/structure/layercamera.cpp \
@@ -138,6 +161,7 @@ SOURCES +=  src/graphics/bitmap/bitmapimage.cpp \
     src/structure/soundclip.cpp \
     src/structure/objectdata.cpp \
     src/structure/filemanager.cpp \
+    src/structure/projectarchive.cpp \
     src/tool/basetool.cpp \
     src/tool/brushtool.cpp \
     src/tool/buckettool.cpp \
@@ -160,10 +184,16 @@ SOURCES +=  src/graphics/bitmap/bitmapimage.cpp \
     src/canvaspainter.cpp \
     src/soundplayer.cpp \
     src/managers/soundmanager.cpp \
+    src/framerenderpipeline.cpp \
     src/movieexporter.cpp \
+    src/frameimporter.cpp \
+    src/pegbaraligner.cpp \
+    src/renderjob.cpp \
     src/miniz.cpp \
     src/qminiz.cpp \
     src/activeframepool.cpp \
+    src/frameprefetcher.cpp \
+    src/onionskincache.cpp \
     src/util/pointerevent.cpp \
     src/selectionpainter.cpp
 
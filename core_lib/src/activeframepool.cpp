@@ -16,39 +16,131 @@ GNU General Public License for more details.
 */
 
 #include "activeframepool.h"
+#include <algorithm>
 #include "keyframe.h"
+#include "bitmapimage.h"
 #include "pencildef.h"
 #include <QDebug>
 
 
-ActiveFramePool::ActiveFramePool(unsigned long n)
+namespace
 {
-    size_t maxSize = n;
+    /** Object::updateActiveFrames() prefetches this many frames on each side of the playhead */
+    const int NEIGHBOUR_FRAMES = 3;
+}
+
+QString FramePoolStats::toString() const
+{
+    const qint64 shown = hits + misses;
+    const double hitRate = (shown > 0) ? hits * 100.0 / shown : 0.0;
 
-    Q_ASSERT(maxSize > 10);
-    mMaxSize = maxSize;
+    return QString("%1 frames, %2 of %3 MB | %4 hits, %5 misses (%6% hit) | %7 evictions")
+        .arg(frameCount)
+        .arg(residentBytes / (1024.0 * 1024.0), 0, 'f', 1)
+        .arg(memoryBudget / (1024 * 1024))
+        .arg(hits)
+        .arg(misses)
+        .arg(hitRate, 0, 'f', 1)
+        .arg(evictions);
+}
+
+ActiveFramePool::ActiveFramePool(qint64 memoryBudget)
+{
+    Q_ASSERT(memoryBudget > 0);
+    mMemoryBudget = memoryBudget;
 }
 
 ActiveFramePool::~ActiveFramePool() {}
 
+/** Loads key now, from the prefetched image if there is one */
 void ActiveFramePool::put(KeyFrame* key)
 {
     if (key == nullptr)
         return;
 
+    touch(key);
+    if (key->isLoaded())
+    {
+        mHits++;
+    }
+    else
+    {
+        mMisses++;
+    }
+
+    if (BitmapImage* bitmap = dynamic_cast<BitmapImage*>(key))
+    {
+        mPrefetcher.finish(bitmap);
+    }
+    key->loadFile();
+
+    if (std::find(mShownFrames.begin(), mShownFrames.end(), key) == mShownFrames.end())
+    {
+        mShownFrames.push_back(key);
+    }
+    measure(key);
+    discardLeastUsedFrames();
+}
+
+/** Loads key in the background if it is a bitmap, see FramePrefetcher */
+void ActiveFramePool::prefetch(KeyFrame* key)
+{
+    if (key == nullptr)
+        return;
+
+    touch(key);
+    if (BitmapImage* bitmap = dynamic_cast<BitmapImage*>(key))
+    {
+        mPrefetcher.request(bitmap);
+    }
+    else
+    {
+        key->loadFile();
+    }
+
+    measure(key);
+    discardLeastUsedFrames();
+}
+
+/** Hands the images decoded in the background over to their key frames */
+void ActiveFramePool::collectPrefetched()
+{
+    for (BitmapImage* bitmap : mPrefetcher.collect())
+    {
+        if (isFrameInPool(bitmap))
+        {
+            measure(bitmap);
+        }
+    }
+    discardLeastUsedFrames();
+}
+
+/** Moves key to the front of the cache list */
+void ActiveFramePool::touch(KeyFrame* key)
+{
     Q_ASSERT(key->pos() > 0);
 
     auto it = mCacheFramesMap.find(key);
     mCacheFramesList.push_front(key);
     if (it != mCacheFramesMap.end())
     {
-        mCacheFramesList.erase(it->second);
+        mCacheFramesList.erase(it->second.position);
+        it->second.position = mCacheFramesList.begin();
+    }
+    else
+    {
+        mCacheFramesMap[key].position = mCacheFramesList.begin();
     }
-    mCacheFramesMap[key] = mCacheFramesList.begin();
     key->addEventListener(this);
-    key->loadFile();
+}
 
-    discardLeastUsedFrames();
+/** Updates the bytes accounted to key, which must be in the pool */
+void ActiveFramePool::measure(KeyFrame* key)
+{
+    Entry& entry = mCacheFramesMap[key];
+    const qint64 bytes = key->memoryUsage();
+    mResidentBytes += bytes - entry.bytes;
+    entry.bytes = bytes;
 }
 
 size_t ActiveFramePool::size() const
@@ -58,57 +150,120 @@ size_t ActiveFramePool::size() const
 
 void ActiveFramePool::clear()
 {
+    mPrefetcher.clear();
     for (KeyFrame* key : mCacheFramesList)
     {
         key->removeEventListner(this);
     }
     mCacheFramesList.clear();
     mCacheFramesMap.clear();
+    mShownFrames.clear();
+    mResidentBytes = 0;
 }
 
-void ActiveFramePool::resize(int n)
+/** Sets how many bytes the key frames in the pool may hold */
+void ActiveFramePool::setMemoryBudget(qint64 bytes)
 {
-    n = std::min(n, 1500);
-    n = std::max(n, 10);
-    mMaxSize = static_cast<unsigned>(n);
+    mMemoryBudget = std::max<qint64>(bytes, 1);
     discardLeastUsedFrames();
 }
 
+/** Moves the protected range to frame. The frames put() afterwards are the ones shown there. */
+void ActiveFramePool::setPlayhead(int frame)
+{
+    mPlayhead = frame;
+    mShownFrames.clear();
+}
+
+/** Sets how many frames on each side of the playhead are kept for the onion skins */
+void ActiveFramePool::setOnionSkinRange(int framesBefore, int framesAfter)
+{
+    mOnionBefore = std::max(framesBefore, 0);
+    mOnionAfter = std::max(framesAfter, 0);
+}
+
 bool ActiveFramePool::isFrameInPool(KeyFrame* key)
 {
     auto it = mCacheFramesMap.find(key);
     return (it != mCacheFramesMap.end());
 }
 
+FramePoolStats ActiveFramePool::stats() const
+{
+    FramePoolStats result;
+    result.hits = mHits;
+    result.misses = mMisses;
+    result.evictions = mEvictions;
+    result.residentBytes = mResidentBytes;
+    result.memoryBudget = mMemoryBudget;
+    result.frameCount = static_cast<int>(mCacheFramesMap.size());
+    return result;
+}
+
 void ActiveFramePool::onKeyFrameDestroy(KeyFrame* key)
 {
     auto it = mCacheFramesMap.find(key);
     if (it != mCacheFramesMap.end())
     {
-        mCacheFramesList.erase(it->second);
+        mResidentBytes -= it->second.bytes;
+        mCacheFramesList.erase(it->second.position);
         mCacheFramesMap.erase(it);
     }
+    mShownFrames.erase(std::remove(mShownFrames.begin(), mShownFrames.end(), key), mShownFrames.end());
+    mPrefetcher.cancel(key);
+}
+
+/** Returns whether key is shown now, or close enough to the playhead to be shown soon */
+bool ActiveFramePool::isProtected(KeyFrame* key) const
+{
+    const int first = mPlayhead - std::max(mOnionBefore, NEIGHBOUR_FRAMES);
+    const int last = mPlayhead + std::max(mOnionAfter, NEIGHBOUR_FRAMES);
+    if (key->pos() >= first && key->pos() <= last)
+    {
+        return true;
+    }
+    return std::find(mShownFrames.begin(), mShownFrames.end(), key) != mShownFrames.end();
 }
 
 void ActiveFramePool::discardLeastUsedFrames()
 {
-    while (mCacheFramesMap.size() > mMaxSize)
+    // Least used first, leaving the frames around the playhead for last
+    auto it = mCacheFramesList.end();
+    while (mResidentBytes > mMemoryBudget && it != mCacheFramesList.begin())
+    {
+        --it;
+        if (!isProtected(*it))
+        {
+            it = evict(it);
+        }
+    }
+
+    // The protected frames alone are over budget, keep the one used last
+    while (mResidentBytes > mMemoryBudget && mCacheFramesList.size() > 1)
     {
-        list_iterator_t last = mCacheFramesList.end();
-        last--;
+        evict(std::prev(mCacheFramesList.end()));
+    }
+}
 
-        KeyFrame* lastKeyFrame = *last;
-        unloadFrame(lastKeyFrame);
+/** Unloads the frame at it and drops it from the pool, returns the position after it */
+ActiveFramePool::list_iterator_t ActiveFramePool::evict(list_iterator_t it)
+{
+    KeyFrame* key = *it;
+    unloadFrame(key);
 
-        mCacheFramesMap.erase(lastKeyFrame);
-        mCacheFramesList.pop_back();
+    auto entry = mCacheFramesMap.find(key);
+    mResidentBytes -= entry->second.bytes;
+    mCacheFramesMap.erase(entry);
+    mShownFrames.erase(std::remove(mShownFrames.begin(), mShownFrames.end(), key), mShownFrames.end());
+    mEvictions++;
 
-        lastKeyFrame->removeEventListner(this);
-    }
+    key->removeEventListner(this);
+    return mCacheFramesList.erase(it);
 }
 
 void ActiveFramePool::unloadFrame(KeyFrame* key)
 {
+    mPrefetcher.cancel(key);
     //qDebug() << "Unload frame:" << key->pos();
     key->unloadFile();
 }
@@ -20,39 +20,90 @@ GNU General Public License for more details.
 
 #include <list>
 #include <unordered_map>
+#include <vector>
+#include <QString>
 #include "keyframe.h"
+#include "frameprefetcher.h"
+
+
+/** Counters of an ActiveFramePool, since it was created */
+struct FramePoolStats
+{
+    qint64 hits = 0;          //< frames shown that were already in memory
+    qint64 misses = 0;        //< frames shown that had to be loaded first
+    qint64 evictions = 0;
+    qint64 residentBytes = 0; //< held by the key frames in the pool
+    qint64 memoryBudget = 0;
+    int frameCount = 0;
+
+    QString toString() const;
+};
 
 
 /** 
  * ActiveFramePool implemented a LRU cache to keep tracking the most recent accessed key frames
  * A key frame will be unloaded if it's not accessed for a while (at the end of cache list)
  * The ActiveFramePool will be updated whenever Editor::scrubTo() gets called.
+ * Frames about to be shown are prefetched: their files are decoded on worker threads
+ * and the images handed over the next time the pool is updated.
+ *
+ * The pool is bounded by the bytes its key frames hold, see KeyFrame::memoryUsage().
+ * Over budget, the least used frames are unloaded first, except those shown now and
+ * those close enough to the playhead to be shown soon or drawn as onion skins.
+ * Those go too only when they alone do not fit.
  *
  * Note: ActiveFramePool doesn't not handle file saving. It loads frames, but never write frames to disks.
  */
 class ActiveFramePool : public KeyFrameEventListener
 {
 public:
-    explicit ActiveFramePool(unsigned long n);
+    explicit ActiveFramePool(qint64 memoryBudget);
     virtual ~ActiveFramePool();
 
     void put(KeyFrame* key);
+    void prefetch(KeyFrame* key);
+    void collectPrefetched();
     size_t size() const;
     void clear();
-    void resize(int n);
+    void setMemoryBudget(qint64 bytes);
+    void setPlayhead(int frame);
+    void setOnionSkinRange(int framesBefore, int framesAfter);
     bool isFrameInPool(KeyFrame*);
+    FramePoolStats stats() const;
 
     void onKeyFrameDestroy(KeyFrame*) override;
 
 private:
+    void touch(KeyFrame* key);
+    void measure(KeyFrame* key);
+    bool isProtected(KeyFrame* key) const;
     void discardLeastUsedFrames();
     void unloadFrame(KeyFrame* key);
 
     using list_iterator_t = std::list<KeyFrame*>::iterator;
 
+    struct Entry
+    {
+        list_iterator_t position;
+        qint64 bytes = 0; //< memoryUsage() when the frame was last used
+    };
+
+    list_iterator_t evict(list_iterator_t it);
+
     std::list<KeyFrame*> mCacheFramesList;
-    std::unordered_map<KeyFrame*, list_iterator_t> mCacheFramesMap;
-    size_t mMaxSize = 200;
+    std::unordered_map<KeyFrame*, Entry> mCacheFramesMap;
+    FramePrefetcher mPrefetcher;
+
+    qint64 mMemoryBudget = 0;
+    qint64 mResidentBytes = 0;
+    int mPlayhead = 1;
+    int mOnionBefore = 0;
+    int mOnionAfter = 0;
+    std::vector<KeyFrame*> mShownFrames; //< put() since the last setPlayhead(), one per layer
+
+    qint64 mHits = 0;
+    qint64 mMisses = 0;
+    qint64 mEvictions = 0;
 };
 
 #endif // ACTIVEFRAMEPOOL_H
@@ -22,9 +22,16 @@ GNU General Public License for more details.
 #include "bitmapimage.h"
 #include "layercamera.h"
 #include "vectorimage.h"
+#include <cmath>
 #include "util.h"
+#include "mipmappyramid.h"
 
 
+/** Divides rounding towards negative infinity, for pixel grids that don't start at 0 */
+static int floorDiv(int a, int b)
+{
+    return (a >= 0) ? a / b : -((-a + b - 1) / b);
+}
 
 CanvasPainter::CanvasPainter(QObject* parent) : QObject(parent)
 , mLog("CanvasRenderer")
@@ -67,52 +74,70 @@ void CanvasPainter::setTransformedSelection(QRect selection, QTransform transfor
 void CanvasPainter::ignoreTransformedSelection()
 {
     mRenderTransform = false;
+    mTransformSession.end();
 }
 
+/** Composites the cached layers below and above the current one with the current layer.
+ *
+ *  While the same frame is shown through the same view, only the dirty rectangle
+ *  given to setPaintSettings() is recomposited; the rest of the canvas is left
+ *  as the previous call painted it.
+ */
 void CanvasPainter::paintCached()
 {
-    QPixmap tempPixmap(mCanvas->size());
-    tempPixmap.fill(Qt::transparent);
-    mCanvas->fill(Qt::transparent);
-    QPainter tempPainter;
-    QPainter painter;
-    initializePainter(tempPainter, tempPixmap);
-    initializePainter(painter, *mCanvas);
+    const bool partial = mPreLayersCache && mPostLayersCache
+        && !mDirtyRect.isEmpty()
+        && mCachedFrame == mFrameNumber
+        && mCachedLayerIndex == mCurrentLayerIndex
+        && mCachedView == mViewTransform
+        && mCachedCanvasKey == mCanvas->cacheKey()
+        && mPreLayersCache->size() == mCanvas->size();
 
     if (!mPreLayersCache)
     {
-        renderPreLayers(painter);
-        mPreLayersCache.reset(new QPixmap(*mCanvas));
+        mPreLayersCache.reset(new QPixmap(mCanvas->size()));
+        mPreLayersCache->fill(Qt::transparent);
+        renderPreLayers(mPreLayersCache.get());
     }
-    else
+    if (!mPostLayersCache)
     {
-        painter.setWorldMatrixEnabled(false);
-        painter.drawPixmap(0, 0, *(mPreLayersCache.get()));
-        painter.setWorldMatrixEnabled(true);
+        mPostLayersCache.reset(new QPixmap(mCanvas->size()));
+        mPostLayersCache->fill(Qt::transparent);
+        renderPostLayers(mPostLayersCache.get());
     }
 
+    const QRect dirty = partial ? mDirtyRect.intersected(mCanvas->rect()) : mCanvas->rect();
+
+    QPainter painter;
+    initializePainter(painter, *mCanvas);
+
+    painter.setWorldMatrixEnabled(false);
+    painter.setClipRect(dirty);
+    painter.setCompositionMode(QPainter::CompositionMode_Source);
+    painter.drawPixmap(dirty, *mPreLayersCache, dirty);
+    painter.setCompositionMode(QPainter::CompositionMode_SourceOver);
+    painter.setWorldMatrixEnabled(true);
+
+    mRenderRect = dirty;
     renderCurLayer(painter);
+    mRenderRect = QRect();
 
-    if (!mPostLayersCache)
-    {
-        renderPostLayers(tempPainter);
-        mPostLayersCache.reset(new QPixmap(tempPixmap));
-        painter.setWorldMatrixEnabled(false);
-        painter.drawPixmap(0, 0, tempPixmap);
-        painter.setWorldMatrixEnabled(true);
-    }
-    else
-    {
-        painter.setWorldMatrixEnabled(false);
-        painter.drawPixmap(0, 0, *(mPostLayersCache.get()));
-        painter.setWorldMatrixEnabled(true);
-    }
+    painter.setWorldMatrixEnabled(false);
+    painter.drawPixmap(dirty, *mPostLayersCache, dirty);
+    painter.end();
+
+    // Painting changes the key, so anyone else drawing on the canvas forces a full repaint next time
+    mCachedCanvasKey = mCanvas->cacheKey();
+    mCachedFrame = mFrameNumber;
+    mCachedLayerIndex = mCurrentLayerIndex;
+    mCachedView = mViewTransform;
 }
 
 void CanvasPainter::resetLayerCache()
 {
     mPreLayersCache.reset();
     mPostLayersCache.reset();
+    mCachedFrame = -1;
 }
 
 void CanvasPainter::initializePainter(QPainter& painter, QPixmap& pixmap)
@@ -177,9 +202,9 @@ void CanvasPainter::renderPostLayers(QPainter& painter)
 
 void CanvasPainter::setPaintSettings(const Object* object, int currentLayer, int frame, QRect rect, BitmapImage *buffer)
 {
-    Q_UNUSED(rect)
     Q_ASSERT(object);
     mObject = object;
+    mDirtyRect = rect;
 
     mCurrentLayerIndex = currentLayer;
     mFrameNumber = frame;
@@ -304,83 +329,128 @@ void CanvasPainter::paintBitmapFrame(QPainter& painter,
         paintedImage = bitmapLayer->getBitmapImageAtFrame(nFrame);
     }
 
-    if ((paintedImage == nullptr || paintedImage->bounds().isEmpty())
-        && !(isCurrentFrame && mBuffer != nullptr && !mBuffer->bounds().isEmpty()))
+    const bool paintBuffer = isCurrentFrame && mBuffer != nullptr && !mBuffer->bounds().isEmpty();
+    if ((paintedImage == nullptr || paintedImage->bounds().isEmpty()) && !paintBuffer)
     {
         return;
     }
 
-    if (paintedImage == nullptr)
+    // Zoomed out, the frame is drawn from the mipmap level closest to the screen resolution
+    const int level = MipmapPyramid::levelForScale(mOptions.scaling);
+    const int factor = 1 << level;
+
+    QRect frameBounds;
+    QImage frameImage;
+    if (paintedImage != nullptr)
     {
-        paintedImage = new BitmapImage();
+        paintedImage->loadFile(); // Critical! force the BitmapImage to load the image
+        frameImage = paintedImage->mipmap(level);
+        frameBounds = paintedImage->bounds();
     }
 
-    paintedImage->loadFile(); // Critical! force the BitmapImage to load the image
-    //qCDebug(mLog) << "Paint Image Size:" << paintedImage->image()->size();
-
-    BitmapImage paintToImage;
-    paintToImage.paste(paintedImage);
+    // If the current frame on the current layer has a transformation, we apply it.
+    const bool transformSelection = mRenderTransform && nFrame == mFrameNumber && layer == mObject->getLayer(mCurrentLayerIndex);
+    if (transformSelection)
+    {
+        paintTransformedSelection(painter);
+    }
 
-    if (isCurrentFrame)
+    // Only the part of the layer that will be visible is composited
+    QRect region = frameBounds;
+    if (paintBuffer)
     {
-        paintToImage.paste(mBuffer, mOptions.cmBufferBlendMode);
+        region = region.united(mBuffer->bounds());
+    }
+    region = region.intersected(renderCanvasRect());
+    if (region.isEmpty())
+    {
+        return;
     }
 
-    if (colorize)
+    // Snap the region to whole pixels of the mipmap level
+    const QPoint anchor = frameBounds.isEmpty() ? region.topLeft() : frameBounds.topLeft();
+    QRect levelRect;
+    levelRect.setLeft(floorDiv(region.left() - anchor.x(), factor));
+    levelRect.setTop(floorDiv(region.top() - anchor.y(), factor));
+    levelRect.setRight(floorDiv(region.right() - anchor.x(), factor));
+    levelRect.setBottom(floorDiv(region.bottom() - anchor.y(), factor));
+
+    QImage source;
+    QRect sourceRect;
+    if (!paintBuffer && !transformSelection)
     {
-        QBrush colorBrush = QBrush(Qt::transparent); //no color for the current frame
+        // Nothing to blend, draw straight from the key frame or its tinted copy
+        levelRect = levelRect.intersected(frameImage.rect());
+        source = (colorize) ? mOnionSkinCache.tinted(paintedImage, frameImage, onionSkinTint(nFrame), level) : frameImage;
+        sourceRect = levelRect;
+    }
+    else
+    {
+        source = QImage(levelRect.size(), QImage::Format_ARGB32_Premultiplied);
+        source.fill(Qt::transparent);
 
-        if (nFrame < mFrameNumber)
+        QPainter composer(&source);
+        composer.setRenderHint(QPainter::SmoothPixmapTransform, level > 0);
+        composer.scale(1.0 / factor, 1.0 / factor);
+        composer.translate(-(anchor + levelRect.topLeft() * factor));
+        if (!frameImage.isNull())
         {
-            colorBrush = QBrush(Qt::red);
+            composer.drawImage(QRectF(anchor, frameImage.size() * factor), frameImage);
         }
-        else if (nFrame > mFrameNumber)
+
+        if (paintBuffer)
         {
-            colorBrush = QBrush(Qt::blue);
+            composer.setCompositionMode(mOptions.cmBufferBlendMode);
+            mBuffer->paintImage(composer);
         }
 
-        paintToImage.drawRect(paintedImage->bounds(),
-                              Qt::NoPen,
-                              colorBrush,
-                              QPainter::CompositionMode_SourceIn,
-                              false);
-    }
+        if (colorize)
+        {
+            composer.setCompositionMode(QPainter::CompositionMode_SourceIn);
+            composer.fillRect(frameBounds, onionSkinTint(nFrame));
+        }
 
-    // If the current frame on the current layer has a transformation, we apply it.
-    if (mRenderTransform && nFrame == mFrameNumber && layer == mObject->getLayer(mCurrentLayerIndex))
-    {
-        paintToImage.clear(mSelection);
-        paintTransformedSelection(painter);
+        if (transformSelection)
+        {
+            composer.setCompositionMode(QPainter::CompositionMode_Clear);
+            composer.fillRect(mSelection, Qt::transparent);
+        }
+        composer.end();
+        sourceRect = source.rect();
     }
 
+    const QRect target(anchor + levelRect.topLeft() * factor, levelRect.size() * factor);
+
     painter.setWorldMatrixEnabled(true);
 
-    prescale(&paintToImage);
-    paintToImage.paintImage(painter, mScaledBitmap, mScaledBitmap.rect(), paintToImage.bounds());
+    QPainter::RenderHints previous_renderhints = painter.renderHints();
+    painter.setRenderHint(QPainter::SmoothPixmapTransform, mOptions.scaling < 1.0f);
+    painter.drawImage(QRectF(target), source, sourceRect);
+    painter.setRenderHints(previous_renderhints);
 }
 
-void CanvasPainter::prescale(BitmapImage* bitmapImage)
+/** Returns the part of the canvas being rendered, in canvas coordinates,
+ *  grown so that resampling at its edges reads the right pixels.
+ *  That is the visible canvas unless paintCached() limits it to the dirty rectangle.
+ */
+QRect CanvasPainter::renderCanvasRect() const
 {
-    QImage origImage = bitmapImage->image()->copy();
-
-    // copy content of our unmodified qimage
-    // to our (not yet) scaled bitmap
-    mScaledBitmap = origImage.copy();
-
-    if (mOptions.scaling >= 1.0f)
-    {
-        // TODO: Qt doesn't handle huge upscaled qimages well...
-        // possible solution, myPaintLib canvas renderer splits its canvas up in chunks.
-    }
-    else
+    QRectF rect = mRenderRect;
+    if (rect.isEmpty())
     {
-        // map to correct matrix
-        QRect mappedOrigImage = mViewTransform.mapRect(bitmapImage->bounds());
-        mScaledBitmap = mScaledBitmap.scaled(mappedOrigImage.size(),
-                                             Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+        if (mCanvas == nullptr)
+        {
+            return QRect();
+        }
+        rect = mCanvas->rect();
     }
+
+    const qreal scaling = qBound(0.01, static_cast<qreal>(mOptions.scaling), 1.0);
+    const int margin = 2 + static_cast<int>(std::ceil(1.0 / scaling));
+    return mViewInverse.mapRect(rect).toAlignedRect().adjusted(-margin, -margin, margin, margin);
 }
 
+
 void CanvasPainter::paintVectorFrame(QPainter& painter,
                                      Layer* layer,
                                      int nFrame,
@@ -414,40 +484,50 @@ void CanvasPainter::paintVectorFrame(QPainter& painter,
         return;
     }
 
-    QImage* pImage = new QImage(mCanvas->size(), QImage::Format_ARGB32_Premultiplied);
-    vectorImage->outputImage(pImage, mViewTransform, mOptions.bOutlines, mOptions.bThinLines, mOptions.bAntiAlias);
+    // Painted again only when the frame, the view or the display options changed
+    QImage image = vectorImage->rasterized(mCanvas->size(), mViewTransform, mOptions.bOutlines, mOptions.bThinLines, mOptions.bAntiAlias);
 
-    //painter.drawImage( QPoint( 0, 0 ), *pImage );
-    // Go through a Bitmap image to paint the onion skin colour
-    BitmapImage tempBitmapImage;
-    tempBitmapImage.setImage(pImage);
+    painter.setWorldMatrixEnabled(false); // Don't transform the image here as we used the viewTransform in the image output
+
+    const bool paintBuffer = isCurrentFrame && mBuffer != nullptr && !mBuffer->bounds().isEmpty();
+    if (!paintBuffer)
+    {
+        painter.drawImage(QPoint(0, 0), (colorize) ? mOnionSkinCache.tinted(vectorImage, image, onionSkinTint(nFrame), 0) : image);
+        return;
+    }
+
+    // Go through a Bitmap image to paint the buffer and the onion skin colour
+    BitmapImage tempBitmapImage(QPoint(0, 0), image);
 
-    if (isCurrentFrame)
+    if (paintBuffer)
     {
         tempBitmapImage.paste(mBuffer, mOptions.cmBufferBlendMode);
     }
 
     if (colorize)
     {
-        QBrush colorBrush = QBrush(Qt::transparent); //no color for the current frame
-
-        if (nFrame < mFrameNumber)
-        {
-            colorBrush = QBrush(Qt::red);
-        }
-        else if (nFrame > mFrameNumber)
-        {
-            colorBrush = QBrush(Qt::blue);
-        }
-        tempBitmapImage.drawRect(pImage->rect(),
-                                 Qt::NoPen, colorBrush,
+        tempBitmapImage.drawRect(image.rect(),
+                                 Qt::NoPen, QBrush(onionSkinTint(nFrame)),
                                  QPainter::CompositionMode_SourceIn, false);
     }
 
-    painter.setWorldMatrixEnabled(false); // Don't transform the image here as we used the viewTransform in the image output
     tempBitmapImage.paintImage(painter);
 }
 
+/** The colour of the onion skin of nFrame: red before the current frame, blue after it */
+QColor CanvasPainter::onionSkinTint(int nFrame) const
+{
+    if (nFrame < mFrameNumber)
+    {
+        return Qt::red;
+    }
+    if (nFrame > mFrameNumber)
+    {
+        return Qt::blue;
+    }
+    return Qt::transparent; //no color for the current frame
+}
+
 void CanvasPainter::paintTransformedSelection(QPainter& painter)
 {
     // Make sure there is something selected
@@ -458,13 +538,17 @@ void CanvasPainter::paintTransformedSelection(QPainter& painter)
 
     if (layer->type() == Layer::BITMAP)
     {
-        // Get the transformed image
+        // The selected pixels are copied on the first paint of the transformation,
+        // then only the visible part of the preview is resampled from them
         BitmapImage* bitmapImage = dynamic_cast<LayerBitmap*>(layer)->getLastBitmapImageAtFrame(mFrameNumber, 0);
-        BitmapImage transformedImage = bitmapImage->transformed(mSelection, mSelectionTransform, mOptions.bAntiAlias);
+        if (!mTransformSession.isActiveFor(bitmapImage, mSelection))
+        {
+            mTransformSession.begin(bitmapImage, mSelection);
+        }
 
-        // Paint the transformation output
         painter.setWorldMatrixEnabled(true);
-        transformedImage.paintImage(painter);
+        mTransformSession.paintPreview(painter, mSelectionTransform, renderCanvasRect(),
+                                       mOptions.scaling, mOptions.bAntiAlias);
     }
 }
 
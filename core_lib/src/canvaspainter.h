@@ -25,6 +25,8 @@ GNU General Public License for more details.
 #include "pencildef.h"
 
 #include "layer.h"
+#include "onionskincache.h"
+#include "transformsession.h"
 
 class Object;
 class BitmapImage;
@@ -112,6 +114,7 @@ private:
 
     void paintBitmapFrame(QPainter&, Layer* layer, int nFrame, bool colorize, bool useLastKeyFrame, bool isCurrentFrame);
     void paintVectorFrame(QPainter&, Layer* layer, int nFrame, bool colorize, bool useLastKeyFrame, bool isCurrentFrame);
+    QColor onionSkinTint(int nFrame) const;
 
     void paintTransformedSelection(QPainter& painter);
     void paintGrid(QPainter& painter);
@@ -121,7 +124,7 @@ private:
     void paintOverlaySafeAreas(QPainter& painter);
     void paintCameraBorder(QPainter& painter);
     void paintAxis(QPainter& painter);
-    void prescale(BitmapImage* bitmapImage);
+    QRect renderCanvasRect() const;
 
     /** Calculate layer opacity based on current layer offset */
     qreal calculateRelativeOpacityForLayer(int layerIndex) const;
@@ -139,7 +142,10 @@ private:
     int mFrameNumber = 0;
     BitmapImage* mBuffer = nullptr;
 
-    QImage mScaledBitmap;
+    /** The part of the canvas to recomposite in paintCached(), in canvas pixmap coordinates.
+     *  Empty while everything is painted. */
+    QRect mDirtyRect;
+    QRect mRenderRect; //< limits the layers being painted, in canvas pixmap coordinates; empty for no limit
 
     bool bMultiLayerOnionSkin = false;
 
@@ -147,12 +153,22 @@ private:
     bool mRenderTransform = false;
     QRect mSelection;
     QTransform mSelectionTransform;
+    TransformSession mTransformSession; //< the selected pixels, copied once per transformation
 
     QLoggingCategory mLog;
 
     // Caches specificially for when drawing on the canvas
     std::unique_ptr<QPixmap> mPreLayersCache, mPostLayersCache;
 
+    // Tinted onion skins, reused while their key frames are unchanged
+    OnionSkinCache mOnionSkinCache;
+
+    // What the canvas showed after the last paintCached(), outside the dirty rectangle it is reused as is
+    int mCachedFrame = -1;
+    int mCachedLayerIndex = -1;
+    QTransform mCachedView;
+    qint64 mCachedCanvasKey = 0;
+
     constexpr static int OVERLAY_SAFE_CENTER_CROSS_SIZE = 25;
 };
 
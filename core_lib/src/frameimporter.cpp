@@ -0,0 +1,376 @@
+/*
+
+Pencil - Traditional Animation Software
+Copyright (C) 2012-2018 Matthew Chiawen Chang
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+*/
+
+#include "frameimporter.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QImageReader>
+#include <QProcess>
+#include <QRegularExpression>
+#include <QRunnable>
+#include <QSysInfo>
+#include <QThread>
+
+#include "movieexporter.h"
+
+
+class ImageDecodeTask : public QRunnable
+{
+public:
+    ImageDecodeTask(FrameImporter* importer, int index) : mImporter(importer), mIndex(index) {}
+
+    void run() override { mImporter->decodeImage(mIndex); }
+
+private:
+    FrameImporter* mImporter;
+    int mIndex;
+};
+
+
+/** Runs ffmpeg for the whole movie on one worker, see FrameImporter::decodeMovie() */
+class MovieDecodeTask : public QRunnable
+{
+public:
+    MovieDecodeTask(FrameImporter* importer, const QString& ffmpegPath, const QStringList& args)
+        : mImporter(importer), mFFmpegPath(ffmpegPath), mArgs(args) {}
+
+    void run() override { mImporter->decodeMovie(mFFmpegPath, mArgs); }
+
+private:
+    FrameImporter* mImporter;
+    QString mFFmpegPath;
+    QStringList mArgs;
+};
+
+
+FrameImporter::FrameImporter()
+{
+    setWorkerCount(0);
+}
+
+FrameImporter::~FrameImporter()
+{
+    cancel();
+    mWorkers.waitForDone();
+}
+
+/** Sets the number of decoding threads, 0 or less picks one per core */
+void FrameImporter::setWorkerCount(int count)
+{
+    if (count <= 0)
+    {
+        count = QThread::idealThreadCount();
+    }
+    count = qMax(1, count);
+
+    mWorkers.setMaxThreadCount(count);
+
+    // Enough to keep every worker busy while the consumer pastes
+    mMaxInFlight = count * 2;
+}
+
+/** Starts decoding files, the frame of files[i] goes to positions[i] */
+Status FrameImporter::startImages(const QStringList& files, const QList<int>& positions)
+{
+    Q_ASSERT(files.size() == positions.size());
+
+    mFiles = files;
+    mPositions = positions;
+    mFrameCount = files.size();
+    mNextToSchedule = 0;
+    mNextToTake = 0;
+
+    scheduleImages();
+    return Status::OK;
+}
+
+/** Starts ffmpeg on movieFile, its frames go to consecutive positions from firstPosition.
+ *
+ *  ffmpeg is run once to read the size and the duration of the movie from its
+ *  report, then again to write the frames resampled to fps as raw BGRA pixels.
+ */
+Status FrameImporter::startMovie(const QString& movieFile, int fps, int firstPosition)
+{
+    const QString ffmpegPath = ffmpegLocation();
+    if (!QFile::exists(ffmpegPath))
+    {
+        qCritical() << "Please place ffmpeg in " << ffmpegPath << " directory";
+        return Status::ERROR_FFMPEG_NOT_FOUND;
+    }
+
+    DebugDetails dd;
+    dd << QString("Import movie ").append(movieFile);
+
+    // Without an output, ffmpeg only describes the input
+    QProcess probe;
+    probe.start(ffmpegPath, QStringList() << "-hide_banner" << "-i" << movieFile);
+    if (!probe.waitForFinished())
+    {
+        dd << "ffmpeg did not describe the movie";
+        return Status(Status::FAIL, dd);
+    }
+    const QString report = QString::fromUtf8(probe.readAllStandardError());
+
+    const QRegularExpressionMatch size = QRegularExpression("Stream #.*Video:.*?(\\d{2,5})x(\\d{2,5})").match(report);
+    if (!size.hasMatch())
+    {
+        dd << "No video stream found" << report;
+        return Status(Status::FAIL, dd);
+    }
+    const int width = size.captured(1).toInt();
+    const int height = size.captured(2).toInt();
+
+    const QRegularExpressionMatch duration = QRegularExpression("Duration: (\\d+):(\\d+):(\\d+\\.?\\d*)").match(report);
+    if (duration.hasMatch())
+    {
+        const double seconds = duration.captured(1).toInt() * 3600
+            + duration.captured(2).toInt() * 60
+            + duration.captured(3).toDouble();
+        mFrameCount = qMax(1, qRound(seconds * fps));
+    }
+
+    // ARGB32 is stored as BGRA bytes on little endian machines
+    const QString pixelFormat = (QSysInfo::ByteOrder == QSysInfo::LittleEndian) ? "bgra" : "argb";
+
+    QStringList args;
+    args << "-v" << "error" << "-i" << movieFile
+         << "-r" << QString::number(fps)
+         << "-f" << "rawvideo" << "-pix_fmt" << pixelFormat << "-";
+
+    mIsMovie = true;
+    mFirstPosition = firstPosition;
+    mMovieSize = QSize(width, height);
+    mMovieFramesDecoded = 0;
+    mMovieEnded = false;
+    mNextToTake = 0;
+
+    // ffmpeg is started by the worker that reads it, wait to know whether it did start
+    QMutexLocker locker(&mMutex);
+    mMovieStarting = true;
+    mWorkers.start(new MovieDecodeTask(this, ffmpegPath, args));
+    while (mMovieStarting)
+    {
+        mFrameReady.wait(&mMutex);
+    }
+    if (!mMovieStarted)
+    {
+        dd << "Could not start ffmpeg";
+        return Status(Status::FAIL, dd);
+    }
+    return Status::OK;
+}
+
+bool FrameImporter::hasMoreFrames() const
+{
+    if (mCanceled)
+    {
+        return false;
+    }
+    if (mIsMovie)
+    {
+        return !mMovieEnded || mNextToTake < mMovieFramesDecoded;
+    }
+    return mNextToTake < mFiles.size();
+}
+
+/** Hands back the next frame, in order.
+ *
+ *  @param[out] frame Receives the decoded frame and its position
+ *  @param[in] timeout Maximum time to wait for the frame, in milliseconds
+ *
+ *  @return True if frame was filled, false if it isn't ready yet,
+ *          there are no more frames, or the import was canceled.
+ */
+bool FrameImporter::takeNextFrame(ImportedFrame& frame, int timeout)
+{
+    if (!hasMoreFrames())
+    {
+        return false;
+    }
+    QMutexLocker locker(&mMutex);
+    auto it = mDecodedImages.find(mNextToTake);
+    if (it == mDecodedImages.end())
+    {
+        mFrameReady.wait(&mMutex, static_cast<unsigned long>(qMax(0, timeout)));
+        it = mDecodedImages.find(mNextToTake);
+    }
+    if (it == mDecodedImages.end() || mCanceled)
+    {
+        return false;
+    }
+
+    frame.position = mIsMovie ? mFirstPosition + mNextToTake : mPositions.at(mNextToTake);
+    frame.fileName = mIsMovie ? QString() : mFiles.at(mNextToTake);
+    frame.image = it->second;
+    mDecodedImages.erase(it);
+    mNextToTake++;
+    if (mIsMovie)
+    {
+        // Room for one more frame of the movie
+        mFrameReady.wakeAll();
+    }
+    locker.unlock();
+
+    if (mIsMovie)
+    {
+        // The estimate from the duration may be short
+        mFrameCount = qMax(mFrameCount, mNextToTake);
+        return true;
+    }
+    if (frame.image.isNull())
+    {
+        mFailedFiles.append(frame.fileName);
+    }
+
+    scheduleImages();
+    return true;
+}
+
+void FrameImporter::cancel()
+{
+    mCanceled = true;
+    mWorkers.clear();
+
+    QMutexLocker locker(&mMutex);
+    mFrameReady.wakeAll();
+}
+
+void FrameImporter::scheduleImages()
+{
+    while (!mCanceled
+           && mNextToSchedule < mFiles.size()
+           && mNextToSchedule - mNextToTake < mMaxInFlight)
+    {
+        mWorkers.start(new ImageDecodeTask(this, mNextToSchedule));
+        mNextToSchedule++;
+    }
+}
+
+/** Runs on a worker thread, the image is converted there so the consumer only pastes it */
+void FrameImporter::decodeImage(int index)
+{
+    QImage image;
+    if (!mCanceled)
+    {
+        QImageReader reader(mFiles.at(index));
+        if (reader.read(&image))
+        {
+            image = image.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+        }
+        else
+        {
+            qDebug() << "Cannot import" << mFiles.at(index) << reader.errorString();
+            image = QImage();
+        }
+    }
+
+    QMutexLocker locker(&mMutex);
+    mDecodedImages[index] = image;
+    mFrameReady.wakeAll();
+}
+
+/** Runs on a worker thread for the whole movie.
+ *
+ *  The QProcess belongs to this thread, which has no event loop, so the pipe is
+ *  only read here and never behind the back of the consumer. While
+ *  MOVIE_FRAMES_AHEAD frames wait to be taken, nothing is read and ffmpeg
+ *  blocks on the full pipe.
+ */
+void FrameImporter::decodeMovie(const QString& ffmpegPath, const QStringList& args)
+{
+    QProcess ffmpeg;
+    ffmpeg.start(ffmpegPath, args);
+    const bool started = ffmpeg.waitForStarted();
+    {
+        QMutexLocker locker(&mMutex);
+        mMovieStarted = started;
+        mMovieEnded = !started;
+        mMovieStarting = false;
+        mFrameReady.wakeAll();
+    }
+    if (!started)
+    {
+        return;
+    }
+
+    QImage frame(mMovieSize, QImage::Format_ARGB32);
+    const qint64 frameBytes = frame.byteCount();
+    qint64 bytesRead = 0;
+    int index = 0;
+    while (!mCanceled)
+    {
+        {
+            QMutexLocker locker(&mMutex);
+            while (!mCanceled && index - mNextToTake >= MOVIE_FRAMES_AHEAD)
+            {
+                mFrameReady.wait(&mMutex);
+            }
+        }
+        if (mCanceled)
+        {
+            break;
+        }
+
+        if (ffmpeg.bytesAvailable() == 0)
+        {
+            // Short waits, so a cancel is noticed
+            if (!ffmpeg.waitForReadyRead(100) && ffmpeg.state() == QProcess::NotRunning
+                && ffmpeg.bytesAvailable() == 0)
+            {
+                // A partial frame at the end is dropped
+                break;
+            }
+            continue;
+        }
+
+        char* pixels = reinterpret_cast<char*>(frame.bits());
+        const qint64 read = ffmpeg.read(pixels + bytesRead, frameBytes - bytesRead);
+        if (read < 0)
+        {
+            break;
+        }
+        bytesRead += read;
+        if (bytesRead < frameBytes)
+        {
+            continue;
+        }
+
+        const QImage image = frame.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+        bytesRead = 0;
+
+        QMutexLocker locker(&mMutex);
+        mDecodedImages[index] = image;
+        index++;
+        mMovieFramesDecoded = index;
+        mFrameReady.wakeAll();
+    }
+
+    if (ffmpeg.state() != QProcess::NotRunning)
+    {
+        ffmpeg.kill();
+        ffmpeg.waitForFinished();
+    }
+    const QByteArray errors = ffmpeg.readAllStandardError();
+    if (!errors.isEmpty() && !mCanceled)
+    {
+        qDebug() << "ffmpeg:" << errors;
+    }
+
+    QMutexLocker locker(&mMutex);
+    mMovieEnded = true;
+    mFrameReady.wakeAll();
+}
@@ -0,0 +1,106 @@
+/*
+
+Pencil - Traditional Animation Software
+Copyright (C) 2012-2018 Matthew Chiawen Chang
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+*/
+
+#ifndef FRAMEIMPORTER_H
+#define FRAMEIMPORTER_H
+
+#include <atomic>
+#include <map>
+#include <QImage>
+#include <QList>
+#include <QMutex>
+#include <QSize>
+#include <QString>
+#include <QStringList>
+#include <QThreadPool>
+#include <QWaitCondition>
+#include "pencilerror.h"
+
+/** One decoded frame and the key frame position it goes to */
+struct ImportedFrame
+{
+    int position = 0;
+    QImage image;     //< premultiplied ARGB32, null if the file could not be read
+    QString fileName; //< empty for the frames of a movie
+};
+
+
+/** Decodes the frames of an import ahead of the thread that adds them to the layer.
+ *
+ *  Image files are read on a pool of worker threads, a few frames ahead of the
+ *  consumer. Movies are decoded by ffmpeg, which writes raw pixels to a pipe, so
+ *  nothing goes through temporary files. One worker owns ffmpeg and reads the pipe
+ *  only while fewer than MOVIE_FRAMES_AHEAD frames wait for the consumer, so ffmpeg
+ *  blocks on the full pipe instead of piling frames up in memory.
+ *
+ *  The consumer calls takeNextFrame() until hasMoreFrames() is false and gets
+ *  the frames back in order.
+ */
+class FrameImporter
+{
+public:
+    FrameImporter();
+    ~FrameImporter();
+
+    void setWorkerCount(int count);
+
+    Status startImages(const QStringList& files, const QList<int>& positions);
+    Status startMovie(const QString& movieFile, int fps, int firstPosition);
+
+    static const int MOVIE_FRAMES_AHEAD = 4;
+
+    bool hasMoreFrames() const;
+    bool takeNextFrame(ImportedFrame& frame, int timeout);
+    void cancel();
+
+    /** The number of frames to import, an estimate for movies */
+    int frameCount() const { return mFrameCount; }
+    QStringList failedFiles() const { return mFailedFiles; }
+
+private:
+    void scheduleImages();
+    void decodeImage(int index);
+    void decodeMovie(const QString& ffmpegPath, const QStringList& args);
+
+    friend class ImageDecodeTask;
+    friend class MovieDecodeTask;
+
+    int mFrameCount = 0;
+    int mNextToTake = 0;
+    QStringList mFailedFiles;
+
+    // Image files
+    QStringList mFiles;
+    QList<int> mPositions;
+    int mNextToSchedule = 0;
+    int mMaxInFlight = 1;
+    QThreadPool mWorkers;
+    QMutex mMutex;
+    QWaitCondition mFrameReady;
+    std::map<int, QImage> mDecodedImages;
+    std::atomic<bool> mCanceled{ false };
+
+    // Movie, the frames decoded go to mDecodedImages as well
+    bool mIsMovie = false;
+    int mFirstPosition = 1;
+    QSize mMovieSize;
+    bool mMovieStarting = false;               //< guarded by mMutex
+    bool mMovieStarted = false;                //< guarded by mMutex
+    std::atomic<int> mMovieFramesDecoded{ 0 };
+    std::atomic<bool> mMovieEnded{ false };    //< ffmpeg is done, no frame is added any more
+};
+
+#endif // FRAMEIMPORTER_H
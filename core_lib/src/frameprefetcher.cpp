@@ -0,0 +1,149 @@
+/*
+
+Pencil - Traditional Animation Software
+Copyright (C) 2012-2018 Matthew Chiawen Chang
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+*/
+
+#include "frameprefetcher.h"
+
+#include <QRunnable>
+#include <QThread>
+#include "bitmapimage.h"
+
+
+class FrameDecodeTask : public QRunnable
+{
+public:
+    explicit FrameDecodeTask(std::shared_ptr<FramePrefetcher::Job> job) : mJob(job) {}
+
+    void run() override
+    {
+        int expected = FramePrefetcher::QUEUED;
+        if (!mJob->state.compare_exchange_strong(expected, FramePrefetcher::RUNNING))
+        {
+            return; // canceled before it started
+        }
+        mJob->image = BitmapImage::decodeFile(mJob->path);
+        mJob->state.store(FramePrefetcher::DONE, std::memory_order_release);
+
+        QMutexLocker locker(&mJob->doneMutex);
+        mJob->done.wakeAll();
+    }
+
+private:
+    std::shared_ptr<FramePrefetcher::Job> mJob;
+};
+
+
+FramePrefetcher::FramePrefetcher()
+{
+    // Leave a core to the GUI thread
+    mWorkers.setMaxThreadCount(qMax(1, QThread::idealThreadCount() - 1));
+}
+
+FramePrefetcher::~FramePrefetcher()
+{
+    clear();
+    mWorkers.waitForDone();
+}
+
+/** Starts decoding the file of key on a worker, unless it is loaded or already on its way */
+void FramePrefetcher::request(BitmapImage* key)
+{
+    if (!key->loadsFromFile() || mJobs.count(key) > 0)
+    {
+        return;
+    }
+
+    auto job = std::make_shared<Job>();
+    job->path = key->fileName();
+    mJobs[key] = Request{ key, job };
+    mWorkers.start(new FrameDecodeTask(job));
+}
+
+/** Gives key the image decoded for it, waiting for the worker if it has started.
+ *
+ *  @return True if key was loaded from a prefetched image. False if it was not requested,
+ *          or the job had not started yet and was dropped, so the caller loads the file itself.
+ */
+bool FramePrefetcher::finish(BitmapImage* key)
+{
+    auto it = mJobs.find(key);
+    if (it == mJobs.end())
+    {
+        return false;
+    }
+    std::shared_ptr<Job> job = it->second.job;
+    mJobs.erase(it);
+
+    int expected = QUEUED;
+    if (job->state.compare_exchange_strong(expected, CANCELED))
+    {
+        return false;
+    }
+
+    // Decoding one file is bounded, and decoding it again here would take as long
+    {
+        QMutexLocker locker(&job->doneMutex);
+        while (job->state.load(std::memory_order_acquire) != DONE)
+        {
+            job->done.wait(&job->doneMutex);
+        }
+    }
+    return key->adoptDecodedFile(job->path, job->image);
+}
+
+void FramePrefetcher::cancel(KeyFrame* key)
+{
+    auto it = mJobs.find(key);
+    if (it != mJobs.end())
+    {
+        int expected = QUEUED;
+        it->second.job->state.compare_exchange_strong(expected, CANCELED);
+        mJobs.erase(it);
+    }
+}
+
+/** Installs every image decoded so far in its key frame, and returns those key frames */
+std::vector<BitmapImage*> FramePrefetcher::collect()
+{
+    std::vector<BitmapImage*> collected;
+    for (auto it = mJobs.begin(); it != mJobs.end();)
+    {
+        const Job& job = *it->second.job;
+        if (job.state.load(std::memory_order_acquire) == DONE)
+        {
+            if (it->second.key->adoptDecodedFile(job.path, job.image))
+            {
+                collected.push_back(it->second.key);
+            }
+            it = mJobs.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+    return collected;
+}
+
+/** Drops the requests. The workers finish the files they have started and throw them away. */
+void FramePrefetcher::clear()
+{
+    for (auto& entry : mJobs)
+    {
+        int expected = QUEUED;
+        entry.second.job->state.compare_exchange_strong(expected, CANCELED);
+    }
+    mJobs.clear();
+}
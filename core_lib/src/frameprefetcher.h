@@ -0,0 +1,81 @@
+/*
+
+Pencil - Traditional Animation Software
+Copyright (C) 2012-2018 Matthew Chiawen Chang
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+*/
+
+#ifndef FRAMEPREFETCHER_H
+#define FRAMEPREFETCHER_H
+
+#include <atomic>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include <QImage>
+#include <QMutex>
+#include <QString>
+#include <QThreadPool>
+#include <QWaitCondition>
+
+class KeyFrame;
+class BitmapImage;
+
+
+/** Decodes the files of bitmap key frames on worker threads before they are shown.
+ *
+ *  Every function is called from the thread that owns the key frames. The workers
+ *  only see the file path, never the key frame, and publish the decoded image
+ *  through an atomic state, so handing it over takes no lock: collect() installs
+ *  the finished images in their key frames with BitmapImage::adoptDecodedFile().
+ *  Only finish() may have to block, until the worker signals that it is done.
+ */
+class FramePrefetcher
+{
+public:
+    FramePrefetcher();
+    ~FramePrefetcher();
+
+    void request(BitmapImage* key);
+    bool finish(BitmapImage* key);
+    void cancel(KeyFrame* key);
+    std::vector<BitmapImage*> collect();
+    void clear();
+
+    int pendingCount() const { return static_cast<int>(mJobs.size()); }
+
+private:
+    friend class FrameDecodeTask;
+
+    enum JobState { QUEUED, RUNNING, DONE, CANCELED };
+
+    struct Job
+    {
+        QString path;
+        QImage image; //< written by the worker before the state becomes DONE
+        std::atomic<int> state{ QUEUED };
+        QMutex doneMutex;
+        QWaitCondition done; //< woken once the state is DONE
+    };
+
+    struct Request
+    {
+        BitmapImage* key;
+        std::shared_ptr<Job> job;
+    };
+
+    /** Indexed as a KeyFrame, as cancel() is called while a key frame is destroyed */
+    std::unordered_map<KeyFrame*, Request> mJobs;
+    QThreadPool mWorkers;
+};
+
+#endif // FRAMEPREFETCHER_H
@@ -0,0 +1,372 @@
+/*
+
+Pencil - Traditional Animation Software
+Copyright (C) 2012-2018 Matthew Chiawen Chang
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+*/
+
+#include "framerenderpipeline.h"
+
+#include <QPainter>
+#include <QRunnable>
+#include <QThread>
+
+#include "object.h"
+#include "layerbitmap.h"
+#include "layervector.h"
+#include "layercamera.h"
+#include "bitmapimage.h"
+#include "vectorimage.h"
+
+
+/** A read-only copy of one key frame, shared by every frame that shows it */
+class KeyFrameSnapshot
+{
+public:
+    explicit KeyFrameSnapshot(BitmapImage* bitmap) : mBitmap(bitmap->clone()) {}
+    explicit KeyFrameSnapshot(VectorImage* vector) : mVector(vector->clone()) {}
+
+    void paint(QPainter& painter, bool antialiasing)
+    {
+        if (mVector)
+        {
+            // VectorImage updates its areas while painting
+            QMutexLocker locker(&mMutex);
+            mVector->paintImage(painter, false, false, antialiasing);
+            return;
+        }
+
+        QImage image;
+        QPoint topLeft;
+        {
+            // The first worker to need the bitmap decodes it for the others
+            QMutexLocker locker(&mMutex);
+            if (mBitmap)
+            {
+                mBitmap->image();
+                mTopLeft = mBitmap->topLeft();
+                mImage = *mBitmap->image();
+                mBitmap.reset();
+            }
+            image = mImage;
+            topLeft = mTopLeft;
+        }
+        painter.drawImage(topLeft, image);
+    }
+
+private:
+    QMutex mMutex;
+    std::unique_ptr<BitmapImage> mBitmap;
+    std::unique_ptr<VectorImage> mVector;
+    QImage mImage;
+    QPoint mTopLeft;
+};
+
+struct FrameSnapshot
+{
+    int frame = 0;
+    QTransform view;
+    std::vector<std::shared_ptr<KeyFrameSnapshot>> layers;
+
+    /** Same key frames through the same view, so the same pixels */
+    bool looksLike(const FrameSnapshot& other) const
+    {
+        return view == other.view && layers == other.layers;
+    }
+};
+
+class FrameRenderTask : public QRunnable
+{
+public:
+    FrameRenderTask(FrameRenderPipeline* pipeline, std::shared_ptr<FrameSnapshot> snapshot)
+        : mPipeline(pipeline), mSnapshot(snapshot) {}
+
+    void run() override { mPipeline->renderFrame(mSnapshot); }
+
+private:
+    FrameRenderPipeline* mPipeline;
+    std::shared_ptr<FrameSnapshot> mSnapshot;
+};
+
+
+QString RenderPipelineStats::toString() const
+{
+    auto fps = [](int frames, qint64 ms)
+    {
+        return (ms > 0) ? frames * 1000.0 / ms : 0.0;
+    };
+
+    return QString("%1 frames (%2 repeated), %3 workers | capture %4 fps | render %5 fps per worker | "
+                   "write %6 fps | consumer waited %7 ms | overall %8 fps")
+        .arg(framesTaken)
+        .arg(framesRepeated)
+        .arg(workerCount)
+        .arg(fps(framesRendered, snapshotTime), 0, 'f', 1)
+        .arg(fps(framesRendered, renderTime), 0, 'f', 1)
+        .arg(fps(framesTaken, writeTime), 0, 'f', 1)
+        .arg(waitTime)
+        .arg(fps(framesTaken, elapsedTime), 0, 'f', 1);
+}
+
+FrameRenderPipeline::FrameRenderPipeline(const Object* object, LayerCamera* camera, QSize exportSize, QColor background)
+    : mObject(object)
+    , mCamera(camera)
+    , mExportSize(exportSize)
+    , mBackground(background)
+{
+    Q_ASSERT(object != nullptr);
+    Q_ASSERT(camera != nullptr);
+
+    mCameraSize = mCamera->getViewSize();
+    mCentralizeCamera.translate(mCameraSize.width() / 2, mCameraSize.height() / 2);
+
+    setWorkerCount(0);
+    setMemoryBudget(1000 * 1000 * 1000);
+}
+
+FrameRenderPipeline::~FrameRenderPipeline()
+{
+    cancel();
+    mWorkers.waitForDone();
+}
+
+void FrameRenderPipeline::setFrameRange(int firstFrame, int lastFrame)
+{
+    std::vector<int> frames;
+    for (int frame = firstFrame; frame <= lastFrame; frame++)
+    {
+        frames.push_back(frame);
+    }
+    setFrames(frames);
+}
+
+/** Sets the frames to render, in the order they are handed back. They need not follow each other. */
+void FrameRenderPipeline::setFrames(const std::vector<int>& frames)
+{
+    Q_ASSERT(!mTimer.isValid()); // The frames cannot change once some are scheduled
+
+    mFrames = frames;
+    mNextToSchedule = 0;
+    mNextToTake = 0;
+}
+
+/** Sets the number of render threads, 0 or less picks one per core */
+void FrameRenderPipeline::setWorkerCount(int count)
+{
+    if (count <= 0)
+    {
+        count = QThread::idealThreadCount();
+    }
+    count = qMax(1, count);
+
+    mWorkers.setMaxThreadCount(count);
+    mStats.workerCount = count;
+}
+
+/** Sets how many bytes of frames may be scheduled ahead of the consumer */
+void FrameRenderPipeline::setMemoryBudget(qint64 bytes)
+{
+    const qint64 frameBytes = qMax<qint64>(1, static_cast<qint64>(mExportSize.width()) * mExportSize.height() * 4);
+    mMaxInFlight = static_cast<size_t>(qBound<qint64>(1, bytes / frameBytes, 100000));
+}
+
+/** Hands back the next frame, in order.
+ *
+ *  @param[out] frame Receives the rendered frame, or a null image if the frame
+ *                   repeats the previous one handed back and setSkipRepeatedFrames() is on
+ *  @param[in] timeout Maximum time to wait for the frame, in milliseconds
+ *
+ *  @return True if frame was filled, false if it isn't ready yet,
+ *          all the frames are done, or the pipeline was canceled.
+ */
+bool FrameRenderPipeline::takeNextFrame(QImage& frame, int timeout)
+{
+    if (!hasMoreFrames() || mCanceled)
+    {
+        return false;
+    }
+
+    if (!mTimer.isValid())
+    {
+        mTimer.start();
+    }
+    scheduleFrames();
+
+    QElapsedTimer waitTimer;
+    waitTimer.start();
+
+    QMutexLocker locker(&mMutex);
+    const int frameNumber = mFrames[mNextToTake];
+    auto it = mFinishedFrames.find(frameNumber);
+    if (it == mFinishedFrames.end())
+    {
+        mFrameReady.wait(&mMutex, static_cast<unsigned long>(qMax(0, timeout)));
+        it = mFinishedFrames.find(frameNumber);
+    }
+    mStats.waitTime += waitTimer.elapsed();
+
+    if (it == mFinishedFrames.end() || mCanceled)
+    {
+        return false;
+    }
+
+    frame = it->second;
+    mFinishedFrames.erase(it);
+    mNextToTake++;
+    mStats.framesTaken++;
+    locker.unlock();
+
+    scheduleFrames();
+    return true;
+}
+
+void FrameRenderPipeline::cancel()
+{
+    mCanceled = true;
+    mWorkers.clear();
+
+    QMutexLocker locker(&mMutex);
+    mFrameReady.wakeAll();
+}
+
+/** Records the time the consumer spent passing a frame on, for the write throughput */
+void FrameRenderPipeline::addWriteTime(qint64 ms)
+{
+    QMutexLocker locker(&mMutex);
+    mStats.writeTime += ms;
+}
+
+RenderPipelineStats FrameRenderPipeline::stats() const
+{
+    QMutexLocker locker(&mMutex);
+    RenderPipelineStats result = mStats;
+    result.elapsedTime = mTimer.isValid() ? mTimer.elapsed() : 0;
+    return result;
+}
+
+void FrameRenderPipeline::scheduleFrames()
+{
+    while (!mCanceled
+           && mNextToSchedule < mFrames.size()
+           && mNextToSchedule - mNextToTake < mMaxInFlight)
+    {
+        QElapsedTimer timer;
+        timer.start();
+
+        const int frameNumber = mFrames[mNextToSchedule];
+        std::shared_ptr<FrameSnapshot> snapshot = captureFrame(frameNumber);
+        const bool repeated = mSkipRepeatedFrames && mLastSnapshot && snapshot->looksLike(*mLastSnapshot);
+        {
+            QMutexLocker locker(&mMutex);
+            mStats.snapshotTime += timer.elapsed();
+            if (repeated)
+            {
+                mFinishedFrames[frameNumber] = QImage();
+                mStats.framesRepeated++;
+                mFrameReady.wakeAll();
+            }
+        }
+
+        if (!repeated)
+        {
+            mWorkers.start(new FrameRenderTask(this, snapshot));
+            mLastSnapshot = snapshot;
+        }
+        mNextToSchedule++;
+    }
+}
+
+/** Captures what frame shows. Must run on the thread that owns the Object. */
+std::shared_ptr<FrameSnapshot> FrameRenderPipeline::captureFrame(int frame)
+{
+    auto snapshot = std::make_shared<FrameSnapshot>();
+    snapshot->frame = frame;
+    snapshot->view = mCamera->getViewAtFrame(frame);
+
+    const int layerCount = mObject->getLayerCount();
+    mLayerSnapshots.resize(static_cast<size_t>(layerCount));
+
+    for (int i = 0; i < layerCount; i++)
+    {
+        Layer* layer = mObject->getLayer(i);
+        if (!layer->visible())
+        {
+            continue;
+        }
+
+        auto& cached = mLayerSnapshots[static_cast<size_t>(i)];
+        if (layer->type() == Layer::BITMAP)
+        {
+            BitmapImage* bitmap = static_cast<LayerBitmap*>(layer)->getLastBitmapImageAtFrame(frame);
+            if (bitmap == nullptr)
+            {
+                continue;
+            }
+            if (cached.first != bitmap)
+            {
+                cached = std::make_pair(bitmap, std::make_shared<KeyFrameSnapshot>(bitmap));
+            }
+            snapshot->layers.push_back(cached.second);
+        }
+        else if (layer->type() == Layer::VECTOR)
+        {
+            VectorImage* vector = static_cast<LayerVector*>(layer)->getLastVectorImageAtFrame(frame, 0);
+            if (vector == nullptr)
+            {
+                continue;
+            }
+            if (cached.first != vector)
+            {
+                cached = std::make_pair(vector, std::make_shared<KeyFrameSnapshot>(vector));
+            }
+            snapshot->layers.push_back(cached.second);
+        }
+    }
+    return snapshot;
+}
+
+/** Paints one frame. Runs on a worker thread and only reads the snapshot. */
+void FrameRenderPipeline::renderFrame(const std::shared_ptr<FrameSnapshot>& snapshot)
+{
+    if (mCanceled)
+    {
+        return;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    QImage image(mExportSize, QImage::Format_ARGB32_Premultiplied);
+    image.fill(mBackground);
+
+    QPainter painter(&image);
+    painter.setWorldTransform(snapshot->view * mCentralizeCamera);
+    painter.setWindow(QRect(0, 0, mCameraSize.width(), mCameraSize.height()));
+
+    // Same settings as Object::paintImage
+    painter.setRenderHint(QPainter::Antialiasing, true);
+    painter.setRenderHint(QPainter::SmoothPixmapTransform, true);
+    painter.setCompositionMode(QPainter::CompositionMode_SourceOver);
+
+    for (const std::shared_ptr<KeyFrameSnapshot>& layer : snapshot->layers)
+    {
+        painter.setOpacity(1.0);
+        layer->paint(painter, mAntialiasing);
+    }
+    painter.end();
+
+    QMutexLocker locker(&mMutex);
+    mFinishedFrames[snapshot->frame] = image;
+    mStats.framesRendered++;
+    mStats.renderTime += timer.elapsed();
+    mFrameReady.wakeAll();
+}
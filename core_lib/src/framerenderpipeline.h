@@ -0,0 +1,125 @@
+/*
+
+Pencil - Traditional Animation Software
+Copyright (C) 2012-2018 Matthew Chiawen Chang
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+*/
+
+#ifndef FRAMERENDERPIPELINE_H
+#define FRAMERENDERPIPELINE_H
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <vector>
+#include <QColor>
+#include <QElapsedTimer>
+#include <QImage>
+#include <QMutex>
+#include <QString>
+#include <QThreadPool>
+#include <QTransform>
+#include <QWaitCondition>
+
+class Object;
+class LayerCamera;
+class KeyFrame;
+class KeyFrameSnapshot;
+struct FrameSnapshot;
+
+
+/** Throughput counters of a FrameRenderPipeline, all durations in milliseconds */
+struct RenderPipelineStats
+{
+    int workerCount = 0;
+    int framesRendered = 0;
+    int framesTaken = 0;
+    int framesRepeated = 0;  //< handed back without rendering, see setSkipRepeatedFrames()
+    qint64 snapshotTime = 0; //< spent capturing frames on the calling thread
+    qint64 renderTime = 0;   //< spent painting, summed over all workers
+    qint64 writeTime = 0;    //< spent by the consumer passing frames on, see addWriteTime()
+    qint64 waitTime = 0;     //< spent by the consumer waiting for the next frame
+    qint64 elapsedTime = 0;  //< since the first frame was scheduled
+
+    QString toString() const;
+};
+
+
+/** Renders a range or a list of frames of an Object through a camera on a pool of worker threads.
+ *
+ *  The consumer calls takeNextFrame() from the thread that owns the Object and gets
+ *  the frames back in order. Each call first captures the frames that fit in the memory
+ *  budget: the key frames to draw are cloned on the calling thread, so the workers
+ *  paint from those read-only snapshots and never touch the Object itself.
+ *  Bitmap clones share their tiles with the originals, and a key frame held over
+ *  several frames is captured only once.
+ *
+ *  The memory budget bounds the frames scheduled but not yet taken by the consumer.
+ *  With setSkipRepeatedFrames(), a frame that shows the same key frames through the
+ *  same view as the one before it is not rendered at all.
+ */
+class FrameRenderPipeline
+{
+public:
+    FrameRenderPipeline(const Object* object, LayerCamera* camera, QSize exportSize, QColor background);
+    ~FrameRenderPipeline();
+
+    void setFrameRange(int firstFrame, int lastFrame);
+    void setFrames(const std::vector<int>& frames);
+    void setWorkerCount(int count);
+    void setMemoryBudget(qint64 bytes);
+    void setAntialiasing(bool b) { mAntialiasing = b; }
+    void setSkipRepeatedFrames(bool b) { mSkipRepeatedFrames = b; }
+
+    bool hasMoreFrames() const { return mNextToTake < mFrames.size(); }
+    bool takeNextFrame(QImage& frame, int timeout);
+    void cancel();
+
+    void addWriteTime(qint64 ms);
+    RenderPipelineStats stats() const;
+
+private:
+    void scheduleFrames();
+    std::shared_ptr<FrameSnapshot> captureFrame(int frame);
+    void renderFrame(const std::shared_ptr<FrameSnapshot>& snapshot);
+
+    friend class FrameRenderTask;
+
+    const Object* mObject = nullptr;
+    LayerCamera* mCamera = nullptr;
+    QSize mExportSize;
+    QColor mBackground;
+    QTransform mCentralizeCamera;
+    QSize mCameraSize;
+    bool mAntialiasing = true;
+    bool mSkipRepeatedFrames = false;
+
+    std::vector<int> mFrames; //< the frames to hand back, in order
+    size_t mNextToSchedule = 0; //< index in mFrames
+    size_t mNextToTake = 0;     //< index in mFrames
+    size_t mMaxInFlight = 1;
+
+    /** The snapshot of the key frame last captured on each layer */
+    std::vector<std::pair<KeyFrame*, std::shared_ptr<KeyFrameSnapshot>>> mLayerSnapshots;
+    std::shared_ptr<FrameSnapshot> mLastSnapshot;
+
+    QThreadPool mWorkers;
+    mutable QMutex mMutex;
+    QWaitCondition mFrameReady;
+    std::map<int, QImage> mFinishedFrames;
+    std::atomic<bool> mCanceled{ false };
+
+    QElapsedTimer mTimer;
+    RenderPipelineStats mStats;
+};
+
+#endif // FRAMERENDERPIPELINE_H
@@ -17,10 +17,14 @@ GNU General Public License for more details.
 #include "bitmapimage.h"
 
 #include <cmath>
+#include <vector>
 #include <QDebug>
 #include <QtMath>
 #include <QFile>
 #include "util.h"
+#include "pixelkernels.h"
+#include "brushdab.h"
+#include "projectarchive.h"
 
 BitmapImage::BitmapImage()
 {
@@ -32,8 +36,17 @@ BitmapImage::BitmapImage(const BitmapImage& a) : KeyFrame(a)
 {
     mBounds = a.mBounds;
     mMinBound = a.mMinBound;
+    mContentBounds = a.mContentBounds;
+    mCropArea = a.mCropArea;
+    mCropEverything = a.mCropEverything;
     mEnableAutoCrop = a.mEnableAutoCrop;
-    mImage = std::make_shared<QImage>(*a.mImage);
+
+    // Share the tiles instead of deep copying the image,
+    // the working surface is rebuilt on first access.
+    a.syncTiles();
+    mTiles = a.mTiles;
+    mTileBacked = a.mTileBacked;
+    mMipmaps = a.mMipmaps;
 }
 
 BitmapImage::BitmapImage(const QRect& rectangle, const QColor& colour)
@@ -41,7 +54,9 @@ BitmapImage::BitmapImage(const QRect& rectangle, const QColor& colour)
     mBounds = rectangle;
     mImage = std::make_shared<QImage>(mBounds.size(), QImage::Format_ARGB32_Premultiplied);
     mImage->fill(colour.rgba());
+    mSurfaceRect = mBounds;
     mMinBound = false;
+    markTilesDirty(mBounds);
 }
 
 BitmapImage::BitmapImage(const QPoint& topLeft, const QImage& image)
@@ -49,6 +64,8 @@ BitmapImage::BitmapImage(const QPoint& topLeft, const QImage& image)
     mBounds = QRect(topLeft, image.size());
     mMinBound = true;
     mImage = std::make_shared<QImage>(image);
+    mSurfaceRect = mBounds;
+    markTilesDirty(mBounds);
 }
 
 BitmapImage::BitmapImage(const QPoint& topLeft, const QString& path)
@@ -69,16 +86,41 @@ void BitmapImage::setImage(QImage* img)
 {
     Q_CHECK_PTR(img);
     mImage.reset(img);
+    mBounds.setSize(img->size());
+    mSurfaceRect = mBounds;
     mMinBound = false;
+    mCropEverything = true;
+
+    mTiles.clear();
+    mTilesDirtyRect = QRect();
+    markTilesDirty(mBounds);
 
     modification();
 }
 
 BitmapImage& BitmapImage::operator=(const BitmapImage& a)
 {
+    if (this == &a)
+    {
+        return *this;
+    }
+
     mBounds = a.mBounds;
     mMinBound = a.mMinBound;
-    mImage = std::make_shared<QImage>(*a.mImage);
+    mContentBounds = a.mContentBounds;
+    mCropArea = a.mCropArea;
+    mCropEverything = a.mCropEverything;
+
+    a.syncTiles();
+    mTiles = a.mTiles;
+    mTilesDirtyRect = QRect();
+    mTileBacked = a.mTileBacked;
+    mImage.reset();
+    if (!mTileBacked)
+    {
+        // a has not been loaded yet, so there are no tiles to share
+        setFileName(a.fileName());
+    }
     modification();
     return *this;
 }
@@ -90,19 +132,76 @@ BitmapImage* BitmapImage::clone()
 
 void BitmapImage::loadFile()
 {
-    if (mImage == nullptr)
+    if (mImage != nullptr)
     {
-        mImage = std::make_shared<QImage>(fileName());
-        mBounds.setSize(mImage->size());
-        mMinBound = false;
+        return;
+    }
+
+    if (mTileBacked)
+    {
+        mImage = std::make_shared<QImage>(mTiles.toImage(mBounds));
+        mSurfaceRect = mBounds;
+        mTilesDirtyRect = QRect();
+    }
+    else
+    {
+        setDecodedImage(decodeFile(fileName()));
     }
 }
 
+/** Reads the key frame file at path as loadFile() does. Does not touch any BitmapImage, so it may run on any thread. */
+QImage BitmapImage::decodeFile(const QString& path)
+{
+    ProjectArchive::extractPending(path);
+    QImage loaded(path);
+    return loaded.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+}
+
+/** Loads the image decoded from path by decodeFile(), instead of reading the file again.
+ *
+ *  @return False if the image is loaded already or its file is no longer path.
+ */
+bool BitmapImage::adoptDecodedFile(const QString& path, const QImage& decoded)
+{
+    if (!loadsFromFile() || fileName() != path)
+    {
+        return false;
+    }
+    setDecodedImage(decoded);
+    return true;
+}
+
+void BitmapImage::setDecodedImage(const QImage& decoded)
+{
+    mImage = std::make_shared<QImage>(decoded);
+    mBounds.setSize(mImage->size());
+    mSurfaceRect = mBounds;
+    mMinBound = false;
+    mCropEverything = true;
+
+    mTiles.clear();
+    mTilesDirtyRect = QRect();
+    markTilesDirty(mBounds);
+    mMipmapBase = QImage();
+}
+
 void BitmapImage::unloadFile()
 {
+    mMipmaps.clear();
+    mMipmapBase = QImage();
     if (isModified() == false)
     {
         mImage.reset();
+        mTiles.clear();
+        mTilesDirtyRect = QRect();
+        mTileBacked = false;
+    }
+    else if (mImage != nullptr)
+    {
+        // Keep only the sparse tiles of modified frames,
+        // the working surface is rebuilt when needed again.
+        syncTiles();
+        mImage.reset();
     }
 }
 
@@ -111,9 +210,31 @@ bool BitmapImage::isLoaded()
     return (mImage != nullptr);
 }
 
+/** Counts the working surface, the tiles and the mipmaps. Tiles shared with a copy are counted too. */
+qint64 BitmapImage::memoryUsage()
+{
+    qint64 bytes = mTiles.byteSize() + mMipmaps.byteSize();
+    if (mImage != nullptr)
+    {
+        bytes += mImage->byteCount();
+    }
+    return bytes;
+}
+
+void BitmapImage::modification()
+{
+    mMipmaps.clear();
+    mMipmapBase = QImage();
+    KeyFrame::modification();
+}
+
 void BitmapImage::paintImage(QPainter& painter)
 {
-    painter.drawImage(mBounds.topLeft(), *image());
+    QImage* img = surface();
+    if (!mBounds.isEmpty())
+    {
+        painter.drawImage(mBounds.topLeft(), *img, mBounds.translated(-mSurfaceRect.topLeft()));
+    }
 }
 
 void BitmapImage::paintImage(QPainter& painter, QImage& image, QRect sourceRect, QRect destRect)
@@ -123,23 +244,87 @@ void BitmapImage::paintImage(QPainter& painter, QImage& image, QRect sourceRect,
                       sourceRect);
 }
 
+/** Returns the memory held by this image only, not shared with copies or clones */
+qint64 BitmapImage::unsharedByteSize() const
+{
+    qint64 size = mTiles.unsharedByteSize();
+    if (mImage != nullptr && mImage->isDetached())
+    {
+        size += mImage->byteCount();
+    }
+    return size;
+}
+
+/** Returns the image of the pixels within bounds(), trimming the working surface to them first. */
 QImage* BitmapImage::image()
+{
+    loadFile();
+    if (mSurfaceRect != mBounds)
+    {
+        *mImage = mBounds.isEmpty() ? QImage() : mImage->copy(mBounds.translated(-mSurfaceRect.topLeft()));
+        mSurfaceRect = mBounds;
+        mMipmapBase = QImage();
+    }
+    return mImage.get();
+}
+
+/** Returns the working surface, which covers mSurfaceRect and may reach past mBounds. */
+QImage* BitmapImage::surface()
 {
     loadFile();
     return mImage.get();
 }
 
+/** Returns the image halved level times, see MipmapPyramid. Level 0 is the image itself.
+ *  The levels are kept until the next modification().
+ *
+ *  The levels are built from the bounds of the working surface in place, without
+ *  trimming it like image() does. Level 0 shares the pixels of the surface and is
+ *  only valid until the next draw. It is the same QImage, with the same cacheKey(),
+ *  for as long as the pixels do not change.
+ */
+QImage BitmapImage::mipmap(int level)
+{
+    QImage* img = surface();
+    if (img == nullptr || img->isNull() || mBounds.isEmpty())
+    {
+        return QImage();
+    }
+
+    const QRect area = mBounds.translated(-mSurfaceRect.topLeft());
+    const uchar* pixels = img->constScanLine(area.top()) + area.left() * (img->depth() / 8);
+    if (mMipmapBase.constBits() != pixels || mMipmapBase.size() != area.size())
+    {
+        mMipmapBase = QImage(pixels, area.width(), area.height(), img->bytesPerLine(), img->format());
+    }
+    return mMipmaps.level(mMipmapBase, level);
+}
+
 BitmapImage BitmapImage::copy()
 {
-    return BitmapImage(mBounds.topLeft(), *image());
+    loadFile();
+    releaseSurface();
+
+    BitmapImage result;
+    result.mImage.reset();
+    result.mBounds = mBounds;
+    result.mTiles = mTiles;
+    result.mTileBacked = true;
+    return result;
 }
 
 BitmapImage BitmapImage::copy(QRect rectangle)
 {
     if (rectangle.isEmpty() || mBounds.isEmpty()) return BitmapImage();
 
-    QRect intersection2 = rectangle.translated(-mBounds.topLeft());
-    BitmapImage result = BitmapImage(rectangle.topLeft(), image()->copy(intersection2));
+    loadFile();
+    releaseSurface();
+
+    BitmapImage result;
+    result.mImage.reset();
+    result.mBounds = rectangle;
+    result.mTiles = mTiles.copy(rectangle);
+    result.mTileBacked = true;
     return result;
 }
 
@@ -152,18 +337,26 @@ void BitmapImage::paste(BitmapImage* bitmapImage, QPainter::CompositionMode cm)
 
     setCompositionModeBounds(bitmapImage, cm);
 
-    QImage* image2 = bitmapImage->image();
+    QImage* image2 = bitmapImage->surface();
+    const QRect sourceRect = bitmapImage->mBounds.translated(-bitmapImage->mSurfaceRect.topLeft());
 
-    QPainter painter(image());
+    QPainter painter(surface());
     painter.setCompositionMode(cm);
-    painter.drawImage(bitmapImage->mBounds.topLeft() - mBounds.topLeft(), *image2);
+    painter.drawImage(bitmapImage->mBounds.topLeft() - mSurfaceRect.topLeft(), *image2, sourceRect);
     painter.end();
 
+    markTilesDirty(bitmapImage->mBounds);
     modification();
 }
 
 void BitmapImage::moveTopLeft(QPoint point)
 {
+    const QPoint offset = point - mBounds.topLeft();
+    mTiles.translate(offset);
+    mTilesDirtyRect.translate(offset);
+    mSurfaceRect.translate(offset);
+    mContentBounds.translate(offset);
+    mCropArea.translate(offset);
     mBounds.moveTopLeft(point);
     // Size is unchanged so there is no need to update mBounds
     modification();
@@ -171,6 +364,7 @@ void BitmapImage::moveTopLeft(QPoint point)
 
 void BitmapImage::transform(QRect newBoundaries, bool smoothTransform)
 {
+    const QImage source = *image(); // before mBounds changes, a tile backed image is rebuilt at mBounds
     mBounds = newBoundaries;
     newBoundaries.moveTopLeft(QPoint(0, 0));
     QImage* newImage = new QImage(mBounds.size(), QImage::Format_ARGB32_Premultiplied);
@@ -180,10 +374,15 @@ void BitmapImage::transform(QRect newBoundaries, bool smoothTransform)
     painter.setCompositionMode(QPainter::CompositionMode_Source);
     painter.fillRect(newImage->rect(), QColor(0, 0, 0, 0));
     painter.setCompositionMode(QPainter::CompositionMode_SourceOver);
-    painter.drawImage(newBoundaries, *image());
+    painter.drawImage(newBoundaries, source);
     painter.end();
     mImage.reset(newImage);
+    mSurfaceRect = mBounds;
+    mCropEverything = true;
 
+    mTiles.clear();
+    mTilesDirtyRect = QRect();
+    markTilesDirty(mBounds);
     modification();
 }
 
@@ -222,23 +421,20 @@ BitmapImage BitmapImage::transformed(QRect newBoundaries, bool smoothTransform)
  *  @param[in] newBoundaries the new bounds
  *
  *  Sets this image's bounds to rectangle.
- *  Modifies mBounds and crops mImage.
+ *  Modifies mBounds and grows the working surface if it does not cover them.
  */
 void BitmapImage::updateBounds(QRect newBoundaries)
 {
     // Check to make sure changes actually need to be made
     if (mBounds == newBoundaries) return;
 
-    QImage* newImage = new QImage( newBoundaries.size(), QImage::Format_ARGB32_Premultiplied);
-    newImage->fill(Qt::transparent);
-    if (!newImage->isNull())
+    if (!newBoundaries.contains(mBounds))
     {
-        QPainter painter(newImage);
-        painter.drawImage(mBounds.topLeft() - newBoundaries.topLeft(), *mImage);
-        painter.end();
+        mTiles.crop(newBoundaries);
+        mTilesDirtyRect = mTilesDirtyRect.intersected(newBoundaries);
     }
-    mImage.reset( newImage );
-    mBounds = newBoundaries;
+
+    setLogicalBounds(newBoundaries);
     mMinBound = false;
 
     modification();
@@ -262,20 +458,87 @@ void BitmapImage::extend(QRect rectangle)
     }
     else
     {
-        QRect newBoundaries = mBounds.united(rectangle).normalized();
-        QImage* newImage = new QImage(newBoundaries.size(), QImage::Format_ARGB32_Premultiplied);
-        newImage->fill(Qt::transparent);
-        if (!newImage->isNull())
+        // Growing never touches the tiles
+        setLogicalBounds(mBounds.united(rectangle).normalized());
+
+        modification();
+    }
+}
+
+/** Moves mBounds over the working surface, growing the surface only when they do not fit in it.
+ *
+ *  The surface grows by margins proportional to its size, so a stroke that keeps
+ *  leaving the bounds costs amortized time in the pixels it adds rather than in
+ *  the size of the image. Shrinking only moves the logical bounds, the surface is
+ *  trimmed when image() hands it out.
+ */
+void BitmapImage::setLogicalBounds(const QRect& newBoundaries)
+{
+    // A tile backed image is simply rebuilt at its new bounds when needed
+    if (mImage == nullptr && mTileBacked)
+    {
+        mBounds = newBoundaries;
+        return;
+    }
+
+    surface();
+    if (!newBoundaries.isEmpty() && !mSurfaceRect.contains(newBoundaries))
+    {
+        growSurface(newBoundaries);
+    }
+
+    // Pixels of the surface outside the bounds are stale, clear the ones coming back into view
+    if (!mBounds.contains(newBoundaries) && !mImage->isNull())
+    {
+        const QRegion exposed = QRegion(newBoundaries.intersected(mSurfaceRect)).subtracted(QRegion(mBounds));
+        if (!exposed.isEmpty())
         {
-            QPainter painter(newImage);
-            painter.drawImage(mBounds.topLeft() - newBoundaries.topLeft(), *image());
-            painter.end();
+            QPainter painter(mImage.get());
+            painter.setCompositionMode(QPainter::CompositionMode_Clear);
+            for (const QRect& rect : exposed.rects())
+            {
+                painter.fillRect(rect.translated(-mSurfaceRect.topLeft()), Qt::transparent);
+            }
         }
-        mImage.reset(newImage);
-        mBounds = newBoundaries;
+    }
+    mBounds = newBoundaries;
+}
 
-        modification();
+/** Reallocates the working surface to cover needed and a margin on the sides it grows towards. */
+void BitmapImage::growSurface(const QRect& needed)
+{
+    QRect grown = needed;
+    if (!mSurfaceRect.isEmpty())
+    {
+        grown = mSurfaceRect.united(needed);
+        const int marginX = qBound(SURFACE_CHUNK, mSurfaceRect.width() / 2, MAX_SURFACE_MARGIN);
+        const int marginY = qBound(SURFACE_CHUNK, mSurfaceRect.height() / 2, MAX_SURFACE_MARGIN);
+        if (needed.left() < mSurfaceRect.left()) grown.setLeft(grown.left() - marginX);
+        if (needed.right() > mSurfaceRect.right()) grown.setRight(grown.right() + marginX);
+        if (needed.top() < mSurfaceRect.top()) grown.setTop(grown.top() - marginY);
+        if (needed.bottom() > mSurfaceRect.bottom()) grown.setBottom(grown.bottom() + marginY);
+    }
+
+    // Align the edges to whole chunks of the canvas
+    auto alignDown = [](int v) { return v - (((v % SURFACE_CHUNK) + SURFACE_CHUNK) % SURFACE_CHUNK); };
+    grown.setCoords(alignDown(grown.left()),
+                    alignDown(grown.top()),
+                    alignDown(grown.right() + SURFACE_CHUNK) - 1,
+                    alignDown(grown.bottom() + SURFACE_CHUNK) - 1);
+
+    QImage* newSurface = new QImage(grown.size(), QImage::Format_ARGB32_Premultiplied);
+    newSurface->fill(Qt::transparent);
+    if (!newSurface->isNull() && mImage != nullptr && !mImage->isNull() && !mBounds.isEmpty())
+    {
+        const QRect kept = mBounds.intersected(mSurfaceRect);
+        QPainter painter(newSurface);
+        painter.setCompositionMode(QPainter::CompositionMode_Source);
+        painter.drawImage(kept.topLeft() - grown.topLeft(), *mImage, kept.translated(-mSurfaceRect.topLeft()));
+        painter.end();
     }
+    mImage.reset(newSurface);
+    mSurfaceRect = newSurface->isNull() ? QRect() : grown;
+    mMipmapBase = QImage();
 }
 
 /** Updates the bounds after a drawImage operation with the composition mode cm.
@@ -314,6 +577,16 @@ void BitmapImage::setCompositionModeBounds(BitmapImage *source, QPainter::Compos
  */
 void BitmapImage::setCompositionModeBounds(QRect sourceBounds, bool isSourceMinBounds, QPainter::CompositionMode cm)
 {
+    // Keep track of what the next autoCrop() has to scan
+    if (keepsCoverage(cm))
+    {
+        addCropArea(sourceBounds);
+    }
+    else
+    {
+        mCropEverything = true;
+    }
+
     QRect newBoundaries;
     switch(cm)
     {
@@ -344,15 +617,69 @@ void BitmapImage::setCompositionModeBounds(QRect sourceBounds, bool isSourceMinB
     updateBounds(newBoundaries);
 }
 
+/** Records that the pixels of mImage inside rect no longer match mTiles.
+ *
+ *  @param[in] rect The modified area, in canvas coordinates
+ */
+void BitmapImage::markTilesDirty(const QRect& rect)
+{
+    const QRect area = rect.normalized();
+    if (area.isEmpty()) return;
+
+    // Leave room for antialiased edges spilling out of the drawing bounds
+    mTilesDirtyRect = mTilesDirtyRect.united(area.adjusted(-1, -1, 1, 1));
+}
+
+/** Writes the modified area of mImage back into the tiles.
+ *
+ *  Only the tiles overlapping the dirty area are duplicated, so the tiles
+ *  still shared with copies of this image are left untouched.
+ */
+void BitmapImage::syncTiles() const
+{
+    if (mImage == nullptr)
+    {
+        return;
+    }
+
+    const QRect dirtyRect = mTilesDirtyRect.intersected(mBounds);
+    if (!dirtyRect.isEmpty())
+    {
+        mTiles.store(*mImage, mSurfaceRect.topLeft(), dirtyRect);
+    }
+    mTilesDirtyRect = QRect();
+    mTileBacked = true;
+}
+
+/** Writes the working surface back into the tiles and releases it.
+ *
+ *  Once copied, the pixels are held by the tiles anyway, so keeping the surface
+ *  as well would hold every copied frame twice. It is rebuilt from the tiles the
+ *  next time the image is drawn on or painted, and only the tiles with pixels take memory.
+ */
+void BitmapImage::releaseSurface()
+{
+    syncTiles();
+    if (mTileBacked)
+    {
+        mImage.reset();
+        mMipmapBase = QImage();
+    }
+}
+
 /** Removes any transparent borders by reducing the boundaries.
  *
  *  This function reduces the bounds of an image until the top and
  *  bottom rows, and the left and right columns of pixels each
  *  contain at least one pixel with a non-zero alpha value
- *  (i.e. non-transparent pixel). Both mBounds and
- *  the size of #mImage are updated.
+ *  (i.e. non-transparent pixel). Only mBounds is updated,
+ *  the working surface is trimmed when image() hands it out.
  *
- *  @pre mBounds.size() == mImage->size()
+ *  When only draws that cannot lower any alpha happened since the last crop,
+ *  just the area they covered is scanned. Anything else, such as erasing,
+ *  rescans the whole image.
+ *
+ *  @pre mSurfaceRect.contains(mBounds)
  *  @post Either the first and last rows and columns all contain a
  *        pixel with alpha > 0 or mBounds.isEmpty() == true
  *  @post isMinimallyBounded() == true
@@ -361,156 +688,132 @@ void BitmapImage::autoCrop()
 {
     if (!mEnableAutoCrop) return;
     if (mBounds.isEmpty()) return; // Exit if current bounds are null
-    if (!mImage) return;
-
-    Q_ASSERT(mBounds.size() == mImage->size());
 
     // Exit if already min bounded
     if (mMinBound) return;
 
-    // Get image properties
-    const int width = mImage->width();
+    if (mTileBacked) loadFile();
+    if (!mImage) return;
 
-    // Relative top and bottom row indices (inclusive)
-    int relTop = 0;
-    int relBottom = mBounds.height()-1;
+    Q_ASSERT(mSurfaceRect.contains(mBounds));
 
-    // Check top row
-    bool isEmpty = true; // Used to track if a non-transparent pixel has been found
-    while (isEmpty && relTop <= relBottom) // Loop through rows
+    QRect newBoundaries;
+    if (mCropEverything)
     {
-        // Point cursor to the first pixel in the current top row
-        const QRgb* cursor = reinterpret_cast<const QRgb*>(mImage->constScanLine(relTop));
-        for (int col = 0; col < width; col++) // Loop through pixels in row
-        {
-            // If the pixel is not transparent
-            // (i.e. alpha channel > 0)
-            if (qAlpha(*cursor) != 0)
-            {
-                // We've found a non-transparent pixel in row relTop,
-                // so we can stop looking for one
-                isEmpty = false;
-                break;
-            }
-            // Move cursor to point to the next pixel in the row
-            cursor++;
-        }
-        if (isEmpty)
-        {
-            // If the row we just checked was empty, increase relTop
-            // to remove the empty row from the top of the bounding box
-            ++relTop;
-        }
+        newBoundaries = findContentBounds(mBounds);
     }
-
-    // Check bottom row
-    isEmpty = true; // Reset isEmpty
-    while (isEmpty && relBottom >= relTop) // Loop through rows
+    else
     {
-        // Point cursor to the first pixel in the current bottom row
-        const QRgb* cursor = reinterpret_cast<const QRgb*>(mImage->constScanLine(relBottom));
-        for (int col = 0; col < width; col++) // Loop through pixels in row
-        {
-            // If the pixel is not transparent
-            // (i.e. alpha channel > 0)
-            if(qAlpha(*cursor) != 0)
-            {
-                // We've found a non-transparent pixel in row relBottom,
-                // so we can stop looking for one
-                isEmpty = false;
-                break;
-            }
-            // Move cursor to point to the next pixel in the row
-            ++cursor;
-        }
-        if (isEmpty)
-        {
-            // If the row we just checked was empty, decrease relBottom
-            // to remove the empty row from the bottom of the bounding box
-            --relBottom;
-        }
+        // The content known before the draws keeps its edges
+        newBoundaries = mContentBounds.intersected(mBounds).united(findContentBounds(mCropArea));
     }
 
-    // Relative left and right column indices (inclusive)
-    int relLeft = 0;
-    int relRight = mBounds.width()-1;
+    //qDebug() << "Original" << mBounds;
+    updateBounds(newBoundaries);
+    //qDebug() << "New bounds" << mBounds;
 
-    // Check left row
-    isEmpty = (relBottom >= relTop); // Check left only when 
-    while (isEmpty && relBottom >= relTop && relLeft <= relRight) // Loop through columns
+    mMinBound = true;
+    mCropEverything = false;
+    mCropArea = QRect();
+}
+
+/** Returns the bounding box of the non-transparent pixels within area, in canvas coordinates.
+ *
+ *  The pixels are read row by row. The top and bottom edges are found by scanning whole
+ *  rows, then each row in between is only scanned left of the left edge found so far and
+ *  right of the right edge.
+ */
+QRect BitmapImage::findContentBounds(const QRect& area) const
+{
+    const QRect scanArea = area.intersected(mBounds).intersected(mSurfaceRect);
+    if (scanArea.isEmpty() || mImage == nullptr) return QRect();
+
+    const int width = scanArea.width();
+    const QPoint origin = scanArea.topLeft() - mSurfaceRect.topLeft();
+    auto rowAt = [this, origin](int relRow)
     {
-        // Point cursor to the pixel at row relTop and column relLeft
-        const QRgb* cursor = reinterpret_cast<const QRgb*>(mImage->constScanLine(relTop)) + relLeft;
-        // Loop through pixels in column
-        // Note: we only need to loop from relTop to relBottom (inclusive)
-        //       not the full image height, because rows 0 to relTop-1 and
-        //       relBottom+1 to mBounds.height() have already been
-        //       confirmed to contain only transparent pixels
-        for (int row = relTop; row <= relBottom; row++)
-        {
-            // If the pixel is not transparent
-            // (i.e. alpha channel > 0)
-            if(qAlpha(*cursor) != 0)
-            {
-                // We've found a non-transparent pixel in column relLeft,
-                // so we can stop looking for one
-                isEmpty = false;
-                break;
-            }
-            // Move cursor to point to next pixel in the column
-            // Increment by width because the data is in row-major order
-            cursor += width;
-        }
-        if (isEmpty)
-        {
-            // If the column we just checked was empty, increase relLeft
-            // to remove the empty column from the left of the bounding box
-            ++relLeft;
-        }
+        return reinterpret_cast<const QRgb*>(mImage->constScanLine(origin.y() + relRow)) + origin.x();
+    };
+
+    int relTop = 0;
+    while (relTop < scanArea.height() && PixelKernels::firstNonTransparent(rowAt(relTop), width) == width)
+    {
+        ++relTop;
+    }
+    if (relTop == scanArea.height())
+    {
+        return QRect();
+    }
+
+    int relBottom = scanArea.height() - 1;
+    while (relBottom > relTop && PixelKernels::firstNonTransparent(rowAt(relBottom), width) == width)
+    {
+        --relBottom;
     }
 
-    // Check right row
-    isEmpty = (relBottom >= relTop); // Reset isEmpty
-    while (isEmpty && relRight >= relLeft) // Loop through columns
+    int relLeft = width;
+    int relRight = -1;
+    for (int row = relTop; row <= relBottom; row++)
     {
-        // Point cursor to the pixel at row relTop and column relRight
-        const QRgb* cursor = reinterpret_cast<const QRgb*>(mImage->constScanLine(relTop)) + relRight;
-        // Loop through pixels in column
-        // Note: we only need to loop from relTop to relBottom (inclusive)
-        //       not the full image height, because rows 0 to relTop-1 and
-        //       relBottom+1 to mBounds.height()-1 have already been
-        //       confirmed to contain only transparent pixels
-        for (int row = relTop; row <= relBottom; row++)
+        const QRgb* cursor = rowAt(row);
+        if (relLeft > 0)
         {
-            // If the pixel is not transparent
-            // (i.e. alpha channel > 0)
-            if(qAlpha(*cursor) != 0)
-            {
-                // We've found a non-transparent pixel in column relRight,
-                // so we can stop looking for one
-                isEmpty = false;
-                break;
-            }
-            // Move cursor to point to next pixel in the column
-            // Increment by width because the data is in row-major order
-            cursor += width;
+            relLeft = qMin(relLeft, PixelKernels::firstNonTransparent(cursor, relLeft));
         }
-        if (isEmpty)
+        if (relRight < width - 1)
         {
-            // If the column we just checked was empty, increase relRight
-            // to remove the empty column from the left of the bounding box
-            --relRight;
+            const int last = PixelKernels::lastNonTransparent(cursor + relRight + 1, width - relRight - 1);
+            if (last >= 0)
+            {
+                relRight += last + 1;
+            }
         }
     }
 
-    //qDebug() << "Original" << mBounds;
-    //qDebug() << "Autocrop" << relLeft << relTop << relRight - mBounds.width() + 1 << relBottom - mBounds.height() + 1;
-    // Update mBounds and mImage if necessary
-    updateBounds(mBounds.adjusted(relLeft, relTop, relRight - mBounds.width() + 1, relBottom - mBounds.height() + 1));
+    return QRect(scanArea.left() + relLeft, scanArea.top() + relTop, relRight - relLeft + 1, relBottom - relTop + 1);
+}
 
-    //qDebug() << "New bounds" << mBounds;
+/** Records a draw within rect that cannot lower the alpha of any pixel.
+ *
+ *  The edges of the content found by the last crop still hold, so the next
+ *  autoCrop() only has to scan the areas recorded here.
+ */
+void BitmapImage::addCropArea(const QRect& rect)
+{
+    if (mMinBound)
+    {
+        mContentBounds = mBounds;
+        mCropArea = QRect();
+        mCropEverything = false;
+    }
+    mCropArea = mCropArea.united(rect.normalized());
+}
 
-    mMinBound = true;
+/** True for the composition modes that never lower the alpha of the destination */
+bool BitmapImage::keepsCoverage(QPainter::CompositionMode cm)
+{
+    switch (cm)
+    {
+    case QPainter::CompositionMode_SourceOver:
+    case QPainter::CompositionMode_DestinationOver:
+    case QPainter::CompositionMode_Destination:
+    case QPainter::CompositionMode_SourceAtop:
+    case QPainter::CompositionMode_Plus:
+    case QPainter::CompositionMode_Multiply:
+    case QPainter::CompositionMode_Screen:
+    case QPainter::CompositionMode_Overlay:
+    case QPainter::CompositionMode_Darken:
+    case QPainter::CompositionMode_Lighten:
+    case QPainter::CompositionMode_ColorDodge:
+    case QPainter::CompositionMode_ColorBurn:
+    case QPainter::CompositionMode_HardLight:
+    case QPainter::CompositionMode_SoftLight:
+    case QPainter::CompositionMode_Difference:
+    case QPainter::CompositionMode_Exclusion:
+        return true;
+    default:
+        return false;
+    }
 }
 
 QRgb BitmapImage::pixel(int x, int y)
@@ -522,7 +825,7 @@ QRgb BitmapImage::pixel(QPoint p)
 {
     QRgb result = qRgba(0, 0, 0, 0); // black
     if (mBounds.contains(p))
-        result = image()->pixel(p - mBounds.topLeft());
+        result = surface()->pixel(p - mSurfaceRect.topLeft());
     return result;
 }
 
@@ -536,7 +839,14 @@ void BitmapImage::setPixel(QPoint p, QRgb colour)
     setCompositionModeBounds(QRect(p, QSize(1,1)), true, QPainter::CompositionMode_SourceOver);
     if (mBounds.contains(p))
     {
-        image()->setPixel(p - mBounds.topLeft(), colour);
+        surface()->setPixel(p - mSurfaceRect.topLeft(), colour);
+        markTilesDirty(QRect(p, QSize(1, 1)));
+    }
+    if (qAlpha(colour) == 0)
+    {
+        // Erasing a pixel may move the edges anywhere
+        mMinBound = false;
+        mCropEverything = true;
     }
     modification();
 }
@@ -552,63 +862,69 @@ void BitmapImage::fillNonAlphaPixels(const QRgb color)
 void BitmapImage::drawLine(QPointF P1, QPointF P2, QPen pen, QPainter::CompositionMode cm, bool antialiasing)
 {
     int width = 2 + pen.width();
-    setCompositionModeBounds(QRect(P1.toPoint(), P2.toPoint()).normalized().adjusted(-width, -width, width, width), true, cm);
-    if (!image()->isNull())
+    QRect dirtyRect = QRect(P1.toPoint(), P2.toPoint()).normalized().adjusted(-width, -width, width, width);
+    setCompositionModeBounds(dirtyRect, true, cm);
+    if (!surface()->isNull())
     {
-        QPainter painter(image());
+        QPainter painter(surface());
         painter.setCompositionMode(cm);
         painter.setRenderHint(QPainter::Antialiasing, antialiasing);
         painter.setPen(pen);
-        painter.drawLine(P1 - mBounds.topLeft(), P2 - mBounds.topLeft());
+        painter.drawLine(P1 - mSurfaceRect.topLeft(), P2 - mSurfaceRect.topLeft());
         painter.end();
     }
+    markTilesDirty(dirtyRect);
     modification();
 }
 
 void BitmapImage::drawRect(QRectF rectangle, QPen pen, QBrush brush, QPainter::CompositionMode cm, bool antialiasing)
 {
     int width = pen.width();
-    setCompositionModeBounds(rectangle.adjusted(-width, -width, width, width).toRect(), true, cm);
+    QRect dirtyRect = rectangle.adjusted(-width, -width, width, width).toRect();
+    setCompositionModeBounds(dirtyRect, true, cm);
     if (brush.style() == Qt::RadialGradientPattern)
     {
         QRadialGradient* gradient = (QRadialGradient*)brush.gradient();
-        gradient->setCenter(gradient->center() - mBounds.topLeft());
-        gradient->setFocalPoint(gradient->focalPoint() - mBounds.topLeft());
+        gradient->setCenter(gradient->center() - mSurfaceRect.topLeft());
+        gradient->setFocalPoint(gradient->focalPoint() - mSurfaceRect.topLeft());
     }
-    if (!image()->isNull())
+    if (!surface()->isNull())
     {
-        QPainter painter(image());
+        QPainter painter(surface());
         painter.setCompositionMode(cm);
         painter.setRenderHint(QPainter::Antialiasing, antialiasing);
         painter.setPen(pen);
         painter.setBrush(brush);
-        painter.drawRect(rectangle.translated(-mBounds.topLeft()));
+        painter.drawRect(rectangle.translated(-mSurfaceRect.topLeft()));
         painter.end();
     }
+    markTilesDirty(dirtyRect);
     modification();
 }
 
 void BitmapImage::drawEllipse(QRectF rectangle, QPen pen, QBrush brush, QPainter::CompositionMode cm, bool antialiasing)
 {
     int width = pen.width();
-    setCompositionModeBounds(rectangle.adjusted(-width, -width, width, width).toRect(), true, cm);
+    QRect dirtyRect = rectangle.adjusted(-width, -width, width, width).toRect();
+    setCompositionModeBounds(dirtyRect, true, cm);
     if (brush.style() == Qt::RadialGradientPattern)
     {
         QRadialGradient* gradient = (QRadialGradient*)brush.gradient();
-        gradient->setCenter(gradient->center() - mBounds.topLeft());
-        gradient->setFocalPoint(gradient->focalPoint() - mBounds.topLeft());
+        gradient->setCenter(gradient->center() - mSurfaceRect.topLeft());
+        gradient->setFocalPoint(gradient->focalPoint() - mSurfaceRect.topLeft());
     }
-    if (!image()->isNull())
+    if (!surface()->isNull())
     {
-        QPainter painter(image());
+        QPainter painter(surface());
 
         painter.setRenderHint(QPainter::Antialiasing, antialiasing);
         painter.setPen(pen);
         painter.setBrush(brush);
         painter.setCompositionMode(cm);
-        painter.drawEllipse(rectangle.translated(-mBounds.topLeft()));
+        painter.drawEllipse(rectangle.translated(-mSurfaceRect.topLeft()));
         painter.end();
     }
+    markTilesDirty(dirtyRect);
     modification();
 }
 
@@ -618,16 +934,17 @@ void BitmapImage::drawPath(QPainterPath path, QPen pen, QBrush brush,
     int width = pen.width();
     // qreal inc = 1.0 + width / 20.0;
 
-    setCompositionModeBounds(path.controlPointRect().adjusted(-width, -width, width, width).toRect(), true, cm);
+    QRect dirtyRect = path.controlPointRect().adjusted(-width, -width, width, width).toRect();
+    setCompositionModeBounds(dirtyRect, true, cm);
 
-    if (!image()->isNull())
+    if (!surface()->isNull())
     {
-        QPainter painter(image());
+        QPainter painter(surface());
         painter.setCompositionMode(cm);
         painter.setRenderHint(QPainter::Antialiasing, antialiasing);
         painter.setPen(pen);
         painter.setBrush(brush);
-        painter.setTransform(QTransform().translate(-mBounds.left(), -mBounds.top()));
+        painter.setTransform(QTransform().translate(-mSurfaceRect.left(), -mSurfaceRect.top()));
         painter.setMatrixEnabled(true);
         if (path.length() > 0)
         {
@@ -656,59 +973,67 @@ void BitmapImage::drawPath(QPainterPath path, QPen pen, QBrush brush,
         }
         painter.end();
     }
+    markTilesDirty(dirtyRect);
     modification();
 }
 
-Status::StatusInt BitmapImage::findLeft(QRectF rect, int grayValue)
+/** Composites a brush dab with source over, without going through QPainter.
+ *
+ *  @param[in] dab The coverage mask of the stamp
+ *  @param[in] topLeft Where the top left pixel of the mask lands, in canvas coordinates
+ *  @param[in] colour The premultiplied colour at full coverage
+ */
+void BitmapImage::drawDab(const BrushDab& dab, const QPoint& topLeft, QRgb colour)
 {
-    Status::StatusInt retValues;
-    retValues.value = -1;
-    retValues.errorcode = Status::FAIL;
-    int left = static_cast<int>(rect.left());
-    int right = static_cast<int>(rect.right());
-    int top = static_cast<int>(rect.top());
-    int bottom = static_cast<int>(rect.bottom());
-    for (int x = left; x <= right; x++)
+    const QRect dirtyRect(topLeft, QSize(dab.size, dab.size));
+    if (dirtyRect.isEmpty() || qAlpha(colour) == 0) return;
+
+    setCompositionModeBounds(dirtyRect, true, QPainter::CompositionMode_SourceOver);
+
+    QImage* img = surface();
+    const QRect area = dirtyRect.intersected(mBounds);
+    if (!img->isNull() && !area.isEmpty())
     {
-        for (int y = top; y <= bottom; y++)
+        const int maskLeft = area.left() - topLeft.x();
+        for (int y = area.top(); y <= area.bottom(); ++y)
         {
-            if (qAlpha(constScanLine(x,y)) == 255 && qGray(constScanLine(x,y)) < grayValue)
-            {
-                retValues.value = x;
-                retValues.errorcode = Status::OK;
-                return retValues;
-            }
+            QRgb* row = reinterpret_cast<QRgb*>(img->scanLine(y - mSurfaceRect.top())) + (area.left() - mSurfaceRect.left());
+            const quint8* mask = dab.alpha.constData() + (y - topLeft.y()) * dab.size + maskLeft;
+            PixelKernels::blendMaskRow(row, mask, area.width(), colour);
         }
     }
-    return retValues;
+    markTilesDirty(dirtyRect);
+    modification();
 }
 
-Status::StatusInt BitmapImage::findTop(QRectF rect, int grayValue)
+/** Lets modify rewrite the pixels of area in place, on the premultiplied working surface.
+ *
+ *  The bounds grow to cover area first. modify may lower the alpha of any pixel
+ *  in it, so the next autoCrop() scans the whole image.
+ *
+ *  @param area The pixels that may change, in canvas coordinates
+ *  @param modify Receives the surface and where its top left pixel is on the canvas
+ */
+void BitmapImage::modifyPixels(const QRect& area, const std::function<void(QImage&, QPoint)>& modify)
 {
-    Status::StatusInt retValues;
-    retValues.value = -1;
-    retValues.errorcode = Status::FAIL;
-    int left = static_cast<int>(rect.left());
-    int right = static_cast<int>(rect.right());
-    int top = static_cast<int>(rect.top());
-    int bottom = static_cast<int>(rect.bottom());
-    for (int y = top; y <= bottom; y++)
+    if (area.isEmpty()) return;
+
+    setCompositionModeBounds(area, false, QPainter::CompositionMode_Source);
+
+    QImage* img = surface();
+    if (!img->isNull())
     {
-        for (int x = left; x <= right; x++)
-        {
-            if (qAlpha(constScanLine(x,y)) == 255 && qGray(constScanLine(x,y)) < grayValue)
-            {
-                retValues.value = y;
-                retValues.errorcode = Status::OK;
-                return retValues;
-            }
-        }
+        modify(*img, mSurfaceRect.topLeft());
     }
-    return retValues;
+    markTilesDirty(area);
+    modification();
 }
 
 Status BitmapImage::writeFile(const QString& filename)
 {
+    if (mTileBacked) loadFile();
+    if (mImage) image(); // trims the surface to the bounds
+
     if (mImage && !mImage->isNull())
     {
         bool b = mImage->save(filename);
@@ -732,7 +1057,12 @@ void BitmapImage::clear()
 {
     mImage = std::make_shared<QImage>(); // null image
     mBounds = QRect(0, 0, 0, 0);
+    mSurfaceRect = mBounds;
     mMinBound = true;
+    mContentBounds = QRect();
+    mCropArea = QRect();
+    mTiles.clear();
+    mTilesDirtyRect = QRect();
     modification();
 }
 
@@ -741,7 +1071,14 @@ QRgb BitmapImage::constScanLine(int x, int y) const
     QRgb result = qRgba(0, 0, 0, 0);
     if (mBounds.contains(QPoint(x, y)))
     {
-        result = *(reinterpret_cast<const QRgb*>(mImage->constScanLine(y - mBounds.top())) + x - mBounds.left());
+        if (mImage)
+        {
+            result = *(reinterpret_cast<const QRgb*>(mImage->constScanLine(y - mSurfaceRect.top())) + x - mSurfaceRect.left());
+        }
+        else if (mTileBacked)
+        {
+            result = mTiles.pixel(x, y);
+        }
     }
     return result;
 }
@@ -752,27 +1089,28 @@ void BitmapImage::scanLine(int x, int y, QRgb colour)
     if (mBounds.contains(QPoint(x, y)))
     {
         // Make sure color is premultiplied before calling
-        *(reinterpret_cast<QRgb*>(image()->scanLine(y - mBounds.top())) + x - mBounds.left()) =
+        *(reinterpret_cast<QRgb*>(surface()->scanLine(y - mSurfaceRect.top())) + x - mSurfaceRect.left()) =
             qRgba(
                 qRed(colour),
                 qGreen(colour),
                 qBlue(colour),
                 qAlpha(colour));
+        markTilesDirty(QRect(x, y, 1, 1));
     }
 }
 
 void BitmapImage::clear(QRect rectangle)
 {
     QRect clearRectangle = mBounds.intersected(rectangle);
-    clearRectangle.moveTopLeft(clearRectangle.topLeft() - mBounds.topLeft());
 
     setCompositionModeBounds(clearRectangle, true, QPainter::CompositionMode_Clear);
 
-    QPainter painter(image());
+    QPainter painter(surface());
     painter.setCompositionMode(QPainter::CompositionMode_Clear);
-    painter.fillRect(clearRectangle, QColor(0, 0, 0, 0));
+    painter.fillRect(clearRectangle.translated(-mSurfaceRect.topLeft()), QColor(0, 0, 0, 0));
     painter.end();
 
+    markTilesDirty(clearRectangle);
     modification();
 }
 
@@ -820,6 +1158,18 @@ bool BitmapImage::compareColor(QRgb newColor, QRgb oldColor, int tolerance, QHas
 
 // Flood fill
 // ----- http://lodev.org/cgtutor/floodfill.html
+/** Fills the area of similar colour around a point.
+ *
+ *  A span based scanline fill that works on the raw rows of targetImage.
+ *  Each row is matched against the seed colour the first time the fill reaches it,
+ *  and the filled spans are composed straight into targetImage.
+ *
+ *  @param[in,out] targetImage The image to fill, it is first extended to cameraRect
+ *  @param[in] cameraRect The camera area, the fill may reach it even outside the image
+ *  @param[in] point The seed of the fill, in canvas coordinates
+ *  @param[in] newColor The premultiplied fill colour, drawn with source over
+ *  @param[in] tolerance The maximum Euclidean distance between the seed colour and a filled colour
+ */
 void BitmapImage::floodFill(BitmapImage* targetImage,
                             QRect cameraRect,
                             QPoint point,
@@ -832,81 +1182,112 @@ void BitmapImage::floodFill(BitmapImage* targetImage,
         return;
     }
 
-    // Square tolerance for use with compareColor
-    tolerance = static_cast<int>(qPow(tolerance, 2));
-
-    QRgb oldColor = targetImage->pixel(point);
-    oldColor = qRgba(qRed(oldColor), qGreen(oldColor), qBlue(oldColor), qAlpha(oldColor));
-
-    // Preparations
-    QList<QPoint> queue; // queue all the pixels of the filled area (as they are found)
-
-    BitmapImage* replaceImage = nullptr;
-    QPoint tempPoint;
-    QRgb newPlacedColor = 0;
-    QScopedPointer< QHash<QRgb, bool> > cache(new QHash<QRgb, bool>());
+    // Square tolerance, the kernels compare squared distances
+    const int toleranceSquared = tolerance * tolerance;
 
-    int xTemp = 0;
-    bool spanLeft = false;
-    bool spanRight = false;
+    // Filling only adds coverage, remember the content edges before extending
+    targetImage->addCropArea(QRect());
 
     // Extend to size of Camera
     targetImage->extend(cameraRect);
-    replaceImage = new BitmapImage(targetImage->mBounds, Qt::transparent);
 
-    queue.append(point);
-    // Preparations END
-
-    while (!queue.empty())
+    QImage* image = targetImage->image();
+    if (image->format() != QImage::Format_ARGB32_Premultiplied)
     {
-        tempPoint = queue.takeFirst();
+        *image = image->convertToFormat(QImage::Format_ARGB32_Premultiplied);
+        targetImage->markTilesDirty(targetImage->mBounds);
+    }
 
-        point.setX(tempPoint.x());
-        point.setY(tempPoint.y());
+    const QRect bounds = targetImage->mBounds;
+    const int width = bounds.width();
+    const int height = bounds.height();
+    const QPoint seed = point - bounds.topLeft();
 
-        xTemp = point.x();
+    uchar* bits = image->bits();
+    const int bytesPerLine = image->bytesPerLine();
+    auto rowAt = [bits, bytesPerLine](int y)
+    {
+        return reinterpret_cast<QRgb*>(bits + static_cast<qptrdiff>(y) * bytesPerLine);
+    };
 
-        newPlacedColor = replaceImage->constScanLine(xTemp, point.y());
-        while (xTemp >= targetImage->mBounds.left() &&
-               compareColor(targetImage->constScanLine(xTemp, point.y()), oldColor, tolerance, cache.data())) xTemp--;
-        xTemp++;
+    const QRgb oldColor = rowAt(seed.y())[seed.x()];
 
-        spanLeft = spanRight = false;
-        while (xTemp <= targetImage->mBounds.right() &&
-               compareColor(targetImage->constScanLine(xTemp, point.y()), oldColor, tolerance, cache.data()) &&
-               newPlacedColor != newColor)
+    // Per pixel state: 0 = not similar, 1 = similar and not filled yet, 2 = filled
+    std::vector<quint8> mask(static_cast<size_t>(width) * static_cast<size_t>(height));
+    std::vector<bool> isRowMatched(static_cast<size_t>(height), false);
+    auto maskRow = [&](int y) -> quint8*
+    {
+        quint8* row = mask.data() + static_cast<size_t>(y) * static_cast<size_t>(width);
+        if (!isRowMatched[y])
         {
+            // The row is matched before any of its pixels gets filled,
+            // so the mask always reflects the original colours
+            PixelKernels::matchColorRow(rowAt(y), width, oldColor, toleranceSquared, row);
+            isRowMatched[y] = true;
+        }
+        return row;
+    };
 
-            // Set pixel color
-            replaceImage->scanLine(xTemp, point.y(), newColor);
+    QRect filledRect;
+    std::vector<QPoint> spans;
+    spans.push_back(seed);
 
-            if (!spanLeft && (point.y() > targetImage->mBounds.top()) &&
-                compareColor(targetImage->constScanLine(xTemp, point.y() - 1), oldColor, tolerance, cache.data())) {
-                queue.append(QPoint(xTemp, point.y() - 1));
-                spanLeft = true;
-            }
-            else if (spanLeft && (point.y() > targetImage->mBounds.top()) &&
-                     !compareColor(targetImage->constScanLine(xTemp, point.y() - 1), oldColor, tolerance, cache.data())) {
-                spanLeft = false;
-            }
+    while (!spans.empty())
+    {
+        const QPoint start = spans.back();
+        spans.pop_back();
 
-            if (!spanRight && point.y() < targetImage->mBounds.bottom() &&
-                compareColor(targetImage->constScanLine(xTemp, point.y() + 1), oldColor, tolerance, cache.data())) {
-                queue.append(QPoint(xTemp, point.y() + 1));
-                spanRight = true;
+        const int y = start.y();
+        quint8* maskLine = maskRow(y);
+        if (maskLine[start.x()] != 1)
+        {
+            continue;
+        }
 
-            }
-            else if (spanRight && point.y() < targetImage->mBounds.bottom() &&
-                     !compareColor(targetImage->constScanLine(xTemp, point.y() + 1), oldColor, tolerance, cache.data())) {
-                spanRight = false;
+        // Grow the span both ways
+        int left = start.x();
+        while (left > 0 && maskLine[left - 1] == 1) left--;
+        int right = start.x();
+        while (right < width - 1 && maskLine[right + 1] == 1) right++;
+
+        QRgb* pixels = rowAt(y);
+        for (int x = left; x <= right; x++)
+        {
+            maskLine[x] = 2;
+            pixels[x] = PixelKernels::sourceOver(newColor, pixels[x]);
+        }
+        filledRect = filledRect.united(QRect(left, y, right - left + 1, 1));
+
+        // Queue one seed for every run of similar pixels above and below the span
+        for (int neighbour : { y - 1, y + 1 })
+        {
+            if (neighbour < 0 || neighbour >= height)
+            {
+                continue;
             }
 
-            Q_ASSERT(queue.count() < (targetImage->mBounds.width() * targetImage->mBounds.height()));
-            xTemp++;
+            const quint8* neighbourLine = maskRow(neighbour);
+            bool inRun = false;
+            for (int x = left; x <= right; x++)
+            {
+                if (neighbourLine[x] == 1)
+                {
+                    if (!inRun)
+                    {
+                        spans.push_back(QPoint(x, neighbour));
+                        inRun = true;
+                    }
+                }
+                else
+                {
+                    inRun = false;
+                }
+            }
         }
     }
 
-    targetImage->paste(replaceImage);
+    targetImage->mMinBound = false;
+    targetImage->addCropArea(filledRect.translated(bounds.topLeft()));
+    targetImage->markTilesDirty(filledRect.translated(bounds.topLeft()));
     targetImage->modification();
-    delete replaceImage;
 }
@@ -17,9 +17,14 @@ GNU General Public License for more details.
 #ifndef BITMAP_IMAGE_H
 #define BITMAP_IMAGE_H
 
+#include <functional>
 #include <memory>
 #include <QPainter>
 #include "keyframe.h"
+#include "tiledimage.h"
+#include "mipmappyramid.h"
+
+struct BrushDab;
 
 
 class BitmapImage : public KeyFrame
@@ -38,12 +43,19 @@ public:
     void loadFile() override;
     void unloadFile() override;
     bool isLoaded() override;
+    qint64 memoryUsage() override;
+    void modification() override;
+
+    bool loadsFromFile() const { return mImage == nullptr && !mTileBacked && !fileName().isEmpty(); }
+    bool adoptDecodedFile(const QString& path, const QImage& decoded);
+    static QImage decodeFile(const QString& path);
 
     void paintImage(QPainter& painter);
     void paintImage(QPainter &painter, QImage &image, QRect sourceRect, QRect destRect);
 
     QImage* image();
     void    setImage(QImage* pImg);
+    QImage  mipmap(int level);
 
     BitmapImage copy();
     BitmapImage copy(QRect rectangle);
@@ -80,6 +92,8 @@ public:
     void drawRect(QRectF rectangle, QPen pen, QBrush brush, QPainter::CompositionMode cm, bool antialiasing);
     void drawEllipse(QRectF rectangle, QPen pen, QBrush brush, QPainter::CompositionMode cm, bool antialiasing);
     void drawPath(QPainterPath path, QPen pen, QBrush brush, QPainter::CompositionMode cm, bool antialiasing);
+    void drawDab(const BrushDab& dab, const QPoint& topLeft, QRgb colour);
+    void modifyPixels(const QRect& area, const std::function<void(QImage& surface, QPoint surfaceTopLeft)>& modify);
 
     QPoint topLeft() { autoCrop(); return mBounds.topLeft(); }
     QPoint topRight() { autoCrop(); return mBounds.topRight(); }
@@ -93,11 +107,6 @@ public:
     int height() { autoCrop(); return mBounds.height(); }
     QSize size() { autoCrop(); return mBounds.size(); }
 
-    // peg bar alignment
-    Status::StatusInt findLeft(QRectF rect, int grayValue);
-    Status::StatusInt findTop(QRectF rect, int grayValue);
-
-
     QRect& bounds() { autoCrop(); return mBounds; }
 
     /** Determines if the BitmapImage is minimally bounded.
@@ -111,6 +120,7 @@ public:
      *          for the contained image.
      */
     bool isMinimallyBounded() const { return mMinBound; }
+    qint64 unsharedByteSize() const;
     void enableAutoCrop(bool b) { mEnableAutoCrop = b; }
 
     Status writeFile(const QString& filename);
@@ -119,16 +129,67 @@ protected:
     void updateBounds(QRect rectangle);
     void extend(const QPoint& p);
     void extend(QRect rectangle);
+    void setLogicalBounds(const QRect& newBoundaries);
+    void growSurface(const QRect& needed);
+    QImage* surface();
+
+    QRect findContentBounds(const QRect& area) const;
+    void addCropArea(const QRect& rect);
+    static bool keepsCoverage(QPainter::CompositionMode cm);
 
     void setCompositionModeBounds(BitmapImage *source, QPainter::CompositionMode cm);
     void setCompositionModeBounds(QRect sourceBounds, bool isSourceMinBounds, QPainter::CompositionMode cm);
 
+    void markTilesDirty(const QRect& rect);
+    void syncTiles() const;
+    void releaseSurface();
+    void setDecodedImage(const QImage& decoded);
+
 private:
     std::shared_ptr< QImage > mImage;
     QRect   mBounds;
 
+    /** The canvas area covered by mImage.
+     *
+     *  mImage is a backing store that contains mBounds and grows past it in chunks,
+     *  so extending the bounds does not reallocate it every time. Pixels outside
+     *  mBounds are meaningless and cleared when the bounds grow over them again.
+     */
+    QRect   mSurfaceRect;
+    static const int SURFACE_CHUNK = 64;
+    static const int MAX_SURFACE_MARGIN = 1024;
+
+    /** Copy-on-write tile storage shared with copies and clones.
+     *
+     *  mImage is the working surface that painters draw into. The tiles mirror
+     *  it except for mTilesDirtyRect, and are brought up to date by syncTiles()
+     *  whenever the image is copied. A copy only receives the tiles and rebuilds
+     *  its own working surface the first time image() is called on it, and the
+     *  copied image releases its surface, see releaseSurface().
+     */
+    mutable TiledImage mTiles;
+    mutable QRect mTilesDirtyRect;
+    /** True when mTiles holds the content, so mImage can be rebuilt from it */
+    mutable bool mTileBacked = false;
+
+    /** Reduced copies of mImage for painting zoomed out, dropped on every modification() */
+    MipmapPyramid mMipmaps;
+    /** Level 0 of the mipmaps, a view of the pixels of mImage within mBounds.
+     *  Kept so it has the same cacheKey() until modification(), and dropped
+     *  whenever mImage is reallocated or released.
+     */
+    QImage mMipmapBase;
+
     /** @see isMinimallyBounded() */
     bool mMinBound = true;
+
+    /** What autoCrop() has to scan while mMinBound is false: the whole image
+     *  when mCropEverything is set, else only mCropArea, the area drawn since
+     *  mContentBounds were found to be the minimal bounds.
+     */
+    QRect mContentBounds;
+    QRect mCropArea;
+    bool mCropEverything = true;
     bool mEnableAutoCrop = false;
 };
 
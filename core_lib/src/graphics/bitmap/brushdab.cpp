@@ -0,0 +1,96 @@
+/*
+
+Pencil - Traditional Animation Software
+Copyright (C) 2012-2018 Matthew Chiawen Chang
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+*/
+#include "brushdab.h"
+
+#include <cmath>
+
+
+/** Returns the dab centred at centre.
+ *
+ *  The dab is placed with its offset from QPoint(qFloor(centre.x()), qFloor(centre.y())).
+ *  The reference stays valid until the next call.
+ */
+const BrushDab& BrushDabCache::dab(qreal width, qreal feather, QPointF centre)
+{
+    const int widthSteps = qMax(1, qRound(width * 8));
+    const int featherStep = qBound(0, qRound(feather), 100);
+    const int phaseX = qBound(0, static_cast<int>((centre.x() - std::floor(centre.x())) * SUBPIXEL_STEPS), SUBPIXEL_STEPS - 1);
+    const int phaseY = qBound(0, static_cast<int>((centre.y() - std::floor(centre.y())) * SUBPIXEL_STEPS), SUBPIXEL_STEPS - 1);
+
+    const quint64 key = (static_cast<quint64>(widthSteps) << 16)
+                      | (static_cast<quint64>(featherStep) << 8)
+                      | static_cast<quint64>(phaseX * SUBPIXEL_STEPS + phaseY);
+
+    auto it = mDabs.find(key);
+    if (it == mDabs.end())
+    {
+        if (mDabs.size() >= MAX_DABS)
+        {
+            mDabs.clear();
+        }
+
+        // Each phase is rasterized at the middle of its quarter pixel
+        const QPointF phase((phaseX + 0.5) / SUBPIXEL_STEPS, (phaseY + 0.5) / SUBPIXEL_STEPS);
+        it = mDabs.insert(key, rasterize(widthSteps / 16.0, featherStep, phase));
+    }
+    return it.value();
+}
+
+/** The premultiplied colour a dab paints at full coverage, as setGaussianGradient() computes it */
+QRgb BrushDabCache::dabColour(const QColor& colour, qreal opacity, qreal feather)
+{
+    feather = qBound<qreal>(0, feather, 100);
+
+    const int mainAlpha = qRound(colour.alphaF() * 255 * opacity);
+    const int alphaAdded = qRound((mainAlpha * feather) / 100);
+    const int alpha = qBound(0, mainAlpha - alphaAdded, 255);
+    return qPremultiply(qRgba(colour.red(), colour.green(), colour.blue(), alpha));
+}
+
+BrushDab BrushDabCache::rasterize(qreal radius, qreal feather, QPointF phase)
+{
+    const int reach = static_cast<int>(std::ceil(radius)) + 1;
+    const qreal hardness = 1.0 - feather / 100.0;
+
+    BrushDab dab;
+    dab.offset = QPoint(-reach, -reach);
+    dab.size = 2 * reach + 1;
+    dab.alpha.fill(0, dab.size * dab.size);
+
+    quint8* mask = dab.alpha.data();
+    for (int y = 0; y < dab.size; ++y)
+    {
+        const qreal dy = (y - reach + 0.5) - phase.y();
+        for (int x = 0; x < dab.size; ++x)
+        {
+            // Sampled at the pixel centre, like the non antialiased ellipse
+            const qreal dx = (x - reach + 0.5) - phase.x();
+            const qreal t = std::sqrt(dx * dx + dy * dy) / radius;
+            if (t > 1.0)
+            {
+                continue;
+            }
+
+            qreal coverage = 1.0;
+            if (t > hardness)
+            {
+                coverage = (1.0 - t) / (1.0 - hardness);
+            }
+            mask[y * dab.size + x] = static_cast<quint8>(qRound(coverage * 255));
+        }
+    }
+    return dab;
+}
@@ -0,0 +1,62 @@
+/*
+
+Pencil - Traditional Animation Software
+Copyright (C) 2012-2018 Matthew Chiawen Chang
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+*/
+#ifndef BRUSHDAB_H
+#define BRUSHDAB_H
+
+#include <QHash>
+#include <QPoint>
+#include <QVector>
+#include <QColor>
+
+
+/** The coverage of one feathered brush stamp, 255 for full and 0 for none */
+struct BrushDab
+{
+    QPoint offset; //< of the top left pixel, from the pixel holding the centre
+    int size = 0;  //< width and height, the mask holds size * size values
+    QVector<quint8> alpha;
+};
+
+
+/** Feathered brush stamps, rasterized once and reused along the stroke.
+ *
+ *  A dab covers the same pixels as the radial gradient ellipse painted by
+ *  ScribbleArea::setGaussianGradient(): full coverage up to 1 - feather / 100
+ *  of the radius, then a linear ramp down to nothing at the radius.
+ *  Dabs are kept per width in 1/8 of a pixel, per feather and per quarter
+ *  pixel of sub-pixel position, so a stroke of constant width reuses a handful
+ *  of masks instead of building a gradient for every stamp.
+ */
+class BrushDabCache
+{
+public:
+    const BrushDab& dab(qreal width, qreal feather, QPointF centre);
+
+    int size() const { return mDabs.size(); }
+    void clear() { mDabs.clear(); }
+
+    static QRgb dabColour(const QColor& colour, qreal opacity, qreal feather);
+
+private:
+    static BrushDab rasterize(qreal radius, qreal feather, QPointF phase);
+
+    static const int SUBPIXEL_STEPS = 4;
+    static const int MAX_DABS = 512;
+
+    QHash<quint64, BrushDab> mDabs;
+};
+
+#endif // BRUSHDAB_H
@@ -0,0 +1,84 @@
+/*
+
+Pencil - Traditional Animation Software
+Copyright (C) 2012-2018 Matthew Chiawen Chang
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+*/
+#include "mipmappyramid.h"
+
+#include <cmath>
+#include "pixelkernels.h"
+
+
+qint64 MipmapPyramid::byteSize() const
+{
+    qint64 total = 0;
+    for (const QImage& image : mLevels)
+    {
+        total += image.byteCount();
+    }
+    return total;
+}
+
+/** Returns level index of base, building the levels missing on the way.
+ *
+ *  @param base The full resolution image, it must be the same on every call until clear()
+ *  @param index The level wanted, clamped to the smallest level with pixels
+ */
+QImage MipmapPyramid::level(const QImage& base, int index)
+{
+    if (index <= 0 || base.isNull())
+    {
+        return base;
+    }
+
+    index = qMin(index, MAX_LEVEL);
+    while (levelCount() < index)
+    {
+        const QImage& previous = mLevels.empty() ? base : mLevels.back();
+        if (previous.width() <= 1 && previous.height() <= 1)
+        {
+            break;
+        }
+        mLevels.push_back(halved(previous));
+    }
+    return mLevels.empty() ? base : mLevels[static_cast<size_t>(qMin(index, levelCount()) - 1)];
+}
+
+/** Returns the smallest level that still has at least one pixel per pixel on screen at scale */
+int MipmapPyramid::levelForScale(qreal scale)
+{
+    if (scale >= 1.0 || scale <= 0.0)
+    {
+        return 0;
+    }
+    return qMin(MAX_LEVEL, static_cast<int>(std::floor(std::log2(1.0 / scale))));
+}
+
+/** Averages image down to half its size, rounding odd sizes up */
+QImage MipmapPyramid::halved(const QImage& image)
+{
+    const QImage source = (image.format() == QImage::Format_ARGB32_Premultiplied)
+        ? image
+        : image.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+
+    QImage result((source.width() + 1) / 2, (source.height() + 1) / 2, QImage::Format_ARGB32_Premultiplied);
+    for (int y = 0; y < result.height(); ++y)
+    {
+        const QRgb* top = reinterpret_cast<const QRgb*>(source.constScanLine(y * 2));
+        const QRgb* bottom = (y * 2 + 1 < source.height())
+            ? reinterpret_cast<const QRgb*>(source.constScanLine(y * 2 + 1))
+            : nullptr;
+        PixelKernels::halveRows(top, bottom, source.width(), reinterpret_cast<QRgb*>(result.scanLine(y)));
+    }
+    return result;
+}
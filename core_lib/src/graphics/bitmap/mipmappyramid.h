@@ -0,0 +1,48 @@
+/*
+
+Pencil - Traditional Animation Software
+Copyright (C) 2012-2018 Matthew Chiawen Chang
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+*/
+#ifndef MIPMAPPYRAMID_H
+#define MIPMAPPYRAMID_H
+
+#include <vector>
+#include <QImage>
+
+
+/** Reduced copies of a bitmap for painting it zoomed out.
+ *
+ *  Level n is the base image halved n times, with each pixel the average of
+ *  a 2x2 block of the level above. Level 0 is the base image itself and is not stored.
+ *  Levels are built the first time they are asked for and kept until clear().
+ */
+class MipmapPyramid
+{
+public:
+    static const int MAX_LEVEL = 8;
+
+    bool isEmpty() const { return mLevels.empty(); }
+    int levelCount() const { return static_cast<int>(mLevels.size()); }
+    qint64 byteSize() const;
+
+    QImage level(const QImage& base, int index);
+    void clear() { mLevels.clear(); }
+
+    static int levelForScale(qreal scale);
+    static QImage halved(const QImage& image);
+
+private:
+    std::vector<QImage> mLevels; //< mLevels[i] holds level i + 1
+};
+
+#endif // MIPMAPPYRAMID_H
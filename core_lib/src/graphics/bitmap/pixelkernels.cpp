@@ -0,0 +1,273 @@
+/*
+
+Pencil - Traditional Animation Software
+Copyright (C) 2012-2018 Matthew Chiawen Chang
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+*/
+#include "pixelkernels.h"
+
+#include <cstring>
+
+#ifdef PENCIL_SIMD_SSE2
+#include <emmintrin.h>
+#endif
+
+
+namespace PixelKernels
+{
+
+static inline bool isSimilar(QRgb color, QRgb reference, int toleranceSquared)
+{
+    const int diffRed = qRed(color) - qRed(reference);
+    const int diffGreen = qGreen(color) - qGreen(reference);
+    const int diffBlue = qBlue(color) - qBlue(reference);
+    const int diffAlpha = qAlpha(color) - qAlpha(reference);
+    return (diffRed * diffRed + diffGreen * diffGreen + diffBlue * diffBlue + diffAlpha * diffAlpha) <= toleranceSquared;
+}
+
+void matchColorRow(const QRgb* row, int count, QRgb reference, int toleranceSquared, quint8* mask)
+{
+    int x = 0;
+
+#ifdef PENCIL_SIMD_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ref = _mm_unpacklo_epi8(_mm_set1_epi32(static_cast<int>(reference)), zero);
+    const __m128i tolerance = _mm_set1_epi32(toleranceSquared);
+
+    for (; x + 4 <= count; x += 4)
+    {
+        const __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x));
+
+        // Widen the channels to 16 bits, then square and add them pairwise
+        const __m128i diffLo = _mm_sub_epi16(_mm_unpacklo_epi8(pixels, zero), ref);
+        const __m128i diffHi = _mm_sub_epi16(_mm_unpackhi_epi8(pixels, zero), ref);
+        __m128i sumLo = _mm_madd_epi16(diffLo, diffLo);
+        __m128i sumHi = _mm_madd_epi16(diffHi, diffHi);
+
+        // Finish the per pixel sums in the even lanes and gather them
+        sumLo = _mm_add_epi32(sumLo, _mm_srli_epi64(sumLo, 32));
+        sumHi = _mm_add_epi32(sumHi, _mm_srli_epi64(sumHi, 32));
+        const __m128i distance = _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(sumLo),
+                                                                 _mm_castsi128_ps(sumHi),
+                                                                 _MM_SHUFFLE(2, 0, 2, 0)));
+
+        const int tooFar = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(distance, tolerance)));
+        mask[x + 0] = (tooFar & 1) ? 0 : 1;
+        mask[x + 1] = (tooFar & 2) ? 0 : 1;
+        mask[x + 2] = (tooFar & 4) ? 0 : 1;
+        mask[x + 3] = (tooFar & 8) ? 0 : 1;
+    }
+#endif
+
+    for (; x < count; ++x)
+    {
+        mask[x] = isSimilar(row[x], reference, toleranceSquared) ? 1 : 0;
+    }
+}
+
+static inline QRgb averageOfFour(QRgb a, QRgb b, QRgb c, QRgb d)
+{
+    // Channels summed in pairs with room for the carries
+    const quint32 redBlue = (a & 0xff00ff) + (b & 0xff00ff) + (c & 0xff00ff) + (d & 0xff00ff) + 0x20002;
+    const quint32 alphaGreen = ((a >> 8) & 0xff00ff) + ((b >> 8) & 0xff00ff) + ((c >> 8) & 0xff00ff) + ((d >> 8) & 0xff00ff) + 0x20002;
+    return ((redBlue >> 2) & 0xff00ff) | (((alphaGreen >> 2) & 0xff00ff) << 8);
+}
+
+void halveRows(const QRgb* top, const QRgb* bottom, int sourceCount, QRgb* dest)
+{
+    int x = 0;
+
+#ifdef PENCIL_SIMD_SSE2
+    if (bottom != nullptr)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i rounding = _mm_set1_epi16(2);
+
+        // Four source pixels of each row give two destination pixels
+        for (; x + 4 <= sourceCount; x += 4)
+        {
+            const __m128i upper = _mm_loadu_si128(reinterpret_cast<const __m128i*>(top + x));
+            const __m128i lower = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bottom + x));
+
+            const __m128i sumLo = _mm_add_epi16(_mm_unpacklo_epi8(upper, zero), _mm_unpacklo_epi8(lower, zero));
+            const __m128i sumHi = _mm_add_epi16(_mm_unpackhi_epi8(upper, zero), _mm_unpackhi_epi8(lower, zero));
+
+            // Add the right pixel of each pair onto the left one
+            const __m128i pairLo = _mm_add_epi16(sumLo, _mm_srli_si128(sumLo, 8));
+            const __m128i pairHi = _mm_add_epi16(sumHi, _mm_srli_si128(sumHi, 8));
+
+            __m128i average = _mm_unpacklo_epi64(pairLo, pairHi);
+            average = _mm_srli_epi16(_mm_add_epi16(average, rounding), 2);
+            _mm_storel_epi64(reinterpret_cast<__m128i*>(dest + x / 2), _mm_packus_epi16(average, zero));
+        }
+    }
+#endif
+
+    for (; x < sourceCount; x += 2)
+    {
+        const bool hasRight = (x + 1 < sourceCount);
+        const QRgb topRight = hasRight ? top[x + 1] : 0;
+        const QRgb bottomLeft = (bottom != nullptr) ? bottom[x] : 0;
+        const QRgb bottomRight = (bottom != nullptr && hasRight) ? bottom[x + 1] : 0;
+        dest[x / 2] = averageOfFour(top[x], topRight, bottomLeft, bottomRight);
+    }
+}
+
+#ifdef PENCIL_SIMD_SSE2
+/** byteMul() on 16 bit channels */
+static inline __m128i byteMul16(__m128i channels, __m128i alpha)
+{
+    const __m128i t = _mm_mullo_epi16(channels, alpha);
+    return _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), _mm_set1_epi16(0x80)), 8);
+}
+
+/** 255 minus the alpha of each pixel, over the four channels of that pixel */
+static inline __m128i inverseAlpha16(__m128i channels)
+{
+    const __m128i alpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(channels, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+    return _mm_sub_epi16(_mm_set1_epi16(255), alpha);
+}
+#endif
+
+void blendMaskRow(QRgb* row, const quint8* mask, int count, QRgb colour)
+{
+    int x = 0;
+
+#ifdef PENCIL_SIMD_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i source = _mm_unpacklo_epi8(_mm_set1_epi32(static_cast<int>(colour)), zero);
+
+    for (; x + 4 <= count; x += 4)
+    {
+        quint32 coverage;
+        memcpy(&coverage, mask + x, sizeof(coverage));
+        if (coverage == 0)
+        {
+            continue;
+        }
+
+        // Spread the coverage of each pixel over its four channels
+        __m128i spread = _mm_unpacklo_epi8(_mm_cvtsi32_si128(static_cast<int>(coverage)), zero);
+        spread = _mm_unpacklo_epi16(spread, spread);
+        const __m128i srcLo = byteMul16(source, _mm_unpacklo_epi32(spread, spread));
+        const __m128i srcHi = byteMul16(source, _mm_unpackhi_epi32(spread, spread));
+
+        __m128i* pixels = reinterpret_cast<__m128i*>(row + x);
+        const __m128i dest = _mm_loadu_si128(pixels);
+        const __m128i outLo = _mm_add_epi16(srcLo, byteMul16(_mm_unpacklo_epi8(dest, zero), inverseAlpha16(srcLo)));
+        const __m128i outHi = _mm_add_epi16(srcHi, byteMul16(_mm_unpackhi_epi8(dest, zero), inverseAlpha16(srcHi)));
+        _mm_storeu_si128(pixels, _mm_packus_epi16(outLo, outHi));
+    }
+#endif
+
+    for (; x < count; ++x)
+    {
+        if (mask[x] != 0)
+        {
+            row[x] = sourceOver(byteMul(colour, mask[x]), row[x]);
+        }
+    }
+}
+
+void darkMaskRow(const QRgb* row, int count, int grayThreshold, quint8* mask)
+{
+    int x = 0;
+
+#ifdef PENCIL_SIMD_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i alphaMask = _mm_set1_epi32(static_cast<int>(0xff000000));
+    const __m128i threshold = _mm_set1_epi32(grayThreshold);
+
+    // qGray() weights in memory order, blue green red alpha
+    const __m128i weights = _mm_set_epi16(0, 11, 16, 5, 0, 11, 16, 5);
+
+    for (; x + 4 <= count; x += 4)
+    {
+        const __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x));
+
+        __m128i sumLo = _mm_madd_epi16(_mm_unpacklo_epi8(pixels, zero), weights);
+        __m128i sumHi = _mm_madd_epi16(_mm_unpackhi_epi8(pixels, zero), weights);
+        sumLo = _mm_add_epi32(sumLo, _mm_srli_epi64(sumLo, 32));
+        sumHi = _mm_add_epi32(sumHi, _mm_srli_epi64(sumHi, 32));
+        const __m128i gray = _mm_srli_epi32(_mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(sumLo),
+                                                                            _mm_castsi128_ps(sumHi),
+                                                                            _MM_SHUFFLE(2, 0, 2, 0))), 5);
+
+        const __m128i opaque = _mm_cmpeq_epi32(_mm_and_si128(pixels, alphaMask), alphaMask);
+        const int dark = _mm_movemask_ps(_mm_castsi128_ps(_mm_and_si128(opaque, _mm_cmplt_epi32(gray, threshold))));
+        mask[x + 0] = (dark & 1) ? 1 : 0;
+        mask[x + 1] = (dark & 2) ? 1 : 0;
+        mask[x + 2] = (dark & 4) ? 1 : 0;
+        mask[x + 3] = (dark & 8) ? 1 : 0;
+    }
+#endif
+
+    for (; x < count; ++x)
+    {
+        mask[x] = (qAlpha(row[x]) == 255 && qGray(row[x]) < grayThreshold) ? 1 : 0;
+    }
+}
+
+#ifdef PENCIL_SIMD_SSE2
+/** One bit per pixel of the four at pixels, set when its alpha is zero */
+static inline int transparentLanes(const QRgb* pixels)
+{
+    const __m128i alpha = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(pixels)),
+                                        _mm_set1_epi32(static_cast<int>(0xff000000)));
+    return _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(alpha, _mm_setzero_si128())));
+}
+#endif
+
+int firstNonTransparent(const QRgb* row, int count)
+{
+    int x = 0;
+
+#ifdef PENCIL_SIMD_SSE2
+    // Skip the transparent pixels four at a time, the scalar loop finds the exact one
+    while (x + 4 <= count && transparentLanes(row + x) == 0xf)
+    {
+        x += 4;
+    }
+#endif
+
+    for (; x < count; ++x)
+    {
+        if (qAlpha(row[x]) != 0)
+        {
+            return x;
+        }
+    }
+    return count;
+}
+
+int lastNonTransparent(const QRgb* row, int count)
+{
+    int x = count;
+
+#ifdef PENCIL_SIMD_SSE2
+    while (x >= 4 && transparentLanes(row + x - 4) == 0xf)
+    {
+        x -= 4;
+    }
+#endif
+
+    for (; x > 0; --x)
+    {
+        if (qAlpha(row[x - 1]) != 0)
+        {
+            return x - 1;
+        }
+    }
+    return -1;
+}
+
+}
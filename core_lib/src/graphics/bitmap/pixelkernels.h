@@ -0,0 +1,106 @@
+/*
+
+Pencil - Traditional Animation Software
+Copyright (C) 2012-2018 Matthew Chiawen Chang
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+*/
+#ifndef PIXELKERNELS_H
+#define PIXELKERNELS_H
+
+#include <QtGlobal>
+#include <QColor>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PENCIL_SIMD_SSE2
+#endif
+
+/** Raw pixel loops working directly on premultiplied ARGB32 scan lines.
+ *
+ *  Each kernel has an SSE2 implementation when the compiler targets it
+ *  and a plain C++ fallback that gives the same results.
+ */
+namespace PixelKernels
+{
+    /** Flags the pixels of a row that are similar to a reference colour.
+     *
+     *  \param row First pixel of the row
+     *  \param count Number of pixels in the row
+     *  \param reference The colour to compare against
+     *  \param toleranceSquared Maximum squared Euclidean distance over the four channels
+     *  \param mask Receives 1 for every similar pixel and 0 for the others
+     */
+    void matchColorRow(const QRgb* row, int count, QRgb reference, int toleranceSquared, quint8* mask);
+
+    /** Averages 2x2 blocks of pixels into one, for the next mipmap level.
+     *
+     *  \param top The even source row
+     *  \param bottom The odd source row, or nullptr past the last row
+     *  \param sourceCount Number of pixels in the source rows
+     *  \param dest Receives (sourceCount + 1) / 2 pixels
+     *
+     *  Missing pixels on the right and bottom edges count as transparent.
+     */
+    void halveRows(const QRgb* top, const QRgb* bottom, int sourceCount, QRgb* dest);
+
+    /** Composites a colour over a row through a coverage mask, with source over.
+     *
+     *  \param row First pixel of the row
+     *  \param mask One coverage per pixel, 255 for full and 0 for none
+     *  \param count Number of pixels in the row
+     *  \param colour The premultiplied colour at full coverage
+     */
+    void blendMaskRow(QRgb* row, const quint8* mask, int count, QRgb colour);
+
+    /** Flags the opaque pixels of a row that are darker than a gray level.
+     *
+     *  \param row First pixel of the row
+     *  \param count Number of pixels in the row
+     *  \param grayThreshold Pixels with a qGray() below it are dark
+     *  \param mask Receives 1 for every opaque dark pixel and 0 for the others
+     */
+    void darkMaskRow(const QRgb* row, int count, int grayThreshold, quint8* mask);
+
+    /** Returns the index of the first pixel of a row with a non-zero alpha, or count if there is none. */
+    int firstNonTransparent(const QRgb* row, int count);
+
+    /** Returns the index of the last pixel of a row with a non-zero alpha, or -1 if there is none. */
+    int lastNonTransparent(const QRgb* row, int count);
+
+    /** Multiplies each channel of a premultiplied pixel by alpha / 255. */
+    inline QRgb byteMul(QRgb x, uint alpha)
+    {
+        uint t = (x & 0xff00ff) * alpha;
+        t = (t + ((t >> 8) & 0xff00ff) + 0x800080) >> 8;
+        t &= 0xff00ff;
+
+        x = ((x >> 8) & 0xff00ff) * alpha;
+        x = (x + ((x >> 8) & 0xff00ff) + 0x800080);
+        x &= 0xff00ff00;
+        return x | t;
+    }
+
+    /** Blends a towards b by t out of 256, on the four premultiplied channels at once. */
+    inline QRgb interpolate(QRgb a, QRgb b, quint32 t)
+    {
+        const quint32 redBlue = (((a & 0xff00ff) * (256 - t) + (b & 0xff00ff) * t) >> 8) & 0xff00ff;
+        const quint32 alphaGreen = ((((a >> 8) & 0xff00ff) * (256 - t) + ((b >> 8) & 0xff00ff) * t) >> 8) & 0xff00ff;
+        return redBlue | (alphaGreen << 8);
+    }
+
+    /** Porter-Duff source over, the same arithmetic as QPainter uses for premultiplied images. */
+    inline QRgb sourceOver(QRgb src, QRgb dst)
+    {
+        return src + byteMul(dst, 255 - qAlpha(src));
+    }
+}
+
+#endif // PIXELKERNELS_H
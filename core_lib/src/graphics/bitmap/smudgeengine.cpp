@@ -0,0 +1,186 @@
+/*
+
+Pencil - Traditional Animation Software
+Copyright (C) 2012-2018 Matthew Chiawen Chang
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+*/
+#include "smudgeengine.h"
+
+#include <cmath>
+#include <cstring>
+#include <QLineF>
+#include <QtMath>
+#include "bitmapimage.h"
+#include "pixelkernels.h"
+
+
+namespace
+{
+    inline QRgb pixelAt(const QRgb* pixels, int width, int height, int x, int y)
+    {
+        if (x < 0 || y < 0 || x >= width || y >= height)
+        {
+            return 0;
+        }
+        return pixels[y * width + x];
+    }
+
+    /** Interpolates the four pixels around (u, v), fixed point with 16 fractional bits measured from the pixel centres */
+    inline QRgb sampleBilinear(const QRgb* pixels, int width, int height, qint64 u, qint64 v)
+    {
+        const int sx = static_cast<int>(u >> 16);
+        const int sy = static_cast<int>(v >> 16);
+        const quint32 tx = static_cast<quint32>((u >> 8) & 0xff);
+        const quint32 ty = static_cast<quint32>((v >> 8) & 0xff);
+
+        const QRgb top = PixelKernels::interpolate(pixelAt(pixels, width, height, sx, sy),
+                                                   pixelAt(pixels, width, height, sx + 1, sy), tx);
+        const QRgb bottom = PixelKernels::interpolate(pixelAt(pixels, width, height, sx, sy + 1),
+                                                      pixelAt(pixels, width, height, sx + 1, sy + 1), tx);
+        return PixelKernels::interpolate(top, bottom, ty);
+    }
+
+    /** Fixed point with 16 fractional bits */
+    inline qint64 toFixed(qreal value)
+    {
+        return static_cast<qint64>(std::floor(value * 65536.0));
+    }
+}
+
+/** Sets the brush as the smudge tool describes it, the feather is from 0 to 100 like for drawBrush() */
+void SmudgeEngine::setBrush(qreal width, qreal feather, qreal opacity)
+{
+    mWidth = qMax<qreal>(1, width);
+    mFeather = feather;
+    mOpacity = opacity;
+}
+
+/** Smudges image with a dab every spacing pixels from from towards to.
+ *
+ *  The first dab is one step past from, the pixels under from are the first to be pushed.
+ *  The image is only touched once for the whole segment, dirtyRect() tells what changed.
+ *
+ *  @return Where the last dab went, from if the segment is shorter than half a step
+ */
+QPointF SmudgeEngine::stroke(BitmapImage* image, QPointF from, QPointF to)
+{
+    mDirtyRect = QRect();
+
+    const qreal distance = QLineF(from, to).length();
+    const int steps = qRound(distance / mSpacing);
+    if (steps == 0)
+    {
+        return from;
+    }
+    const QPointF step = (to - from) * (mSpacing / distance);
+    const QPointF last = from + steps * step;
+
+    if (image == nullptr || image->bounds().isEmpty())
+    {
+        return last;
+    }
+
+    // Every dab, and the one at from that the first pulls its pixels from
+    QRect area;
+    for (int i = 0; i <= steps; i++)
+    {
+        const QPointF centre = from + i * step;
+        const BrushDab& dab = mDabs.dab(mWidth, mFeather, centre);
+        area |= QRect(QPoint(qFloor(centre.x()), qFloor(centre.y())) + dab.offset, QSize(dab.size, dab.size));
+    }
+    if (!area.intersects(image->bounds()))
+    {
+        return last;
+    }
+
+    image->modifyPixels(area, [&](QImage& surface, QPoint surfaceTopLeft)
+    {
+        for (int i = 1; i <= steps; i++)
+        {
+            smudgeDab(surface, surfaceTopLeft, area, from + i * step, step);
+        }
+    });
+    mDirtyRect = area;
+    return last;
+}
+
+/** Applies the dab at centre, which moved by step from the previous one.
+ *  Pixels outside area count as transparent.
+ */
+void SmudgeEngine::smudgeDab(QImage& surface, QPoint surfaceTopLeft, const QRect& area,
+                             QPointF centre, QPointF step)
+{
+    const BrushDab& dab = mDabs.dab(mWidth, mFeather, centre);
+    const QPoint dabTopLeft = QPoint(qFloor(centre.x()), qFloor(centre.y())) + dab.offset;
+    const QRect dabRect = QRect(dabTopLeft, QSize(dab.size, dab.size)).intersected(area);
+    if (dabRect.isEmpty())
+    {
+        return;
+    }
+
+    // The same strength as the white gradients the brushes were painted with
+    const QColor white(255, 255, 255, mMode == LIQUIFY ? 255 : 127);
+    const quint32 strength = qAlpha(BrushDabCache::dabColour(white, mOpacity, mFeather));
+    if (strength == 0)
+    {
+        return;
+    }
+
+    // The pixels as they were before this dab, as far as they are pulled from
+    const int reach = static_cast<int>(std::ceil(qMax(std::abs(step.x()), std::abs(step.y())))) + 1;
+    const QRect snapshotRect = dabRect.adjusted(-reach, -reach, reach, reach).intersected(area);
+    const int snapshotWidth = snapshotRect.width();
+    const int snapshotHeight = snapshotRect.height();
+    mSnapshot.resize(static_cast<size_t>(snapshotWidth * snapshotHeight));
+    for (int y = 0; y < snapshotHeight; ++y)
+    {
+        const QRgb* source = reinterpret_cast<const QRgb*>(surface.constScanLine(snapshotRect.top() + y - surfaceTopLeft.y()))
+                             + (snapshotRect.left() - surfaceTopLeft.x());
+        std::memcpy(mSnapshot.data() + y * snapshotWidth, source, static_cast<size_t>(snapshotWidth) * sizeof(QRgb));
+    }
+    const QRgb* snapshot = mSnapshot.data();
+
+    const qint64 du = toFixed(step.x());
+    const qint64 dv = toFixed(step.y());
+
+    for (int y = dabRect.top(); y <= dabRect.bottom(); ++y)
+    {
+        QRgb* row = reinterpret_cast<QRgb*>(surface.scanLine(y - surfaceTopLeft.y())) + (dabRect.left() - surfaceTopLeft.x());
+        const quint8* mask = dab.alpha.constData() + (y - dabTopLeft.y()) * dab.size + (dabRect.left() - dabTopLeft.x());
+        const qint64 v = static_cast<qint64>(y - snapshotRect.top()) << 16;
+
+        for (int x = 0; x < dabRect.width(); ++x)
+        {
+            // Coverage of the brush, out of 255
+            const quint32 weight = (mask[x] * strength + 127) / 255;
+            if (weight == 0)
+            {
+                continue;
+            }
+            const qint64 u = static_cast<qint64>(dabRect.left() + x - snapshotRect.left()) << 16;
+
+            if (mMode == LIQUIFY)
+            {
+                // Pulled from as far back as the brush covers, out of 256
+                const quint32 t = weight + (weight >> 7);
+                const QRgb pulled = sampleBilinear(snapshot, snapshotWidth, snapshotHeight,
+                                                   u - ((du * t) >> 8), v - ((dv * t) >> 8));
+                row[x] = PixelKernels::interpolate(row[x], pulled, t);
+            }
+            else
+            {
+                const QRgb carried = sampleBilinear(snapshot, snapshotWidth, snapshotHeight, u - du, v - dv);
+                row[x] = PixelKernels::sourceOver(PixelKernels::byteMul(carried, weight), row[x]);
+            }
+        }
+    }
+}
@@ -0,0 +1,67 @@
+/*
+
+Pencil - Traditional Animation Software
+Copyright (C) 2012-2018 Matthew Chiawen Chang
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+*/
+#ifndef SMUDGEENGINE_H
+#define SMUDGEENGINE_H
+
+#include <vector>
+#include <QImage>
+#include <QPointF>
+#include <QRect>
+#include "brushdab.h"
+
+class BitmapImage;
+
+
+/** Pushes the pixels of a bitmap along a stroke, dab after dab.
+ *
+ *  LIQUIFY displaces the pixels under each dab by the step from the previous
+ *  dab, scaled by the coverage of the brush, and reads them with a bilinear
+ *  sampler so the drawing slides smoothly. SMEAR lays the pixels under the
+ *  previous dab over the next one, at half strength by default.
+ *
+ *  A whole segment of the stroke is processed in one go, directly on the
+ *  premultiplied rows of the image with fixed point weights.
+ */
+class SmudgeEngine
+{
+public:
+    enum Mode { LIQUIFY, SMEAR };
+
+    void setMode(Mode mode) { mMode = mode; }
+    void setBrush(qreal width, qreal feather, qreal opacity);
+    void setSpacing(qreal spacing) { mSpacing = qMax<qreal>(0.5, spacing); }
+
+    QPointF stroke(BitmapImage* image, QPointF from, QPointF to);
+
+    /** The canvas area changed by the last stroke() */
+    QRect dirtyRect() const { return mDirtyRect; }
+
+private:
+    void smudgeDab(QImage& surface, QPoint surfaceTopLeft, const QRect& area,
+                   QPointF centre, QPointF step);
+
+    Mode mMode = LIQUIFY;
+    qreal mWidth = 24;
+    qreal mFeather = 0;
+    qreal mOpacity = 1;
+    qreal mSpacing = 2;
+
+    BrushDabCache mDabs;
+    std::vector<QRgb> mSnapshot; //< the pixels under a dab before it is applied
+    QRect mDirtyRect;
+};
+
+#endif // SMUDGEENGINE_H
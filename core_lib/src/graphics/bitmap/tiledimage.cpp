@@ -0,0 +1,361 @@
+/*
+
+Pencil - Traditional Animation Software
+Copyright (C) 2012-2018 Matthew Chiawen Chang
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+*/
+#include "tiledimage.h"
+
+#include <cstring>
+
+const int TiledImage::TILE_SIZE;
+
+TiledImage::TiledImage()
+{
+}
+
+qint64 TiledImage::byteSize() const
+{
+    return static_cast<qint64>(mTiles.size()) * TILE_SIZE * TILE_SIZE * sizeof(QRgb);
+}
+
+/** Returns the bytes of the tiles no other TiledImage holds, that is what freeing this one would give back.
+ *  Tiles in a table still shared as a whole are not counted.
+ */
+qint64 TiledImage::unsharedByteSize() const
+{
+    if (!mTiles.isDetached())
+    {
+        return 0;
+    }
+
+    qint64 count = 0;
+    for (auto it = mTiles.constBegin(); it != mTiles.constEnd(); ++it)
+    {
+        if (it.value().isDetached())
+        {
+            count++;
+        }
+    }
+    return count * TILE_SIZE * TILE_SIZE * static_cast<qint64>(sizeof(QRgb));
+}
+
+QRect TiledImage::boundingRect() const
+{
+    QRect result;
+    for (auto it = mTiles.constBegin(); it != mTiles.constEnd(); ++it)
+    {
+        int tx, ty;
+        tileIndex(it.key(), tx, ty);
+        result = result.united(tileRect(tx, ty));
+    }
+    return result;
+}
+
+QRgb TiledImage::pixel(int x, int y) const
+{
+    const int tx = floorDiv(x - mOrigin.x(), TILE_SIZE);
+    const int ty = floorDiv(y - mOrigin.y(), TILE_SIZE);
+
+    auto it = mTiles.constFind(tileKey(tx, ty));
+    if (it == mTiles.constEnd())
+    {
+        return qRgba(0, 0, 0, 0);
+    }
+    const QRect rect = tileRect(tx, ty);
+    const QRgb* row = reinterpret_cast<const QRgb*>(it.value().constScanLine(y - rect.top()));
+    return row[x - rect.left()];
+}
+
+void TiledImage::clear()
+{
+    mTiles.clear();
+}
+
+/** Erases the pixels inside rect.
+ *
+ *  Tiles entirely covered by rect are released, the others are detached
+ *  and only the covered part is cleared.
+ */
+void TiledImage::clear(const QRect& rect)
+{
+    const QRect range = tileRange(rect);
+    for (int ty = range.top(); ty <= range.bottom(); ++ty)
+    {
+        for (int tx = range.left(); tx <= range.right(); ++tx)
+        {
+            const quint64 key = tileKey(tx, ty);
+            if (!mTiles.contains(key))
+            {
+                continue;
+            }
+
+            const QRect tr = tileRect(tx, ty);
+            if (rect.contains(tr))
+            {
+                mTiles.remove(key);
+                continue;
+            }
+
+            const QRect part = tr.intersected(rect);
+            QImage tile = mTiles.take(key);
+            for (int y = part.top(); y <= part.bottom(); ++y)
+            {
+                QRgb* row = reinterpret_cast<QRgb*>(tile.scanLine(y - tr.top()));
+                std::memset(row + (part.left() - tr.left()), 0, part.width() * sizeof(QRgb));
+            }
+            if (!isTransparent(tile))
+            {
+                mTiles.insert(key, tile);
+            }
+        }
+    }
+}
+
+/** Drops every pixel outside rect. */
+void TiledImage::crop(const QRect& rect)
+{
+    *this = copy(rect);
+}
+
+/** Writes the area rect of source back into the tiles.
+ *
+ *  @param[in] source The image holding the new pixels
+ *  @param[in] sourceTopLeft Canvas position of the top left pixel of source
+ *  @param[in] rect The area to store, in canvas coordinates
+ *
+ *  Only the tiles touching rect are duplicated; tiles that end up
+ *  fully transparent are released.
+ */
+void TiledImage::store(const QImage& source, const QPoint& sourceTopLeft, const QRect& rect)
+{
+    const QRect area = rect.intersected(QRect(sourceTopLeft, source.size()));
+    if (area.isEmpty())
+    {
+        return;
+    }
+
+    const QRect range = tileRange(area);
+    for (int ty = range.top(); ty <= range.bottom(); ++ty)
+    {
+        for (int tx = range.left(); tx <= range.right(); ++tx)
+        {
+            const quint64 key = tileKey(tx, ty);
+            const QRect tr = tileRect(tx, ty);
+            const QRect part = tr.intersected(area);
+
+            QImage patch = source.copy(part.translated(-sourceTopLeft))
+                .convertToFormat(QImage::Format_ARGB32_Premultiplied);
+
+            QImage tile;
+            if (part == tr)
+            {
+                tile = patch;
+            }
+            else
+            {
+                tile = mTiles.contains(key) ? mTiles.take(key) : blankTile();
+                for (int y = 0; y < part.height(); ++y)
+                {
+                    QRgb* dst = reinterpret_cast<QRgb*>(tile.scanLine(part.top() - tr.top() + y));
+                    std::memcpy(dst + (part.left() - tr.left()),
+                                patch.constScanLine(y),
+                                part.width() * sizeof(QRgb));
+                }
+            }
+
+            if (isTransparent(tile))
+            {
+                mTiles.remove(key);
+            }
+            else
+            {
+                mTiles.insert(key, tile);
+            }
+        }
+    }
+}
+
+/** Copies the stored pixels into target.
+ *
+ *  @param[in,out] target A Format_ARGB32_Premultiplied image. Pixels not covered
+ *                 by a tile are left untouched.
+ *  @param[in] targetTopLeft Canvas position of the top left pixel of target
+ */
+void TiledImage::paintTo(QImage& target, const QPoint& targetTopLeft) const
+{
+    Q_ASSERT(target.format() == QImage::Format_ARGB32_Premultiplied);
+
+    const QRect targetRect(targetTopLeft, target.size());
+    if (targetRect.isEmpty())
+    {
+        return;
+    }
+
+    auto blitTile = [&](int tx, int ty, const QImage& tile)
+    {
+        const QRect tr = tileRect(tx, ty);
+        const QRect part = tr.intersected(targetRect);
+        if (part.isEmpty())
+        {
+            return;
+        }
+        for (int y = part.top(); y <= part.bottom(); ++y)
+        {
+            const QRgb* src = reinterpret_cast<const QRgb*>(tile.constScanLine(y - tr.top()));
+            QRgb* dst = reinterpret_cast<QRgb*>(target.scanLine(y - targetTopLeft.y()));
+            std::memcpy(dst + (part.left() - targetTopLeft.x()),
+                        src + (part.left() - tr.left()),
+                        part.width() * sizeof(QRgb));
+        }
+    };
+
+    // Walk whichever is smaller: the tiles under target, or the stored tiles
+    const QRect range = tileRange(targetRect);
+    if (static_cast<qint64>(range.width()) * range.height() < mTiles.size())
+    {
+        for (int ty = range.top(); ty <= range.bottom(); ++ty)
+        {
+            for (int tx = range.left(); tx <= range.right(); ++tx)
+            {
+                auto it = mTiles.constFind(tileKey(tx, ty));
+                if (it != mTiles.constEnd())
+                {
+                    blitTile(tx, ty, it.value());
+                }
+            }
+        }
+    }
+    else
+    {
+        for (auto it = mTiles.constBegin(); it != mTiles.constEnd(); ++it)
+        {
+            int tx, ty;
+            tileIndex(it.key(), tx, ty);
+            blitTile(tx, ty, it.value());
+        }
+    }
+}
+
+QImage TiledImage::toImage(const QRect& rect) const
+{
+    QImage image(rect.size(), QImage::Format_ARGB32_Premultiplied);
+    if (image.isNull())
+    {
+        return image;
+    }
+    image.fill(Qt::transparent);
+    paintTo(image, rect.topLeft());
+    return image;
+}
+
+/** Returns the part of this image inside rect.
+ *
+ *  Tiles entirely inside rect are shared with the result, not copied.
+ */
+TiledImage TiledImage::copy(const QRect& rect) const
+{
+    TiledImage result;
+    result.mOrigin = mOrigin;
+
+    for (auto it = mTiles.constBegin(); it != mTiles.constEnd(); ++it)
+    {
+        int tx, ty;
+        tileIndex(it.key(), tx, ty);
+
+        const QRect tr = tileRect(tx, ty);
+        if (rect.contains(tr))
+        {
+            result.mTiles.insert(it.key(), it.value());
+            continue;
+        }
+
+        const QRect part = tr.intersected(rect);
+        if (part.isEmpty())
+        {
+            continue;
+        }
+
+        QImage tile = blankTile();
+        for (int y = part.top(); y <= part.bottom(); ++y)
+        {
+            const QRgb* src = reinterpret_cast<const QRgb*>(it.value().constScanLine(y - tr.top()));
+            QRgb* dst = reinterpret_cast<QRgb*>(tile.scanLine(y - tr.top()));
+            std::memcpy(dst + (part.left() - tr.left()),
+                        src + (part.left() - tr.left()),
+                        part.width() * sizeof(QRgb));
+        }
+        if (!isTransparent(tile))
+        {
+            result.mTiles.insert(it.key(), tile);
+        }
+    }
+    return result;
+}
+
+quint64 TiledImage::tileKey(int tx, int ty)
+{
+    return (static_cast<quint64>(static_cast<quint32>(tx)) << 32) | static_cast<quint32>(ty);
+}
+
+void TiledImage::tileIndex(quint64 key, int& tx, int& ty)
+{
+    tx = static_cast<qint32>(static_cast<quint32>(key >> 32));
+    ty = static_cast<qint32>(static_cast<quint32>(key & 0xffffffffu));
+}
+
+int TiledImage::floorDiv(int a, int b)
+{
+    return (a >= 0) ? (a / b) : -((-a + b - 1) / b);
+}
+
+bool TiledImage::isTransparent(const QImage& tile)
+{
+    for (int y = 0; y < tile.height(); ++y)
+    {
+        const QRgb* row = reinterpret_cast<const QRgb*>(tile.constScanLine(y));
+        for (int x = 0; x < tile.width(); ++x)
+        {
+            if (qAlpha(row[x]) != 0)
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+QImage TiledImage::blankTile()
+{
+    QImage tile(TILE_SIZE, TILE_SIZE, QImage::Format_ARGB32_Premultiplied);
+    tile.fill(Qt::transparent);
+    return tile;
+}
+
+QRect TiledImage::tileRect(int tx, int ty) const
+{
+    return QRect(mOrigin.x() + tx * TILE_SIZE, mOrigin.y() + ty * TILE_SIZE, TILE_SIZE, TILE_SIZE);
+}
+
+/** Returns the indices of the tiles overlapping rect, as a rectangle in tile space. */
+QRect TiledImage::tileRange(const QRect& rect) const
+{
+    if (rect.isEmpty())
+    {
+        return QRect();
+    }
+    const int left = floorDiv(rect.left() - mOrigin.x(), TILE_SIZE);
+    const int top = floorDiv(rect.top() - mOrigin.y(), TILE_SIZE);
+    const int right = floorDiv(rect.right() - mOrigin.x(), TILE_SIZE);
+    const int bottom = floorDiv(rect.bottom() - mOrigin.y(), TILE_SIZE);
+    return QRect(QPoint(left, top), QPoint(right, bottom));
+}
@@ -0,0 +1,75 @@
+/*
+
+Pencil - Traditional Animation Software
+Copyright (C) 2012-2018 Matthew Chiawen Chang
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+*/
+#ifndef TILEDIMAGE_H
+#define TILEDIMAGE_H
+
+#include <QHash>
+#include <QImage>
+#include <QRect>
+
+
+/** Sparse, copy-on-write tile storage for bitmap key frames.
+ *
+ *  The picture is cut into TILE_SIZE x TILE_SIZE premultiplied ARGB tiles
+ *  laid on a grid anchored at origin(). Tiles are implicitly shared QImages,
+ *  so copying a TiledImage only bumps reference counts, and a tile is duplicated
+ *  the first time one of the copies writes to it.
+ *  Fully transparent tiles are never stored.
+ *
+ *  All rectangles and points are given in canvas coordinates.
+ */
+class TiledImage
+{
+public:
+    static const int TILE_SIZE = 64;
+
+    TiledImage();
+
+    bool isEmpty() const { return mTiles.isEmpty(); }
+    int tileCount() const { return mTiles.size(); }
+    qint64 byteSize() const;
+    qint64 unsharedByteSize() const;
+
+    QPoint origin() const { return mOrigin; }
+    void translate(const QPoint& offset) { mOrigin += offset; }
+    QRect boundingRect() const;
+
+    QRgb pixel(int x, int y) const;
+
+    void clear();
+    void clear(const QRect& rect);
+    void crop(const QRect& rect);
+
+    void store(const QImage& source, const QPoint& sourceTopLeft, const QRect& rect);
+    void paintTo(QImage& target, const QPoint& targetTopLeft) const;
+    QImage toImage(const QRect& rect) const;
+    TiledImage copy(const QRect& rect) const;
+
+private:
+    static quint64 tileKey(int tx, int ty);
+    static void tileIndex(quint64 key, int& tx, int& ty);
+    static int floorDiv(int a, int b);
+    static bool isTransparent(const QImage& tile);
+    static QImage blankTile();
+
+    QRect tileRect(int tx, int ty) const;
+    QRect tileRange(const QRect& rect) const;
+
+    QHash<quint64, QImage> mTiles;
+    QPoint mOrigin;
+};
+
+#endif // TILEDIMAGE_H
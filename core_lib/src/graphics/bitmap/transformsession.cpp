@@ -0,0 +1,171 @@
+/*
+
+Pencil - Traditional Animation Software
+Copyright (C) 2012-2018 Matthew Chiawen Chang
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+*/
+#include "transformsession.h"
+
+#include <cmath>
+#include <QPainter>
+#include "bitmapimage.h"
+#include "pixelkernels.h"
+
+
+namespace
+{
+    inline QRgb pixelAt(const QImage& image, int x, int y)
+    {
+        if (x < 0 || y < 0 || x >= image.width() || y >= image.height())
+        {
+            return 0;
+        }
+        return reinterpret_cast<const QRgb*>(image.constScanLine(y))[x];
+    }
+
+    /** Fixed point with 16 fractional bits */
+    inline qint64 toFixed(qreal value)
+    {
+        return static_cast<qint64>(std::floor(value * 65536.0));
+    }
+}
+
+/** Copies the selected pixels of image, and forgets the previous session. */
+void TransformSession::begin(BitmapImage* image, const QRect& selection)
+{
+    end();
+    if (image == nullptr || selection.isEmpty())
+    {
+        return;
+    }
+
+    BitmapImage selectedPart = image->copy(selection);
+    mPixels = selectedPart.image()->convertToFormat(QImage::Format_ARGB32_Premultiplied);
+
+    mImage = image;
+    mImageKey = image->image()->cacheKey();
+    mSelection = selection;
+}
+
+void TransformSession::end()
+{
+    mImage = nullptr;
+    mImageKey = 0;
+    mSelection = QRect();
+    mPixels = QImage();
+    mMipmaps.clear();
+}
+
+/** Whether the session holds the pixels of selection in image as they are now */
+bool TransformSession::isActiveFor(BitmapImage* image, const QRect& selection) const
+{
+    return mImage != nullptr
+        && mImage == image
+        && mSelection == selection
+        && mImageKey == image->image()->cacheKey();
+}
+
+/** Paints the selection through transform, only where it meets visibleRect.
+ *
+ *  @param painter Paints in canvas coordinates
+ *  @param transform Maps the selection to where it is being dragged, in canvas coordinates
+ *  @param visibleRect The part of the canvas being painted
+ *  @param viewScale Screen pixels per canvas pixel, the preview is not rendered finer than that
+ *  @param bilinear Filters the preview, otherwise the nearest pixel is taken
+ */
+void TransformSession::paintPreview(QPainter& painter, const QTransform& transform, const QRect& visibleRect,
+                                    qreal viewScale, bool bilinear)
+{
+    if (!isActive() || mPixels.isNull() || !transform.isInvertible())
+    {
+        return;
+    }
+
+    const QRect target = transform.mapRect(QRectF(mSelection)).toAlignedRect().intersected(visibleRect);
+    if (target.isEmpty())
+    {
+        return;
+    }
+
+    // Zoomed out, the preview has one pixel per screen pixel rather than per canvas pixel
+    const int targetFactor = 1 << MipmapPyramid::levelForScale(viewScale);
+    const QSize targetSize((target.width() + targetFactor - 1) / targetFactor,
+                           (target.height() + targetFactor - 1) / targetFactor);
+
+    // Shrunk, the selection is read from the mipmap level closest to the screen resolution
+    const qreal transformScale = std::sqrt(std::abs(transform.determinant()));
+    const QImage source = mMipmaps.level(mPixels, MipmapPyramid::levelForScale(transformScale * viewScale));
+    int sourceFactor = 1;
+    for (int width = mPixels.width(); width > source.width(); width = (width + 1) / 2)
+    {
+        sourceFactor *= 2;
+    }
+
+    const QTransform targetToSource = QTransform::fromScale(targetFactor, targetFactor)
+        * QTransform::fromTranslate(target.left(), target.top())
+        * transform.inverted()
+        * QTransform::fromTranslate(-mSelection.left(), -mSelection.top())
+        * QTransform::fromScale(1.0 / sourceFactor, 1.0 / sourceFactor);
+
+    QImage preview(targetSize, QImage::Format_ARGB32_Premultiplied);
+    resample(source, targetToSource, preview, bilinear);
+
+    painter.save();
+    painter.setRenderHint(QPainter::SmoothPixmapTransform, targetFactor > 1);
+    painter.drawImage(QRectF(target.topLeft(), QSizeF(targetSize) * targetFactor), preview);
+    painter.restore();
+}
+
+/** Fills target with source seen through an affine map.
+ *
+ *  @param source A premultiplied ARGB32 image
+ *  @param targetToSource Maps target pixel coordinates to source pixel coordinates
+ *  @param target A premultiplied ARGB32 image, every pixel is written
+ *  @param bilinear Interpolates between the four nearest source pixels,
+ *                  otherwise the source pixel under each target pixel centre is taken
+ *
+ *  Outside of source counts as transparent. The map is affine, so the source position
+ *  moves by the same step from one target pixel to the next along a row.
+ */
+void TransformSession::resample(const QImage& source, const QTransform& targetToSource, QImage& target, bool bilinear)
+{
+    const qint64 du = toFixed(targetToSource.m11());
+    const qint64 dv = toFixed(targetToSource.m12());
+
+    // Bilinear weights are measured from the pixel centres
+    const qreal centre = bilinear ? 0.5 : 0.0;
+
+    for (int y = 0; y < target.height(); ++y)
+    {
+        QRgb* row = reinterpret_cast<QRgb*>(target.scanLine(y));
+        const QPointF start = targetToSource.map(QPointF(0.5, y + 0.5));
+        qint64 u = toFixed(start.x() - centre);
+        qint64 v = toFixed(start.y() - centre);
+
+        for (int x = 0; x < target.width(); ++x, u += du, v += dv)
+        {
+            const int sx = static_cast<int>(u >> 16);
+            const int sy = static_cast<int>(v >> 16);
+            if (!bilinear)
+            {
+                row[x] = pixelAt(source, sx, sy);
+                continue;
+            }
+
+            const quint32 tx = static_cast<quint32>((u >> 8) & 0xff);
+            const quint32 ty = static_cast<quint32>((v >> 8) & 0xff);
+            const QRgb top = PixelKernels::interpolate(pixelAt(source, sx, sy), pixelAt(source, sx + 1, sy), tx);
+            const QRgb bottom = PixelKernels::interpolate(pixelAt(source, sx, sy + 1), pixelAt(source, sx + 1, sy + 1), tx);
+            row[x] = PixelKernels::interpolate(top, bottom, ty);
+        }
+    }
+}
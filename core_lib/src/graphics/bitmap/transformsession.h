@@ -0,0 +1,57 @@
+/*
+
+Pencil - Traditional Animation Software
+Copyright (C) 2012-2018 Matthew Chiawen Chang
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+*/
+#ifndef TRANSFORMSESSION_H
+#define TRANSFORMSESSION_H
+
+#include <QImage>
+#include <QRect>
+#include <QTransform>
+#include "mipmappyramid.h"
+
+class QPainter;
+class BitmapImage;
+
+
+/** The pixels of a bitmap selection being moved, rotated or scaled.
+ *
+ *  begin() copies the selected pixels once. Each preview is then resampled from
+ *  that copy, or from one of its mipmap levels when the selection is shrunk,
+ *  with a nearest or bilinear affine loop that only fills the visible part of
+ *  the transformed selection. The smooth resample is left to the commit.
+ */
+class TransformSession
+{
+public:
+    void begin(BitmapImage* image, const QRect& selection);
+    void end();
+
+    bool isActive() const { return mImage != nullptr; }
+    bool isActiveFor(BitmapImage* image, const QRect& selection) const;
+
+    void paintPreview(QPainter& painter, const QTransform& transform, const QRect& visibleRect,
+                      qreal viewScale, bool bilinear);
+
+    static void resample(const QImage& source, const QTransform& targetToSource, QImage& target, bool bilinear);
+
+private:
+    BitmapImage* mImage = nullptr;
+    qint64 mImageKey = 0;
+    QRect mSelection;
+    QImage mPixels;
+    MipmapPyramid mMipmaps;
+};
+
+#endif // TRANSFORMSESSION_H
@@ -103,3 +103,60 @@ void BezierArea::loadDomElement(QDomElement element)
         vertexTag = vertexTag.nextSibling();
     }
 }
+
+/** Reads the area element the reader is on, and leaves the reader at its end */
+void BezierArea::loadDomElement(QXmlStreamReader& xmlReader)
+{
+    mColourNumber = xmlReader.attributes().value("colourNumber").toInt();
+
+    while (xmlReader.readNextStartElement())
+    {
+        if (xmlReader.name() == QLatin1String("vertex"))
+        {
+            const QXmlStreamAttributes attributes = xmlReader.attributes();
+            mVertex.append(VertexRef(attributes.value("curve").toInt(), attributes.value("vertex").toInt()));
+        }
+        xmlReader.skipCurrentElement();
+    }
+}
+
+/** Writes the colour, the flags and the vertex references of the area. The selection is not saved. */
+void BezierArea::writeBinary(QDataStream& stream) const
+{
+    const quint8 flags = (mIsFilled ? 1 : 0);
+    stream << static_cast<qint32>(mColourNumber) << flags << static_cast<quint32>(mVertex.size());
+    for (const VertexRef& vertexRef : mVertex)
+    {
+        stream << static_cast<qint32>(vertexRef.curveNumber) << static_cast<qint32>(vertexRef.vertexNumber);
+    }
+}
+
+/** Reads an area written by writeBinary(), returns false if the data is cut short.
+ *  The area is read unselected.
+ */
+bool BezierArea::readBinary(QDataStream& stream)
+{
+    qint32 colour = 0;
+    quint8 flags = 0;
+    quint32 count = 0;
+    stream >> colour >> flags >> count;
+    if (stream.status() != QDataStream::Ok || count > stream.device()->bytesAvailable() / (2 * sizeof(qint32)))
+    {
+        return false;
+    }
+
+    mColourNumber = colour;
+    mIsFilled = (flags & 1) != 0;
+    mSelected = false;
+
+    mVertex.clear();
+    mVertex.reserve(static_cast<int>(count));
+    for (quint32 i = 0; i < count; i++)
+    {
+        qint32 curveNumber = 0;
+        qint32 vertexNumber = 0;
+        stream >> curveNumber >> vertexNumber;
+        mVertex.append(VertexRef(curveNumber, vertexNumber));
+    }
+    return stream.status() == QDataStream::Ok;
+}
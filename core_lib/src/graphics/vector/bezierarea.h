@@ -20,6 +20,7 @@ GNU General Public License for more details.
 
 #include <QtXml>
 #include <QPainterPath>
+#include <QDataStream>
 
 #include "vertexref.h"
 
@@ -33,6 +34,9 @@ public:
 
     Status createDomElement(QXmlStreamWriter& xmlStream);
     void loadDomElement(QDomElement element);
+    void loadDomElement(QXmlStreamReader& xmlReader);
+    void writeBinary(QDataStream& stream) const;
+    bool readBinary(QDataStream& stream);
 
     VertexRef getVertexRef(int i);
     int getColourNumber() { return mColourNumber; }
@@ -173,6 +173,127 @@ void BezierCurve::loadDomElement(QDomElement element)
     }
 }
 
+/** Reads the curve element the reader is on, and leaves the reader at its end */
+void BezierCurve::loadDomElement(QXmlStreamReader& xmlReader)
+{
+    const QXmlStreamAttributes attributes = xmlReader.attributes();
+    auto isTrue = [&attributes](const QString& name)
+    {
+        const QStringRef value = attributes.value(name);
+        return (value == "1") || (value == "true");
+    };
+
+    width = attributes.value("width").toDouble();
+    variableWidth = isTrue("variableWidth");
+    feather = attributes.value("feather").toDouble();
+    invisible = isTrue("invisible");
+    mFilled = isTrue("filled");
+    if (width == 0) invisible = true;
+
+    colourNumber = attributes.value("colourNumber").toInt();
+    origin = QPointF(attributes.value("originX").toFloat(), attributes.value("originY").toFloat());
+    pressure.append(attributes.value("originPressure").toFloat());
+    selected.append(false);
+
+    while (xmlReader.readNextStartElement())
+    {
+        if (xmlReader.name() == QLatin1String("segment"))
+        {
+            const QXmlStreamAttributes segment = xmlReader.attributes();
+            QPointF c1Point = QPointF(segment.value("c1x").toFloat(), segment.value("c1y").toFloat());
+            QPointF c2Point = QPointF(segment.value("c2x").toFloat(), segment.value("c2y").toFloat());
+            QPointF vertexPoint = QPointF(segment.value("vx").toFloat(), segment.value("vy").toFloat());
+            qreal pressureValue = segment.value("pressure").toFloat();
+            appendCubic(c1Point, c2Point, vertexPoint, pressureValue);
+        }
+        xmlReader.skipCurrentElement();
+    }
+}
+
+/** Writes the curve as packed arrays: c1, c2 and the vertices as x, y float pairs,
+ *  then the pressures, the origin first. The selection is not saved.
+ */
+void BezierCurve::writeBinary(QDataStream& stream) const
+{
+    const quint8 flags = (variableWidth ? 1 : 0) | (invisible ? 2 : 0) | (mFilled ? 4 : 0);
+    stream << width << feather << static_cast<qint32>(colourNumber) << flags;
+    stream << static_cast<float>(origin.x()) << static_cast<float>(origin.y());
+
+    stream << static_cast<quint32>(vertex.size());
+    for (const QList<QPointF>* points : { &c1, &c2, &vertex })
+    {
+        for (const QPointF& point : *points)
+        {
+            stream << static_cast<float>(point.x()) << static_cast<float>(point.y());
+        }
+    }
+    for (float pointPressure : pressure)
+    {
+        stream << pointPressure;
+    }
+}
+
+/** Reads a curve written by writeBinary(), returns false if the data is cut short or inconsistent.
+ *  Every point is read unselected.
+ */
+bool BezierCurve::readBinary(QDataStream& stream)
+{
+    qint32 colour = 0;
+    quint8 flags = 0;
+    float originX = 0.f;
+    float originY = 0.f;
+    quint32 count = 0;
+    stream >> width >> feather >> colour >> flags >> originX >> originY >> count;
+
+    // Each segment takes 7 floats at least, so a bad count is caught before allocating for it
+    if (stream.status() != QDataStream::Ok || count > stream.device()->bytesAvailable() / (7 * sizeof(float)))
+    {
+        return false;
+    }
+
+    colourNumber = colour;
+    variableWidth = (flags & 1) != 0;
+    invisible = (flags & 2) != 0;
+    mFilled = (flags & 4) != 0;
+    origin = QPointF(originX, originY);
+
+    const int size = static_cast<int>(count);
+    for (QList<QPointF>* points : { &c1, &c2, &vertex })
+    {
+        points->clear();
+        points->reserve(size);
+        for (int i = 0; i < size; i++)
+        {
+            float x = 0.f;
+            float y = 0.f;
+            stream >> x >> y;
+            points->append(QPointF(x, y));
+        }
+    }
+
+    pressure.clear();
+    pressure.reserve(size + 1);
+    for (int i = 0; i <= size; i++)
+    {
+        float pointPressure = 0.f;
+        stream >> pointPressure;
+        pressure.append(pointPressure);
+    }
+
+    if (stream.status() != QDataStream::Ok)
+    {
+        return false;
+    }
+
+    selected.clear();
+    selected.reserve(size + 1);
+    for (int i = 0; i <= size; i++)
+    {
+        selected.append(false);
+    }
+    return true;
+}
+
 
 void BezierCurve::setOrigin(const QPointF& point)
 {
@@ -427,17 +548,32 @@ void BezierCurve::removeVertex(int i)
 
 void BezierCurve::drawPath(QPainter& painter, Object* object, QTransform transformation, bool simplified, bool showThinLines )
 {
-    QColor colour = object->getColour(colourNumber).colour;
-
     BezierCurve myCurve;
     if (isPartlySelected()) { myCurve = (transformed(transformation)); }
     else { myCurve = *this; }
 
+    QPainterPath strokedPath;
+    if ( variableWidth && !simplified && !invisible)
+    {
+        strokedPath = myCurve.getStrokedPath();
+    }
+    drawPath(painter, object, myCurve.getSimplePath(), strokedPath, simplified, showThinLines);
+}
+
+/** Draws the curve from paths computed beforehand.
+ *
+ *  @param simplePath The curve as returned by getSimplePath(), transformed if it is selected
+ *  @param strokedPath The same for getStrokedPath(), only used for visible variable width curves
+ */
+void BezierCurve::drawPath(QPainter& painter, Object* object, const QPainterPath& simplePath, const QPainterPath& strokedPath, bool simplified, bool showThinLines ) const
+{
+    QColor colour = object->getColour(colourNumber).colour;
+
     if ( variableWidth && !simplified && !invisible)
     {
         painter.setPen(QPen(QBrush(colour), 1, Qt::NoPen, Qt::RoundCap,Qt::RoundJoin));
         painter.setBrush(colour);
-        painter.drawPath(myCurve.getStrokedPath());
+        painter.drawPath(strokedPath);
     }
     else
     {
@@ -474,8 +610,7 @@ void BezierCurve::drawPath(QPainter& painter, Object* object, QTransform transfo
             painter.setPen( QPen( QBrush( colour ), renderedWidth, Qt::SolidLine, Qt::RoundCap, Qt::RoundJoin ) );
             //painter.setPen( QPen( Qt::darkYellow , 5, Qt::SolidLine, Qt::RoundCap, Qt::RoundJoin ) );
         }
-        QPainterPath path = myCurve.getSimplePath();
-        painter.drawPath( path );
+        painter.drawPath( simplePath );
     }
 
     if (!simplified)
@@ -486,26 +621,7 @@ void BezierCurve::drawPath(QPainter& painter, Object* object, QTransform transfo
         qreal lineWidth = 1.5/painter.matrix().m11();
         lineWidth = fabs(lineWidth); // make sure line width is positive, otherwise nothing is drawn
         painter.setPen(QPen(QBrush(colour), lineWidth, Qt::SolidLine, Qt::RoundCap,Qt::RoundJoin));
-        if (isSelected()) painter.drawPath(myCurve.getSimplePath());
-
-
-        for(int i=-1; i< vertex.size(); i++)
-        {
-            if (isSelected(i))
-            {
-//                painter.fillRect(myCurve.getVertex(i).x()-0.5*squareWidth, myCurve.getVertex(i).y()-0.5*squareWidth, squareWidth, squareWidth, colour);
-
-                //painter.fillRect(QRectF(myCurve.getVertex(i).x()-0.5*squareWidth, myCurve.getVertex(i).y()-0.5*squareWidth, squareWidth, squareWidth), colour);
-
-                /*painter.drawText(myCurve.getVertex(i)+QPointF(4.0,0.0), QString::number(i)+"-"+QString::number(myCurve.getVertex(i).x())+","+QString::number(myCurve.getVertex(i).y()));
-                QPointF normale = QPointF(4.0, 0.0);
-                if (i>-1) { normale = (myCurve.getVertex(i)-myCurve.getC2(i)); } else { normale = (myCurve.getC1(i+1)-myCurve.getVertex(i)); }
-                normale = QPointF(-normale.y(), normale.x());
-                normale = 8.0*normale/eLength(normale)/painter.matrix().m11();
-                painter.drawLine(myCurve.getVertex(i), myCurve.getVertex(i)+normale);
-                painter.drawText(myCurve.getVertex(i)+2*normale, QString::number(i));*/
-            }
-        }
+        if (isSelected()) painter.drawPath(simplePath);
     }
 }
 
@@ -18,6 +18,7 @@ GNU General Public License for more details.
 
 #include <QtXml>
 #include <QPainter>
+#include <QDataStream>
 
 class Object;
 class Status;
@@ -38,6 +39,9 @@ public:
 
     Status createDomElement(QXmlStreamWriter &xmlStream);
     void loadDomElement(QDomElement element);
+    void loadDomElement(QXmlStreamReader& xmlReader);
+    void writeBinary(QDataStream& stream) const;
+    bool readBinary(QDataStream& stream);
 
     qreal getWidth() const { return width; }
     qreal getFeather() const { return feather; }
@@ -89,6 +93,7 @@ public:
     QRectF getBoundingRect();
 
     void drawPath(QPainter& painter, Object* object, QTransform transformation, bool simplified, bool showThinLines );
+    void drawPath(QPainter& painter, Object* object, const QPainterPath& simplePath, const QPainterPath& strokedPath, bool simplified, bool showThinLines ) const;
     void createCurve(const QList<QPointF>& pointList, const QList<qreal>& pressureList , bool smooth);
     void smoothCurve();
 
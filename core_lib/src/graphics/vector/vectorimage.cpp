@@ -16,26 +16,99 @@ GNU General Public License for more details.
 */
 #include "vectorimage.h"
 
+#include <algorithm>
 #include <cmath>
-#include <QImage>
+#include <QMutex>
+#include <QPainter>
+#include <QDataStream>
+#include <QXmlStreamReader>
 #include "object.h"
 
 
+namespace
+{
+    /** Bytes of rasterized() images kept over all the vector frames */
+    const qint64 RASTER_CACHE_BUDGET = 256 * 1024 * 1024;
+
+    QMutex rasterCacheMutex;
+    QList<VectorImage*> rasterCacheOrder; //< the images holding a raster, least recently painted first
+    qint64 rasterCacheBytes = 0;
+
+    enum RasterFlag
+    {
+        RASTER_SIMPLIFIED = 1,
+        RASTER_THIN_CURVES = 2,
+        RASTER_ANTIALIASING = 4
+    };
+
+    /** The first bytes of a file written in the binary format */
+    const char BINARY_MAGIC[] = "PVEC";
+    const int BINARY_MAGIC_SIZE = 4;
+    /** Raised whenever the binary layout changes, files of a later version are not read */
+    const quint16 BINARY_VERSION = 1;
+
+    void setUpBinaryStream(QDataStream& stream)
+    {
+        stream.setVersion(QDataStream::Qt_5_0);
+        stream.setByteOrder(QDataStream::LittleEndian);
+        stream.setFloatingPointPrecision(QDataStream::SinglePrecision);
+    }
+}
+
+
 VectorImage::VectorImage()
 {
     deselectAll();
 }
 
+/** Creates a key frame whose curves stay in filePath until loadFile() */
+VectorImage::VectorImage(const QString& filePath)
+{
+    deselectAll();
+    setFileName(filePath);
+    setModified(false);
+    mLoaded = false;
+}
+
 VectorImage::VectorImage(const VectorImage& v2) : KeyFrame(v2)
 {
     deselectAll();
     mObject = v2.mObject;
     mCurves = v2.mCurves;
     mArea = v2.mArea;
+    mLoaded = v2.mLoaded;
 }
 
 VectorImage::~VectorImage()
 {
+    clearPaintCache();
+}
+
+/**
+ * @brief VectorImage::operator =
+ * Copies the curves, the areas and the selection. The paint caches and the
+ * spatial index belong to each image and are rebuilt when needed.
+ */
+VectorImage& VectorImage::operator=(const VectorImage& v2)
+{
+    if (this == &v2)
+    {
+        return *this;
+    }
+
+    KeyFrame::operator=(v2);
+    mObject = v2.mObject;
+    mCurves = v2.mCurves;
+    mArea = v2.mArea;
+    mSelectionRect = v2.mSelectionRect;
+    mSelectionTransformation = v2.mSelectionTransformation;
+    mSize = v2.mSize;
+    mLoaded = v2.mLoaded;
+
+    clearPaintCache();
+    mIndex.invalidateCurves();
+    mIndex.invalidateAreas();
+    return *this;
 }
 
 VectorImage* VectorImage::clone()
@@ -43,8 +116,85 @@ VectorImage* VectorImage::clone()
     return new VectorImage(*this);
 }
 
+void VectorImage::modification()
+{
+    clearPaintCache();
+    KeyFrame::modification();
+}
+
+/**
+ * @brief VectorImage::loadFile
+ * Reads the curves of a key frame created from a file, or unloaded since
+ */
+void VectorImage::loadFile()
+{
+    if (mLoaded)
+    {
+        return;
+    }
+    mLoaded = true;
+
+    if (!read(fileName()))
+    {
+        qDebug() << "VectorImage - Cannot read file" << fileName();
+    }
+    setModified(false);
+}
+
+/**
+ * @brief VectorImage::unloadFile
+ * Releases what paintImage() and rasterized() keep. The curves are released too
+ * when they are the same as in the file, and read again by the next loadFile().
+ */
+void VectorImage::unloadFile()
+{
+    clearPaintCache();
+    if (!mLoaded || isModified() || fileName().isEmpty() || !QFile::exists(fileName()))
+    {
+        return;
+    }
+
+    mCurves.clear();
+    mArea.clear();
+    mCurveDisplayOrders.clear();
+    mIndex = VectorSpatialIndex();
+    deselectAll();
+    mSelectionTransformation.reset();
+    mLoaded = false;
+}
+
+/**
+ * @brief VectorImage::memoryUsage
+ * @return an estimate of the bytes held by the curves, the areas and the paint cache
+ */
+qint64 VectorImage::memoryUsage()
+{
+    // QList keeps a pointer per item and allocates the items larger than a pointer separately
+    const qint64 pointBytes = sizeof(void*) + sizeof(QPointF);
+    const qint64 slotBytes = sizeof(void*);
+    const qint64 pathElementBytes = sizeof(QPainterPath::Element);
+
+    qint64 bytes = 0;
+    for (const BezierCurve& curve : mCurves)
+    {
+        bytes += sizeof(BezierCurve) + curve.getVertexSize() * (3 * pointBytes + 2 * slotBytes);
+    }
+    for (const BezierArea& area : mArea)
+    {
+        bytes += sizeof(BezierArea) + area.mVertex.size() * (slotBytes + sizeof(VertexRef));
+        bytes += area.mPath.elementCount() * pathElementBytes;
+    }
+    for (const CurvePaths& paths : mCurvePaths)
+    {
+        bytes += (paths.simple.elementCount() + paths.stroked.elementCount()) * pathElementBytes;
+    }
+    bytes += mRaster.byteCount();
+    return bytes;
+}
+
 /**
  * @brief VectorImage::read
+ * Reads either format written by write(), told apart by the first bytes of the file
  * @return True if file was read successfully from path
  */
 bool VectorImage::read(QString filePath)
@@ -61,18 +211,11 @@ bool VectorImage::read(QString filePath)
         return false;
     }
 
-    QDomDocument doc;
-    if (!doc.setContent(&file)) return false; // this is not a XML file
-    QDomDocumentType type = doc.doctype();
-    if (type.name() != "PencilVectorImage") return false; // this is not a Pencil document
-
-    QDomElement element = doc.documentElement();
-    if (element.tagName() == "image")
+    const bool isBinary = (file.peek(BINARY_MAGIC_SIZE) == QByteArray::fromRawData(BINARY_MAGIC, BINARY_MAGIC_SIZE));
+    const bool ok = (isBinary) ? readBinary(&file) : readXml(&file);
+    if (!ok)
     {
-        if (element.attribute("type") == "vector")
-        {
-            loadDomElement(element);
-        }
+        return false;
     }
 
     setFileName(filePath);
@@ -80,14 +223,122 @@ bool VectorImage::read(QString filePath)
     return true;
 }
 
+/**
+ * @brief VectorImage::readXml
+ * Reads the XML as it goes, the curves are built without a document in between
+ * @return True if device held a Pencil vector image
+ */
+bool VectorImage::readXml(QIODevice* device)
+{
+    QXmlStreamReader xmlReader(device);
+    bool isPencilDocument = false;
+    while (!xmlReader.atEnd() && !xmlReader.isStartElement())
+    {
+        xmlReader.readNext();
+        if (xmlReader.isDTD())
+        {
+            isPencilDocument = (xmlReader.dtdName() == QLatin1String("PencilVectorImage"));
+        }
+    }
+    if (xmlReader.hasError()) return false; // this is not a XML file
+    if (!isPencilDocument) return false; // this is not a Pencil document
+
+    if (xmlReader.name() == QLatin1String("image"))
+    {
+        if (xmlReader.attributes().value("type") == QLatin1String("vector"))
+        {
+            loadDomElement(xmlReader);
+        }
+    }
+    return !xmlReader.hasError();
+}
+
+/**
+ * @brief VectorImage::readBinary
+ * Reads the format written by writeBinary()
+ * @return True if device held a complete image of a version this build knows
+ */
+bool VectorImage::readBinary(QIODevice* device)
+{
+    QDataStream stream(device);
+    setUpBinaryStream(stream);
+
+    QByteArray magic(BINARY_MAGIC_SIZE, 0);
+    quint16 version = 0;
+    stream.readRawData(magic.data(), BINARY_MAGIC_SIZE);
+    stream >> version;
+    if (stream.status() != QDataStream::Ok
+        || magic != QByteArray::fromRawData(BINARY_MAGIC, BINARY_MAGIC_SIZE)
+        || version > BINARY_VERSION)
+    {
+        return false;
+    }
+
+    quint32 curveCount = 0;
+    stream >> curveCount;
+    for (quint32 i = 0; i < curveCount; i++)
+    {
+        BezierCurve newCurve;
+        if (!newCurve.readBinary(stream))
+        {
+            return false;
+        }
+        mCurves.append(newCurve);
+    }
+
+    quint32 areaCount = 0;
+    stream >> areaCount;
+    for (quint32 i = 0; i < areaCount; i++)
+    {
+        BezierArea newArea;
+        if (!newArea.readBinary(stream))
+        {
+            return false;
+        }
+        addArea(newArea);
+    }
+    clean();
+    return stream.status() == QDataStream::Ok;
+}
+
+/**
+ * @brief VectorImage::writeBinary
+ * Writes "PVEC", the format version, then the curves and the areas, each preceded by their number.
+ * See BezierCurve::writeBinary() and BezierArea::writeBinary() for the layout of each one.
+ * @return True if everything was written
+ */
+bool VectorImage::writeBinary(QIODevice* device)
+{
+    QDataStream stream(device);
+    setUpBinaryStream(stream);
+
+    stream.writeRawData(BINARY_MAGIC, BINARY_MAGIC_SIZE);
+    stream << BINARY_VERSION;
+
+    stream << static_cast<quint32>(mCurves.size());
+    for (const BezierCurve& curve : mCurves)
+    {
+        curve.writeBinary(stream);
+    }
+    stream << static_cast<quint32>(mArea.size());
+    for (const BezierArea& area : mArea)
+    {
+        area.writeBinary(stream);
+    }
+    return stream.status() == QDataStream::Ok;
+}
+
 /**
  * @brief VectorImage::write
  * @param filePath: QString
- * @param format: QString of the file format
+ * @param format: QString of the file format, "VEC" for XML or "VECB" for the compact binary encoding
  * @return Status
  */
 Status VectorImage::write(QString filePath, QString format)
 {
+    // Before the file is opened, it may be the one the curves are still in
+    loadFile();
+
     DebugDetails debugInfo;
     debugInfo << "VectorImage::write";
     debugInfo << QString("filePath = ").append(filePath);
@@ -102,6 +353,17 @@ Status VectorImage::write(QString filePath, QString format)
         return Status(Status::FAIL, debugInfo);
     }
 
+    if (format == "VECB")
+    {
+        if (!writeBinary(&file))
+        {
+            debugInfo << "- binary writing failed";
+            return Status(Status::FAIL, debugInfo);
+        }
+        setFileName(filePath);
+        return Status::OK;
+    }
+
     if (format != "VEC")
     {
         debugInfo << "Unrecognized format";
@@ -193,8 +455,39 @@ void VectorImage::loadDomElement(QDomElement element)
     clean();
 }
 
+/**
+ * @brief VectorImage::loadDomElement
+ * @param xmlReader: QXmlStreamReader on the image element, left at its end
+ */
+void VectorImage::loadDomElement(QXmlStreamReader& xmlReader)
+{
+    while (xmlReader.readNextStartElement()) // an atom in a vector picture is a curve or an area
+    {
+        if (xmlReader.name() == QLatin1String("curve"))
+        {
+            BezierCurve newCurve;
+            newCurve.loadDomElement(xmlReader);
+            mCurves.append(newCurve);
+        }
+        else if (xmlReader.name() == QLatin1String("area"))
+        {
+            BezierArea newArea;
+            newArea.loadDomElement(xmlReader);
+            addArea(newArea);
+        }
+        else
+        {
+            xmlReader.skipCurrentElement();
+        }
+    }
+    clean();
+}
+
 BezierCurve& VectorImage::curve(int i)
 {
+    // The caller may reshape the curve through the reference
+    mIndex.invalidateCurves();
+    clearPaintCache();
     return mCurves[i];
 }
 
@@ -207,6 +500,7 @@ BezierCurve& VectorImage::curve(int i)
 void VectorImage::addPoint(int curveNumber, int vertexNumber, qreal fraction)
 {
     mCurves[curveNumber].addPoint(vertexNumber, fraction);
+    mIndex.setCurve(curveNumber, mCurves.at(curveNumber));
     // updates the bezierAreas
     for (int j = 0; j < mArea.size(); j++)
     {
@@ -259,6 +553,7 @@ void VectorImage::removeCurveAt(int i)
     }
     // then remove curve
     mCurves.removeAt(i);
+    mIndex.invalidateCurves();
     modification();
 }
 
@@ -290,6 +585,7 @@ void VectorImage::insertCurve(int position, BezierCurve& newCurve, qreal factor,
     if (position < 0 || position > mCurves.size() - 1)
     {
         mCurves.append(newCurve);
+        mIndex.setCurve(mCurves.size() - 1, newCurve);
     }
     else
     {
@@ -304,6 +600,7 @@ void VectorImage::insertCurve(int position, BezierCurve& newCurve, qreal factor,
             }
         }
         mCurves.insert(position, newCurve);
+        mIndex.invalidateCurves();
     }
     updateImageSize(newCurve);
     modification();
@@ -336,7 +633,16 @@ void VectorImage::checkCurveExtremity(BezierCurve& newCurve, qreal tolerance)
     }
 
     // finds if the first or last point of the new curve is close to other curves
-    for (int i = 0; i < mCurves.size(); i++)   // for each other curve
+    // only the curves passing within the tolerance of an end point can move it
+    auto nextCurveNearEnds = [&](int from)
+    {
+        const QPointF margin(tolerance + 1, tolerance + 1);
+        const QPointF first = newCurve.getVertex(-1);
+        const QPointF last = newCurve.getVertex(newCurve.getVertexSize() - 1);
+        return qMin(nextCurveNear(QRectF(first - margin, first + margin), from),
+                    nextCurveNear(QRectF(last - margin, last + margin), from));
+    };
+    for (int i = nextCurveNearEnds(0); i < mCurves.size(); i = nextCurveNearEnds(i + 1))   // for each other curve
     {
         for (int j = 0; j < mCurves.at(i).getVertexSize(); j++)   // for each cubic section of the other curve
         {
@@ -441,7 +747,13 @@ void VectorImage::checkCurveIntersections(BezierCurve& newCurve, qreal tolerance
         //if (k==newCurve.getVertexSize()-1) L1 = QLineF(P1, Q1- 1.5*tol*(P1-Q1)/BezierCurve::eLength(P1-Q1));  // we extend slightly the line for the last point
         //QPointF extension1 = 1.5*tol*(P1-Q1)/BezierCurve::eLength(P1-Q1);
         //L1 = QLineF(P1 + extension1, Q1 - extension1);
-        for (int i = 0; i < mCurves.size(); i++)   // for each other curve // TO DO: should only loop on "nearby" curves instead of all
+        // only the curves passing within the tolerance of the section can touch it
+        auto nextCurveNearSection = [&](int from)
+        {
+            const QRectF bounds = VectorSpatialIndex::segmentBounds(newCurve, k);
+            return nextCurveNear(bounds.adjusted(-tolerance, -tolerance, tolerance, tolerance), from);
+        };
+        for (int i = nextCurveNearSection(0); i < mCurves.size(); i = nextCurveNearSection(i + 1))   // for each other curve nearby
         {
             // ---- finds if the first or last point of the other curve is close to the current cubic section of the new curve
             QPointF P = mCurves.at(i).getVertex(-1);
@@ -565,6 +877,7 @@ void VectorImage::checkCurveIntersections(BezierCurve& newCurve, qreal tolerance
                     }
                 }
             }
+            mIndex.setCurve(i, mCurves.at(i));
         }
     }
 }
@@ -903,6 +1216,8 @@ void VectorImage::deleteSelection()
             i--;
         }
     }
+    mIndex.invalidateCurves();
+    mIndex.invalidateAreas();
     modification();
 }
 
@@ -928,6 +1243,10 @@ void VectorImage::removeVertex(int curve, int vertex)
             j--;
         }
     }
+    mIndex.invalidateCurves();
+    mIndex.invalidateAreas();
+    clearPaintCache();
+
     // then eliminates the point
     if (mCurves[curve].getVertexSize() > 1)
     {
@@ -1048,6 +1367,8 @@ void VectorImage::paste(VectorImage& vectorImage)
         }
         if (ok) mArea.append(newArea);
     }
+    mIndex.invalidateCurves();
+    mIndex.invalidateAreas();
     modification();
 }
 
@@ -1101,26 +1422,30 @@ bool VectorImage::usesColour(int index)
  */
 void VectorImage::removeColour(int index)
 {
+    bool changed = false;
     for (int i = 0; i < mArea.size(); i++)
     {
-        if (mArea[i].getColourNumber() > index) mArea[i].decreaseColourNumber();
+        if (mArea[i].getColourNumber() > index) { mArea[i].decreaseColourNumber(); changed = true; }
     }
     for (int i = 0; i < mCurves.size(); i++)
     {
-        if (mCurves[i].getColourNumber() > index) mCurves[i].decreaseColourNumber();
+        if (mCurves[i].getColourNumber() > index) { mCurves[i].decreaseColourNumber(); changed = true; }
     }
+    if (changed) modification();
 }
 
 void VectorImage::moveColor(int start, int end)
 {
+    bool changed = false;
     for(int i=0; i< mArea.size(); i++)
      {
-         if (mArea[i].getColourNumber() == start) mArea[i].setColourNumber(end);
+         if (mArea[i].getColourNumber() == start) { mArea[i].setColourNumber(end); changed = true; }
      }
      for(int i=0; i< mCurves.size(); i++)
      {
-         if (mCurves[i].getColourNumber() == start) mCurves[i].setColourNumber(end);
+         if (mCurves[i].getColourNumber() == start) { mCurves[i].setColourNumber(end); changed = true; }
      }
+     if (changed) modification();
 }
 
 /**
@@ -1149,7 +1474,15 @@ void VectorImage::paintImage(QPainter& painter,
     {
         for (int i = 0; i < mArea.size(); i++)
         {
-            updateArea(mArea[i]); // to do: if selected
+            if (!mAreaPathsValid)
+            {
+                const QRectF oldBounds = mArea[i].mPath.controlPointRect();
+                updateArea(mArea[i]); // to do: if selected
+                if (mArea[i].mPath.controlPointRect() != oldBounds)
+                {
+                    mIndex.invalidateAreas();
+                }
+            }
 
             // --- fill areas ---- //
             QColor colour = getColour(mArea[i].mColourNumber);
@@ -1173,12 +1506,31 @@ void VectorImage::paintImage(QPainter& painter,
             painter.setRenderHint(QPainter::Antialiasing, antialiasing);
             painter.setClipping(false);
         }
+        mAreaPathsValid = true;
     }
 
     // ---- draw curves ----
-    for (BezierCurve curve : mCurves)
+    if (mCurvePaths.size() != mCurves.size())
     {
-        curve.drawPath(painter, mObject, mSelectionTransformation, simplified, showThinCurves);
+        mCurvePaths.clear();
+        mCurvePaths.reserve(mCurves.size());
+        for (int i = 0; i < mCurves.size(); i++)
+        {
+            BezierCurve myCurve = mCurves[i];
+            if (myCurve.isPartlySelected()) { myCurve = myCurve.transformed(mSelectionTransformation); }
+
+            CurvePaths paths;
+            paths.simple = myCurve.getSimplePath();
+            if (myCurve.getVariableWidth() && !myCurve.isInvisible())
+            {
+                paths.stroked = myCurve.getStrokedPath();
+            }
+            mCurvePaths.append(paths);
+        }
+    }
+    for (int i = 0; i < mCurves.size(); i++)
+    {
+        mCurves.at(i).drawPath(painter, mObject, mCurvePaths.at(i).simple, mCurvePaths.at(i).stroked, simplified, showThinCurves);
         painter.setClipping(false);
     }
 }
@@ -1203,6 +1555,43 @@ void VectorImage::outputImage(QImage* image,
     paintImage(painter, simplified, showThinCurves, antialiasing);
 }
 
+/**
+ * @brief VectorImage::rasterized
+ * @param size: QSize of the image
+ * @param myView: QTransform
+ * @param simplified: bool
+ * @param showThinCurves: bool
+ * @param antialiasing: bool
+ * @return the image outputImage() would give, painted again only if the
+ * picture, the palette, the view or the flags changed since the last call
+ */
+QImage VectorImage::rasterized(QSize size,
+                               QTransform myView,
+                               bool simplified,
+                               bool showThinCurves,
+                               bool antialiasing)
+{
+    const int flags = (simplified ? RASTER_SIMPLIFIED : 0)
+        | (showThinCurves ? RASTER_THIN_CURVES : 0)
+        | (antialiasing ? RASTER_ANTIALIASING : 0);
+    const uint palette = paletteKey();
+
+    if (mRaster.isNull() || mRaster.size() != size || mRasterView != myView
+        || mRasterFlags != flags || mRasterPaletteKey != palette)
+    {
+        QImage image(size, QImage::Format_ARGB32_Premultiplied);
+        outputImage(&image, myView, simplified, showThinCurves, antialiasing);
+
+        dropRaster();
+        mRaster = image;
+        mRasterView = myView;
+        mRasterFlags = flags;
+        mRasterPaletteKey = palette;
+    }
+    keepRaster(this);
+    return mRaster;
+}
+
 /**
  * @brief VectorImage::clear
  */
@@ -1210,6 +1599,8 @@ void VectorImage::clear()
 {
     while (mCurves.size() > 0) { mCurves.removeAt(0); }
     while (mArea.size() > 0) { mArea.removeAt(0); }
+    mIndex.invalidateCurves();
+    mIndex.invalidateAreas();
     modification();
 }
 
@@ -1226,6 +1617,8 @@ void VectorImage::clean()
             i--;
         }
     }
+    mIndex.invalidateCurves();
+    clearPaintCache();
 }
 
 /**
@@ -1249,6 +1642,7 @@ void VectorImage::applySelectionTransformation(QTransform transf)
             mCurves[i].transform(transf);
         }
     }
+    mIndex.invalidateCurves();
     calculateSelectionRect();
     mSelectionTransformation.reset();
     modification();
@@ -1358,7 +1752,10 @@ void VectorImage::applyVariableWidthToSelection(bool YesOrNo)
 QList<int> VectorImage::getCurvesCloseTo(QPointF P1, qreal maxDistance)
 {
     QList<int> result;
-    for (int j = 0; j < mCurves.size(); j++)
+    // The stroked path reaches at most twice its width past the control points
+    const qreal margin = 3 * qAbs(maxDistance);
+    const QPointF corner(margin, margin);
+    for (int j : curvesNear(QRectF(P1 - corner, P1 + corner)))
     {
         BezierCurve myCurve;
         if (mCurves[j].isPartlySelected())
@@ -1419,10 +1816,12 @@ QList<VertexRef> VectorImage::getVerticesCloseTo(QPointF P1, qreal maxDistance)
 {
     QList<VertexRef> result;
 
+    const QPointF corner(qAbs(maxDistance), qAbs(maxDistance));
+
     // Square maxDistance rather than taking the square root for each distance
     maxDistance *= maxDistance;
 
-    for (int curve = 0; curve < mCurves.size(); curve++)
+    for (int curve : curvesNear(QRectF(P1 - corner, P1 + corner)))
     {
         for (int vertex = -1; vertex < mCurves.at(curve).getVertexSize(); vertex++)
         {
@@ -2184,7 +2583,12 @@ void VectorImage::fillContour(QList<QPointF> contourPath, int colour)
 void VectorImage::addArea(BezierArea bezierArea)
 {
     updateArea(bezierArea);
+    const bool indexed = mIndex.areasValid(mArea.size());
     mArea.append(bezierArea);
+    if (indexed)
+    {
+        mIndex.appendArea(bezierArea);
+    }
     modification();
 }
 
@@ -2196,14 +2600,13 @@ void VectorImage::addArea(BezierArea bezierArea)
 int VectorImage::getFirstAreaNumber(QPointF point)
 {
     int result = -1;
-    for (int i = 0; i < mArea.size() && result == -1; i++)
+    const QList<int> candidates = spatialIndex().areasAt(point);
+    for (int n = 0; n < candidates.size() && result == -1; n++)
     {
-        if (mArea[i].mPath.controlPointRect().contains(point))
+        const int i = candidates.at(n);
+        if (mArea[i].mPath.contains(point))
         {
-            if (mArea[i].mPath.contains(point))
-            {
-                result = i;
-            }
+            result = i;
         }
     }
     return result;
@@ -2246,14 +2649,13 @@ BezierCurve VectorImage::getLastCurve()
 int VectorImage::getLastAreaNumber(QPointF point, int maxAreaNumber)
 {
     int result = -1;
-    for (int i = maxAreaNumber; i > -1 && result == -1; i--)
+    const QList<int> candidates = spatialIndex().areasAt(point);
+    for (int n = candidates.size() - 1; n > -1 && result == -1; n--)
     {
-        if (mArea[i].mPath.controlPointRect().contains(point))
+        const int i = candidates.at(n);
+        if (i <= maxAreaNumber && mArea[i].mPath.contains(point))
         {
-            if (mArea[i].mPath.contains(point))
-            {
-                result = i;
-            }
+            result = i;
         }
     }
     return result;
@@ -2270,6 +2672,7 @@ void VectorImage::removeArea(QPointF point)
     if (areaNumber != -1)
     {
         mArea.removeAt(areaNumber);
+        mIndex.invalidateAreas();
     }
     modification();
 }
@@ -2395,3 +2798,122 @@ void VectorImage::updateImageSize(BezierCurve& updatedCurve) {
         mSize.setHeight(heightFromBottom);
     }
 }
+
+/**
+ * @brief VectorImage::spatialIndex
+ * @return the index of the curves and areas, indexed again if they were renumbered
+ */
+VectorSpatialIndex& VectorImage::spatialIndex()
+{
+    if (!mIndex.curvesValid())
+    {
+        mIndex.rebuildCurves(mCurves);
+    }
+    if (!mIndex.areasValid(mArea.size()))
+    {
+        mIndex.rebuildAreas(mArea);
+    }
+    return mIndex;
+}
+
+/**
+ * @brief VectorImage::curvesNear
+ * @param rect: QRectF
+ * @return the curves which may pass through rect as they are displayed, in increasing order
+ */
+QList<int> VectorImage::curvesNear(const QRectF& rect)
+{
+    QList<int> result = spatialIndex().curvesNear(rect);
+    if (!mSelectionTransformation.isIdentity())
+    {
+        // The index holds the selected curves where they were before the transformation
+        for (int i = 0; i < mCurves.size(); i++)
+        {
+            if (mCurves.at(i).isPartlySelected()) result.append(i);
+        }
+        std::sort(result.begin(), result.end());
+        result.erase(std::unique(result.begin(), result.end()), result.end());
+    }
+    return result;
+}
+
+/**
+ * @brief VectorImage::nextCurveNear
+ * @param rect: QRectF
+ * @param curveNumber: int of the first curve to consider
+ * @return the first curve from curveNumber on with a cubic section near rect, or the number of curves if none
+ */
+int VectorImage::nextCurveNear(const QRectF& rect, int curveNumber)
+{
+    const QList<int> candidates = spatialIndex().curvesNear(rect);
+    auto it = std::lower_bound(candidates.begin(), candidates.end(), curveNumber);
+    return (it != candidates.end()) ? *it : mCurves.size();
+}
+
+/**
+ * @brief VectorImage::clearPaintCache
+ * Drops the paths and the raster kept for painting
+ */
+void VectorImage::clearPaintCache()
+{
+    mCurvePaths.clear();
+    mAreaPathsValid = false;
+    dropRaster();
+}
+
+/**
+ * @brief VectorImage::dropRaster
+ * Releases the image kept by rasterized()
+ */
+void VectorImage::dropRaster()
+{
+    // Unlinked even without a raster, so the cache never keeps a pointer to a deleted image
+    QMutexLocker locker(&rasterCacheMutex);
+    if (rasterCacheOrder.removeOne(this))
+    {
+        rasterCacheBytes -= mRaster.byteCount();
+    }
+    mRaster = QImage();
+}
+
+/**
+ * @brief VectorImage::paletteKey
+ * @return a hash of the colours of the object, which change the raster without changing the image
+ */
+uint VectorImage::paletteKey() const
+{
+    if (mObject == nullptr)
+    {
+        return 0;
+    }
+
+    uint key = static_cast<uint>(mObject->getColourCount());
+    for (int i = 0; i < mObject->getColourCount(); i++)
+    {
+        key = key * 31 + mObject->getColour(i).colour.rgba();
+    }
+    return key;
+}
+
+/**
+ * @brief VectorImage::keepRaster
+ * @param image: VectorImage* just painted from its raster
+ * Marks the raster of image as the most recently used, and drops the rasters
+ * of the other images painted longest ago while they go over the budget.
+ */
+void VectorImage::keepRaster(VectorImage* image)
+{
+    QMutexLocker locker(&rasterCacheMutex);
+    if (!rasterCacheOrder.removeOne(image))
+    {
+        rasterCacheBytes += image->mRaster.byteCount();
+    }
+    rasterCacheOrder.append(image);
+
+    while (rasterCacheBytes > RASTER_CACHE_BUDGET && rasterCacheOrder.size() > 1)
+    {
+        VectorImage* oldest = rasterCacheOrder.takeFirst();
+        rasterCacheBytes -= oldest->mRaster.byteCount();
+        oldest->mRaster = QImage();
+    }
+}
@@ -19,25 +19,35 @@ GNU General Public License for more details.
 
 #include <QTransform>
 #include <QStringList>
+#include <QImage>
+#include <QVector>
 
 #include "bezierarea.h"
 #include "beziercurve.h"
 #include "vertexref.h"
 #include "keyframe.h"
+#include "vectorspatialindex.h"
 
 class Object;
 class QPainter;
-class QImage;
+class QIODevice;
 
 
 class VectorImage : public KeyFrame
 {
 public:
     VectorImage();
+    explicit VectorImage(const QString& filePath);
     VectorImage(const VectorImage&);
     virtual ~VectorImage();
+    VectorImage& operator=(const VectorImage& v2);
 
     VectorImage* clone() override;
+    void modification() override;
+    void loadFile() override;
+    void unloadFile() override;
+    bool isLoaded() override { return mLoaded; }
+    qint64 memoryUsage() override;
 
     void setObject(Object* pObj) { mObject = pObj; }
 
@@ -46,6 +56,7 @@ public:
 
     Status createDomElement(QXmlStreamWriter& doc);
     void loadDomElement(QDomElement element);
+    void loadDomElement(QXmlStreamReader& xmlReader);
 
     BezierCurve& curve(int i);
 
@@ -90,6 +101,7 @@ public:
 
     void paintImage(QPainter& painter, bool simplified, bool showThinCurves, bool antialiasing);
     void outputImage(QImage* image, QTransform myView, bool simplified, bool showThinCurves, bool antialiasing); // uses paintImage
+    QImage rasterized(QSize size, QTransform myView, bool simplified, bool showThinCurves, bool antialiasing);
 
     void clear();
     void clean();
@@ -147,6 +159,10 @@ public:
     QSize getSize() { return mSize; }
 
 private:
+    bool readXml(QIODevice* device);
+    bool readBinary(QIODevice* device);
+    bool writeBinary(QIODevice* device);
+
     void addPoint(int curveNumber, int vertexNumber, qreal fraction);
 
     void checkCurveExtremity(BezierCurve& newCurve, qreal tolerance);
@@ -155,6 +171,15 @@ private:
     void updateImageSize(BezierCurve& updatedCurve);
     QPainterPath mGetStrokedPath;
 
+    void clearPaintCache();
+    void dropRaster();
+    uint paletteKey() const;
+    static void keepRaster(VectorImage* image);
+
+    VectorSpatialIndex& spatialIndex();
+    QList<int> curvesNear(const QRectF& rect);
+    int nextCurveNear(const QRectF& rect, int curveNumber);
+
 private:
     QList<BezierCurve> mCurves;
 
@@ -162,6 +187,24 @@ private:
     QRectF mSelectionRect;
     QTransform mSelectionTransformation;
     QSize mSize;
+    bool mLoaded = true; //< false while the curves are only in the file, see loadFile()
+    VectorSpatialIndex mIndex; //< rebuilt on demand after the curve numbers change
+
+    struct CurvePaths
+    {
+        QPainterPath simple;
+        QPainterPath stroked;
+    };
+
+    /** What paintImage() draws for each curve and area, kept until the next modification() */
+    QVector<CurvePaths> mCurvePaths;
+    bool mAreaPathsValid = false;
+
+    /** The last result of rasterized() and what it was painted with */
+    QImage mRaster;
+    QTransform mRasterView;
+    int mRasterFlags = 0;
+    uint mRasterPaletteKey = 0;
 };
 
 #endif
@@ -0,0 +1,234 @@
+/*
+
+Pencil - Traditional Animation Software
+Copyright (C) 2012-2018 Matthew Chiawen Chang
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+*/
+#include "vectorspatialindex.h"
+
+#include <algorithm>
+#include <cmath>
+#include "beziercurve.h"
+#include "bezierarea.h"
+
+namespace
+{
+    /** Segments spanning more cells than this are kept in a plain list */
+    const int MAX_CELLS_PER_ENTRY = 256;
+
+    void sortUnique(QList<int>& list)
+    {
+        std::sort(list.begin(), list.end());
+        list.erase(std::unique(list.begin(), list.end()), list.end());
+    }
+}
+
+void VectorSpatialIndex::rebuildCurves(const QList<BezierCurve>& curves)
+{
+    mCurveCells.clear();
+    mLargeSegments.clear();
+    mCellsOfCurve.clear();
+    mCurvesValid = true;
+
+    for (int i = 0; i < curves.size(); i++)
+    {
+        setCurve(i, curves.at(i));
+    }
+}
+
+void VectorSpatialIndex::rebuildAreas(const QList<BezierArea>& areas)
+{
+    mAreaCells.clear();
+    mAreaRects.clear();
+    mAreasValid = true;
+
+    for (const BezierArea& area : areas)
+    {
+        appendArea(area);
+    }
+}
+
+/** Files the segments of curve under curveNumber, replacing what was there */
+void VectorSpatialIndex::setCurve(int curveNumber, const BezierCurve& curve)
+{
+    if (!mCurvesValid)
+    {
+        return;
+    }
+
+    removeCurve(curveNumber);
+    if (curveNumber >= mCellsOfCurve.size())
+    {
+        mCellsOfCurve.resize(curveNumber + 1);
+    }
+
+    QVector<quint64>& cellsOfCurve = mCellsOfCurve[curveNumber];
+    for (int j = 0; j < curve.getVertexSize(); j++)
+    {
+        const Segment segment = { curveNumber, segmentBounds(curve, j) };
+        const QRect range = cellRange(segment.bounds);
+        if (static_cast<qint64>(range.width()) * range.height() > MAX_CELLS_PER_ENTRY)
+        {
+            mLargeSegments.append(segment);
+            continue;
+        }
+
+        for (int cy = range.top(); cy <= range.bottom(); cy++)
+        {
+            for (int cx = range.left(); cx <= range.right(); cx++)
+            {
+                const quint64 key = cellKey(cx, cy);
+                QVector<Segment>& cell = mCurveCells[key];
+                if (cell.isEmpty() || cell.last().curve != curveNumber)
+                {
+                    cellsOfCurve.append(key);
+                }
+                cell.append(segment);
+            }
+        }
+    }
+}
+
+void VectorSpatialIndex::removeCurve(int curveNumber)
+{
+    auto isOfCurve = [curveNumber](const Segment& s) { return s.curve == curveNumber; };
+
+    if (curveNumber < mCellsOfCurve.size())
+    {
+        for (quint64 key : mCellsOfCurve[curveNumber])
+        {
+            auto it = mCurveCells.find(key);
+            if (it == mCurveCells.end())
+            {
+                continue;
+            }
+            it->erase(std::remove_if(it->begin(), it->end(), isOfCurve), it->end());
+            if (it->isEmpty())
+            {
+                mCurveCells.erase(it);
+            }
+        }
+        mCellsOfCurve[curveNumber].clear();
+    }
+    mLargeSegments.erase(std::remove_if(mLargeSegments.begin(), mLargeSegments.end(), isOfCurve), mLargeSegments.end());
+}
+
+void VectorSpatialIndex::appendArea(const BezierArea& area)
+{
+    const int areaNumber = mAreaRects.size();
+    const QRectF bounds = area.mPath.controlPointRect();
+    mAreaRects.append(bounds);
+
+    const QRect range = cellRange(bounds);
+    for (int cy = range.top(); cy <= range.bottom(); cy++)
+    {
+        for (int cx = range.left(); cx <= range.right(); cx++)
+        {
+            mAreaCells[cellKey(cx, cy)].append(areaNumber);
+        }
+    }
+}
+
+/** Returns in increasing order the curves with a segment whose control points bounding box meets rect */
+QList<int> VectorSpatialIndex::curvesNear(const QRectF& rect) const
+{
+    QList<int> result;
+    auto collect = [&](const Segment& segment)
+    {
+        // Touching counts, a horizontal or vertical segment has an empty box
+        if (segment.bounds.left() <= rect.right() && rect.left() <= segment.bounds.right()
+            && segment.bounds.top() <= rect.bottom() && rect.top() <= segment.bounds.bottom())
+        {
+            result.append(segment.curve);
+        }
+    };
+
+    const QRect range = cellRange(rect);
+    if (static_cast<qint64>(range.width()) * range.height() > mCurveCells.size())
+    {
+        // Cheaper to look at every cell than every position of a huge rect
+        for (const QVector<Segment>& cell : mCurveCells)
+        {
+            std::for_each(cell.begin(), cell.end(), collect);
+        }
+    }
+    else
+    {
+        for (int cy = range.top(); cy <= range.bottom(); cy++)
+        {
+            for (int cx = range.left(); cx <= range.right(); cx++)
+            {
+                auto it = mCurveCells.find(cellKey(cx, cy));
+                if (it != mCurveCells.end())
+                {
+                    std::for_each(it->begin(), it->end(), collect);
+                }
+            }
+        }
+    }
+    std::for_each(mLargeSegments.begin(), mLargeSegments.end(), collect);
+
+    sortUnique(result);
+    return result;
+}
+
+/** Returns in increasing order the areas whose control points bounding box contains point */
+QList<int> VectorSpatialIndex::areasAt(const QPointF& point) const
+{
+    QList<int> result;
+    const QRect range = cellRange(QRectF(point, QSizeF(0, 0)));
+    auto it = mAreaCells.find(cellKey(range.left(), range.top()));
+    if (it != mAreaCells.end())
+    {
+        for (int areaNumber : *it)
+        {
+            if (mAreaRects[areaNumber].contains(point))
+            {
+                result.append(areaNumber);
+            }
+        }
+    }
+    sortUnique(result);
+    return result;
+}
+
+/** The bounding box of the end points and control points of a cubic segment, which contains the segment */
+QRectF VectorSpatialIndex::segmentBounds(const BezierCurve& curve, int segment)
+{
+    const QPointF points[4] = { curve.getVertex(segment - 1), curve.getC1(segment),
+                                curve.getC2(segment), curve.getVertex(segment) };
+    qreal left = points[0].x(), right = left;
+    qreal top = points[0].y(), bottom = top;
+    for (const QPointF& p : points)
+    {
+        left = qMin(left, p.x());
+        right = qMax(right, p.x());
+        top = qMin(top, p.y());
+        bottom = qMax(bottom, p.y());
+    }
+    return QRectF(QPointF(left, top), QPointF(right, bottom));
+}
+
+QRect VectorSpatialIndex::cellRange(const QRectF& rect) const
+{
+    const QRectF r = rect.normalized();
+    auto cellOf = [](qreal v)
+    {
+        return static_cast<int>(qBound(-1.0e9, std::floor(v / CELL_SIZE), 1.0e9));
+    };
+    return QRect(QPoint(cellOf(r.left()), cellOf(r.top())), QPoint(cellOf(r.right()), cellOf(r.bottom())));
+}
+
+quint64 VectorSpatialIndex::cellKey(int cx, int cy)
+{
+    return (static_cast<quint64>(static_cast<quint32>(cx)) << 32) | static_cast<quint32>(cy);
+}
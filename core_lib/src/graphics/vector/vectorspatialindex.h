@@ -0,0 +1,80 @@
+/*
+
+Pencil - Traditional Animation Software
+Copyright (C) 2012-2018 Matthew Chiawen Chang
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+*/
+#ifndef VECTORSPATIALINDEX_H
+#define VECTORSPATIALINDEX_H
+
+#include <QHash>
+#include <QList>
+#include <QRectF>
+#include <QVector>
+
+class BezierCurve;
+class BezierArea;
+
+
+/** A uniform grid over the cubic segments and the areas of a VectorImage.
+ *
+ *  Each segment is filed under the cells its control points bounding box covers,
+ *  so the curves near a point are found without going through every segment.
+ *  Curves are looked up by their number in the VectorImage: when curves are
+ *  inserted before others or removed the numbers shift and the curves must be
+ *  indexed again, see invalidateCurves().
+ *
+ *  Queries return candidates, the caller still runs the exact test on them.
+ */
+class VectorSpatialIndex
+{
+public:
+    static const int CELL_SIZE = 64;
+
+    bool curvesValid() const { return mCurvesValid; }
+    bool areasValid(int areaCount) const { return mAreasValid && mAreaRects.size() == areaCount; }
+    void invalidateCurves() { mCurvesValid = false; }
+    void invalidateAreas() { mAreasValid = false; }
+
+    void rebuildCurves(const QList<BezierCurve>& curves);
+    void rebuildAreas(const QList<BezierArea>& areas);
+
+    void setCurve(int curveNumber, const BezierCurve& curve);
+    void appendArea(const BezierArea& area);
+
+    QList<int> curvesNear(const QRectF& rect) const;
+    QList<int> areasAt(const QPointF& point) const;
+
+    static QRectF segmentBounds(const BezierCurve& curve, int segment);
+
+private:
+    struct Segment
+    {
+        int curve;
+        QRectF bounds;
+    };
+
+    void removeCurve(int curveNumber);
+    QRect cellRange(const QRectF& rect) const;
+    static quint64 cellKey(int cx, int cy);
+
+    QHash<quint64, QVector<Segment>> mCurveCells;
+    QVector<Segment> mLargeSegments; //< segments covering too many cells to be filed
+    QVector<QVector<quint64>> mCellsOfCurve;
+    bool mCurvesValid = false;
+
+    QHash<quint64, QVector<int>> mAreaCells;
+    QVector<QRectF> mAreaRects;
+    bool mAreasValid = false;
+};
+
+#endif // VECTORSPATIALINDEX_H
@@ -18,18 +18,22 @@ GNU General Public License for more details.
 #ifndef BACKUPELEMENT_H
 #define BACKUPELEMENT_H
 
+#include <map>
+#include <memory>
+#include <vector>
 #include <QObject>
 #include "vectorimage.h"
 #include "bitmapimage.h"
 #include "soundclip.h"
 
 class Editor;
+class LayerBitmap;
 
 class BackupElement : public QObject
 {
     Q_OBJECT
 public:
-    enum types { UNDEFINED, BITMAP_MODIF, VECTOR_MODIF, SOUND_MODIF };
+    enum types { UNDEFINED, BITMAP_MODIF, VECTOR_MODIF, SOUND_MODIF, BITMAP_FRAMES_MODIF };
 
     QString undoText;
     bool somethingSelected;
@@ -38,6 +42,13 @@ public:
 
     virtual int type() { return UNDEFINED; }
     virtual void restore(Editor*) { qDebug() << "Wrong"; }
+
+    /** Memory the element holds on its own, shared data is not counted */
+    virtual qint64 byteSize() { return 0; }
+    /** Bytes the element wrote to disk, see spill() */
+    virtual qint64 diskSize() { return 0; }
+    /** Moves the element's data to a file in folder, returns false if it stays in memory */
+    virtual bool spill(const QString& folder) { Q_UNUSED(folder); return false; }
 };
 
 class BackupBitmapElement : public BackupElement
@@ -45,11 +56,42 @@ class BackupBitmapElement : public BackupElement
     Q_OBJECT
 public:
     BackupBitmapElement(BitmapImage* bi) { bitmapImage = bi->copy(); }
+    ~BackupBitmapElement();
 
     int layer, frame;
     BitmapImage bitmapImage;
     int type() { return BackupElement::BITMAP_MODIF; }
     void restore(Editor*);
+
+    qint64 byteSize() override;
+    qint64 diskSize() override { return mSpillSize; }
+    bool spill(const QString& folder) override;
+    void reload();
+
+private:
+    // bitmapImage is empty while it is in this file
+    QString mSpillFile;
+    QPoint mSpillTopLeft;
+    qint64 mSpillSize = 0;
+};
+
+/** Frames of bitmap layers changed by one action, such as importing a sequence */
+class BackupBitmapFramesElement : public BackupElement
+{
+    Q_OBJECT
+public:
+    void save(int layerIndex, LayerBitmap* bitmapLayer, int frame);
+
+    int type() { return BackupElement::BITMAP_FRAMES_MODIF; }
+    void restore(Editor*);
+
+    /** The layer index and the position of each frame saved */
+    std::vector<std::pair<int, int>> frames() const;
+    qint64 byteSize() override;
+
+private:
+    // The frames without a key frame when they were saved map to nothing
+    std::map<std::pair<int, int>, std::unique_ptr<BitmapImage>> mFrames;
 };
 
 class BackupVectorElement : public BackupElement
@@ -62,6 +104,8 @@ public:
 
     int type() { return BackupElement::VECTOR_MODIF; }
     void restore(Editor*);
+
+    qint64 byteSize() override;
 };
 
 class BackupSoundElement : public BackupElement
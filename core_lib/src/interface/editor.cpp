@@ -25,6 +25,10 @@ GNU General Public License for more details.
 #include <QImageReader>
 #include <QDragEnterEvent>
 #include <QDropEvent>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QTemporaryDir>
 
 #include "object.h"
 #include "objectdata.h"
@@ -48,7 +52,8 @@ GNU General Public License for more details.
 #include "scribblearea.h"
 #include "timeline.h"
 #include "util.h"
-#include "movieexporter.h"
+#include "frameimporter.h"
+#include "pegbaraligner.h"
 
 #define MIN(a,b) ((a)>(b)?(b):(a))
 
@@ -163,8 +168,17 @@ void Editor::settingUpdated(SETTING setting)
         mScribbleArea->updateAllFrames();
         emit updateTimeLine();
         break;
-    case SETTING::FRAME_POOL_SIZE:
-        mObject->setActiveFramePoolSize(mPreferenceManager->getInt(SETTING::FRAME_POOL_SIZE));
+    case SETTING::FRAME_POOL_MEMORY_BUDGET:
+    case SETTING::PREV_ONION:
+    case SETTING::NEXT_ONION:
+    case SETTING::ONION_PREV_FRAMES_NUM:
+    case SETTING::ONION_NEXT_FRAMES_NUM:
+        updateActiveFramePool();
+        break;
+    case SETTING::UNDO_MEMORY_BUDGET:
+    case SETTING::UNDO_SPILL_TO_DISK:
+        enforceUndoBudget();
+        emit updateBackup();
         break;
     case SETTING::LAYER_VISIBILITY:
         mScribbleArea->setLayerVisibility(static_cast<LayerVisibility>(mPreferenceManager->getInt(SETTING::LAYER_VISIBILITY)));
@@ -229,11 +243,6 @@ void Editor::backup(int backupLayer, int backupFrame, QString undoText)
     {
         delete mBackupList.takeLast();
     }
-    while (mBackupList.size() > 19)   // we authorize only 20 levels of cancellation
-    {
-        delete mBackupList.takeFirst();
-        mBackupIndex--;
-    }
 
     Layer* layer = mObject->getLayer(backupLayer);
     if (layer != nullptr)
@@ -305,11 +314,106 @@ void Editor::backup(int backupLayer, int backupFrame, QString undoText)
         }
     }
 
+    enforceUndoBudget();
     updateAutoSaveCounter();
 
     emit updateBackup();
 }
 
+/** Adds an element made by the caller on top of the undo stack, which takes it over */
+void Editor::pushBackup(BackupElement* element)
+{
+    while (mBackupList.size() - 1 > mBackupIndex && mBackupList.size() > 0)
+    {
+        delete mBackupList.takeLast();
+    }
+
+    mBackupList.append(element);
+    mBackupIndex++;
+
+    enforceUndoBudget();
+    updateAutoSaveCounter();
+
+    emit updateBackup();
+}
+
+/** Applies the frame cache preferences to the object.
+ *  The onion skins shown are kept loaded along with the current frame.
+ */
+void Editor::updateActiveFramePool()
+{
+    if (mPreferenceManager == nullptr || mObject == nullptr)
+    {
+        return;
+    }
+
+    const qint64 budget = qMax(64, mPreferenceManager->getInt(SETTING::FRAME_POOL_MEMORY_BUDGET));
+    mObject->setActiveFramePoolBudget(budget * 1024 * 1024);
+
+    const bool prevOnion = mPreferenceManager->isOn(SETTING::PREV_ONION);
+    const bool nextOnion = mPreferenceManager->isOn(SETTING::NEXT_ONION);
+    mObject->setActiveFramePoolOnionRange(prevOnion ? mPreferenceManager->getInt(SETTING::ONION_PREV_FRAMES_NUM) : 0,
+                                          nextOnion ? mPreferenceManager->getInt(SETTING::ONION_NEXT_FRAMES_NUM) : 0);
+}
+
+/** Keeps the undo stack within the memory budget set in the preferences.
+ *
+ *  The oldest elements are spilled to disk first when that is allowed,
+ *  and dropped once the disk copies take four times the budget as well.
+ *  The two newest elements always stay, undo() backs up the current state
+ *  and then restores the one before it. Only the elements below mBackupIndex
+ *  are spilled or dropped, the ones from it on are still needed by undo and redo.
+ */
+void Editor::enforceUndoBudget()
+{
+    qint64 budget = 512;
+    bool canSpill = true;
+    if (mPreferenceManager)
+    {
+        budget = mPreferenceManager->getInt(SETTING::UNDO_MEMORY_BUDGET);
+        canSpill = mPreferenceManager->isOn(SETTING::UNDO_SPILL_TO_DISK);
+    }
+    budget = qMax<qint64>(1, budget) * 1024 * 1024;
+
+    qint64 memoryUsed = 0;
+    qint64 diskUsed = 0;
+    for (BackupElement* element : mBackupList)
+    {
+        memoryUsed += element->byteSize();
+        diskUsed += element->diskSize();
+    }
+
+    // Only the elements below the cursor are touched, it may have moved back after a few undos
+    for (int i = 0; i < mBackupIndex && memoryUsed > budget && canSpill; i++)
+    {
+        BackupElement* element = mBackupList[i];
+        const qint64 size = element->byteSize();
+        if (size > 0 && element->spill(undoSpillFolder()))
+        {
+            memoryUsed -= size;
+            diskUsed += element->diskSize();
+        }
+    }
+
+    while (mBackupList.size() > 2 && mBackupIndex > 0 && (memoryUsed > budget || diskUsed > budget * 4))
+    {
+        BackupElement* element = mBackupList.takeFirst();
+        memoryUsed -= element->byteSize();
+        diskUsed -= element->diskSize();
+        delete element;
+        mBackupIndex--;
+    }
+}
+
+QString Editor::undoSpillFolder()
+{
+    if (mUndoSpillDir == nullptr)
+    {
+        mUndoSpillDir.reset(new QTemporaryDir(QDir::tempPath() + "/Pencil2D-undo-XXXXXX"));
+    }
+    return mUndoSpillDir->isValid() ? mUndoSpillDir->path() : QString();
+}
+
 void Editor::restoreKey()
 {
     BackupElement* lastBackupElement = mBackupList[mBackupIndex];
@@ -324,6 +428,7 @@ void Editor::restoreKey()
         frame = lastBackupBitmapElement->frame;
         layer = object()->getLayer(layerIndex);
         addKeyFrame(layerIndex, frame);
+        lastBackupBitmapElement->reload();
         dynamic_cast<LayerBitmap*>(layer)->getBitmapImageAtFrame(frame)->paste(&lastBackupBitmapElement->bitmapImage);
     }
     if (lastBackupElement->type() == BackupElement::VECTOR_MODIF)
@@ -383,6 +488,7 @@ void BackupBitmapElement::restore(Editor* editor)
         {
             if (layer->type() == Layer::BITMAP)
             {
+                reload();
                 auto pLayerBitmap = static_cast<LayerBitmap*>(layer);
                 *pLayerBitmap->getLastBitmapImageAtFrame(this->frame, 0) = this->bitmapImage;  // restore the image
             }
@@ -390,6 +496,146 @@ void BackupBitmapElement::restore(Editor* editor)
     }
 }
 
+BackupBitmapElement::~BackupBitmapElement()
+{
+    if (!mSpillFile.isEmpty())
+    {
+        QFile::remove(mSpillFile);
+    }
+}
+
+/** Only the tiles that changed since the backup belong to it, the others are shared with the drawing */
+qint64 BackupBitmapElement::byteSize()
+{
+    return bitmapImage.unsharedByteSize();
+}
+
+bool BackupBitmapElement::spill(const QString& folder)
+{
+    if (!mSpillFile.isEmpty() || folder.isEmpty() || bitmapImage.bounds().isEmpty())
+    {
+        return false;
+    }
+
+    static int spillCount = 0;
+    const QString filePath = QDir(folder).filePath(QString("undo%1.png").arg(++spillCount));
+
+    // Quality 80 is zlib level 1, the fastest that still compresses. The file is only read back by this session.
+    if (!bitmapImage.image()->save(filePath, "PNG", 80))
+    {
+        QFile::remove(filePath);
+        return false;
+    }
+
+    mSpillFile = filePath;
+    mSpillTopLeft = bitmapImage.bounds().topLeft();
+    mSpillSize = QFileInfo(filePath).size();
+    bitmapImage = BitmapImage();
+    return true;
+}
+
+/** Brings bitmapImage back in memory if it was spilled */
+void BackupBitmapElement::reload()
+{
+    if (mSpillFile.isEmpty())
+    {
+        return;
+    }
+
+    QImage image(mSpillFile);
+    bitmapImage = BitmapImage(mSpillTopLeft, image.convertToFormat(QImage::Format_ARGB32_Premultiplied));
+
+    QFile::remove(mSpillFile);
+    mSpillFile.clear();
+    mSpillSize = 0;
+}
+
+/** Keeps frame as it is now, before it changes. Only the first save of a frame counts. */
+void BackupBitmapFramesElement::save(int layerIndex, LayerBitmap* bitmapLayer, int frame)
+{
+    const std::pair<int, int> key(layerIndex, frame);
+    if (mFrames.find(key) != mFrames.end())
+    {
+        return;
+    }
+
+    std::unique_ptr<BitmapImage>& saved = mFrames[key];
+    if (bitmapLayer->keyExists(frame))
+    {
+        saved.reset(new BitmapImage(bitmapLayer->getBitmapImageAtFrame(frame)->copy()));
+    }
+}
+
+std::vector<std::pair<int, int>> BackupBitmapFramesElement::frames() const
+{
+    std::vector<std::pair<int, int>> keys;
+    for (const auto& it : mFrames)
+    {
+        keys.push_back(it.first);
+    }
+    return keys;
+}
+
+/** Puts back the saved key frames, and removes those that did not exist */
+void BackupBitmapFramesElement::restore(Editor* editor)
+{
+    if (mFrames.empty())
+    {
+        return;
+    }
+
+    for (const auto& it : mFrames)
+    {
+        auto bitmapLayer = static_cast<LayerBitmap*>(editor->object()->getLayer(it.first.first));
+        const int frame = it.first.second;
+        if (bitmapLayer == nullptr)
+        {
+            continue;
+        }
+
+        if (it.second == nullptr)
+        {
+            if (bitmapLayer->keyExists(frame))
+            {
+                bitmapLayer->removeKeyFrame(frame);
+            }
+            continue;
+        }
+
+        if (!bitmapLayer->keyExists(frame))
+        {
+            bitmapLayer->addNewKeyFrameAt(frame);
+        }
+        *bitmapLayer->getBitmapImageAtFrame(frame) = *it.second;
+    }
+
+    const int firstFrame = mFrames.begin()->first.second;
+    editor->layers()->notifyAnimationLengthChanged();
+    editor->scrubTo(firstFrame);
+    editor->updateFrame(firstFrame);
+}
+
+qint64 BackupBitmapFramesElement::byteSize()
+{
+    qint64 size = 0;
+    for (const auto& it : mFrames)
+    {
+        if (it.second)
+        {
+            size += it.second->unsharedByteSize();
+        }
+    }
+    return size;
+}
+
+/** Everything the copied image holds. Assigning a VectorImage leaves its paint
+ *  caches behind, the points are counted even while shared with the drawing.
+ */
+qint64 BackupVectorElement::byteSize()
+{
+    return vectorImage.memoryUsage();
+}
+
 void BackupVectorElement::restore(Editor* editor)
 {
     Layer* layer = editor->object()->getLayer(this->layer);
@@ -457,6 +703,19 @@ void Editor::undo()
                 backup(lastBackupSoundElement->layer, lastBackupSoundElement->frame, "NoOp");
                 mBackupIndex--;
             }
+            if (lastBackupElement->type() == BackupElement::BITMAP_FRAMES_MODIF)
+            {
+                BackupBitmapFramesElement* lastBackupFramesElement = static_cast<BackupBitmapFramesElement*>(lastBackupElement);
+
+                BackupBitmapFramesElement* element = new BackupBitmapFramesElement;
+                element->undoText = "NoOp";
+                for (const auto& frame : lastBackupFramesElement->frames())
+                {
+                    element->save(frame.first, static_cast<LayerBitmap*>(mObject->getLayer(frame.first)), frame.second);
+                }
+                pushBackup(element);
+                mBackupIndex--;
+            }
         }
 
         mBackupList[mBackupIndex]->restore(this);
@@ -702,94 +961,11 @@ void Editor::updateObject()
         mScribbleArea->updateAllFrames();
     }
     
-    if (mPreferenceManager)
-    {
-        mObject->setActiveFramePoolSize(mPreferenceManager->getInt(SETTING::FRAME_POOL_SIZE));
-    }
+    updateActiveFramePool();
 
     emit updateLayerCount();
 }
 
-/* TODO: Export absolutely does not belong here, but due to the messed up project structure
- * there isn't really any better place atm. Once we do have a proper structure in place, this
- * should go somewhere else */
-bool Editor::exportSeqCLI(QString filePath, LayerCamera *cameraLayer, QString format, int width, int height, int startFrame, int endFrame, bool transparency, bool antialias)
-{
-    if (width < 0)
-    {
-        width = cameraLayer->getViewRect().width();
-    }
-    if (height < 0)
-    {
-        height = cameraLayer->getViewRect().height();
-    }
-    if (startFrame < 1)
-    {
-        startFrame = 1;
-    }
-    if (endFrame < -1)
-    {
-        endFrame = mLayerManager->animationLength();
-    }
-    if (endFrame < 0)
-    {
-        endFrame = mLayerManager->animationLength(false);
-    }
-
-    QSize exportSize = QSize(width, height);
-    mObject->exportFrames(startFrame,
-                          endFrame,
-                          cameraLayer,
-                          exportSize,
-                          filePath,
-                          format,
-                          transparency,
-                          false,
-                          "",
-                          antialias,
-                          nullptr,
-                          0);
-    return true;
-}
-
-bool Editor::exportMovieCLI(QString filePath, LayerCamera *cameraLayer, int width, int height, int startFrame, int endFrame)
-{
-    if (width < 0)
-    {
-        width = cameraLayer->getViewRect().width();
-    }
-    if (height < 0)
-    {
-        height = cameraLayer->getViewRect().height();
-    }
-    if (startFrame < 1)
-    {
-        startFrame = 1;
-    }
-    if (endFrame < -1)
-    {
-        endFrame = mLayerManager->animationLength();
-    }
-    if (endFrame < 0)
-    {
-        endFrame = mLayerManager->animationLength(false);
-    }
-
-    QSize exportSize = QSize(width, height);
-
-    ExportMovieDesc desc;
-    desc.strFileName = filePath;
-    desc.startFrame = startFrame;
-    desc.endFrame = endFrame;
-    desc.fps = playback()->fps();
-    desc.exportSize = exportSize;
-    desc.strCameraName = cameraLayer->name();
-
-    MovieExporter ex;
-    ex.run(object(), desc, [](float,float){}, [](float){}, [](QString){});
-    return true;
-}
-
 QString Editor::workingDir() const
 {
     return mObject->workingDir();
@@ -924,6 +1100,84 @@ bool Editor::importGIF(QString filePath, int numOfImages)
     return false;
 }
 
+/** Pastes every frame of an import into its own key frame of the current bitmap layer.
+ *
+ *  The frames are added in the order they come out of the importer, without
+ *  moving the playhead between them, and the whole import is a single undo step.
+ *
+ *  @param frames Decodes the frames, images or a movie, ahead of this loop
+ *  @param progress Called with the number of frames pasted so far, also while waiting
+ *                 for the next frame, so it can cancel frames at any time
+ */
+Status Editor::importBitmapFrames(FrameImporter& frames, std::function<void(int)> progress)
+{
+    Layer* layer = layers()->currentLayer();
+    if (layer == nullptr || layer->type() != Layer::BITMAP)
+    {
+        return Status::ERROR_INVALID_LAYER_TYPE;
+    }
+    if (!layer->visible())
+    {
+        mScribbleArea->showLayerNotVisibleWarning();
+        return Status::FAIL;
+    }
+    auto bitmapLayer = static_cast<LayerBitmap*>(layer);
+    LayerCamera* camera = static_cast<LayerCamera*>(layers()->getLastCameraLayer());
+
+    const int layerIndex = layers()->currentLayerIndex();
+    BackupBitmapFramesElement* element = new BackupBitmapFramesElement;
+    element->undoText = tr("Import Image");
+
+    int imported = 0;
+    int lastPosition = -1;
+    while (frames.hasMoreFrames())
+    {
+        ImportedFrame frame;
+        if (!frames.takeNextFrame(frame, 100) || frame.image.isNull() || frame.position < 1)
+        {
+            if (progress)
+            {
+                progress(imported);
+            }
+            continue;
+        }
+
+        QTransform importView = view()->getImportView();
+        if (view()->getImportFollowsCamera() && camera != nullptr)
+        {
+            importView = camera->getViewAtFrame(frame.position);
+        }
+        const QPoint center(static_cast<int>(importView.dx()), static_cast<int>(importView.dy()));
+
+        element->save(layerIndex, bitmapLayer, frame.position);
+        if (!bitmapLayer->keyExists(frame.position))
+        {
+            bitmapLayer->addNewKeyFrameAt(frame.position);
+        }
+        BitmapImage importedBitmapImage(center - QPoint(frame.image.width() / 2, frame.image.height() / 2), frame.image);
+        bitmapLayer->getBitmapImageAtFrame(frame.position)->paste(&importedBitmapImage);
+
+        lastPosition = frame.position;
+        imported++;
+        if (progress)
+        {
+            progress(imported);
+        }
+    }
+
+    if (imported == 0)
+    {
+        delete element;
+        return Status::OK;
+    }
+
+    pushBackup(element);
+    layers()->notifyAnimationLengthChanged();
+    scrubTo(lastPosition);
+    updateFrame(lastPosition);
+    return Status::OK;
+}
+
 qreal Editor::viewScaleInversed()
 {
     return view()->getViewInverse().m11();
@@ -1007,6 +1261,12 @@ void Editor::scrubTo(int frame)
         emit updateTimeLine(); // needs to update the timeline to update onion skin positions
     }
     mObject->updateActiveFrames(frame);
+
+    if (mPlaybackManager)
+    {
+        mPlaybackManager->recordScrub(frame);
+        mObject->prefetchFrames(mPlaybackManager->upcomingFrames(frame));
+    }
 }
 
 void Editor::scrubForward()
@@ -1138,53 +1398,87 @@ void Editor::swapLayers(int i, int j)
     mScribbleArea->updateAllFrames();
 }
 
-Status::StatusInt Editor::pegBarAlignment(QStringList layers)
+/** Finds the pegs on the key frames of layers, and how far each key frame is from the reference.
+ *
+ *  The reference is the current key frame of the current layer, the pegs are
+ *  searched in the selection. Nothing moves until applyPegBarOffsets().
+ *
+ *  @param layers Names of the bitmap layers to align
+ *  @param subPixel Registers on the centre of the pegs to a fraction of a pixel,
+ *                  otherwise on their left and top edges
+ *  @param[out] registrations Receives one entry per key frame
+ */
+Status Editor::findPegBarOffsets(const QStringList& layers, bool subPixel, std::vector<PegRegistration>& registrations)
 {
-    Status::StatusInt retLeft;
-    Status::StatusInt retRight;
+    registrations.clear();
 
-    LayerBitmap* layerbitmap = static_cast<LayerBitmap*>(mLayerManager->currentLayer());
-    BitmapImage* img = layerbitmap->getBitmapImageAtFrame(currentFrame());
-    QRectF rect = select()->mySelectionRect();
-    retLeft = img->findLeft(rect, 121);
-    retRight = img->findTop(rect, 121);
-    if (retLeft.errorcode == Status::FAIL || retRight.errorcode == Status::FAIL)
+    Layer* referenceLayer = mLayerManager->currentLayer();
+    if (referenceLayer == nullptr || referenceLayer->type() != Layer::BITMAP)
     {
-        retLeft.errorcode = Status::FAIL;
-        return retLeft;
+        return Status::ERROR_INVALID_LAYER_TYPE;
     }
-    int peg_x = retLeft.value;
-    int peg_y = retRight.value;
+    BitmapImage* reference = static_cast<LayerBitmap*>(referenceLayer)->getBitmapImageAtFrame(currentFrame());
 
-    // move other layers
-    for (int i = 0; i < layers.count(); i++)
+    PegBarAligner aligner(select()->mySelectionRect(), subPixel ? PegBarAligner::CENTROID : PegBarAligner::EDGES);
+    if (!aligner.findReference(reference))
     {
-        layerbitmap = static_cast<LayerBitmap*>(mLayerManager->findLayerByName(layers.at(i)));
-        for (int k = layerbitmap->firstKeyFramePosition(); k <= layerbitmap->getMaxKeyFramePosition(); k++)
+        return Status::FAIL;
+    }
+
+    QList<int> layerIndexes;
+    for (int i = 0; i < mObject->getLayerCount(); i++)
+    {
+        Layer* layer = mObject->getLayer(i);
+        if (layer->type() == Layer::BITMAP && layers.contains(layer->name()))
         {
-            if (layerbitmap->keyExists(k))
-            {
-                img = layerbitmap->getBitmapImageAtFrame(k);
-                retLeft = img->findLeft(rect, 121);
-                const QString body = tr("Peg bar not found at %1, %2").arg(layerbitmap->name()).arg(k);
-                if (retLeft.errorcode == Status::FAIL)
-                {
-                    emit needDisplayInfoNoTitle(body);
-                    return retLeft;
-                }
-                retRight = img->findTop(rect, 121);
-                if (retRight.errorcode == Status::FAIL)
-                {
-                    emit needDisplayInfoNoTitle(body);
-                    return retRight;
-                }
-                img->moveTopLeft(QPoint(img->left() + (peg_x - retLeft.value), img->top() + (peg_y - retRight.value)));
-            }
+            layerIndexes.append(i);
         }
     }
-    deselectAll();
 
-    return retLeft;
+    aligner.detect(mObject.get(), layerIndexes);
+    registrations = aligner.registrations();
+
+    for (const PegRegistration& registration : registrations)
+    {
+        if (!registration.found)
+        {
+            const QString body = tr("Peg bar not found at %1, %2").arg(mObject->getLayer(registration.layer)->name()).arg(registration.frame);
+            emit needDisplayInfoNoTitle(body);
+            return Status::FAIL;
+        }
+    }
+    return Status::OK;
+}
+
+/** Moves the key frames by the offsets found by findPegBarOffsets(), as a single undo step */
+void Editor::applyPegBarOffsets(const std::vector<PegRegistration>& registrations)
+{
+    BackupBitmapFramesElement* element = new BackupBitmapFramesElement;
+    element->undoText = tr("Peg bar alignment");
+
+    for (const PegRegistration& registration : registrations)
+    {
+        auto layer = static_cast<LayerBitmap*>(mObject->getLayer(registration.layer));
+        if (!registration.found || registration.offset.isNull() || layer == nullptr)
+        {
+            continue;
+        }
+
+        element->save(registration.layer, layer, registration.frame);
+        PegBarAligner::apply(layer->getBitmapImageAtFrame(registration.frame), registration.offset);
+    }
+
+    if (element->frames().empty())
+    {
+        delete element;
+    }
+    else
+    {
+        pushBackup(element);
+    }
+
+    deselectAll();
+    updateCurrentFrame();
 }
 
 void Editor::prepareSave()
@@ -18,7 +18,9 @@ GNU General Public License for more details.
 #ifndef EDITOR_H
 #define EDITOR_H
 
+#include <functional>
 #include <memory>
+#include <vector>
 #include <QObject>
 #include <QList>
 #include "pencilerror.h"
@@ -43,7 +45,10 @@ class SoundManager;
 class ScribbleArea;
 class TimeLine;
 class BackupElement;
+class QTemporaryDir;
 class ActiveFramePool;
+class FrameImporter;
+struct PegRegistration;
 
 enum class SETTING;
 
@@ -101,8 +106,6 @@ public:
      */
     void setLayerVisibility(LayerVisibility visibility);
     LayerVisibility layerVisibility();
-    bool exportSeqCLI(QString filePath, LayerCamera* cameraLayer, QString format = "PNG", int width = -1, int height = -1, int startFrame = 1, int endFrame = -1, bool transparency = false, bool antialias = true);
-    bool exportMovieCLI(QString filePath, LayerCamera* cameraLayer, int width = -1, int height = -1, int startFrame = 1, int endFrame = -1);
 
     qreal viewScaleInversed();
     void deselectAll();
@@ -110,8 +113,6 @@ public:
 
     QString workingDir() const;
 
-    void importMovie(QString filePath, int fps);
-
     // backup
     int mBackupIndex;
     BackupElement* currentBackup();
@@ -138,6 +139,7 @@ public: //slots
 
     bool importImage(QString filePath);
     bool importGIF(QString filePath, int numOfImages = 0);
+    Status importBitmapFrames(FrameImporter& frames, std::function<void(int)> progress);
     void updateFrame(int frameNumber);
     void restoreKey();
 
@@ -156,7 +158,8 @@ public: //slots
     void switchVisibilityOfLayer(int layerNumber);
     void showLayerNotVisibleWarning();
     void swapLayers(int i, int j);
-    Status::StatusInt pegBarAlignment(QStringList layers);
+    Status findPegBarOffsets(const QStringList& layers, bool subPixel, std::vector<PegRegistration>& registrations);
+    void applyPegBarOffsets(const std::vector<PegRegistration>& registrations);
 
     void backup(QString undoText);
     void backup(int layerNumber, int frameNumber, QString undoText);
@@ -223,9 +226,14 @@ private:
 
     // backup
     void clearUndoStack();
+    void pushBackup(BackupElement* element);
+    void enforceUndoBudget();
+    void updateActiveFramePool();
+    QString undoSpillFolder();
     void updateAutoSaveCounter();
     int mLastModifiedFrame = -1;
     int mLastModifiedLayer = -1;
+    std::unique_ptr<QTemporaryDir> mUndoSpillDir; //< where the old undo steps go when over budget
 
     // clipboard
     bool clipboardBitmapOk = true;
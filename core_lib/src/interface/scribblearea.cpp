@@ -19,6 +19,7 @@ GNU General Public License for more details.
 
 #include <cmath>
 #include <QMessageBox>
+#include <QtMath>
 #include <QPixmapCache>
 
 #include "pointerevent.h"
@@ -752,8 +753,8 @@ void ScribbleArea::paintBitmapBuffer()
 
     QRect rect = mEditor->view()->mapCanvasToScreen(mBufferImg->bounds()).toRect();
 
-    drawCanvas(frameNumber, rect.adjusted(-1, -1, 1, 1));
-    update(rect);
+    // The next paint event recomposites the rect, no need to redraw the whole canvas here
+    update(rect.adjusted(-1, -1, 1, 1));
 
     // Update the cache for the last key-frame.
     auto lastKeyFramePosition = mEditor->layers()->LastFrameAtFrame(frameNumber);
@@ -804,8 +805,7 @@ void ScribbleArea::paintBitmapBufferRect(const QRect& rect)
         QPixmapCache::remove(mPixmapCacheKeys[static_cast<unsigned>(frameNumber)]);
         mPixmapCacheKeys[static_cast<unsigned>(frameNumber)] = QPixmapCache::Key();
 
-        drawCanvas(frameNumber, rect.adjusted(-1, -1, 1, 1));
-        update(rect);
+        update(rect.adjusted(-1, -1, 1, 1));
     }
 }
 
@@ -1206,11 +1206,11 @@ void ScribbleArea::drawBrush(QPointF thePoint, qreal brushWidth, qreal mOffset,
 
     if (usingFeather)
     {
-        QRadialGradient radialGrad(thePoint, 0.5 * brushWidth);
-        setGaussianGradient(radialGrad, fillColour, opacity, mOffset);
+        // Same coverage as a gradient from setGaussianGradient(), stamped from a cached mask
+        const BrushDab& dab = mDabCache.dab(brushWidth, mOffset, thePoint);
+        const QPoint topLeft = QPoint(qFloor(thePoint.x()), qFloor(thePoint.y())) + dab.offset;
 
-        mBufferImg->drawEllipse(rectangle, Qt::NoPen, radialGrad,
-                                QPainter::CompositionMode_SourceOver, false);
+        mBufferImg->drawDab(dab, topLeft, BrushDabCache::dabColour(fillColour, opacity, mOffset));
     }
     else
     {
@@ -1225,75 +1225,6 @@ void ScribbleArea::flipSelection(bool flipVertical)
     paintTransformedSelection();
 }
 
-void ScribbleArea::blurBrush(BitmapImage *bmiSource_, QPointF srcPoint_, QPointF thePoint_, qreal brushWidth_, qreal mOffset_, qreal opacity_)
-{
-    QRadialGradient radialGrad(thePoint_, 0.5 * brushWidth_);
-    setGaussianGradient(radialGrad, QColor(255, 255, 255, 127), opacity_, mOffset_);
-
-    QRectF srcRect(srcPoint_.x() - 0.5 * brushWidth_, srcPoint_.y() - 0.5 * brushWidth_, brushWidth_, brushWidth_);
-    QRectF trgRect(thePoint_.x() - 0.5 * brushWidth_, thePoint_.y() - 0.5 * brushWidth_, brushWidth_, brushWidth_);
-
-    BitmapImage bmiSrcClip = bmiSource_->copy(srcRect.toAlignedRect());
-    BitmapImage bmiTmpClip = bmiSrcClip; // TODO: find a shorter way
-
-    bmiTmpClip.drawRect(srcRect, Qt::NoPen, radialGrad, QPainter::CompositionMode_Source, mPrefs->isOn(SETTING::ANTIALIAS));
-    bmiSrcClip.bounds().moveTo(trgRect.topLeft().toPoint());
-    bmiTmpClip.paste(&bmiSrcClip, QPainter::CompositionMode_SourceIn);
-    mBufferImg->paste(&bmiTmpClip);
-}
-
-void ScribbleArea::liquifyBrush(BitmapImage *bmiSource_, QPointF srcPoint_, QPointF thePoint_, qreal brushWidth_, qreal mOffset_, qreal opacity_)
-{
-    QPointF delta = (thePoint_ - srcPoint_); // increment vector
-    QRectF trgRect(thePoint_.x() - 0.5 * brushWidth_, thePoint_.y() - 0.5 * brushWidth_, brushWidth_, brushWidth_);
-
-    QRadialGradient radialGrad(thePoint_, 0.5 * brushWidth_);
-    setGaussianGradient(radialGrad, QColor(255, 255, 255, 255), opacity_, mOffset_);
-
-    // Create gradient brush
-    BitmapImage bmiTmpClip;
-    bmiTmpClip.drawRect(trgRect, Qt::NoPen, radialGrad, QPainter::CompositionMode_Source, mPrefs->isOn(SETTING::ANTIALIAS));
-
-    // Slide texture/pixels of the source image
-    qreal factor, factorGrad;
-
-    for (int yb = bmiTmpClip.top(); yb < bmiTmpClip.bottom(); yb++)
-    {
-        for (int xb = bmiTmpClip.left(); xb < bmiTmpClip.right(); xb++)
-        {
-            QColor color;
-            color.setRgba(bmiTmpClip.pixel(xb, yb));
-            factorGrad = color.alphaF(); // any from r g b a is ok
-
-            int xa = xb - factorGrad * delta.x();
-            int ya = yb - factorGrad * delta.y();
-
-            color.setRgba(bmiSource_->pixel(xa, ya));
-            factor = color.alphaF();
-
-            if (factor > 0.0)
-            {
-                color.setRed(color.red() / factor);
-                color.setGreen(color.green() / factor);
-                color.setBlue(color.blue() / factor);
-                color.setAlpha(255); // Premultiplied color
-
-                color.setRed(color.red()*factorGrad);
-                color.setGreen(color.green()*factorGrad);
-                color.setBlue(color.blue()*factorGrad);
-                color.setAlpha(255 * factorGrad); // Premultiplied color
-
-                bmiTmpClip.setPixel(xb, yb, color.rgba());
-            }
-            else
-            {
-                bmiTmpClip.setPixel(xb, yb, qRgba(255, 255, 255, 0));
-            }
-        }
-    }
-    mBufferImg->paste(&bmiTmpClip);
-}
-
 void ScribbleArea::drawPolyline(QPainterPath path, QPen pen, bool useAA)
 {
     QRectF updateRect = mEditor->view()->mapCanvasToScreen(path.boundingRect().toRect()).adjusted(-1, -1, 1, 1);
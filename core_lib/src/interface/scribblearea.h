@@ -34,6 +34,7 @@ GNU General Public License for more details.
 #include "log.h"
 #include "pencildef.h"
 #include "bitmapimage.h"
+#include "brushdab.h"
 #include "colourref.h"
 #include "vectorselection.h"
 #include "canvaspainter.h"
@@ -158,8 +159,6 @@ public:
     void drawPen(QPointF thePoint, qreal brushWidth, QColor fillColour, bool useAA = true);
     void drawPencil(QPointF thePoint, qreal brushWidth, qreal fixedBrushFeather, QColor fillColour, qreal opacity);
     void drawBrush(QPointF thePoint, qreal brushWidth, qreal offset, QColor fillColour, qreal opacity, bool usingFeather = true, bool useAA = false);
-    void blurBrush(BitmapImage *bmiSource_, QPointF srcPoint_, QPointF thePoint_, qreal brushWidth_, qreal offset_, qreal opacity_);
-    void liquifyBrush(BitmapImage *bmiSource_, QPointF srcPoint_, QPointF thePoint_, qreal brushWidth_, qreal offset_, qreal opacity_);
 
     void paintBitmapBuffer();
     void paintBitmapBufferRect(const QRect& rect);
@@ -243,6 +242,9 @@ private:
     CanvasPainter mCanvasPainter;
     SelectionPainter mSelectionPainter;
 
+    // Feathered stamps of the current brush, see drawBrush()
+    BrushDabCache mDabCache;
+
     // Pixmap Cache keys
     std::vector<QPixmapCache::Key> mPixmapCacheKeys;
 
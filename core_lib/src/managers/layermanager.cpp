@@ -24,6 +24,7 @@ GNU General Public License for more details.
 #include "layerbitmap.h"
 #include "layervector.h"
 #include "layercamera.h"
+#include "keyframeindex.h"
 
 
 LayerManager::LayerManager(Editor* editor) : BaseManager(editor)
@@ -220,54 +221,42 @@ LayerSound* LayerManager::createSoundLayer(const QString& strLayerName)
 
 int LayerManager::LastFrameAtFrame(int frameIndex)
 {
-    Object* o = object();
-    for (int i = frameIndex; i >= 0; i -= 1)
-    {
-        for (int layerIndex = 0; layerIndex < o->getLayerCount(); ++layerIndex)
-        {
-            auto pLayer = o->getLayer(layerIndex);
-            if (pLayer->keyExists(i))
-            {
-                return i;
-            }
-        }
-    }
-    return -1;
+    return object()->keyFrameIndex()->lastKeyAtOrBefore(frameIndex);
 }
 
 int LayerManager::firstKeyFrameIndex()
 {
-    int minPosition = INT_MAX;
-
+    // A layer without key frames starts at 0, see Layer::firstKeyFramePosition()
     Object* o = object();
+    if (o->getLayerCount() == 0)
+    {
+        return INT_MAX;
+    }
     for (int i = 0; i < o->getLayerCount(); ++i)
     {
-        Layer* pLayer = o->getLayer(i);
-
-        int position = pLayer->firstKeyFramePosition();
-        if (position < minPosition)
+        if (o->getLayer(i)->keyFrameCount() == 0)
         {
-            minPosition = position;
+            return 0;
         }
     }
-    return minPosition;
+    return o->keyFrameIndex()->firstKey();
 }
 
 int LayerManager::lastKeyFrameIndex()
 {
-    int maxPosition = 0;
+    return qMax(0, object()->keyFrameIndex()->lastKey());
+}
 
-    for (int i = 0; i < object()->getLayerCount(); ++i)
-    {
-        Layer* pLayer = object()->getLayer(i);
+/** The first key frame of any layer after frameIndex, -1 if there is none */
+int LayerManager::nextKeyFrameIndex(int frameIndex)
+{
+    return object()->keyFrameIndex()->nextKey(frameIndex);
+}
 
-        int position = pLayer->getMaxKeyFramePosition();
-        if (position > maxPosition)
-        {
-            maxPosition = position;
-        }
-    }
-    return maxPosition;
+/** The last key frame of any layer before frameIndex, -1 if there is none */
+int LayerManager::previousKeyFrameIndex(int frameIndex)
+{
+    return object()->keyFrameIndex()->previousKey(frameIndex);
 }
 
 int LayerManager::count()
@@ -325,17 +314,13 @@ void LayerManager::notifyLayerChanged(Layer* layer)
  */
 int LayerManager::animationLength(bool includeSounds)
 {
-    int maxFrame = -1;
+    int maxFrame = object()->keyFrameIndex()->lastKey(false);
 
-    Object* o = object();
-    for (int i = 0; i < o->getLayerCount(); i++)
+    if (includeSounds)
     {
-        if (o->getLayer(i)->type() == Layer::SOUND)
+        // A sound clip lasts past its key frame
+        for (LayerSound* soundLayer : object()->getLayersByType<LayerSound>())
         {
-            if (!includeSounds)
-                continue;
-
-            Layer* soundLayer = o->getLayer(i);
             soundLayer->foreachKeyFrame([&maxFrame](KeyFrame* keyFrame)
             {
                 int endPosition = keyFrame->pos() + (keyFrame->length() - 1);
@@ -345,14 +330,6 @@ int LayerManager::animationLength(bool includeSounds)
                 }
             });
         }
-        else
-        {
-            int lastFramePos = o->getLayer(i)->getMaxKeyFramePosition();
-            if (lastFramePos > maxFrame)
-            {
-                maxFrame = lastFramePos;
-            }
-        }
     }
     return maxFrame;
 }
@@ -65,6 +65,8 @@ public:
     int LastFrameAtFrame(int frameIndex);
     int firstKeyFrameIndex();
     int lastKeyFrameIndex();
+    int nextKeyFrameIndex(int frameIndex);
+    int previousKeyFrameIndex(int frameIndex);
 
     int animationLength(bool includeSounds = true);
     void notifyAnimationLengthChanged();
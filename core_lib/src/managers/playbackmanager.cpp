@@ -372,6 +372,67 @@ void PlaybackManager::stopSounds()
     }
 }
 
+/** Tracks how fast and which way the frames are walked, for upcomingFrames() */
+void PlaybackManager::recordScrub(int frame)
+{
+    const qint64 elapsed = mScrubTimer.isValid() ? mScrubTimer.restart() : -1;
+    if (elapsed < 0)
+    {
+        mScrubTimer.start();
+    }
+
+    const int step = frame - mLastScrubFrame;
+    mLastScrubFrame = frame;
+
+    if (elapsed < 0 || elapsed > 500)
+    {
+        // After a pause only the direction is known
+        mScrubVelocity = (step < 0) ? -1.0 : 1.0;
+        return;
+    }
+    const qreal velocity = step * 1000.0 / qMax<qint64>(elapsed, 1);
+    mScrubVelocity = 0.5 * mScrubVelocity + 0.5 * velocity;
+}
+
+/** Predicts the frames shown after frame, in the order they will be.
+ *
+ *  While playing they follow the playback range and loop, or the flip list.
+ *  Otherwise the scrubbing goes on in the same direction for half a second.
+ */
+QVector<int> PlaybackManager::upcomingFrames(int frame) const
+{
+    QVector<int> frames;
+    if (mFlipTimer && mFlipTimer->isActive())
+    {
+        return mFlipList.mid(1);
+    }
+
+    if (mTimer && mTimer->isActive())
+    {
+        const int count = qBound(4, mFps / 2, 24);
+        int next = frame;
+        for (int i = 0; i < count; i++)
+        {
+            next++;
+            if (next > mEndFrame)
+            {
+                if (!mIsLooping) { break; }
+                next = mStartFrame;
+            }
+            frames.append(next);
+        }
+        return frames;
+    }
+
+    const int direction = (mScrubVelocity < 0) ? -1 : 1;
+    const int count = qBound(2, qRound(qAbs(mScrubVelocity) * 0.5), 24);
+    for (int i = 1; i <= count && frame + direction * i >= 1; i++)
+    {
+        frames.append(frame + direction * i);
+    }
+    return frames;
+}
+
 void PlaybackManager::timerTick()
 {
     int currentFrame = editor()->currentFrame();
@@ -19,6 +19,7 @@ GNU General Public License for more details.
 #define PLAYBACKMANAGER_H
 
 #include "basemanager.h"
+#include <QElapsedTimer>
 #include <QVector>
 
 class QTimer;
@@ -62,6 +63,9 @@ public:
 
     void stopSounds();
 
+    void recordScrub(int frame);
+    QVector<int> upcomingFrames(int frame) const;
+
 Q_SIGNALS:
     void fpsChanged(int fps);
     void loopStateChanged(bool b);
@@ -102,6 +106,10 @@ private:
     bool mCheckForSoundsHalfway = false;
     QVector<int> mListOfActiveSoundFrames;
     QVector<int> mFlipList;
+
+    QElapsedTimer mScrubTimer;
+    int mLastScrubFrame = 1;
+    qreal mScrubVelocity = 0.0; //< frames per second, negative when going backward
 };
 
 #endif // PLAYBACKMANAGER_H
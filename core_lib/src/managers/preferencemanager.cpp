@@ -82,7 +82,9 @@ void PreferenceManager::loadPrefs()
     set(SETTING::BACKGROUND_STYLE,         settings.value(SETTING_BACKGROUND_STYLE,       "white").toString());
 
     set(SETTING::LAYOUT_LOCK,              settings.value(SETTING_LAYOUT_LOCK,            false).toBool());
-    set(SETTING::FRAME_POOL_SIZE,          settings.value(SETTING_FRAME_POOL_SIZE,        200).toInt());
+    set(SETTING::FRAME_POOL_MEMORY_BUDGET, settings.value(SETTING_FRAME_POOL_MEMORY_BUDGET, 1024).toInt()); // in MB
+    set(SETTING::UNDO_MEMORY_BUDGET,       settings.value(SETTING_UNDO_MEMORY_BUDGET,     512).toInt()); // in MB
+    set(SETTING::UNDO_SPILL_TO_DISK,       settings.value(SETTING_UNDO_SPILL_TO_DISK,     true).toBool());
 
     set(SETTING::FPS,                      settings.value(SETTING_FPS,                    12).toInt());
     set(SETTING::FIELD_W,                  settings.value(SETTING_FIELD_W,                800).toInt());
@@ -285,8 +287,11 @@ void PreferenceManager::set(SETTING option, int value)
     case SETTING::TITLE_SAFE:
         settings.setValue(SETTING_TITLE_SAFE, value);
         break;
-    case SETTING::FRAME_POOL_SIZE:
-        settings.setValue(SETTING_FRAME_POOL_SIZE, value);
+    case SETTING::FRAME_POOL_MEMORY_BUDGET:
+        settings.setValue(SETTING_FRAME_POOL_MEMORY_BUDGET, value);
+        break;
+    case SETTING::UNDO_MEMORY_BUDGET:
+        settings.setValue(SETTING_UNDO_MEMORY_BUDGET, value);
         break;
     case SETTING::DRAW_ON_EMPTY_FRAME_ACTION:
         settings.setValue( SETTING_DRAW_ON_EMPTY_FRAME_ACTION, value);
@@ -410,6 +415,9 @@ void PreferenceManager::set(SETTING option, bool value)
     case SETTING::ASK_FOR_PRESET:
         settings.setValue(SETTING_ASK_FOR_PRESET, value);
         break;
+    case SETTING::UNDO_SPILL_TO_DISK:
+        settings.setValue(SETTING_UNDO_SPILL_TO_DISK, value);
+        break;
     default:
         Q_ASSERT(false);
         break;
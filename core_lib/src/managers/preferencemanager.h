@@ -78,7 +78,9 @@ enum class SETTING
     LANGUAGE,
     LAYOUT_LOCK,
     DRAW_ON_EMPTY_FRAME_ACTION,
-    FRAME_POOL_SIZE,
+    FRAME_POOL_MEMORY_BUDGET,
+    UNDO_MEMORY_BUDGET,
+    UNDO_SPILL_TO_DISK,
     ROTATION_INCREMENT,
     ASK_FOR_PRESET,
     DEFAULT_PRESET,
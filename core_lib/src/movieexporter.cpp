@@ -21,6 +21,7 @@ GNU General Public License for more details.
 #include <cstdint>
 #include <QDir>
 #include <QDebug>
+#include <QElapsedTimer>
 #include <QProcess>
 #include <QApplication>
 #include <QStandardPaths>
@@ -287,34 +288,21 @@ Status MovieExporter::generateMovie(
     {
         cameraLayer = obj->getLayersByType< LayerCamera >().front();
     }
-    int currentFrame = frameStart;
 
-    /* We create an image with the correct dimensions and background
-     * color here and then copy this and draw over top of it to
-     * generate each frame. This is faster than having to generate
-     * a new background image for each frame.
-     */
-    QImage imageToExportBase(exportSize, QImage::Format_ARGB32_Premultiplied);
     QColor bgColor = Qt::white;
     if (transparency)
     {
         bgColor.setAlpha(0);
     }
-    imageToExportBase.fill(bgColor);
-
-    QSize camSize = cameraLayer->getViewSize();
-    QTransform centralizeCamera;
-    centralizeCamera.translate(camSize.width() / 2, camSize.height() / 2);
-
-    int failCounter = 0;
-    /* Movie export uses a "sliding window" to reduce memory usage
-     * while having a relatively small impact on speed. This basically
-     * means that there is a maximum number of frames that can be waiting
-     * to be encoded by ffmpeg at any one time. The limit is set by the
-     * frameWindow variable which is designed to take up a maximum of
-     * about 1GB of memory
+
+    /* Frames are rendered ahead of ffmpeg on worker threads. The number
+     * of frames waiting to be encoded at any one time is bounded by
+     * mDesc.frameBudget, about 1GB of memory by default.
      */
-    int frameWindow = static_cast<int>(1e9 / (camSize.width() * camSize.height() * 4.0));
+    FrameRenderPipeline frames(obj, cameraLayer, exportSize, bgColor);
+    frames.setFrameRange(frameStart, frameEnd);
+    frames.setWorkerCount(mDesc.renderThreads);
+    frames.setMemoryBudget(mDesc.frameBudget);
 
     // Build FFmpeg command
 
@@ -355,43 +343,7 @@ Status MovieExporter::generateMovie(
 
     // Run FFmpeg command
 
-    STATUS_CHECK(executeFFMpegPipe(strCmd, progress, [&](QProcess& ffmpeg, int framesProcessed)
-    {
-        if(framesProcessed < 0)
-        {
-            failCounter++;
-        }
-
-        if(currentFrame > frameEnd)
-        {
-            ffmpeg.closeWriteChannel();
-            return false;
-        }
-
-        if((currentFrame - frameStart <= framesProcessed + frameWindow || failCounter > 10) && currentFrame <= frameEnd)
-        {
-            QImage imageToExport = imageToExportBase.copy();
-            QPainter painter(&imageToExport);
-
-            QTransform view = cameraLayer->getViewAtFrame(currentFrame);
-            painter.setWorldTransform(view * centralizeCamera);
-            painter.setWindow(QRect(0, 0, camSize.width(), camSize.height()));
-
-            obj->paintImage(painter, currentFrame, false, true);
-            painter.end();
-
-            // Should use sizeInBytes instead of byteCount to support large images,
-            // but this is only supported in QT 5.10+
-            int bytesWritten = ffmpeg.write(reinterpret_cast<const char*>(imageToExport.constBits()), imageToExport.byteCount());
-            Q_ASSERT(bytesWritten == imageToExport.byteCount());
-
-            currentFrame++;
-            failCounter = 0;
-            return true;
-        }
-
-        return false;
-    }));
+    STATUS_CHECK(executeFFMpegPipe(strCmd, progress, frames));
 
     return Status::OK;
 }
@@ -428,31 +380,23 @@ Status MovieExporter::generateGif(
     bool transparency = false;
     QString strCameraName = mDesc.strCameraName;
     bool loop = mDesc.loop;
-    int bytesWritten;
 
     auto cameraLayer = static_cast<LayerCamera*>(obj->findLayerByName(strCameraName, Layer::CAMERA));
     if (cameraLayer == nullptr)
     {
         cameraLayer = obj->getLayersByType< LayerCamera >().front();
     }
-    int currentFrame = frameStart;
 
-    /* We create an image with the correct dimensions and background
-     * color here and then copy this and draw over top of it to
-     * generate each frame. This is faster than having to generate
-     * a new background image for each frame.
-     */
-    QImage imageToExportBase(exportSize, QImage::Format_ARGB32_Premultiplied);
     QColor bgColor = Qt::white;
     if (transparency)
     {
         bgColor.setAlpha(0);
     }
-    imageToExportBase.fill(bgColor);
 
-    QSize camSize = cameraLayer->getViewSize();
-    QTransform centralizeCamera;
-    centralizeCamera.translate(camSize.width() / 2, camSize.height() / 2);
+    FrameRenderPipeline frames(obj, cameraLayer, exportSize, bgColor);
+    frames.setFrameRange(frameStart, frameEnd);
+    frames.setWorkerCount(mDesc.renderThreads);
+    frames.setMemoryBudget(mDesc.frameBudget);
 
     // Build FFmpeg command
 
@@ -472,39 +416,14 @@ Status MovieExporter::generateGif(
 
     // Run FFmpeg command
 
-    STATUS_CHECK(executeFFMpegPipe(strCmd, progress, [&](QProcess& ffmpeg, int framesProcessed)
-    {
-        /* The GIF FFmpeg command requires the entires stream to be
-         * written before FFmpeg can encode the GIF. This is because
-         * the generated pallete is based off of the colors in all
-         * frames. The only way to avoid this would be to generate
-         * all the frames twice and run two separate commands, which
-         * would likely have unacceptable speed costs.
-         */
-
-        Q_UNUSED(framesProcessed);
-        if(currentFrame > frameEnd)
-        {
-            ffmpeg.closeWriteChannel();
-            return false;
-        }
-
-        QImage imageToExport = imageToExportBase.copy();
-        QPainter painter(&imageToExport);
-
-        QTransform view = cameraLayer->getViewAtFrame(currentFrame);
-        painter.setWorldTransform(view * centralizeCamera);
-        painter.setWindow(QRect(0, 0, camSize.width(), camSize.height()));
-
-        obj->paintImage(painter, currentFrame, false, true);
-
-        bytesWritten = ffmpeg.write(reinterpret_cast<const char*>(imageToExport.constBits()), imageToExport.byteCount());
-        Q_ASSERT(bytesWritten == imageToExport.byteCount());
-
-        currentFrame++;
-
-        return true;
-    }));
+    /* The GIF FFmpeg command requires the entires stream to be
+     * written before FFmpeg can encode the GIF. This is because
+     * the generated pallete is based off of the colors in all
+     * frames. The only way to avoid this would be to generate
+     * all the frames twice and run two separate commands, which
+     * would likely have unacceptable speed costs.
+     */
+    STATUS_CHECK(executeFFMpegPipe(strCmd, progress, frames));
 
     return Status::OK;
 }
@@ -575,8 +494,8 @@ Status MovieExporter::executeFFMpeg(QString strCmd, std::function<void(float)> p
     return Status::OK;
 }
 
-/** Runs the specified command (should be ffmpeg), and lets
- *  writeFrame pipe data into it 1 frame at a time.
+/** Runs the specified command (should be ffmpeg), and pipes the
+ *  frames of a FrameRenderPipeline into it one at a time.
  *
  *  @param[in]  strCmd A string containing the command to execute and
  *              all of its arguments
@@ -584,40 +503,25 @@ Status MovieExporter::executeFFMpeg(QString strCmd, std::function<void(float)> p
  *              (the percentage of the ffmpeg operation complete) and
  *              may display the output to the user in any way it
  *              sees fit.
- *  @param[in]  writeFrame A function that takes two arguments, a
- *              process (the ffmpeg process) and an integer
- *              (frames processed or -1, see full description).
- *              This function should write a single frame to the
- *              process. The function returns true value if it
- *              actually wrote a frame.
+ *  @param[in]  frames The pipeline rendering the frames to encode.
  *
  *  This function operates generally as follows:
  *  1. Spawn process with the command from strCmd
  *  2. Check ffmpeg's output for a progress update.
- *  3. Add frames with writeFrame until it returns false.
+ *  3. Write the next frame once the pipeline has rendered it.
  *  4. Repeat from step 2 until all frames have been written.
  *
- *  The idea is that there are two forms of processing occuring
- *  simultaneously, generating frames to send to ffmpeg, and ffmpeg
- *  encoding those frames. Whether these this actually occur
- *  concurrently or one after another appears to depend on the environment.
- *
- *  The writeFrame function deserves a bit of extra details. It does
- *  not only return false when there is an error in generating or
- *  writing a frame, it also does it when it wants to "return control"
- *  to the rest of the executeFFMpegPipe function for the purposes of
- *  reading updates from ffmpeg's output. This should be done every
- *  once in a while if possible, but with some formats (specifically gif),
- *  all frames must be loaded before any processing can continue, so
- *  there is no point returning false for it until all frames have
- *  been written. writeFrame is also responsible for closing the writeChannel
- *  of the process when it has finished writing all frames. This indicates
- *  to executeFFMpegPipe that it no longer needs to call writeFrame.
+ *  Three stages run concurrently: the pipeline workers render frames,
+ *  this function writes them in order, and ffmpeg encodes them. Writing
+ *  waits for ffmpeg to drain the pipe, so at most about one frame is
+ *  buffered by QProcess and the frames in memory stay within the
+ *  pipeline's budget. The process and the progress callback stay on
+ *  the calling thread.
  *
  *  @return Returns Status::OK if everything went well, and Status::FAIL
  *  and error is detected (usually a non-zero exit code for ffmpeg).
  */
-Status MovieExporter::executeFFMpegPipe(QString strCmd, std::function<void(float)> progress, std::function<bool(QProcess&, int)> writeFrame)
+Status MovieExporter::executeFFMpegPipe(QString strCmd, std::function<void(float)> progress, FrameRenderPipeline& frames)
 {
     qDebug() << strCmd;
 
@@ -630,20 +534,21 @@ Status MovieExporter::executeFFMpegPipe(QString strCmd, std::function<void(float
     {
         int framesGenerated = 0;
         int lastFrameProcessed = 0;
+        bool writeChannelClosed = false;
         const int frameStart = mDesc.startFrame;
         const int frameEnd = mDesc.endFrame;
         while(ffmpeg.state() == QProcess::Running)
         {
             if (mCanceled)
             {
+                frames.cancel();
                 ffmpeg.terminate();
                 return Status::CANCELED;
             }
 
-            // Check FFmpeg progress
+            // Check FFmpeg progress, without blocking while there are frames to write
 
-            int framesProcessed = -1;
-            if(ffmpeg.waitForReadyRead(10))
+            if(ffmpeg.waitForReadyRead(writeChannelClosed ? 10 : 0))
             {
                 QString output(ffmpeg.readAll());
                 QStringList sList = output.split(QRegExp("[\r\n]"), QString::SkipEmptyParts);
@@ -653,23 +558,37 @@ Status MovieExporter::executeFFMpegPipe(QString strCmd, std::function<void(float
                 }
                 if(output.startsWith("frame="))
                 {
-                    lastFrameProcessed = framesProcessed = output.mid(6, output.indexOf(' ')).toInt();
+                    lastFrameProcessed = output.mid(6, output.indexOf(' ')).toInt();
                 }
             }
 
-            if(!ffmpeg.isWritable())
+            if(!writeChannelClosed && ffmpeg.isWritable())
             {
-                continue;
+                QImage frame;
+                if(frames.takeNextFrame(frame, 10))
+                {
+                    QElapsedTimer writeTimer;
+                    writeTimer.start();
+
+                    // Should use sizeInBytes instead of byteCount to support large images,
+                    // but this is only supported in QT 5.10+
+                    qint64 bytesWritten = ffmpeg.write(reinterpret_cast<const char*>(frame.constBits()), frame.byteCount());
+                    Q_ASSERT(bytesWritten == frame.byteCount());
+
+                    while(ffmpeg.bytesToWrite() > frame.byteCount() && ffmpeg.state() == QProcess::Running)
+                    {
+                        ffmpeg.waitForBytesWritten(10);
+                    }
+                    frames.addWriteTime(writeTimer.elapsed());
+                    framesGenerated++;
+                }
+                else if(!frames.hasMoreFrames())
+                {
+                    ffmpeg.closeWriteChannel();
+                    writeChannelClosed = true;
+                }
             }
 
-            while(writeFrame(ffmpeg, framesProcessed))
-            {
-                framesGenerated++;
-
-                const float percentGenerated = framesGenerated / static_cast<float>(frameEnd - frameStart);
-                const float percentConverted = lastFrameProcessed / static_cast<float>(frameEnd - frameStart);
-                progress((percentGenerated + percentConverted) / 2);
-            }
             const float percentGenerated = framesGenerated / static_cast<float>(frameEnd - frameStart);
             const float percentConverted = lastFrameProcessed / static_cast<float>(frameEnd - frameStart);
             progress((percentGenerated + percentConverted) / 2);
@@ -682,6 +601,8 @@ Status MovieExporter::executeFFMpegPipe(QString strCmd, std::function<void(float
             qDebug() << "[ffmpeg]" << s;
         }
 
+        mPipelineStats = frames.stats();
+
         if(ffmpeg.exitStatus() != QProcess::NormalExit)
         {
             qDebug() << "ERROR: FFmpeg crashed";
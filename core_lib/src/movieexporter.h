@@ -22,9 +22,12 @@ GNU General Public License for more details.
 #include <QSize>
 #include <QTemporaryDir>
 #include "pencilerror.h"
+#include "framerenderpipeline.h"
 
 class Object;
-class QProcess;
+
+/** The ffmpeg binary shipped with the application, or the one on the path */
+QString ffmpegLocation();
 
 struct ExportMovieDesc
 {
@@ -37,6 +40,8 @@ struct ExportMovieDesc
     QString strCameraName;
     bool loop = false;
     bool alpha = false;
+    int renderThreads = 0;                   //< 0 renders on one thread per core
+    qint64 frameBudget = 1000 * 1000 * 1000; //< bytes of frames rendered ahead of ffmpeg
 };
 
 class MovieExporter
@@ -51,6 +56,7 @@ public:
                std::function<void(float)> minorProgress,
                std::function<void(QString)> progressMessage);
     QString error();
+    RenderPipelineStats pipelineStats() const { return mPipelineStats; }
 
     void cancel() { mCanceled = true; }
 private:
@@ -59,7 +65,7 @@ private:
     Status generateGif(const Object *obj, QString ffmpeg, QString strOut, std::function<void(float)>  progress);
 
     Status executeFFMpeg(QString strCmd, std::function<void(float)> progress);
-    Status executeFFMpegPipe(QString strCmd, std::function<void(float)> progress, std::function<bool(QProcess&,int)> writeFrame);
+    Status executeFFMpegPipe(QString strCmd, std::function<void(float)> progress, FrameRenderPipeline& frames);
     Status checkInputParameters(const ExportMovieDesc&);
 
 private:
@@ -67,6 +73,7 @@ private:
     QString mTempWorkDir;
     ExportMovieDesc mDesc;
     bool mCanceled = false;
+    RenderPipelineStats mPipelineStats;
 };
 
 #endif // MOVIEEXPORTER_H
@@ -0,0 +1,137 @@
+/*
+
+Pencil - Traditional Animation Software
+Copyright (C) 2012-2018 Matthew Chiawen Chang
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+*/
+
+#include "onionskincache.h"
+
+#include <QPainter>
+
+
+OnionSkinCache::OnionSkinCache(qint64 memoryBudget)
+{
+    setMemoryBudget(memoryBudget);
+}
+
+OnionSkinCache::~OnionSkinCache()
+{
+    clear();
+}
+
+/** Returns source with the colour of its pixels replaced by tint, keeping their alpha.
+ *
+ *  @param[in] keyFrame The key frame source was painted from
+ *  @param[in] source What the key frame paints, a mipmap level or a vector raster
+ *  @param[in] tint The onion skin colour, transparent hides the frame
+ *  @param[in] level The mipmap level of source, 0 for full size
+ */
+QImage OnionSkinCache::tinted(KeyFrame* keyFrame, const QImage& source, QColor tint, int level)
+{
+    const Key key(keyFrame, tint.rgba(), level);
+    auto it = mEntries.find(key);
+    if (it != mEntries.end() && it->second.sourceKey == source.cacheKey())
+    {
+        it->second.lastUse = ++mUseCount;
+        return it->second.image;
+    }
+    if (it != mEntries.end())
+    {
+        remove(it);
+    }
+
+    QImage image(source.size(), QImage::Format_ARGB32_Premultiplied);
+    image.fill(Qt::transparent);
+
+    QPainter painter(&image);
+    painter.drawImage(0, 0, source);
+    painter.setCompositionMode(QPainter::CompositionMode_SourceIn);
+    painter.fillRect(image.rect(), tint);
+    painter.end();
+
+    Entry& entry = mEntries[key];
+    entry.sourceKey = source.cacheKey();
+    entry.image = image;
+    entry.lastUse = ++mUseCount;
+    mBytes += image.byteCount();
+    keyFrame->addEventListener(this);
+
+    discardLeastUsed();
+    return image;
+}
+
+void OnionSkinCache::clear()
+{
+    for (auto& entry : mEntries)
+    {
+        std::get<0>(entry.first)->removeEventListner(this);
+    }
+    mEntries.clear();
+    mBytes = 0;
+}
+
+/** Sets how many bytes the tinted images may hold */
+void OnionSkinCache::setMemoryBudget(qint64 bytes)
+{
+    mMemoryBudget = qMax<qint64>(bytes, 1);
+    discardLeastUsed();
+}
+
+void OnionSkinCache::onKeyFrameDestroy(KeyFrame* keyFrame)
+{
+    // The key frame is going away, so its listeners are left as they are
+    for (auto it = mEntries.begin(); it != mEntries.end();)
+    {
+        if (std::get<0>(it->first) == keyFrame)
+        {
+            mBytes -= it->second.image.byteCount();
+            it = mEntries.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
+
+/** Drops an entry, and stops listening to its key frame once no entry shows it */
+void OnionSkinCache::remove(std::map<Key, Entry>::iterator it)
+{
+    KeyFrame* keyFrame = std::get<0>(it->first);
+    mBytes -= it->second.image.byteCount();
+    mEntries.erase(it);
+
+    // Entries of the same key frame are next to each other in the map
+    auto next = mEntries.lower_bound(Key(keyFrame, 0, 0));
+    if (next == mEntries.end() || std::get<0>(next->first) != keyFrame)
+    {
+        keyFrame->removeEventListner(this);
+    }
+}
+
+void OnionSkinCache::discardLeastUsed()
+{
+    // Always keep the entry used last, it is being painted
+    while (mBytes > mMemoryBudget && mEntries.size() > 1)
+    {
+        auto oldest = mEntries.begin();
+        for (auto it = mEntries.begin(); it != mEntries.end(); ++it)
+        {
+            if (it->second.lastUse < oldest->second.lastUse)
+            {
+                oldest = it;
+            }
+        }
+        remove(oldest);
+    }
+}
@@ -0,0 +1,70 @@
+/*
+
+Pencil - Traditional Animation Software
+Copyright (C) 2012-2018 Matthew Chiawen Chang
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+*/
+
+#ifndef ONIONSKINCACHE_H
+#define ONIONSKINCACHE_H
+
+#include <map>
+#include <tuple>
+#include <QColor>
+#include <QImage>
+#include "keyframe.h"
+
+
+/** Tinted onion skins, kept while the key frames they show do not change.
+ *
+ *  An entry is found by key frame, tint colour and mipmap level, and is only used
+ *  while the image it was tinted from is still the one the key frame paints, compared
+ *  by QImage::cacheKey(). Drawing on a key frame rebuilds its mipmaps and modifying a
+ *  vector frame rasterizes it again, so both give a new source image and the stale
+ *  entry is replaced. Moving the playhead by one frame reuses all the other onion skins.
+ *
+ *  The least recently used entries are dropped to stay within the memory budget.
+ */
+class OnionSkinCache : public KeyFrameEventListener
+{
+public:
+    explicit OnionSkinCache(qint64 memoryBudget = 256 * 1024 * 1024);
+    ~OnionSkinCache();
+
+    QImage tinted(KeyFrame* keyFrame, const QImage& source, QColor tint, int level);
+
+    void clear();
+    int size() const { return static_cast<int>(mEntries.size()); }
+    qint64 byteSize() const { return mBytes; }
+    void setMemoryBudget(qint64 bytes);
+
+    void onKeyFrameDestroy(KeyFrame* keyFrame) override;
+
+private:
+    struct Entry
+    {
+        qint64 sourceKey = 0;
+        QImage image;
+        quint64 lastUse = 0;
+    };
+    using Key = std::tuple<KeyFrame*, QRgb, int>;
+
+    void remove(std::map<Key, Entry>::iterator it);
+    void discardLeastUsed();
+
+    std::map<Key, Entry> mEntries;
+    qint64 mBytes = 0;
+    qint64 mMemoryBudget = 0;
+    quint64 mUseCount = 0;
+};
+
+#endif // ONIONSKINCACHE_H
@@ -0,0 +1,275 @@
+/*
+
+Pencil - Traditional Animation Software
+Copyright (C) 2012-2018 Matthew Chiawen Chang
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+*/
+
+#include "pegbaraligner.h"
+
+#include <cmath>
+#include <memory>
+#include <QRunnable>
+#include <QThread>
+#include <QThreadPool>
+
+#include "object.h"
+#include "layer.h"
+#include "keyframe.h"
+#include "bitmapimage.h"
+#include "pixelkernels.h"
+#include "transformsession.h"
+
+
+/** The pixels of one key frame to search: a copy of the peg area of a loaded
+ *  key frame, or the file of a key frame that is still on disk.
+ */
+struct PegSource
+{
+    std::shared_ptr<BitmapImage> area;
+    QString fileName;
+    QPoint fileTopLeft;
+};
+
+
+/** Searches the peg area of one key frame on a worker thread.
+ *
+ *  A key frame still on disk is decoded here and the image dropped after
+ *  the search, so the key frame itself stays unloaded.
+ */
+class PegSearchTask : public QRunnable
+{
+public:
+    PegSearchTask(const PegSource& source, PegRegistration* registration, const QRect& pegArea,
+                  PegBarAligner::Mode mode, int grayThreshold, QPointF reference)
+        : mSource(source), mRegistration(registration), mPegArea(pegArea)
+        , mMode(mode), mGrayThreshold(grayThreshold), mReference(reference) {}
+
+    void run() override
+    {
+        QImage image;
+        QPoint topLeft;
+        if (mSource.area != nullptr)
+        {
+            image = *mSource.area->image();
+            topLeft = mSource.area->topLeft();
+        }
+        else
+        {
+            // findPeg() only reads the pixels under the peg area
+            image = BitmapImage::decodeFile(mSource.fileName);
+            topLeft = mSource.fileTopLeft;
+        }
+
+        mRegistration->found = PegBarAligner::findPeg(image, topLeft, mPegArea,
+                                                      mMode, mGrayThreshold, mRegistration->peg);
+        if (mRegistration->found)
+        {
+            mRegistration->offset = mReference - mRegistration->peg;
+        }
+    }
+
+private:
+    PegSource mSource;
+    PegRegistration* mRegistration;
+    QRect mPegArea;
+    PegBarAligner::Mode mMode;
+    int mGrayThreshold;
+    QPointF mReference;
+};
+
+
+PegBarAligner::PegBarAligner(const QRectF& pegArea, Mode mode, int grayThreshold)
+    : mMode(mode)
+    , mGrayThreshold(grayThreshold)
+{
+    // Both edges are in, like the selection was always searched
+    mPegArea = QRect(QPoint(static_cast<int>(pegArea.left()), static_cast<int>(pegArea.top())),
+                     QPoint(static_cast<int>(pegArea.right()), static_cast<int>(pegArea.bottom())));
+}
+
+/** Finds the pegs every other key frame is registered on */
+bool PegBarAligner::findReference(BitmapImage* reference)
+{
+    if (reference == nullptr)
+    {
+        return false;
+    }
+    BitmapImage area = reference->copy(mPegArea);
+    const QImage image = *area.image();
+    return findPeg(image, area.topLeft(), mPegArea, mMode, mGrayThreshold, mReference);
+}
+
+/** Finds the pegs on every key frame of the bitmap layers, on worker threads */
+void PegBarAligner::detect(const Object* object, const QList<int>& layers)
+{
+    mRegistrations.clear();
+
+    std::vector<PegSource> sources;
+    for (int layerIndex : layers)
+    {
+        Layer* layer = object->getLayer(layerIndex);
+        if (layer == nullptr || layer->type() != Layer::BITMAP)
+        {
+            continue;
+        }
+
+        layer->foreachKeyFrame([&](KeyFrame* key)
+        {
+            PegRegistration registration;
+            registration.layer = layerIndex;
+            registration.frame = key->pos();
+            mRegistrations.push_back(registration);
+
+            BitmapImage* bitmap = static_cast<BitmapImage*>(key);
+            PegSource source;
+            if (bitmap->loadsFromFile())
+            {
+                // Decoded by the worker, loading it here would block the calling thread
+                source.fileName = bitmap->fileName();
+                source.fileTopLeft = bitmap->topLeft();
+            }
+            else
+            {
+                // Only the tiles under the peg area are shared with the drawing
+                source.area = std::make_shared<BitmapImage>(bitmap->copy(mPegArea));
+            }
+            sources.push_back(source);
+        });
+    }
+
+    QThreadPool workers;
+    workers.setMaxThreadCount(mWorkerCount > 0 ? mWorkerCount : QThread::idealThreadCount());
+    for (size_t i = 0; i < mRegistrations.size(); i++)
+    {
+        workers.start(new PegSearchTask(sources[i], &mRegistrations[i], mPegArea, mMode, mGrayThreshold, mReference));
+    }
+    workers.waitForDone();
+}
+
+bool PegBarAligner::allFound() const
+{
+    for (const PegRegistration& registration : mRegistrations)
+    {
+        if (!registration.found)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/** Moves a drawing by offset. A fraction of a pixel is resampled, whole pixels only move the bounds. */
+void PegBarAligner::apply(BitmapImage* image, QPointF offset)
+{
+    const QPoint whole(static_cast<int>(std::floor(offset.x())), static_cast<int>(std::floor(offset.y())));
+    const QPointF fraction = offset - whole;
+
+    // Less than a step of the bilinear weights
+    const qreal step = 1.0 / 256;
+    if (fraction.x() < step && fraction.y() < step)
+    {
+        image->moveTopLeft(image->topLeft() + whole);
+        return;
+    }
+    if (image->bounds().isEmpty())
+    {
+        return;
+    }
+
+    const QImage source = image->image()->convertToFormat(QImage::Format_ARGB32_Premultiplied);
+    const QPoint topLeft = image->topLeft();
+
+    // One more pixel on the side the fraction slides over
+    QImage* shifted = new QImage(source.width() + (fraction.x() < step ? 0 : 1),
+                                 source.height() + (fraction.y() < step ? 0 : 1),
+                                 QImage::Format_ARGB32_Premultiplied);
+    TransformSession::resample(source, QTransform::fromTranslate(-fraction.x(), -fraction.y()), *shifted, true);
+
+    image->setImage(shifted);
+    image->moveTopLeft(topLeft + whole);
+}
+
+/** Finds the pegs in the part of image under pegArea.
+ *
+ *  @param image A premultiplied ARGB32 image
+ *  @param topLeft Where image is on the canvas
+ *  @param pegArea The area to search, on the canvas
+ *  @param[out] peg Receives the position of the pegs on the canvas
+ *
+ *  @return False if there is no dark pixel in the area
+ */
+bool PegBarAligner::findPeg(const QImage& image, QPoint topLeft, const QRect& pegArea,
+                            Mode mode, int grayThreshold, QPointF& peg)
+{
+    const QRect area = pegArea.intersected(QRect(topLeft, image.size()));
+    if (area.isEmpty() || image.isNull())
+    {
+        return false;
+    }
+
+    std::vector<quint8> mask(static_cast<size_t>(area.width()));
+
+    int left = area.right() + 1;
+    int top = -1;
+    double weightSum = 0;
+    double xSum = 0;
+    double ySum = 0;
+
+    for (int y = area.top(); y <= area.bottom(); y++)
+    {
+        const QRgb* row = reinterpret_cast<const QRgb*>(image.constScanLine(y - topLeft.y())) + (area.left() - topLeft.x());
+        PixelKernels::darkMaskRow(row, area.width(), grayThreshold, mask.data());
+
+        for (int x = 0; x < area.width(); x++)
+        {
+            if (mask[x] == 0)
+            {
+                continue;
+            }
+
+            if (mode == EDGES)
+            {
+                if (top < 0)
+                {
+                    top = y;
+                }
+                left = qMin(left, area.left() + x);
+
+                // Nothing further right on this row can be more to the left
+                break;
+            }
+
+            const double weight = grayThreshold - qGray(row[x]);
+            weightSum += weight;
+            xSum += weight * (area.left() + x + 0.5);
+            ySum += weight * (y + 0.5);
+        }
+    }
+
+    if (mode == EDGES)
+    {
+        if (top < 0)
+        {
+            return false;
+        }
+        peg = QPointF(left, top);
+        return true;
+    }
+
+    if (weightSum <= 0)
+    {
+        return false;
+    }
+    peg = QPointF(xSum / weightSum, ySum / weightSum);
+    return true;
+}
@@ -0,0 +1,84 @@
+/*
+
+Pencil - Traditional Animation Software
+Copyright (C) 2012-2018 Matthew Chiawen Chang
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+*/
+
+#ifndef PEGBARALIGNER_H
+#define PEGBARALIGNER_H
+
+#include <vector>
+#include <QImage>
+#include <QList>
+#include <QPointF>
+#include <QRect>
+
+class Object;
+class BitmapImage;
+
+
+/** Where the pegs were found on one key frame, and how far it moves to match the reference */
+struct PegRegistration
+{
+    int layer = -1;  //< index of the layer in the Object
+    int frame = 0;
+    bool found = false;
+    QPointF peg;
+    QPointF offset;
+};
+
+
+/** Registers the key frames of bitmap layers on the pegs of a reference drawing.
+ *
+ *  The pegs are the opaque pixels darker than a gray level in the peg area.
+ *  EDGES takes the leftmost and the topmost of them, which is exact to the pixel.
+ *  CENTROID takes their centre of mass weighted by how dark they are, which
+ *  registers scans that moved by a fraction of a pixel.
+ *
+ *  detect() only visits existing key frames. The peg area of each loaded one is
+ *  copied on the calling thread, the ones still on disk are decoded by the workers
+ *  without being loaded into the layer. The search runs on a pool of worker threads
+ *  and the results can be looked at before apply() moves the drawings.
+ */
+class PegBarAligner
+{
+public:
+    enum Mode { EDGES, CENTROID };
+
+    PegBarAligner(const QRectF& pegArea, Mode mode = EDGES, int grayThreshold = 121);
+
+    void setWorkerCount(int count) { mWorkerCount = count; }
+
+    bool findReference(BitmapImage* reference);
+    QPointF reference() const { return mReference; }
+
+    void detect(const Object* object, const QList<int>& layers);
+    const std::vector<PegRegistration>& registrations() const { return mRegistrations; }
+    bool allFound() const;
+
+    static void apply(BitmapImage* image, QPointF offset);
+
+    static bool findPeg(const QImage& image, QPoint topLeft, const QRect& pegArea,
+                        Mode mode, int grayThreshold, QPointF& peg);
+
+private:
+    QRect mPegArea;
+    Mode mMode = EDGES;
+    int mGrayThreshold = 121;
+    int mWorkerCount = 0;
+
+    QPointF mReference;
+    std::vector<PegRegistration> mRegistrations;
+};
+
+#endif // PEGBARALIGNER_H
@@ -19,6 +19,8 @@ GNU General Public License for more details.
 #include <QDir>
 #include <QDebug>
 #include <QDirIterator>
+#include <QSaveFile>
+#include <vector>
 #include "miniz.h"
 #include "util.h"
 
@@ -38,8 +40,101 @@ bool MiniZ::isZip(const QString& sZipFilePath)
     return (num > 0);
 }
 
+namespace
+{
+    /** One file of the archive being written */
+    struct ZipEntry
+    {
+        QString filePath;
+        QByteArray archiveName;
+
+        int previousIndex = -1; // entry of the same name in the previous archive
+        mz_uint64 previousSize = 0;
+        mz_uint32 previousCrc = 0;
+
+        bool readOK = false;
+        bool reused = false;     // same bytes as the previous entry, copied raw
+        bool deflated = false;   // data holds a raw deflate stream
+        QByteArray data;
+        mz_uint64 size = 0;
+        mz_uint32 crc = 0;
+    };
+
+    // Files smaller than this are left to the writer to store
+    const int MIN_DEFLATE_SIZE = 64;
+    // Maximum file bytes read and compressed ahead of the writer
+    const qint64 MAX_BATCH_BYTES = 128 * 1024 * 1024;
+
+    /** Reads one file and compresses it, unless the previous archive already has it.
+     *  Runs on a worker thread and only touches entry.
+     */
+    void prepareEntry(ZipEntry& entry)
+    {
+        QFile file(entry.filePath);
+        if (!file.open(QFile::ReadOnly))
+        {
+            return;
+        }
+        QByteArray content = file.readAll();
+        file.close();
+
+        entry.readOK = true;
+        entry.size = static_cast<mz_uint64>(content.size());
+        entry.crc = static_cast<mz_uint32>(mz_crc32(MZ_CRC32_INIT,
+                                                    reinterpret_cast<const unsigned char*>(content.constData()),
+                                                    static_cast<size_t>(content.size())));
+
+        if (entry.previousIndex >= 0 && entry.previousSize == entry.size && entry.previousCrc == entry.crc)
+        {
+            entry.reused = true;
+            return;
+        }
+
+        if (content.size() >= MIN_DEFLATE_SIZE)
+        {
+            // Same parameters as mz_zip_writer_add_mem uses for MZ_BEST_SPEED
+            const int flags = static_cast<int>(tdefl_create_comp_flags_from_zip_params(MZ_BEST_SPEED, -MZ_DEFAULT_WINDOW_BITS, MZ_DEFAULT_STRATEGY));
+            size_t deflatedSize = 0;
+            void* deflated = tdefl_compress_mem_to_heap(content.constData(), static_cast<size_t>(content.size()), &deflatedSize, flags);
+            if (deflated != nullptr)
+            {
+                entry.data = QByteArray(static_cast<const char*>(deflated), static_cast<int>(deflatedSize));
+                entry.deflated = true;
+                mz_free(deflated);
+                return;
+            }
+        }
+        entry.data = content;
+    }
+
+    size_t writeToSaveFile(void* opaque, mz_uint64 offset, const void* buffer, size_t n)
+    {
+        QSaveFile* file = static_cast<QSaveFile*>(opaque);
+        if (file->pos() != static_cast<qint64>(offset) && !file->seek(static_cast<qint64>(offset)))
+        {
+            return 0;
+        }
+        const qint64 written = file->write(static_cast<const char*>(buffer), static_cast<qint64>(n));
+        return (written < 0) ? 0 : static_cast<size_t>(written);
+    }
+}
+
+/** Zips the files of fileList into zipFilePath.
+ *
+ *  @param[in] zipFilePath The archive to write
+ *  @param[in] srcFolderPath The folder the archive paths are relative to
+ *  @param[in] fileList The files to add, all inside srcFolderPath
+ *  @param[in] previousZipPath An earlier archive of the same folder, may be empty.
+ *             Files whose size and CRC match its entry of the same name are
+ *             copied raw from it instead of being compressed again.
+ *
+ *  The other files are compressed in parallel, in batches so the compressed data
+ *  waiting for the writer stays bounded. The archive is written to a temporary
+ *  file that only replaces zipFilePath once it is complete, so a failed save
+ *  leaves the previous file untouched. previousZipPath may be zipFilePath itself.
+ */
 // ReSharper disable once CppInconsistentNaming
-Status MiniZ::compressFolder(QString zipFilePath, QString srcFolderPath, const QStringList& fileList)
+Status MiniZ::compressFolder(QString zipFilePath, QString srcFolderPath, const QStringList& fileList, QString previousZipPath)
 {
     DebugDetails dd;
     dd << QString("Creating Zip %1 from folder %2").arg(zipFilePath).arg(srcFolderPath);
@@ -49,43 +144,143 @@ Status MiniZ::compressFolder(QString zipFilePath, QString srcFolderPath, const Q
         srcFolderPath.append("/");
     }
 
+    mz_zip_archive* previous = new mz_zip_archive;
+    OnScopeExit(delete previous);
+    mz_zip_zero_struct(previous);
+
+    bool hasPrevious = false;
+    if (!previousZipPath.isEmpty() && QFile::exists(previousZipPath))
+    {
+        hasPrevious = mz_zip_reader_init_file(previous, previousZipPath.toUtf8().data(), 0);
+        dd << QString("Previous archive %1: %2").arg(previousZipPath).arg(hasPrevious ? "reusing unchanged files" : "unreadable");
+    }
+    OnScopeExit(if (hasPrevious) mz_zip_reader_end(previous));
+
+    std::vector<ZipEntry> entries(static_cast<size_t>(fileList.size()));
+    mz_zip_archive_file_stat* stat = new mz_zip_archive_file_stat;
+    OnScopeExit(delete stat);
+
+    for (int i = 0; i < fileList.size(); ++i)
+    {
+        ZipEntry& entry = entries[static_cast<size_t>(i)];
+        entry.filePath = fileList[i];
+
+        QString sRelativePath = entry.filePath;
+        sRelativePath.replace(srcFolderPath, "");
+        entry.archiveName = sRelativePath.toUtf8();
+
+        if (hasPrevious)
+        {
+            int index = mz_zip_reader_locate_file(previous, entry.archiveName.constData(), nullptr, MZ_ZIP_FLAG_CASE_SENSITIVE);
+            if (index >= 0 && mz_zip_reader_file_stat(previous, static_cast<mz_uint>(index), stat) && !stat->m_is_directory)
+            {
+                entry.previousIndex = index;
+                entry.previousSize = stat->m_uncomp_size;
+                entry.previousCrc = stat->m_crc32;
+            }
+        }
+    }
+
+    QSaveFile saveFile(zipFilePath);
+    if (!saveFile.open(QIODevice::WriteOnly))
+    {
+        dd << QString("Cannot open %1 for writing: %2").arg(zipFilePath).arg(saveFile.errorString());
+        return Status(Status::FAIL, dd);
+    }
+
     mz_zip_archive* mz = new mz_zip_archive;
     OnScopeExit(delete mz);
     mz_zip_zero_struct(mz);
+    mz->m_pWrite = writeToSaveFile;
+    mz->m_pIO_opaque = &saveFile;
 
-    mz_bool ok = mz_zip_writer_init_file(mz, zipFilePath.toUtf8().data(), 0);
+    mz_bool ok = mz_zip_writer_init(mz, 0);
     if (!ok)
     {
         mz_zip_error err = mz_zip_get_last_error(mz);
         dd << QString("Miniz writer init failed: %1").arg((int)err);
     }
 
-    //qDebug() << "SrcFolder=" << srcFolderPath;
-    for (const QString& filePath : fileList)
+    int reusedCount = 0;
+    size_t batchBegin = 0;
+    while (ok && batchBegin < entries.size())
     {
-        QString sRelativePath = filePath;
-        sRelativePath.replace(srcFolderPath, "");
+        // Take files until the batch holds enough bytes to keep every worker busy
+        size_t batchEnd = batchBegin;
+        qint64 batchBytes = 0;
+        while (batchEnd < entries.size() && (batchEnd == batchBegin || batchBytes < MAX_BATCH_BYTES))
+        {
+            batchBytes += QFileInfo(entries[batchEnd].filePath).size();
+            batchEnd++;
+        }
 
-        dd << QString("Add file to zip: ").append(sRelativePath);
+        parallelFor(static_cast<int>(batchEnd - batchBegin), [&entries, batchBegin](int i)
+        {
+            prepareEntry(entries[batchBegin + static_cast<size_t>(i)]);
+        });
 
-        ok = mz_zip_writer_add_file(mz,
-                                    sRelativePath.toUtf8().data(),
-                                    filePath.toUtf8().data(),
-                                    "", 0, MZ_BEST_SPEED);
-        if (!ok)
+        // The archive itself is written in order, on this thread
+        for (size_t i = batchBegin; i < batchEnd; ++i)
         {
-            mz_zip_error err = mz_zip_get_last_error(mz);
-            dd << QString("  Cannot add %1: error %2, %3").arg(sRelativePath).arg((int)err).arg(mz_zip_get_error_string(err));
+            ZipEntry& entry = entries[i];
+            const char* name = entry.archiveName.constData();
+            dd << QString("Add file to zip: ").append(QString::fromUtf8(entry.archiveName));
+
+            mz_bool added = false;
+            if (!entry.readOK)
+            {
+                dd << QString("  Cannot read %1").arg(entry.filePath);
+            }
+            else if (entry.reused)
+            {
+                added = mz_zip_writer_add_from_zip_reader(mz, previous, static_cast<mz_uint>(entry.previousIndex));
+                reusedCount += (added) ? 1 : 0;
+            }
+            else if (entry.deflated)
+            {
+                added = mz_zip_writer_add_mem_ex_v2(mz, name, entry.data.constData(), static_cast<size_t>(entry.data.size()),
+                                                    "", 0, MZ_BEST_SPEED | MZ_ZIP_FLAG_COMPRESSED_DATA,
+                                                    entry.size, entry.crc, nullptr, nullptr, 0, nullptr, 0);
+            }
+            else
+            {
+                added = mz_zip_writer_add_mem(mz, name, entry.data.constData(), static_cast<size_t>(entry.data.size()), MZ_BEST_SPEED);
+            }
+
+            if (!added)
+            {
+                ok = false;
+                mz_zip_error err = mz_zip_get_last_error(mz);
+                dd << QString("  Cannot add %1: error %2, %3").arg(entry.filePath).arg((int)err).arg(mz_zip_get_error_string(err));
+            }
+            entry.data.clear();
         }
+        batchBegin = batchEnd;
     }
+    dd << QString("%1 of %2 files copied from the previous archive").arg(reusedCount).arg(entries.size());
+
     ok &= mz_zip_writer_finalize_archive(mz);
     mz_zip_writer_end(mz);
 
     if (!ok)
     {
+        saveFile.cancelWriting();
         dd << "Miniz finalize archive failed";
         return Status(Status::FAIL, dd);
     }
+
+    // The previous archive may be the file being replaced
+    if (hasPrevious)
+    {
+        mz_zip_reader_end(previous);
+        hasPrevious = false;
+    }
+
+    if (!saveFile.commit())
+    {
+        dd << QString("Cannot replace %1: %2").arg(zipFilePath).arg(saveFile.errorString());
+        return Status(Status::FAIL, dd);
+    }
     return Status::OK;
 }
 
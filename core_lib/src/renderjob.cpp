@@ -0,0 +1,281 @@
+/*
+
+Pencil - Traditional Animation Software
+Copyright (C) 2012-2018 Matthew Chiawen Chang
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+*/
+
+#include "renderjob.h"
+
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+
+#include "object.h"
+#include "layercamera.h"
+#include "keyframe.h"
+#include "filemanager.h"
+#include "movieexporter.h"
+
+
+namespace
+{
+    struct ImageFormat
+    {
+        const char* extension;
+        const char* format;
+        bool alpha;
+    };
+
+    const ImageFormat imageFormats[] =
+    {
+        { "png",  "PNG",  true },
+        { "jpg",  "JPG",  false },
+        { "jpeg", "JPG",  false },
+        { "tif",  "TIFF", true },
+        { "tiff", "TIFF", true },
+        { "bmp",  "BMP",  false },
+    };
+
+    const char* const movieExtensions[] = { "mp4", "avi", "gif", "webm", "apng" };
+}
+
+RenderJob::RenderJob(const RenderJobDesc& desc) : mDesc(desc)
+{
+}
+
+RenderJob::~RenderJob()
+{
+}
+
+/** Loads the project, then resolves the camera, the frame range and the export size. */
+Status RenderJob::load()
+{
+    mCamera = nullptr;
+
+    FileManager fm;
+    mObject.reset(fm.load(mDesc.projectFile));
+    if (mObject == nullptr)
+    {
+        return fm.error();
+    }
+
+    if (!mDesc.cameraName.isEmpty())
+    {
+        // Falls back on the first camera, camera() tells which one was used
+        mCamera = static_cast<LayerCamera*>(mObject->findLayerByName(mDesc.cameraName, Layer::CAMERA));
+    }
+    if (mCamera == nullptr)
+    {
+        std::vector<LayerCamera*> cameras = mObject->getLayersByType<LayerCamera>();
+        if (cameras.empty())
+        {
+            return Status::ERROR_NEED_AT_LEAST_ONE_CAMERA_LAYER;
+        }
+        mCamera = cameras.front();
+    }
+
+    // A start before the first frame starts on it, see RenderJobDesc for the end
+    mFirstFrame = qMax(1, mDesc.startFrame);
+    mLastFrame = mDesc.endFrame;
+    if (mLastFrame < -1)
+    {
+        mLastFrame = animationLength(mObject.get(), true);
+    }
+    if (mLastFrame < 0)
+    {
+        mLastFrame = animationLength(mObject.get(), false);
+    }
+
+    const QRect viewRect = mCamera->getViewRect();
+    mExportSize = QSize((mDesc.exportSize.width() < 0) ? viewRect.width() : mDesc.exportSize.width(),
+                        (mDesc.exportSize.height() < 0) ? viewRect.height() : mDesc.exportSize.height());
+    return Status::OK;
+}
+
+/** Renders the range to the output file, loading the project first if need be. */
+Status RenderJob::run()
+{
+    if (mObject == nullptr)
+    {
+        STATUS_CHECK(load());
+    }
+    if (mLastFrame < mFirstFrame)
+    {
+        DebugDetails dd;
+        dd << QString("Nothing to render between frames %1 and %2").arg(mFirstFrame).arg(mLastFrame);
+        return Status(Status::INVALID_ARGUMENT, dd);
+    }
+
+    return isMovieFile(mDesc.outputFile) ? renderMovie() : renderImageSequence();
+}
+
+bool RenderJob::isMovieFile(const QString& fileName)
+{
+    const QString extension = QFileInfo(fileName).suffix().toLower();
+    for (const char* movieExtension : movieExtensions)
+    {
+        if (extension == movieExtension)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/** The last frame drawn on, or heard on if includeSounds, like LayerManager::animationLength() */
+int RenderJob::animationLength(const Object* object, bool includeSounds)
+{
+    int maxFrame = -1;
+    for (int i = 0; i < object->getLayerCount(); i++)
+    {
+        Layer* layer = object->getLayer(i);
+        if (layer->type() == Layer::SOUND)
+        {
+            if (!includeSounds)
+            {
+                continue;
+            }
+            layer->foreachKeyFrame([&maxFrame](KeyFrame* keyFrame)
+            {
+                maxFrame = qMax(maxFrame, keyFrame->pos() + (keyFrame->length() - 1));
+            });
+        }
+        else
+        {
+            maxFrame = qMax(maxFrame, layer->getMaxKeyFramePosition());
+        }
+    }
+    return maxFrame;
+}
+
+/** Writes each frame as it comes out of the pipeline, named like Object::exportFrames() does */
+Status RenderJob::renderImageSequence()
+{
+    const QFileInfo outputInfo(mDesc.outputFile);
+    const QString extension = outputInfo.suffix().toLower();
+
+    ImageFormat format = imageFormats[0];
+    QString prefix = mDesc.outputFile;
+    for (const ImageFormat& f : imageFormats)
+    {
+        if (extension == f.extension)
+        {
+            format = f;
+            prefix.chop(extension.size() + 1);
+            break;
+        }
+    }
+
+    // Formats without an alpha channel get the background
+    QColor background = Qt::white;
+    if (mDesc.transparency && format.alpha)
+    {
+        background.setAlpha(0);
+    }
+
+    FrameRenderPipeline frames(mObject.get(), mCamera, mExportSize, background);
+    frames.setFrameRange(mFirstFrame, mLastFrame);
+    frames.setWorkerCount(mDesc.renderThreads);
+    frames.setMemoryBudget(mDesc.frameBudget);
+    frames.setAntialiasing(mDesc.antialiasing);
+    frames.setSkipRepeatedFrames(true);
+
+    DebugDetails dd;
+    dd << QString("Render %1 frames %2 to %3 into %4")
+          .arg(mDesc.projectFile).arg(mFirstFrame).arg(mLastFrame).arg(mDesc.outputFile);
+
+    bool ok = true;
+    QString lastFileName;
+    int frameNumber = mFirstFrame;
+    const int frameCount = mLastFrame - mFirstFrame + 1;
+    while (frames.hasMoreFrames())
+    {
+        if (mCanceled)
+        {
+            frames.cancel();
+            mStats = frames.stats();
+            return Status::CANCELED;
+        }
+
+        QImage image;
+        if (!frames.takeNextFrame(image, 100))
+        {
+            continue;
+        }
+
+        QElapsedTimer writeTimer;
+        writeTimer.start();
+
+        // A repeated frame is a copy of the last file written
+        const QString fileName = QString("%1%2.%3").arg(prefix).arg(frameNumber, 4, 10, QChar('0')).arg(format.extension);
+        bool written = false;
+        if (image.isNull())
+        {
+            QFile::remove(fileName);
+            written = QFile::copy(lastFileName, fileName);
+        }
+        else
+        {
+            written = image.save(fileName, format.format);
+        }
+        if (!written)
+        {
+            ok = false;
+            dd << QString("Cannot write ").append(fileName);
+        }
+        lastFileName = fileName;
+        frames.addWriteTime(writeTimer.elapsed());
+
+        frameNumber++;
+        if (mProgress)
+        {
+            mProgress((frameNumber - mFirstFrame) / static_cast<float>(frameCount));
+        }
+    }
+
+    mStats = frames.stats();
+    return (ok) ? Status::OK : Status(Status::FAIL, dd);
+}
+
+Status RenderJob::renderMovie()
+{
+    ExportMovieDesc desc;
+    desc.strFileName = mDesc.outputFile;
+    desc.startFrame = mFirstFrame;
+    desc.endFrame = mLastFrame;
+    desc.fps = mObject->data()->getFrameRate();
+    desc.exportSize = mExportSize;
+    desc.strCameraName = mCamera->name();
+    desc.alpha = mDesc.transparency;
+    desc.renderThreads = mDesc.renderThreads;
+    desc.frameBudget = mDesc.frameBudget;
+
+    // The exporter reports progress on this thread, which is where it can be canceled from
+    MovieExporter exporter;
+    Status st = exporter.run(mObject.get(), desc,
+                             [](float, float) {},
+                             [this, &exporter](float f)
+                             {
+                                 if (mCanceled)
+                                 {
+                                     exporter.cancel();
+                                 }
+                                 if (mProgress)
+                                 {
+                                     mProgress(f);
+                                 }
+                             },
+                             [](QString) {});
+    mStats = exporter.pipelineStats();
+    return st;
+}
@@ -0,0 +1,97 @@
+/*
+
+Pencil - Traditional Animation Software
+Copyright (C) 2012-2018 Matthew Chiawen Chang
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+*/
+
+#ifndef RENDERJOB_H
+#define RENDERJOB_H
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <QSize>
+#include <QString>
+#include "pencilerror.h"
+#include "framerenderpipeline.h"
+
+class Object;
+class LayerCamera;
+
+
+/** What a RenderJob renders, and where to */
+struct RenderJobDesc
+{
+    QString projectFile;
+    QString outputFile;       //< the extension picks an image sequence or a movie
+    QString cameraName;       //< empty picks the first camera layer
+    int startFrame = 1;
+    int endFrame = -1;        //< -1 ends on the last key frame, -2 on the end of the last sound clip
+    QSize exportSize{ -1, -1 }; //< a negative side takes the one of the camera
+    bool transparency = false;
+    bool antialiasing = true;
+    int renderThreads = 0;                   //< 0 renders on one thread per core
+    qint64 frameBudget = 1000 * 1000 * 1000; //< bytes of frames rendered ahead of the writer
+};
+
+
+/** Loads a project and renders a range of it through a camera, without an Editor.
+ *
+ *  Nothing here touches a widget, the preferences or the sound player, so a job runs
+ *  under a QGuiApplication on the offscreen platform and several jobs can run at the
+ *  same time on different threads of one process. Each job owns its Object, which
+ *  is loaded and rendered on the thread that calls run().
+ *
+ *  Image sequences are written straight from a FrameRenderPipeline, movies go
+ *  through MovieExporter and need ffmpeg like the export dialog does.
+ */
+class RenderJob
+{
+public:
+    explicit RenderJob(const RenderJobDesc& desc);
+    ~RenderJob();
+
+    Status load();
+    Status run();
+    void cancel() { mCanceled = true; }
+
+    void setProgressCallback(std::function<void(float)> progress) { mProgress = progress; }
+
+    const RenderJobDesc& desc() const { return mDesc; }
+    Object* object() const { return mObject.get(); }
+    LayerCamera* camera() const { return mCamera; }
+    int firstFrame() const { return mFirstFrame; }
+    int lastFrame() const { return mLastFrame; }
+    QSize exportSize() const { return mExportSize; }
+    RenderPipelineStats stats() const { return mStats; }
+
+    static bool isMovieFile(const QString& fileName);
+    static int animationLength(const Object* object, bool includeSounds);
+
+private:
+    Status renderImageSequence();
+    Status renderMovie();
+
+    RenderJobDesc mDesc;
+    std::unique_ptr<Object> mObject;
+    LayerCamera* mCamera = nullptr;
+    int mFirstFrame = 1;
+    int mLastFrame = 0;
+    QSize mExportSize;
+
+    std::function<void(float)> mProgress;
+    std::atomic<bool> mCanceled{ false };
+    RenderPipelineStats mStats;
+};
+
+#endif // RENDERJOB_H
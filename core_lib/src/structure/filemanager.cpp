@@ -24,6 +24,7 @@ GNU General Public License for more details.
 #include "fileformat.h"
 #include "object.h"
 #include "layercamera.h"
+#include "projectarchive.h"
 
 namespace
 {
@@ -83,7 +84,7 @@ Object* FileManager::load(QString sFileName)
     {
         dd << "Recognized New zipped Pencil File Format (*.pclx) !";
 
-        unzip(sFileName, obj->workingDir());
+        unzip(sFileName, obj);
 
         strMainXMLFile = QDir(obj->workingDir()).filePath(PFF_XML_FILE_NAME);
         strDataFolder = QDir(obj->workingDir()).filePath(PFF_DATA_DIR);
@@ -97,6 +98,10 @@ Object* FileManager::load(QString sFileName)
     obj->setMainXMLFile(strMainXMLFile);
 
     int totalFileCount = QDir(strDataFolder).entryList(QDir::Files).size();
+    if (obj->archive())
+    {
+        totalFileCount += obj->archive()->pendingCount();
+    }
     mMaxProgressValue = totalFileCount;
     emit progressRangeChanged(mMaxProgressValue);
 
@@ -293,6 +298,20 @@ Status FileManager::save(Object* object, QString sFileName)
                       tr("\"%1\" is a file. Please delete the file and try again.").arg(dataInfo.absoluteFilePath()));
     }
 
+    // The key frames never loaded are still in the archive the project was opened from
+    if (ProjectArchive* archive = object->archive())
+    {
+        Status st = archive->extractAll();
+        if (!st.ok())
+        {
+            dd.collect(st.details());
+            return Status(Status::FAIL, dd,
+                          tr("Internal Error"),
+                          tr("An internal error occurred. Your file may not be saved successfully."));
+        }
+        object->setArchive(nullptr);
+    }
+
     // save data
     int numLayers = object->getLayerCount();
     dd << QString("Total %1 layers").arg(numLayers);
@@ -369,13 +388,18 @@ Status FileManager::save(Object* object, QString sFileName)
 
     progressForward();
 
-    if (!isOldType)
+    if (!isOldType && !saveLayersOK)
+    {
+        // Keep the last good project, the frames are still in the working folder
+        dd << "Layers failed to save, the archive is left as it was";
+    }
+    else if (!isOldType)
     {
         dd << "Miniz";
 
-        QString sBackupFile = backupPreviousFile(sFileName);
-
-        Status s = MiniZ::compressFolder(sFileName, sTempWorkingFolder, zippedFiles);
+        // Unchanged files are copied from the file being overwritten, which is only
+        // replaced once the new archive is complete
+        Status s = MiniZ::compressFolder(sFileName, sTempWorkingFolder, zippedFiles, sFileName);
         if (!s.ok())
         {
             dd.collect(s.details());
@@ -384,9 +408,6 @@ Status FileManager::save(Object* object, QString sFileName)
                           tr("An internal error occurred. Your file may not be saved successfully."));
         }
         dd << "Zip file saved successfully";
-
-        if (s.ok() && saveLayersOK)
-            deleteBackupFile(sBackupFile);
     }
 
     progressForward();
@@ -547,32 +568,6 @@ Object* FileManager::cleanUpWithErrorCode(Status error)
     return nullptr;
 }
 
-QString FileManager::backupPreviousFile(const QString& fileName)
-{
-    if (!QFile::exists(fileName))
-        return "";
-
-    QFileInfo info(fileName);
-    QString sBackupFile = info.completeBaseName() + ".backup." + info.suffix();
-    QString sBackupFileFullPath = QDir(info.absolutePath()).filePath(sBackupFile);
-
-    bool ok = QFile::rename(info.absoluteFilePath(), sBackupFileFullPath);
-    if (!ok)
-    {
-        qDebug() << "Cannot backup the previous file.";
-        return "";
-    }
-    return sBackupFileFullPath;
-}
-
-void FileManager::deleteBackupFile(const QString& fileName)
-{
-    if (QFile::exists(fileName))
-    {
-        QFile::remove(fileName);
-    }
-}
-
 void FileManager::progressForward()
 {
     mCurrentProgress++;
@@ -591,13 +586,18 @@ bool FileManager::loadPalette(Object* obj)
     return true;
 }
 
-void FileManager::unzip(const QString& strZipFile, const QString& strUnzipTarget)
+void FileManager::unzip(const QString& strZipFile, Object* obj)
 {
+    const QString strUnzipTarget = obj->workingDir();
+
     // removes the previous directory first  - better approach
     removePFFTmpDirectory(strUnzipTarget);
 
-    Status s = MiniZ::uncompressFolder(strZipFile, strUnzipTarget);
+    // The bitmap key frames stay in the archive until they are loaded
+    ProjectArchive* archive = new ProjectArchive;
+    Status s = archive->open(strZipFile, strUnzipTarget);
     Q_ASSERT(s.ok());
+    obj->setArchive(archive);
 
     mstrLastTempFolder = strUnzipTarget;
 }
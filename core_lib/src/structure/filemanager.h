@@ -50,7 +50,7 @@ Q_SIGNALS:
     void progressRangeChanged(int maxValue);
 
 private:
-    void unzip(const QString& strZipFile, const QString& strUnzipTarget);
+    void unzip(const QString& strZipFile, Object* obj);
 
     bool loadObject(Object*, const QDomElement& root);
     bool loadObjectOldWay(Object*, const QDomElement& root);
@@ -63,9 +63,6 @@ private:
     void extractProjectData(const QDomElement& element, ObjectData* data);
     Object* cleanUpWithErrorCode(Status);
 
-    QString backupPreviousFile(const QString& fileName);
-    void deleteBackupFile(const QString& fileName);
-
     void progressForward();
 
 private:
@@ -39,7 +39,7 @@ public:
     int length() const { return mLength; }
     void setLength(int len) { mLength = len; }
 
-    void modification() { mIsModified = true; }
+    virtual void modification() { mIsModified = true; }
     void setModified(bool b) { mIsModified = b; }
     bool isModified() const { return mIsModified; }
 
@@ -56,6 +56,8 @@ public:
     virtual void loadFile() {}
     virtual void unloadFile() {}
     virtual bool isLoaded() { return true; }
+    /** The bytes this key frame holds in memory, as accounted by the ActiveFramePool */
+    virtual qint64 memoryUsage() { return 0; }
 
 private:
     int mFrame = -1;
@@ -0,0 +1,96 @@
+/*
+
+Pencil - Traditional Animation Software
+Copyright (C) 2012-2018 Matthew Chiawen Chang
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+*/
+#include "keyframeindex.h"
+
+#include <iterator>
+#include <QtGlobal>
+
+
+void KeyFrameIndex::add(int position, bool isSound)
+{
+    Count& count = mPositions[position];
+    count.keys++;
+    if (isSound)
+    {
+        count.sounds++;
+    }
+}
+
+void KeyFrameIndex::remove(int position, bool isSound)
+{
+    auto it = mPositions.find(position);
+    Q_ASSERT(it != mPositions.end());
+    if (it == mPositions.end())
+    {
+        return;
+    }
+
+    it->second.keys--;
+    if (isSound)
+    {
+        it->second.sounds--;
+    }
+    if (it->second.keys <= 0)
+    {
+        mPositions.erase(it);
+    }
+}
+
+/** The last position at or before position where any layer has a key frame, -1 if there is none */
+int KeyFrameIndex::lastKeyAtOrBefore(int position) const
+{
+    auto it = mPositions.upper_bound(position);
+    if (it == mPositions.begin())
+    {
+        return -1;
+    }
+    return std::prev(it)->first;
+}
+
+/** The last key frame position strictly before position, -1 if there is none */
+int KeyFrameIndex::previousKey(int position) const
+{
+    return lastKeyAtOrBefore(position - 1);
+}
+
+/** The first key frame position strictly after position, -1 if there is none */
+int KeyFrameIndex::nextKey(int position) const
+{
+    auto it = mPositions.upper_bound(position);
+    return (it != mPositions.end()) ? it->first : -1;
+}
+
+/** The first key frame position of any layer, -1 if there is none */
+int KeyFrameIndex::firstKey() const
+{
+    return (!mPositions.empty()) ? mPositions.begin()->first : -1;
+}
+
+/** The last key frame position of any layer, -1 if there is none.
+ *
+ *  @param[in] includeSounds False skips the positions where only sound clips start
+ */
+int KeyFrameIndex::lastKey(bool includeSounds) const
+{
+    for (auto it = mPositions.rbegin(); it != mPositions.rend(); ++it)
+    {
+        if (includeSounds || it->second.keys > it->second.sounds)
+        {
+            return it->first;
+        }
+    }
+    return -1;
+}
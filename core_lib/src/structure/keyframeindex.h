@@ -0,0 +1,57 @@
+/*
+
+Pencil - Traditional Animation Software
+Copyright (C) 2012-2018 Matthew Chiawen Chang
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+*/
+#ifndef KEYFRAMEINDEX_H
+#define KEYFRAMEINDEX_H
+
+#include <map>
+
+
+/** The positions of the key frames of every layer of an Object, merged and sorted.
+ *
+ *  Layer adds and removes its positions as key frames are created, loaded,
+ *  moved and deleted, so the questions about all the layers at once, like the
+ *  last key frame at or before a frame, are answered with one lookup instead
+ *  of asking each layer about each frame.
+ *
+ *  Sound clips are counted apart, because the length of the animation is
+ *  sometimes measured without them.
+ */
+class KeyFrameIndex
+{
+public:
+    void add(int position, bool isSound);
+    void remove(int position, bool isSound);
+    void clear() { mPositions.clear(); }
+
+    bool isEmpty() const { return mPositions.empty(); }
+    bool keyExists(int position) const { return mPositions.count(position) != 0; }
+
+    int lastKeyAtOrBefore(int position) const;
+    int previousKey(int position) const;
+    int nextKey(int position) const;
+    int firstKey() const;
+    int lastKey(bool includeSounds = true) const;
+
+private:
+    struct Count
+    {
+        int keys = 0;   //< key frames of all the layers at the position
+        int sounds = 0; //< of those, the sound clips
+    };
+    std::map<int, Count> mPositions;
+};
+
+#endif // KEYFRAMEINDEX_H
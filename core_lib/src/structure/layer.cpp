@@ -20,6 +20,7 @@ GNU General Public License for more details.
 #include <QSettings>
 #include "keyframe.h"
 #include "object.h"
+#include "keyframeindex.h"
 #include "timelinecells.h"
 
 
@@ -42,6 +43,7 @@ Layer::Layer(Object* pObject, LAYER_TYPE eType) : QObject(pObject)
 
 Layer::~Layer()
 {
+    removeFromKeyFrameIndex();
     for (auto it : mKeyFrames)
     {
         KeyFrame* pKeyFrame = it.second;
@@ -186,7 +188,7 @@ bool Layer::addKeyFrame(int position, KeyFrame* pKeyFrame)
     }
 
     pKeyFrame->setPos(position);
-    mKeyFrames.insert(std::make_pair(position, pKeyFrame));
+    insertKeyFrame(position, pKeyFrame);
 
     return true;
 }
@@ -196,7 +198,7 @@ bool Layer::removeKeyFrame(int position)
     auto frame = getKeyFrameWhichCovers(position);
     if (frame)
     {
-        mKeyFrames.erase(frame->pos());
+        eraseKeyFrame(frame->pos());
         delete frame;
     }
     return true;
@@ -228,7 +230,7 @@ bool Layer::swapKeyFrames(int position1, int position2) //Current behaviour, nee
         auto firstFrame = mKeyFrames.find(position1);
         pFirstFrame = firstFrame->second;
 
-        mKeyFrames.erase(position1);
+        eraseKeyFrame(position1);
 
         keyPosition1 = true;
     }
@@ -238,7 +240,7 @@ bool Layer::swapKeyFrames(int position1, int position2) //Current behaviour, nee
         auto secondFrame = mKeyFrames.find(position2);
         pSecondFrame = secondFrame->second;
 
-        mKeyFrames.erase(position2);
+        eraseKeyFrame(position2);
 
         keyPosition2 = true;
     }
@@ -246,7 +248,7 @@ bool Layer::swapKeyFrames(int position1, int position2) //Current behaviour, nee
     if (keyPosition2)
     {
         pSecondFrame->setPos(position1);
-        mKeyFrames.insert(std::make_pair(position1, pSecondFrame));
+        insertKeyFrame(position1, pSecondFrame);
     }
     else if (position1 == 1)
     {
@@ -256,7 +258,7 @@ bool Layer::swapKeyFrames(int position1, int position2) //Current behaviour, nee
     if (keyPosition1)
     {
         pFirstFrame->setPos(position2);
-        mKeyFrames.insert(std::make_pair(position2, pFirstFrame));
+        insertKeyFrame(position2, pFirstFrame);
     }
     else if (position2 == 1)
     {
@@ -272,15 +274,41 @@ bool Layer::swapKeyFrames(int position1, int position2) //Current behaviour, nee
     return true;
 }
 
+/** Takes pKey at position, and notes it in the key frame index of the Object */
+void Layer::insertKeyFrame(int position, KeyFrame* pKey)
+{
+    mKeyFrames.insert(std::make_pair(position, pKey));
+    mObject->keyFrameIndex()->add(position, meType == SOUND);
+}
+
+void Layer::eraseKeyFrame(int position)
+{
+    if (mKeyFrames.erase(position) > 0)
+    {
+        mObject->keyFrameIndex()->remove(position, meType == SOUND);
+    }
+}
+
+/** Takes the key frames of this layer out of the index, for a layer leaving its Object.
+ *  The destructor does it, so a deleted layer never leaves its positions behind.
+ */
+void Layer::removeFromKeyFrameIndex()
+{
+    for (auto pair : mKeyFrames)
+    {
+        mObject->keyFrameIndex()->remove(pair.first, meType == SOUND);
+    }
+}
+
 bool Layer::loadKey(KeyFrame* pKey)
 {
     auto it = mKeyFrames.find(pKey->pos());
     if (it != mKeyFrames.end())
     {
         delete it->second;
-        mKeyFrames.erase(it);
+        eraseKeyFrame(pKey->pos());
     }
-    mKeyFrames.emplace(pKey->pos(), pKey);
+    insertKeyFrame(pKey->pos(), pKey);
     return true;
 }
 
@@ -289,6 +317,9 @@ Status Layer::save(const QString& sDataFolder, QStringList& attachedFiles, Progr
     DebugDetails dd;
     dd << __FUNCTION__;
 
+    // Key frames whose files were written here are skipped by saveKeyFrameFile()
+    encodeKeyFrameFiles(sDataFolder);
+
     bool ok = true;
 
     for (auto pair : mKeyFrames)
@@ -613,7 +644,7 @@ bool Layer::moveSelectedFrames(int offset)
 
             if (selectedFrame != nullptr)
             {
-                mKeyFrames.erase(fromPos);
+                eraseKeyFrame(fromPos);
 
                 // Slide back every frame between fromPos to toPos
                 // to avoid having 2 frames in the same position
@@ -628,10 +659,10 @@ bool Layer::moveSelectedFrames(int offset)
 
                     if (frame != nullptr)
                     {
-                        mKeyFrames.erase(framePosition);
+                        eraseKeyFrame(framePosition);
 
                         frame->setPos(targetPosition);
-                        mKeyFrames.insert(std::make_pair(targetPosition, frame));
+                        insertKeyFrame(targetPosition, frame);
                     }
 
                     targetPosition = targetPosition - step;
@@ -649,7 +680,7 @@ bool Layer::moveSelectedFrames(int offset)
 
                 // Update the position of the selected frame
                 selectedFrame->setPos(toPos);
-                mKeyFrames.insert(std::make_pair(toPos, selectedFrame));
+                insertKeyFrame(toPos, selectedFrame);
             }
             indexInSelection = indexInSelection + step;
         }
@@ -111,7 +111,9 @@ public:
 
     bool moveSelectedFrames(int offset);
 
-    Status save(const QString& sDataFolder, QStringList& attachedFiles, ProgressCallback progressStep);
+    void removeFromKeyFrameIndex();
+
+    virtual Status save(const QString& sDataFolder, QStringList& attachedFiles, ProgressCallback progressStep);
     virtual Status presave(const QString& sDataFolder) { Q_UNUSED(sDataFolder); return Status::SAFE; }
 
     // graphic representation -- could be put in another class
@@ -128,8 +130,12 @@ public:
 protected:
     void setId(int LayerId) { mId = LayerId; }
     virtual KeyFrame* createKeyFrame(int position, Object*) = 0;
+    virtual void encodeKeyFrameFiles(const QString& dataPath) { Q_UNUSED(dataPath); }
 
 private:
+    void insertKeyFrame(int position, KeyFrame*);
+    void eraseKeyFrame(int position);
+
     LAYER_TYPE meType = UNDEFINED;
     Object*    mObject = nullptr;
     int        mId = 0;
@@ -19,8 +19,11 @@ GNU General Public License for more details.
 #include <QDebug>
 #include <QDir>
 #include <QFile>
+#include <vector>
 #include "keyframe.h"
 #include "bitmapimage.h"
+#include "projectarchive.h"
+#include "util.h"
 
 
 
@@ -86,6 +89,60 @@ Status LayerBitmap::saveKeyFrameFile(KeyFrame* keyframe, QString path)
     return Status::OK;
 }
 
+/** Encodes the modified key frames to PNG in parallel, before Layer::save goes through them.
+ *
+ *  The images to encode are taken on the calling thread; the workers only
+ *  compress their own shared copy, so the key frames are never touched off
+ *  this thread. A key frame written here no longer needs saving, the others,
+ *  empty or failed, are left to saveKeyFrameFile(), which reports the failure.
+ */
+void LayerBitmap::encodeKeyFrameFiles(const QString& dataPath)
+{
+    struct FrameToEncode
+    {
+        BitmapImage* bitmap = nullptr;
+        QString filePath;
+        QImage image;
+        bool ok = false;
+    };
+
+    QDir dataFolder(dataPath);
+    std::vector<FrameToEncode> frames;
+    foreachKeyFrame([&](KeyFrame* key)
+    {
+        FrameToEncode frame;
+        frame.bitmap = static_cast<BitmapImage*>(key);
+        frame.filePath = filePath(key, dataFolder);
+        if (!needSaveFrame(key, frame.filePath))
+        {
+            return;
+        }
+
+        QImage* image = frame.bitmap->image();
+        if (image && !image->isNull())
+        {
+            frame.image = *image;
+            frames.push_back(frame);
+        }
+    });
+
+    parallelFor(static_cast<int>(frames.size()), [&frames](int i)
+    {
+        FrameToEncode& frame = frames[static_cast<size_t>(i)];
+        frame.ok = frame.image.save(frame.filePath);
+        frame.image = QImage();
+    });
+
+    for (const FrameToEncode& frame : frames)
+    {
+        if (frame.ok)
+        {
+            frame.bitmap->setFileName(frame.filePath);
+            frame.bitmap->setModified(false);
+        }
+    }
+}
+
 KeyFrame* LayerBitmap::createKeyFrame(int position, Object*)
 {
     BitmapImage* b = new BitmapImage;
@@ -194,7 +251,7 @@ void LayerBitmap::loadDomElement(QDomElement element, QString dataDirPath, Progr
             {
                 QString path = dataDirPath + "/" + imageElement.attribute("src"); // the file is supposed to be in the data directory
                 QFileInfo fi(path);
-                if (!fi.exists()) path = imageElement.attribute("src");
+                if (!fi.exists() && !ProjectArchive::isPending(path)) path = imageElement.attribute("src");
                 int position = imageElement.attribute("frame").toInt();
                 int x = imageElement.attribute("topLeftX").toInt();
                 int y = imageElement.attribute("topLeftY").toInt();
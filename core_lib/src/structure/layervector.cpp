@@ -34,8 +34,14 @@ bool LayerVector::usesColour(int colorIndex)
     foreachKeyFrame([&](KeyFrame* pKeyFrame)
     {
         auto pVecImage = static_cast<VectorImage*>(pKeyFrame);
+        const bool wasLoaded = pVecImage->isLoaded();
+        pVecImage->loadFile();
 
         bUseColor = bUseColor || pVecImage->usesColour(colorIndex);
+        if (!wasLoaded)
+        {
+            pVecImage->unloadFile();
+        }
     });
 
     return bUseColor;
@@ -46,7 +52,13 @@ void LayerVector::removeColour(int colorIndex)
     foreachKeyFrame([=](KeyFrame* pKeyFrame)
     {
         auto pVecImage = static_cast<VectorImage*>(pKeyFrame);
+        const bool wasLoaded = pVecImage->isLoaded();
+        pVecImage->loadFile();
         pVecImage->removeColour(colorIndex);
+        if (!wasLoaded)
+        {
+            pVecImage->unloadFile(); // keeps the frames the colour change modified
+        }
     });
 }
 
@@ -55,7 +67,13 @@ void LayerVector::moveColor(int start, int end)
     foreachKeyFrame( [=] (KeyFrame* pKeyFrame)
     {
         auto pVecImage = static_cast<VectorImage*>(pKeyFrame);
+        const bool wasLoaded = pVecImage->isLoaded();
+        pVecImage->loadFile();
         pVecImage->moveColor(start, end);
+        if (!wasLoaded)
+        {
+            pVecImage->unloadFile(); // keeps the frames the colour change modified
+        }
     });
 }
 
@@ -65,10 +83,10 @@ void LayerVector::loadImageAtFrame(QString path, int frameNumber)
     {
         removeKeyFrame(frameNumber);
     }
-    VectorImage* vecImg = new VectorImage;
+    // The file is read the first time the key frame is used, see VectorImage::loadFile()
+    VectorImage* vecImg = new VectorImage(path);
     vecImg->setPos(frameNumber);
     vecImg->setObject(object());
-    vecImg->read(path);
     addKeyFrame(frameNumber, vecImg);
 }
 
@@ -84,7 +102,7 @@ Status LayerVector::saveKeyFrameFile(KeyFrame* keyFrame, QString path)
         return Status::SAFE;
     }
 
-    Status st = vecImage->write(strFilePath, "VEC");
+    Status st = vecImage->write(strFilePath, "VECB");
     if (!st.ok())
     {
         vecImage->setFileName("");
@@ -103,6 +121,22 @@ Status LayerVector::saveKeyFrameFile(KeyFrame* keyFrame, QString path)
     return Status::OK;
 }
 
+/** Loads the key frames that have been moved but not modified,
+ *  before saving the others writes over the files they are still in.
+ */
+Status LayerVector::presave(const QString& sDataFolder)
+{
+    QDir dataFolder(sDataFolder);
+    foreachKeyFrame([&dataFolder, this](KeyFrame* key)
+    {
+        if (!key->isLoaded() && key->fileName() != dataFolder.filePath(fileName(key)))
+        {
+            key->loadFile();
+        }
+    });
+    return Status::SAFE;
+}
+
 KeyFrame* LayerVector::createKeyFrame(int position, Object* obj)
 {
     VectorImage* v = new VectorImage;
@@ -113,7 +147,8 @@ KeyFrame* LayerVector::createKeyFrame(int position, Object* obj)
 
 QString LayerVector::fileName(KeyFrame* key)
 {
-    return QString::asprintf("%03d.%03d.vec", id(), key->pos());
+    // Binary, see VectorImage::write(). Projects saved before still have .vec files in XML.
+    return QString::asprintf("%03d.%03d.vecb", id(), key->pos());
 }
 
 bool LayerVector::needSaveFrame(KeyFrame* key, const QString& strSavePath)
@@ -177,12 +212,24 @@ void LayerVector::loadDomElement(QDomElement element, QString dataDirPath, Progr
     }
 }
 
+/** Returns the key frame at frameNumber, with its curves loaded */
 VectorImage* LayerVector::getVectorImageAtFrame(int frameNumber) const
 {
-    return static_cast<VectorImage*>(getKeyFrameAt(frameNumber));
+    VectorImage* image = static_cast<VectorImage*>(getKeyFrameAt(frameNumber));
+    if (image != nullptr)
+    {
+        image->loadFile();
+    }
+    return image;
 }
 
+/** Returns the key frame shown at frameNumber + increment, with its curves loaded */
 VectorImage* LayerVector::getLastVectorImageAtFrame(int frameNumber, int increment) const
 {
-    return static_cast<VectorImage*>(getLastKeyFrameAtPosition(frameNumber + increment));
+    VectorImage* image = static_cast<VectorImage*>(getLastKeyFrameAtPosition(frameNumber + increment));
+    if (image != nullptr)
+    {
+        image->loadFile();
+    }
+    return image;
 }
@@ -16,11 +16,17 @@ GNU General Public License for more details.
 */
 #include "object.h"
 
+#include <algorithm>
+#include <atomic>
 #include <QDomDocument>
 #include <QTextStream>
 #include <QProgressDialog>
 #include <QApplication>
 #include <QFile>
+#include <QRunnable>
+#include <QSemaphore>
+#include <QThread>
+#include <QThreadPool>
 
 #include "layer.h"
 #include "layerbitmap.h"
@@ -34,12 +40,50 @@ GNU General Public License for more details.
 #include "vectorimage.h"
 #include "fileformat.h"
 #include "activeframepool.h"
+#include "projectarchive.h"
+#include "keyframeindex.h"
+#include "framerenderpipeline.h"
 
 
+namespace
+{
+    /** Encodes one rendered frame to the first file, then copies it to the others */
+    class FrameEncodeTask : public QRunnable
+    {
+    public:
+        FrameEncodeTask(const QImage& image, const QStringList& fileNames, const QString& format,
+                        QSemaphore* queue, std::atomic<bool>* ok)
+            : mImage(image), mFileNames(fileNames), mFormat(format.toLatin1()), mQueue(queue), mOk(ok) {}
+
+        void run() override
+        {
+            bool written = mImage.save(mFileNames.first(), mFormat.constData());
+            for (int i = 1; i < mFileNames.size() && written; i++)
+            {
+                QFile::remove(mFileNames[i]);
+                written = QFile::copy(mFileNames.first(), mFileNames[i]);
+            }
+            if (!written)
+            {
+                *mOk = false;
+            }
+            mQueue->release();
+        }
+
+    private:
+        QImage mImage;
+        QStringList mFileNames;
+        QByteArray mFormat;
+        QSemaphore* mQueue;
+        std::atomic<bool>* mOk;
+    };
+}
+
 Object::Object(QObject* parent) : QObject(parent)
 {
     setData(new ObjectData());
-    mActiveFramePool.reset(new ActiveFramePool(400));
+    mActiveFramePool.reset(new ActiveFramePool(1024LL * 1024 * 1024));
+    mKeyFrameIndex.reset(new KeyFrameIndex);
 }
 
 Object::~Object()
@@ -751,45 +795,105 @@ bool Object::exportFrames(int frameStart, int frameEnd,
         << frameEnd
         << "at size " << exportSize;
 
-    for (int currentFrame = frameStart; currentFrame <= frameEnd; currentFrame++)
+    QColor bgColor = Qt::white;
+    if (transparency)
+        bgColor.setAlpha(0);
+
+    // Only the key positions of the layer are rendered when exporting key frames only
+    std::vector<int> frameNumbers;
+    Layer* keyLayer = (exportKeyframesOnly) ? findLayerByName(layerName) : nullptr;
+    if (keyLayer != nullptr)
+    {
+        keyLayer->foreachKeyFrame([&](KeyFrame* key)
+        {
+            if (key->pos() >= frameStart && key->pos() <= frameEnd)
+            {
+                frameNumbers.push_back(key->pos());
+            }
+        });
+        std::sort(frameNumbers.begin(), frameNumbers.end());
+    }
+    else
+    {
+        for (int frame = frameStart; frame <= frameEnd; frame++)
+        {
+            frameNumbers.push_back(frame);
+        }
+    }
+
+    /* Frames are rendered on the pipeline workers and encoded on a second pool,
+     * with at most two frames per encoder waiting. The cores are shared out between
+     * the two pools. A frame that looks like the one before it is neither rendered
+     * nor encoded: its file is a copy of the last one.
+     */
+    const int encoderCount = qMax(1, QThread::idealThreadCount() / 2);
+    const int rendererCount = qMax(1, QThread::idealThreadCount() - encoderCount);
+
+    FrameRenderPipeline frames(this, cameraLayer, exportSize, bgColor);
+    frames.setFrames(frameNumbers);
+    frames.setWorkerCount(rendererCount);
+    frames.setAntialiasing(antialiasing);
+    frames.setSkipRepeatedFrames(true);
+
+    QThreadPool encoders;
+    encoders.setMaxThreadCount(encoderCount);
+    QSemaphore queue(2 * encoders.maxThreadCount());
+    std::atomic<bool> ok{ true };
+
+    QImage lastImage;
+    QStringList lastFileNames;
+    auto encodeLastImage = [&]()
+    {
+        if (!lastFileNames.isEmpty())
+        {
+            queue.acquire();
+            encoders.start(new FrameEncodeTask(lastImage, lastFileNames, format, &queue, &ok));
+            lastFileNames.clear();
+        }
+    };
+
+    const int totalFramesToExport = static_cast<int>(frameNumbers.size());
+    int framesExported = 0;
+    while (frames.hasMoreFrames())
     {
         if (progress != nullptr)
         {
-            int totalFramesToExport = (frameEnd - frameStart) + 1;
             if (totalFramesToExport != 0) // Avoid dividing by zero.
             {
-                progress->setValue((currentFrame - frameStart + 1) * progressMax / totalFramesToExport);
+                progress->setValue((framesExported + 1) * progressMax / totalFramesToExport);
                 QApplication::processEvents(); // Required to make progress bar update on-screen.
             }
 
             if (progress->wasCanceled())
             {
+                frames.cancel();
                 break;
             }
         }
 
-        QTransform view = cameraLayer->getViewAtFrame(currentFrame);
-        QSize camSize = cameraLayer->getViewSize();
-
-        QString frameNumberString = QString::number(currentFrame);
-        while (frameNumberString.length() < 4)
+        QImage image;
+        if (!frames.takeNextFrame(image, 100))
         {
-            frameNumberString.prepend("0");
+            continue;
         }
-        QString sFileName = filePath + frameNumberString + extension;
-        Layer* layer = findLayerByName(layerName);
-        if (exportKeyframesOnly)
+
+        if (!image.isNull())
         {
-            if (layer->keyExists(currentFrame))
-                exportIm(currentFrame, view, camSize, exportSize, sFileName, format, antialiasing, transparency);
+            encodeLastImage();
+            lastImage = image;
         }
-        else
+
+        QString frameNumberString = QString::number(frameNumbers[static_cast<size_t>(framesExported)]);
+        while (frameNumberString.length() < 4)
         {
-            exportIm(currentFrame, view, camSize, exportSize, sFileName, format, antialiasing, transparency);
+            frameNumberString.prepend("0");
         }
+        lastFileNames.append(filePath + frameNumberString + extension);
+        framesExported++;
     }
-
-    return true;
+    encodeLastImage();
+    encoders.waitForDone();
+    return ok;
 }
 
 bool Object::exportX(int frameStart, int frameEnd, QTransform view, QSize exportSize, QString filePath, bool antialiasing)
@@ -872,6 +976,12 @@ void Object::setData(ObjectData* d)
     mData.reset(d);
 }
 
+/** Takes ownership of the archive the key frames are lazily extracted from, nullptr releases it */
+void Object::setArchive(ProjectArchive* archive)
+{
+    mArchive.reset(archive);
+}
+
 int Object::totalKeyFrameCount()
 {
     int sum = 0;
@@ -882,22 +992,63 @@ int Object::totalKeyFrameCount()
     return sum;
 }
 
+/** Loads what frame shows and starts loading the key frames around it in the background */
 void Object::updateActiveFrames(int frame) const
 {
+    mActiveFramePool->setPlayhead(frame);
+    mActiveFramePool->collectPrefetched();
+
     int beginFrame = std::max(frame - 3, 1);
     int endFrame = frame + 4;
     for (int i = 0; i < getLayerCount(); ++i)
     {
         Layer* layer = getLayer(i);
+        mActiveFramePool->put(layer->getLastKeyFrameAtPosition(frame));
         for (int k = beginFrame; k < endFrame; ++k)
         {
             KeyFrame* key = layer->getKeyFrameAt(k);
-            mActiveFramePool->put(key);
+            mActiveFramePool->prefetch(key);
+        }
+    }
+}
+
+/** Starts loading in the background the bitmap key frames shown at the given frames */
+void Object::prefetchFrames(const QVector<int>& frames) const
+{
+    for (int i = 0; i < getLayerCount(); ++i)
+    {
+        Layer* layer = getLayer(i);
+        if (layer->type() != Layer::BITMAP)
+        {
+            continue;
+        }
+
+        KeyFrame* previous = nullptr;
+        for (int frame : frames)
+        {
+            KeyFrame* key = layer->getLastKeyFrameAtPosition(frame);
+            if (key != previous)
+            {
+                mActiveFramePool->prefetch(key);
+                previous = key;
+            }
         }
     }
 }
 
-void Object::setActiveFramePoolSize(int n)
+/** Sets how many bytes the loaded key frames may hold */
+void Object::setActiveFramePoolBudget(qint64 bytes)
+{
+    mActiveFramePool->setMemoryBudget(bytes);
+}
+
+/** Sets how many frames around the current one are kept loaded for the onion skins */
+void Object::setActiveFramePoolOnionRange(int framesBefore, int framesAfter)
+{
+    mActiveFramePool->setOnionSkinRange(framesBefore, framesAfter);
+}
+
+FramePoolStats Object::activeFramePoolStats() const
 {
-    mActiveFramePool->resize(n);
+    return mActiveFramePool->stats();
 }
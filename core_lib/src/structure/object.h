@@ -20,6 +20,7 @@ GNU General Public License for more details.
 #include <memory>
 #include <QObject>
 #include <QList>
+#include <QVector>
 #include <QColor>
 #include "layer.h"
 #include "colourref.h"
@@ -35,6 +36,9 @@ class LayerCamera;
 class LayerSound;
 class ObjectData;
 class ActiveFramePool;
+class KeyFrameIndex;
+struct FramePoolStats;
+class ProjectArchive;
 
 
 struct ExportMovieParameters
@@ -150,9 +154,17 @@ public:
     ObjectData* data();
     void setData(ObjectData*);
 
+    ProjectArchive* archive() const { return mArchive.get(); }
+    void setArchive(ProjectArchive*);
+
+    KeyFrameIndex* keyFrameIndex() const { return mKeyFrameIndex.get(); }
+
     int totalKeyFrameCount();
     void updateActiveFrames(int frame) const;
-    void setActiveFramePoolSize(int n);
+    void prefetchFrames(const QVector<int>& frames) const;
+    void setActiveFramePoolBudget(qint64 bytes);
+    void setActiveFramePoolOnionRange(int framesBefore, int framesAfter);
+    FramePoolStats activeFramePoolStats() const;
 
 signals:
     void layerViewChanged();
@@ -173,6 +185,8 @@ private:
 
     std::unique_ptr<ObjectData> mData;
     mutable std::unique_ptr<ActiveFramePool> mActiveFramePool;
+    std::unique_ptr<ProjectArchive> mArchive; //< the .pclx the bitmap key frames are still extracted from, if any
+    std::unique_ptr<KeyFrameIndex> mKeyFrameIndex; //< the key frame positions of all the layers
 };
 
 
@@ -0,0 +1,299 @@
+/*
+
+Pencil - Traditional Animation Software
+Copyright (C) 2012-2018 Matthew Chiawen Chang
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+*/
+#include "projectarchive.h"
+
+#include <QDir>
+#include <QFileInfo>
+#include <QList>
+#include <QWaitCondition>
+#include "miniz.h"
+#include "fileformat.h"
+
+
+namespace
+{
+    QMutex openArchivesMutex;
+    QWaitCondition archiveReleased; //< woken when a static call stops using an archive
+    QList<ProjectArchive*> openArchives;
+
+    /** Bitmap key frames are the only entries extracted on demand */
+    bool isLazyEntry(const QString& name)
+    {
+        return name.startsWith(QString(PFF_DATA_DIR) + "/")
+            && name.endsWith(".png", Qt::CaseInsensitive);
+    }
+}
+
+ProjectArchive::ProjectArchive()
+{
+}
+
+ProjectArchive::~ProjectArchive()
+{
+    close();
+}
+
+/** Opens zipFilePath and extracts everything but the bitmap key frames into workingDir. */
+Status ProjectArchive::open(const QString& zipFilePath, const QString& workingDir)
+{
+    close();
+
+    DebugDetails dd;
+    dd << QString("Open archive %1 in folder %2").arg(zipFilePath).arg(workingDir);
+
+    QDir baseDir(workingDir);
+    if (!baseDir.mkpath("."))
+    {
+        dd << "Cannot create the working folder";
+        return Status(Status::FAIL, dd);
+    }
+
+    mz_zip_archive* zip = new mz_zip_archive;
+    mz_zip_zero_struct(zip);
+    if (!mz_zip_reader_init_file(zip, zipFilePath.toUtf8().data(), 0))
+    {
+        delete zip;
+        return Status(Status::FAIL, dd);
+    }
+
+    // Not registered yet, so nothing else reads the working folder
+    mWorkingDir = QDir::cleanPath(baseDir.absolutePath()) + "/";
+
+    QMutexLocker locker(&mMutex);
+    mZip = zip;
+    mEntryCount = static_cast<int>(mz_zip_reader_get_num_files(mZip));
+
+    bool ok = true;
+    mz_zip_archive_file_stat* stat = new mz_zip_archive_file_stat;
+    for (int i = 0; i < mEntryCount; ++i)
+    {
+        if (!mz_zip_reader_file_stat(mZip, static_cast<mz_uint>(i), stat))
+        {
+            ok = false;
+            continue;
+        }
+
+        const QString name = QString::fromUtf8(stat->m_filename);
+        if (stat->m_is_directory)
+        {
+            baseDir.mkpath(name);
+        }
+        else if (isLazyEntry(name))
+        {
+            mPending.insert(name, i);
+        }
+        else
+        {
+            const QString fullPath = baseDir.filePath(name);
+            QFileInfo(fullPath).absoluteDir().mkpath(".");
+            if (!mz_zip_reader_extract_to_file(mZip, static_cast<mz_uint>(i), fullPath.toUtf8(), 0))
+            {
+                ok = false;
+                dd << QString("File extraction failed: ").append(name);
+            }
+        }
+    }
+    delete stat;
+    mPendingCount = mPending.size();
+    locker.unlock();
+
+    QMutexLocker registryLocker(&openArchivesMutex);
+    openArchives.append(this);
+
+    if (!ok)
+    {
+        return Status(Status::FAIL, dd);
+    }
+    return Status::OK;
+}
+
+/** Releases the archive file. Entries not extracted yet are no longer available. */
+void ProjectArchive::close()
+{
+    {
+        // Wait for the static calls that found the archive before it left the registry
+        QMutexLocker registryLocker(&openArchivesMutex);
+        openArchives.removeAll(this);
+        while (mUsers > 0)
+        {
+            archiveReleased.wait(&openArchivesMutex);
+        }
+    }
+
+    QMutexLocker locker(&mMutex);
+    if (mZip)
+    {
+        mz_zip_reader_end(mZip);
+        delete mZip;
+        mZip = nullptr;
+    }
+    mPending.clear();
+    mPendingCount = 0;
+}
+
+int ProjectArchive::pendingCount() const
+{
+    return mPendingCount;
+}
+
+/** Extracts filePath from the archive unless it has been already.
+ *
+ *  @param[in] filePath The path of the file in the working folder
+ *  @return True if the file is on disk now
+ */
+bool ProjectArchive::extract(const QString& filePath)
+{
+    QMutexLocker locker(&mMutex);
+    return extractLocked(filePath);
+}
+
+/** Does what extract() does. Call with mMutex held. */
+bool ProjectArchive::extractLocked(const QString& filePath)
+{
+    auto it = mPending.find(relativePath(filePath));
+    if (it == mPending.end() || mZip == nullptr)
+    {
+        return QFile::exists(filePath);
+    }
+
+    const QString fullPath = mWorkingDir + it.key();
+    QFileInfo(fullPath).absoluteDir().mkpath(".");
+    bool ok = mz_zip_reader_extract_to_file(mZip, static_cast<mz_uint>(it.value()), fullPath.toUtf8(), 0);
+    if (ok)
+    {
+        mPending.erase(it);
+        mPendingCount = mPending.size();
+    }
+    return ok;
+}
+
+/** Extracts every entry still in the archive, so the working folder holds the whole project. */
+Status ProjectArchive::extractAll()
+{
+    QStringList pending;
+    {
+        QMutexLocker locker(&mMutex);
+        for (auto it = mPending.constBegin(); it != mPending.constEnd(); ++it)
+        {
+            pending.append(mWorkingDir + it.key());
+        }
+    }
+
+    DebugDetails dd;
+    dd << QString("Extract %1 remaining files").arg(pending.size());
+
+    bool ok = true;
+    for (const QString& filePath : pending)
+    {
+        if (!extract(filePath))
+        {
+            ok = false;
+            dd << QString("File extraction failed: ").append(filePath);
+        }
+    }
+    return (ok) ? Status::OK : Status(Status::FAIL, dd);
+}
+
+/** Returns whether filePath is in an open archive and has not been extracted yet. */
+bool ProjectArchive::isPending(const QString& filePath)
+{
+    ProjectArchive* archive = acquire(filePath);
+    if (archive == nullptr)
+    {
+        return false;
+    }
+
+    bool pending;
+    {
+        QMutexLocker locker(&archive->mMutex);
+        pending = archive->mPending.contains(archive->relativePath(filePath));
+    }
+    release(archive);
+    return pending;
+}
+
+/** Extracts filePath if it is still in an open archive.
+ *
+ *  @return False only if the file should have been extracted and could not be.
+ */
+bool ProjectArchive::extractPending(const QString& filePath)
+{
+    ProjectArchive* archive = acquire(filePath);
+    if (archive == nullptr)
+    {
+        return true;
+    }
+
+    // The registry is free again, only this archive is held while extracting
+    bool ok;
+    {
+        QMutexLocker locker(&archive->mMutex);
+        ok = archive->extractLocked(filePath);
+    }
+    release(archive);
+    return ok;
+}
+
+QString ProjectArchive::relativePath(const QString& filePath) const
+{
+    const QString path = QDir::cleanPath(QFileInfo(filePath).absoluteFilePath());
+    if (!path.startsWith(mWorkingDir))
+    {
+        return QString();
+    }
+    return path.mid(mWorkingDir.size());
+}
+
+/** Finds the archive whose working folder contains filePath. Call with openArchivesMutex held.
+ *
+ *  Only the working folder and the pending count are read, neither needs the archive lock.
+ */
+ProjectArchive* ProjectArchive::archiveOf(const QString& filePath)
+{
+    if (filePath.isEmpty())
+    {
+        return nullptr;
+    }
+    for (ProjectArchive* archive : openArchives)
+    {
+        if (archive->mPendingCount > 0 && !archive->relativePath(filePath).isEmpty())
+        {
+            return archive;
+        }
+    }
+    return nullptr;
+}
+
+/** Finds the archive of filePath and keeps close() from releasing it until release(). */
+ProjectArchive* ProjectArchive::acquire(const QString& filePath)
+{
+    QMutexLocker registryLocker(&openArchivesMutex);
+    ProjectArchive* archive = archiveOf(filePath);
+    if (archive != nullptr)
+    {
+        ++archive->mUsers;
+    }
+    return archive;
+}
+
+void ProjectArchive::release(ProjectArchive* archive)
+{
+    QMutexLocker registryLocker(&openArchivesMutex);
+    if (--archive->mUsers == 0)
+    {
+        archiveReleased.wakeAll();
+    }
+}
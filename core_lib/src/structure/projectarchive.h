@@ -0,0 +1,74 @@
+/*
+
+Pencil - Traditional Animation Software
+Copyright (C) 2012-2018 Matthew Chiawen Chang
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+*/
+#ifndef PROJECTARCHIVE_H
+#define PROJECTARCHIVE_H
+
+#include <atomic>
+#include <QHash>
+#include <QMutex>
+#include <QString>
+#include "pencilerror.h"
+
+struct mz_zip_archive;
+
+
+/** A .pclx project opened without extracting all of it.
+ *
+ *  open() extracts main.xml, the palette, the vector and sound files to the
+ *  working folder and leaves the bitmap key frames in the archive. Each one is
+ *  extracted the first time BitmapImage::loadFile() needs it, so the time to
+ *  open a project does not grow with the number of drawn frames.
+ *
+ *  The entries still in the archive are looked up by the path they will have
+ *  in the working folder, through the static functions, from any thread.
+ *  Finding the archive of a path takes neither the lock of an archive, so
+ *  looking up a file is never held up by an extraction from another archive.
+ */
+class ProjectArchive
+{
+public:
+    ProjectArchive();
+    ~ProjectArchive();
+
+    Status open(const QString& zipFilePath, const QString& workingDir);
+    void close();
+
+    int entryCount() const { return mEntryCount; }
+    int pendingCount() const;
+
+    bool extract(const QString& filePath);
+    Status extractAll();
+
+    static bool isPending(const QString& filePath);
+    static bool extractPending(const QString& filePath);
+
+private:
+    bool extractLocked(const QString& filePath);
+    QString relativePath(const QString& filePath) const;
+    static ProjectArchive* archiveOf(const QString& filePath);
+    static ProjectArchive* acquire(const QString& filePath);
+    static void release(ProjectArchive* archive);
+
+    mutable QMutex mMutex; //< guards mZip and mPending
+    mz_zip_archive* mZip = nullptr;
+    QString mWorkingDir; //< set before the archive is registered and left alone until it is removed
+    QHash<QString, int> mPending; //< archive name => entry index, for the entries not extracted yet
+    std::atomic<int> mPendingCount{ 0 }; //< mPending.size(), readable without mMutex
+    int mUsers = 0; //< static calls using the archive, guarded by the registry lock
+    int mEntryCount = 0;
+};
+
+#endif // PROJECTARCHIVE_H
@@ -18,6 +18,7 @@ GNU General Public License for more details.
 #include "soundclip.h"
 
 #include <QFile>
+#include <QFileInfo>
 #include <QMediaPlayer>
 #include <QtMath>
 #include "soundplayer.h"
@@ -41,6 +42,18 @@ SoundClip* SoundClip::clone()
     return new SoundClip(*this);
 }
 
+/** No samples are decoded up front, the player streams the clip from its file.
+ *  The size of that file bounds what the player buffers.
+ */
+qint64 SoundClip::memoryUsage()
+{
+    if (mPlayer == nullptr || fileName().isEmpty())
+    {
+        return 0;
+    }
+    return QFileInfo(fileName()).size();
+}
+
 Status SoundClip::init(const QString& strSoundFile)
 {
     if (strSoundFile.isEmpty())
@@ -32,6 +32,7 @@ public:
     ~SoundClip() override;
 
     SoundClip* clone() override;
+    qint64 memoryUsage() override;
 
     Status init(const QString& strSoundFile);
     bool isValid() const;
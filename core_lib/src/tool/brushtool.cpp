@@ -325,7 +325,7 @@ void BrushTool::paintVectorStroke()
         curve.setVariableWidth(properties.pressure);
         curve.setColourNumber(mEditor->color()->frontColorNumber());
 
-        VectorImage* vectorImage = static_cast<VectorImage*>(layer->getLastKeyFrameAtPosition(mEditor->currentFrame()));
+        VectorImage* vectorImage = static_cast<LayerVector*>(layer)->getLastVectorImageAtFrame(mEditor->currentFrame(), 0);
         vectorImage->addCurve(curve, mEditor->view()->scaling(), false);
 
         if (vectorImage->isAnyCurveSelected() || mEditor->select()->somethingSelected())
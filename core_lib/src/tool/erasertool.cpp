@@ -330,7 +330,7 @@ void EraserTool::updateStrokes()
     {
         qreal radius = properties.width / 2;
 
-        VectorImage* currKey = static_cast<VectorImage*>(layer->getLastKeyFrameAtPosition(mEditor->currentFrame()));
+        VectorImage* currKey = static_cast<LayerVector*>(layer)->getLastVectorImageAtFrame(mEditor->currentFrame(), 0);
         QList<VertexRef> nearbyVertices = currKey->getVerticesCloseTo(getCurrentPoint(), radius);
         for (auto nearbyVertice : nearbyVertices)
         {
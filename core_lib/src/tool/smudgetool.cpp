@@ -29,7 +29,6 @@ GNU General Public License for more details.
 
 #include "layerbitmap.h"
 #include "layervector.h"
-#include "blitrect.h"
 
 SmudgeTool::SmudgeTool(QObject* parent) : StrokeTool(parent)
 {
@@ -141,6 +140,9 @@ void SmudgeTool::pointerPressEvent(PointerEvent* event)
     {
         if (layer->type() == Layer::BITMAP)
         {
+            // The key frame is smudged in place while the pointer moves, so the undo step is taken now
+            mEditor->backup(typeName());
+
             mScribbleArea->setAllDirty();
             startStroke();
             mLastBrushPoint = getCurrentPoint();
@@ -232,8 +234,6 @@ void SmudgeTool::pointerReleaseEvent(PointerEvent* event)
 
     if (event->button() == Qt::LeftButton)
     {
-        mEditor->backup(typeName());
-
         if (layer->type() == Layer::BITMAP)
         {
             drawStroke();
@@ -242,6 +242,8 @@ void SmudgeTool::pointerReleaseEvent(PointerEvent* event)
         }
         else if (layer->type() == Layer::VECTOR)
         {
+            mEditor->backup(typeName());
+
             VectorImage *vectorImage = ((LayerVector *)layer)->getLastVectorImageAtFrame(mEditor->currentFrame(), 0);
             vectorImage->applySelectionTransformation();
 
@@ -280,66 +282,26 @@ void SmudgeTool::drawStroke()
     //opacity = currentPressure; // todo: Probably not interesting?!
     //brushWidth = brushWidth * opacity;
 
-    BlitRect rect;
-    QPointF a = mLastBrushPoint;
-    QPointF b = getCurrentPoint();
-
-
+    mSmudge.setBrush(brushWidth, offset, opacity);
     if (toolMode == 1) // liquify hard
     {
-        qreal brushStep = 2;
-        qreal distance = QLineF(b, a).length() / 2.0;
-        int steps = qRound(distance / brushStep);
-        int rad = qRound(brushWidth / 2.0) + 2;
-
-        QPointF sourcePoint = mLastBrushPoint;
-        for (int i = 0; i < steps; i++)
-        {
-            QPointF targetPoint = mLastBrushPoint + (i + 1) * (brushStep) * (b - mLastBrushPoint) / distance;
-            rect.extend(targetPoint.toPoint());
-            mScribbleArea->liquifyBrush(targetImage,
-                                        sourcePoint,
-                                        targetPoint,
-                                        brushWidth,
-                                        offset,
-                                        opacity);
-
-            if (i == (steps - 1))
-            {
-                mLastBrushPoint = targetPoint;
-            }
-            sourcePoint = targetPoint;
-            mScribbleArea->paintBitmapBufferRect(rect);
-            mScribbleArea->refreshBitmap(rect, rad);
-        }
+        mSmudge.setMode(SmudgeEngine::LIQUIFY);
+        mSmudge.setSpacing(4);
     }
     else // liquify smooth
     {
-        qreal brushStep = 2.0;
-        qreal distance = QLineF(b, a).length();
-        int steps = qRound(distance / brushStep);
-        int rad = qRound(brushWidth / 2.0) + 2;
+        mSmudge.setMode(SmudgeEngine::SMEAR);
+        mSmudge.setSpacing(2);
+    }
 
-        QPointF sourcePoint = mLastBrushPoint;
-        for (int i = 0; i < steps; i++)
-        {
-            QPointF targetPoint = mLastBrushPoint + (i + 1) * (brushStep) * (b - mLastBrushPoint) / distance;
-            rect.extend(targetPoint.toPoint());
-            mScribbleArea->blurBrush(targetImage,
-                                     sourcePoint,
-                                     targetPoint,
-                                     brushWidth,
-                                     offset,
-                                     opacity);
-
-            if (i == (steps - 1))
-            {
-                mLastBrushPoint = targetPoint;
-            }
-            sourcePoint = targetPoint;
-            mScribbleArea->paintBitmapBufferRect(rect);
-            mScribbleArea->refreshBitmap(rect, rad);
-        }
+    // The whole segment is smudged at once, then refreshed once
+    mLastBrushPoint = mSmudge.stroke(targetImage, mLastBrushPoint, getCurrentPoint());
+
+    const QRect rect = mSmudge.dirtyRect();
+    if (!rect.isEmpty())
+    {
+        mScribbleArea->paintBitmapBufferRect(rect);
+        mScribbleArea->refreshBitmap(rect, 1);
     }
 }
 
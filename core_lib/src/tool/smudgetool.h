@@ -19,6 +19,7 @@ GNU General Public License for more details.
 #define SMUDGETOOL_H
 
 #include "stroketool.h"
+#include "smudgeengine.h"
 
 class SmudgeTool : public StrokeTool
 {
@@ -52,6 +53,7 @@ private:
     QPointF offsetFromPressPos();
 
     QPointF mLastBrushPoint;
+    SmudgeEngine mSmudge;
 };
 
 #endif // SMUDGETOOL_H
@@ -227,7 +227,9 @@ inline LayerVisibility& operator--(LayerVisibility& vis)
 #define SETTING_ONION_BLUE       "OnionBlue"
 #define SETTING_ONION_RED        "OnionRed"
 
-#define SETTING_FRAME_POOL_SIZE "FramePoolSize"
+#define SETTING_FRAME_POOL_MEMORY_BUDGET "FramePoolMemoryBudget"
+#define SETTING_UNDO_MEMORY_BUDGET "UndoMemoryBudget"
+#define SETTING_UNDO_SPILL_TO_DISK "UndoSpillToDisk"
 #define SETTING_GRID_SIZE_W      "GridSizeW"
 #define SETTING_GRID_SIZE_H      "GridSizeH"
 #define SETTING_OVERLAY_CENTER   "OverlayCenter"
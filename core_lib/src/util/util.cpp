@@ -15,7 +15,11 @@ GNU General Public License for more details.
 
 */
 #include "util.h"
+#include <atomic>
 #include <QAbstractSpinBox>
+#include <QRunnable>
+#include <QThread>
+#include <QThreadPool>
 
 QTransform RectMapTransform( QRectF source, QRectF target )
 {
@@ -60,3 +64,48 @@ void clearFocusOnFinished(QAbstractSpinBox *spinBox)
 {
     QObject::connect(spinBox, &QAbstractSpinBox::editingFinished, spinBox, &QAbstractSpinBox::clearFocus);
 }
+
+namespace
+{
+    class ParallelForWorker : public QRunnable
+    {
+    public:
+        ParallelForWorker(std::atomic<int>& next, int count, const std::function<void(int)>& task)
+            : mNext(next), mCount(count), mTask(task) {}
+
+        void run() override
+        {
+            for (int i = mNext++; i < mCount; i = mNext++)
+            {
+                mTask(i);
+            }
+        }
+
+    private:
+        std::atomic<int>& mNext;
+        int mCount;
+        const std::function<void(int)>& mTask;
+    };
+}
+
+void parallelFor(int count, std::function<void(int)> task)
+{
+    if (count <= 1)
+    {
+        for (int i = 0; i < count; ++i)
+            task(i);
+        return;
+    }
+
+    // A private pool, so waiting does not depend on unrelated tasks
+    QThreadPool pool;
+    const int workers = qMin(count, qMax(1, QThread::idealThreadCount()));
+    pool.setMaxThreadCount(workers);
+
+    std::atomic<int> next(0);
+    for (int i = 0; i < workers; ++i)
+    {
+        pool.start(new ParallelForWorker(next, count, task));
+    }
+    pool.waitForDone();
+}
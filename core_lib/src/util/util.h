@@ -27,6 +27,11 @@ QTransform RectMapTransform( QRectF source, QRectF target );
 
 void clearFocusOnFinished(QAbstractSpinBox *spinBox);
 
+/** Calls task(i) for every i in [0, count) on a pool of worker threads
+ *  and returns once all calls have finished. The calls may run in any order.
+ */
+void parallelFor(int count, std::function<void(int)> task);
+
 class ScopeGuard
 {
 public:
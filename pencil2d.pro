@@ -7,6 +7,7 @@ TEMPLATE = subdirs
 SUBDIRS = \ # sub-project names
     core_lib \
     app \
+    cli \
     tests
 
 # build the project sequentially as listed in SUBDIRS !
@@ -15,10 +16,12 @@ CONFIG += ordered
 # where to find the sub projects - give the folders
 core_lib.subdir = core_lib
 app.subdir      = app
+cli.subdir      = cli
 tests.subdir    = tests
 
 # what subproject depends on others
 app.depends      = core_lib
+cli.depends      = core_lib
 tests.depends    = core_lib
 
 TRANSLATIONS += translations/pencil.ts \
@@ -17,8 +17,17 @@ GNU General Public License for more details.
 #define CATCH_CONFIG_RUNNER
 #include "catch.hpp"
 
+#include <QApplication>
+
 int main(int argc, char* argv[])
 {
+    // The tool tests drive a ScribbleArea, which is never shown
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM"))
+    {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+    QApplication app(argc, argv);
+
     int result = Catch::Session().run(argc, argv);
     return result;
 }
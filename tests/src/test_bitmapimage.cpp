@@ -15,7 +15,24 @@ GNU General Public License for more details.
 */
 #include "catch.hpp"
 
+#include <memory>
+#include <vector>
+#include <QElapsedTimer>
+#include <QTemporaryDir>
+#include <QThread>
 #include "bitmapimage.h"
+#include "frameprefetcher.h"
+#include "activeframepool.h"
+#include "tiledimage.h"
+#include "mipmappyramid.h"
+#include "pixelkernels.h"
+#include "brushdab.h"
+#include "onionskincache.h"
+#include "transformsession.h"
+#include "pegbaraligner.h"
+#include "smudgeengine.h"
+#include "object.h"
+#include "layerbitmap.h"
 
 TEST_CASE("BitmapImage constructors")
 {
@@ -91,4 +108,673 @@ TEST_CASE("BitmapImage functions")
         REQUIRE(b->width() == 50);
         REQUIRE(b->height() == 50);
     }
+
+    SECTION("autoCrop() follows drawing and erasing")
+    {
+        BitmapImage b(QRect(0, 0, 100, 100), Qt::transparent);
+        b.enableAutoCrop(true);
+        REQUIRE(b.bounds().isEmpty());
+
+        b.drawRect(QRectF(10, 20, 5, 5), Qt::NoPen, QBrush(Qt::red), QPainter::CompositionMode_SourceOver, false);
+        REQUIRE(b.bounds() == QRect(10, 20, 5, 5));
+
+        b.drawRect(QRectF(50, 60, 10, 10), Qt::NoPen, QBrush(Qt::red), QPainter::CompositionMode_SourceOver, false);
+        REQUIRE(b.bounds() == QRect(10, 20, 50, 50));
+        REQUIRE(b.isMinimallyBounded());
+
+        b.clear(QRect(50, 60, 10, 10));
+        REQUIRE(b.bounds() == QRect(10, 20, 5, 5));
+    }
+
+    SECTION("Rows are scanned for their first and last visible pixels")
+    {
+        std::vector<QRgb> row(11, qRgba(0, 0, 0, 0));
+        REQUIRE(PixelKernels::firstNonTransparent(row.data(), 11) == 11);
+        REQUIRE(PixelKernels::lastNonTransparent(row.data(), 11) == -1);
+
+        row[5] = qRgba(1, 0, 0, 1);
+        row[9] = qRgba(0, 0, 0, 255);
+        REQUIRE(PixelKernels::firstNonTransparent(row.data(), 11) == 5);
+        REQUIRE(PixelKernels::lastNonTransparent(row.data(), 11) == 9);
+        REQUIRE(PixelKernels::firstNonTransparent(row.data(), 5) == 5);
+    }
+
+    SECTION("Growing the bounds keeps the pixels and clears the new area")
+    {
+        BitmapImage b(QRect(0, 0, 10, 10), Qt::red);
+        b.drawRect(QRectF(20, 0, 10, 10), Qt::NoPen, QBrush(Qt::blue), QPainter::CompositionMode_SourceOver, false);
+
+        REQUIRE(b.pixel(5, 5) == qRgb(255, 0, 0));
+        REQUIRE(qAlpha(b.pixel(15, 5)) == 0);
+        REQUIRE(b.pixel(25, 5) == qRgb(0, 0, 255));
+        REQUIRE(b.image()->size() == b.size());
+        REQUIRE(b.image()->pixel(QPoint(25, 5) - b.topLeft()) == qRgb(0, 0, 255));
+    }
+
+    SECTION("A stroke leaving the bounds on every dab keeps all of it")
+    {
+        BitmapImage b;
+        for (int x = 0; x < 300; x++)
+        {
+            b.drawRect(QRectF(-x, x, 1, 1), Qt::NoPen, QBrush(Qt::red), QPainter::CompositionMode_SourceOver, false);
+        }
+
+        REQUIRE(b.pixel(-150, 150) == qRgb(255, 0, 0));
+        REQUIRE(qAlpha(b.pixel(-150, 149)) == 0);
+        REQUIRE(b.image()->size() == b.size());
+        REQUIRE(b.image()->pixel(QPoint(-299, 299) - b.topLeft()) == qRgb(255, 0, 0));
+    }
+}
+
+TEST_CASE("BitmapImage flood fill")
+{
+    const QRgb red = qRgb(255, 0, 0);
+
+    SECTION("Fills the enclosed area only")
+    {
+        BitmapImage b(QRect(0, 0, 20, 20), Qt::white);
+        b.drawRect(QRectF(5, 5, 10, 10), QPen(Qt::black, 1), Qt::NoBrush, QPainter::CompositionMode_Source, false);
+
+        BitmapImage::floodFill(&b, QRect(0, 0, 20, 20), QPoint(10, 10), red, 0);
+
+        REQUIRE(b.pixel(10, 10) == red);
+        REQUIRE(b.pixel(6, 14) == red);
+        REQUIRE(b.pixel(5, 10) == qRgb(0, 0, 0));
+        REQUIRE(b.pixel(2, 2) == qRgb(255, 255, 255));
+    }
+
+    SECTION("Tolerance is a Euclidean distance")
+    {
+        BitmapImage b(QRect(0, 0, 20, 20), QColor(100, 100, 100));
+        b.drawRect(QRectF(10, 0, 10, 20), Qt::NoPen, QBrush(QColor(110, 100, 100)), QPainter::CompositionMode_Source, false);
+
+        BitmapImage strict(b);
+        BitmapImage::floodFill(&strict, QRect(0, 0, 20, 20), QPoint(2, 2), red, 9);
+        REQUIRE(strict.pixel(5, 5) == red);
+        REQUIRE(strict.pixel(15, 5) == qRgb(110, 100, 100));
+
+        BitmapImage loose(b);
+        BitmapImage::floodFill(&loose, QRect(0, 0, 20, 20), QPoint(2, 2), red, 10);
+        REQUIRE(loose.pixel(15, 5) == red);
+    }
+}
+
+TEST_CASE("BitmapImage copy-on-write tiles")
+{
+    SECTION("Modifying a clone leaves the original untouched")
+    {
+        auto b = std::make_shared<BitmapImage>(QRect(0, 0, 200, 200), Qt::red);
+        std::shared_ptr<BitmapImage> b2(b->clone());
+
+        b2->clear(QRect(10, 10, 20, 20));
+
+        REQUIRE(qAlpha(b2->pixel(15, 15)) == 0);
+        REQUIRE(b->pixel(15, 15) == qRgb(255, 0, 0));
+        REQUIRE(b2->pixel(150, 150) == qRgb(255, 0, 0));
+    }
+
+    SECTION("Restoring a copy")
+    {
+        auto b = std::make_shared<BitmapImage>(QRect(0, 0, 100, 100), Qt::red);
+        BitmapImage backup = b->copy();
+
+        b->drawRect(QRectF(40, 40, 10, 10), Qt::NoPen, QBrush(Qt::blue), QPainter::CompositionMode_Source, false);
+        REQUIRE(b->pixel(45, 45) == qRgb(0, 0, 255));
+
+        *b = backup;
+        REQUIRE(b->pixel(45, 45) == qRgb(255, 0, 0));
+        REQUIRE(b->image()->size() == QSize(100, 100));
+    }
+}
+
+TEST_CASE("TiledImage")
+{
+    const int tileSize = TiledImage::TILE_SIZE;
+
+    SECTION("Transparent tiles take no memory")
+    {
+        QImage image(tileSize * 4, tileSize * 4, QImage::Format_ARGB32_Premultiplied);
+        image.fill(Qt::transparent);
+        image.setPixel(tileSize + 1, tileSize + 1, qRgba(255, 0, 0, 255));
+
+        TiledImage tiles;
+        tiles.store(image, QPoint(0, 0), image.rect());
+
+        REQUIRE(tiles.tileCount() == 1);
+        REQUIRE(tiles.pixel(tileSize + 1, tileSize + 1) == qRgba(255, 0, 0, 255));
+        REQUIRE(tiles.toImage(image.rect()) == image);
+    }
+
+    SECTION("Copies share untouched tiles")
+    {
+        QImage image(tileSize * 2, tileSize, QImage::Format_ARGB32_Premultiplied);
+        image.fill(Qt::green);
+
+        TiledImage tiles;
+        tiles.store(image, QPoint(0, 0), image.rect());
+        REQUIRE(tiles.tileCount() == 2);
+
+        TiledImage copied = tiles;
+        copied.clear(QRect(0, 0, 5, 5));
+
+        REQUIRE(qAlpha(copied.pixel(2, 2)) == 0);
+        REQUIRE(tiles.pixel(2, 2) == QColor(Qt::green).rgba());
+        REQUIRE(copied.pixel(tileSize, 0) == QColor(Qt::green).rgba());
+    }
+
+    SECTION("Only the tiles changed since a copy count as its own memory")
+    {
+        const qint64 tileBytes = tileSize * tileSize * 4;
+
+        BitmapImage b(QRect(0, 0, tileSize * 4, tileSize * 4), Qt::red);
+        BitmapImage backup = b.copy();
+        REQUIRE(backup.unsharedByteSize() == 0);
+
+        b.clear(QRect(5, 5, 10, 10));
+        b.copy(); // brings the tiles of b up to date
+
+        REQUIRE(backup.unsharedByteSize() == tileBytes);
+    }
+
+    SECTION("A copied image keeps its pixels only once")
+    {
+        const qint64 tileBytes = tileSize * tileSize * 4;
+
+        BitmapImage b(QRect(0, 0, tileSize * 4, tileSize * 4), Qt::transparent);
+        b.drawRect(QRectF(tileSize, tileSize, 10, 10), Qt::NoPen, QBrush(Qt::red), QPainter::CompositionMode_SourceOver, false);
+        BitmapImage backup = b.copy();
+
+        REQUIRE_FALSE(b.isLoaded());
+        REQUIRE(b.memoryUsage() == tileBytes);
+        REQUIRE(b.pixel(tileSize + 5, tileSize + 5) == qRgb(255, 0, 0));
+        REQUIRE(b.image()->pixel(tileSize + 5, tileSize + 5) == qRgb(255, 0, 0));
+    }
+}
+
+TEST_CASE("BitmapImage mipmaps")
+{
+    SECTION("Each level averages 2x2 blocks of the level above")
+    {
+        QImage image(3, 2, QImage::Format_ARGB32_Premultiplied);
+        image.fill(Qt::transparent);
+        image.setPixel(0, 0, qRgba(200, 0, 0, 200));
+        image.setPixel(1, 1, qRgba(0, 100, 0, 100));
+        image.setPixel(2, 0, qRgba(0, 0, 80, 80));
+
+        QImage halved = MipmapPyramid::halved(image);
+        REQUIRE(halved.size() == QSize(2, 1));
+
+        // Compare the premultiplied values, pixel() would convert them back
+        const QRgb* row = reinterpret_cast<const QRgb*>(halved.constScanLine(0));
+        REQUIRE(row[0] == qRgba(50, 25, 0, 75));
+        REQUIRE(row[1] == qRgba(0, 0, 20, 20));
+    }
+
+    SECTION("Levels follow the zoom")
+    {
+        REQUIRE(MipmapPyramid::levelForScale(2.0) == 0);
+        REQUIRE(MipmapPyramid::levelForScale(0.6) == 0);
+        REQUIRE(MipmapPyramid::levelForScale(0.5) == 1);
+        REQUIRE(MipmapPyramid::levelForScale(0.3) == 1);
+        REQUIRE(MipmapPyramid::levelForScale(0.1) == 3);
+    }
+
+    SECTION("Modifying the image drops the mipmaps")
+    {
+        BitmapImage b(QRect(0, 0, 64, 64), Qt::red);
+        REQUIRE(b.mipmap(2).size() == QSize(16, 16));
+        REQUIRE(b.mipmap(2).pixel(3, 3) == qRgb(255, 0, 0));
+
+        b.drawRect(QRectF(0, 0, 64, 64), Qt::NoPen, QBrush(Qt::blue), QPainter::CompositionMode_Source, false);
+        REQUIRE(b.mipmap(2).pixel(3, 3) == qRgb(0, 0, 255));
+        REQUIRE(b.mipmap(0).size() == QSize(64, 64));
+    }
+
+    SECTION("Levels cover the bounds of a grown image")
+    {
+        BitmapImage b(QRect(0, 0, 64, 64), Qt::red);
+        b.drawRect(QRectF(96, 32, 32, 32), Qt::NoPen, QBrush(Qt::blue), QPainter::CompositionMode_SourceOver, false);
+        REQUIRE(b.bounds() == QRect(0, 0, 128, 64));
+
+        REQUIRE(b.mipmap(0).size() == QSize(128, 64));
+        REQUIRE(b.mipmap(0).pixel(8, 8) == qRgb(255, 0, 0));
+        REQUIRE(b.mipmap(0).pixel(100, 40) == qRgb(0, 0, 255));
+        REQUIRE(b.mipmap(1).size() == QSize(64, 32));
+        REQUIRE(b.mipmap(1).pixel(50, 20) == qRgb(0, 0, 255));
+        REQUIRE(qAlpha(b.mipmap(1).pixel(40, 4)) == 0);
+    }
+}
+
+TEST_CASE("Brush dabs")
+{
+    SECTION("A stroke of constant width reuses its dabs")
+    {
+        BrushDabCache cache;
+        cache.dab(10.0, 50, QPointF(5.1, 5.1));
+        cache.dab(10.0, 50, QPointF(38.1, 20.1));
+        REQUIRE(cache.size() == 1);
+
+        cache.dab(10.0, 50, QPointF(38.6, 20.1));
+        cache.dab(12.0, 50, QPointF(38.6, 20.1));
+        REQUIRE(cache.size() == 3);
+    }
+
+    SECTION("A dab covers the same pixels as the gradient ellipse")
+    {
+        const QPointF centre(20.5, 20.5);
+        const qreal width = 16;
+        const qreal feather = 40;
+        const QColor colour(0, 0, 255);
+        const QRgb dabColour = BrushDabCache::dabColour(colour, 1.0, feather);
+
+        QRadialGradient gradient(centre, 0.5 * width);
+        gradient.setColorAt(0.0, QColor::fromRgba(qUnpremultiply(dabColour)));
+        gradient.setColorAt(1.0 - feather / 100.0, QColor::fromRgba(qUnpremultiply(dabColour)));
+        gradient.setColorAt(1.0, QColor(0, 0, 255, 0));
+
+        BitmapImage painted(QRect(0, 0, 40, 40), Qt::transparent);
+        painted.drawEllipse(QRectF(centre.x() - 8, centre.y() - 8, width, width), Qt::NoPen, gradient,
+                            QPainter::CompositionMode_SourceOver, false);
+
+        BrushDabCache cache;
+        const BrushDab& dab = cache.dab(width, feather, centre);
+        BitmapImage stamped(QRect(0, 0, 40, 40), Qt::transparent);
+        stamped.drawDab(dab, QPoint(20, 20) + dab.offset, dabColour);
+
+        REQUIRE(stamped.pixel(20, 20) == painted.pixel(20, 20));
+        REQUIRE(qAlpha(stamped.pixel(20 + 9, 20)) == 0);
+
+        qint64 paintedCoverage = 0;
+        qint64 stampedCoverage = 0;
+        for (int y = 0; y < 40; ++y)
+        {
+            for (int x = 0; x < 40; ++x)
+            {
+                paintedCoverage += qAlpha(painted.pixel(x, y));
+                stampedCoverage += qAlpha(stamped.pixel(x, y));
+            }
+        }
+        REQUIRE(qAbs(stampedCoverage - paintedCoverage) <= paintedCoverage / 20);
+    }
+
+    SECTION("Masked rows blend like the scalar source over")
+    {
+        const QRgb colour = qPremultiply(qRgba(200, 100, 50, 180));
+        std::vector<QRgb> row(13);
+        std::vector<quint8> mask(13);
+        for (int i = 0; i < 13; ++i)
+        {
+            row[i] = qPremultiply(qRgba(i * 19, 255 - i * 7, i * 3, i * 20));
+            mask[i] = static_cast<quint8>((i * 41) % 256);
+        }
+        mask[4] = mask[5] = mask[6] = mask[7] = 0;
+
+        std::vector<QRgb> expected = row;
+        for (int i = 0; i < 13; ++i)
+        {
+            if (mask[i] != 0)
+            {
+                expected[i] = PixelKernels::sourceOver(PixelKernels::byteMul(colour, mask[i]), expected[i]);
+            }
+        }
+
+        PixelKernels::blendMaskRow(row.data(), mask.data(), 13, colour);
+        REQUIRE(row == expected);
+    }
+}
+
+TEST_CASE("OnionSkinCache")
+{
+    OnionSkinCache cache;
+    BitmapImage b(QRect(0, 0, 8, 8), Qt::green);
+
+    SECTION("An unchanged key frame reuses its tinted image")
+    {
+        QImage first = cache.tinted(&b, b.mipmap(0), Qt::red, 0);
+        REQUIRE(first.pixel(3, 3) == qRgb(255, 0, 0));
+
+        QImage second = cache.tinted(&b, b.mipmap(0), Qt::red, 0);
+        REQUIRE(second.cacheKey() == first.cacheKey());
+        REQUIRE(cache.size() == 1);
+
+        cache.tinted(&b, b.mipmap(0), Qt::blue, 0);
+        REQUIRE(cache.size() == 2);
+    }
+
+    SECTION("Drawing on the key frame tints it again")
+    {
+        QImage first = cache.tinted(&b, b.mipmap(0), Qt::red, 0);
+
+        b.clear(QRect(0, 0, 4, 8));
+        QImage second = cache.tinted(&b, b.mipmap(0), Qt::red, 0);
+        REQUIRE(second.cacheKey() != first.cacheKey());
+        REQUIRE(qAlpha(second.pixel(1, 1)) == 0);
+        REQUIRE(second.pixel(6, 1) == qRgb(255, 0, 0));
+        REQUIRE(cache.size() == 1);
+    }
+
+    SECTION("Deleting the key frame drops its images")
+    {
+        BitmapImage* onion = new BitmapImage(QRect(0, 0, 8, 8), Qt::green);
+        cache.tinted(onion, onion->mipmap(0), Qt::red, 0);
+        REQUIRE(cache.size() == 1);
+
+        delete onion;
+        REQUIRE(cache.size() == 0);
+        REQUIRE(cache.byteSize() == 0);
+    }
+}
+
+TEST_CASE("TransformSession")
+{
+    QImage source(8, 6, QImage::Format_ARGB32_Premultiplied);
+    for (int y = 0; y < source.height(); y++)
+    {
+        for (int x = 0; x < source.width(); x++)
+        {
+            source.setPixel(x, y, qRgba(x * 30, y * 40, 0, 255));
+        }
+    }
+
+    SECTION("Resampling through the identity keeps the pixels")
+    {
+        QImage nearest(source.size(), QImage::Format_ARGB32_Premultiplied);
+        TransformSession::resample(source, QTransform(), nearest, false);
+        REQUIRE(nearest == source);
+
+        QImage bilinear(source.size(), QImage::Format_ARGB32_Premultiplied);
+        TransformSession::resample(source, QTransform(), bilinear, true);
+        REQUIRE(bilinear == source);
+    }
+
+    SECTION("Resampling a translation moves the pixels")
+    {
+        QImage target(source.size(), QImage::Format_ARGB32_Premultiplied);
+        TransformSession::resample(source, QTransform::fromTranslate(-2, -1), target, false);
+        REQUIRE(qAlpha(target.pixel(1, 0)) == 0);
+        REQUIRE(target.pixel(2, 1) == source.pixel(0, 0));
+        REQUIRE(target.pixel(7, 5) == source.pixel(5, 4));
+    }
+
+    SECTION("The session follows its key frame")
+    {
+        BitmapImage b(QRect(0, 0, 16, 16), Qt::green);
+        TransformSession session;
+        session.begin(&b, QRect(4, 4, 8, 8));
+        REQUIRE(session.isActiveFor(&b, QRect(4, 4, 8, 8)));
+        REQUIRE_FALSE(session.isActiveFor(&b, QRect(0, 0, 8, 8)));
+
+        b.clear(QRect(0, 0, 2, 2));
+        REQUIRE_FALSE(session.isActiveFor(&b, QRect(4, 4, 8, 8)));
+
+        session.end();
+        REQUIRE_FALSE(session.isActive());
+    }
+}
+
+TEST_CASE("PegBarAligner")
+{
+    const QRectF pegArea(0, 0, 40, 20);
+
+    auto drawPegs = [](BitmapImage* b, QPoint at)
+    {
+        b->drawRect(QRectF(at, QSizeF(6, 4)), Qt::NoPen, QBrush(Qt::black), QPainter::CompositionMode_SourceOver, false);
+    };
+
+    SECTION("Dark opaque pixels are flagged four at a time and one by one")
+    {
+        std::vector<QRgb> row(11, qRgba(255, 255, 255, 255));
+        row[2] = qRgba(0, 0, 0, 255);
+        row[7] = qRgba(0, 0, 0, 128);
+        row[10] = qRgba(100, 100, 100, 255);
+
+        std::vector<quint8> mask(11);
+        PixelKernels::darkMaskRow(row.data(), 11, 121, mask.data());
+        REQUIRE(mask == std::vector<quint8>{ 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 1 });
+    }
+
+    SECTION("Edges give the left and top of the pegs, the centroid their centre")
+    {
+        BitmapImage b(QRect(0, 0, 40, 20), Qt::white);
+        drawPegs(&b, QPoint(10, 5));
+        const QImage image = *b.image();
+
+        QPointF peg;
+        REQUIRE(PegBarAligner::findPeg(image, b.topLeft(), pegArea.toRect(), PegBarAligner::EDGES, 121, peg));
+        REQUIRE(peg == QPointF(10, 5));
+        REQUIRE(PegBarAligner::findPeg(image, b.topLeft(), pegArea.toRect(), PegBarAligner::CENTROID, 121, peg));
+        REQUIRE(peg == QPointF(13, 7));
+
+        REQUIRE_FALSE(PegBarAligner::findPeg(image, b.topLeft(), QRect(30, 12, 8, 8), PegBarAligner::EDGES, 121, peg));
+    }
+
+    SECTION("Every key frame is registered on the reference")
+    {
+        Object object;
+        object.init();
+        LayerBitmap* layer = object.addNewBitmapLayer();
+        layer->addNewKeyFrameAt(1);
+        layer->addNewKeyFrameAt(5);
+        drawPegs(layer->getBitmapImageAtFrame(1), QPoint(10, 5));
+        drawPegs(layer->getBitmapImageAtFrame(5), QPoint(13, 3));
+
+        BitmapImage reference(QRect(0, 0, 40, 20), Qt::white);
+        drawPegs(&reference, QPoint(10, 5));
+
+        PegBarAligner aligner(pegArea);
+        aligner.setWorkerCount(2);
+        REQUIRE(aligner.findReference(&reference));
+        aligner.detect(&object, QList<int>() << object.getLayerCount() - 1);
+
+        REQUIRE(aligner.allFound());
+        REQUIRE(aligner.registrations().size() == 2);
+        for (const PegRegistration& registration : aligner.registrations())
+        {
+            const QPointF expected = (registration.frame == 5) ? QPointF(-3, 2) : QPointF(0, 0);
+            REQUIRE(registration.offset == expected);
+        }
+    }
+
+    SECTION("Key frames on disk are searched without being loaded")
+    {
+        QTemporaryDir testDir("PENCIL_TEST_XXXXXXXX");
+        const QString path = testDir.filePath("001.005.png");
+        BitmapImage drawing(QRect(0, 0, 40, 20), Qt::white);
+        drawPegs(&drawing, QPoint(13, 3));
+        REQUIRE(drawing.image()->save(path));
+
+        Object object;
+        object.init();
+        LayerBitmap* layer = object.addNewBitmapLayer();
+        layer->loadImageAtFrame(path, QPoint(0, 0), 5);
+        REQUIRE(layer->getBitmapImageAtFrame(5)->loadsFromFile());
+
+        BitmapImage reference(QRect(0, 0, 40, 20), Qt::white);
+        drawPegs(&reference, QPoint(10, 5));
+
+        PegBarAligner aligner(pegArea);
+        REQUIRE(aligner.findReference(&reference));
+        aligner.detect(&object, QList<int>() << object.getLayerCount() - 1);
+
+        for (const PegRegistration& registration : aligner.registrations())
+        {
+            if (registration.frame == 5)
+            {
+                REQUIRE(registration.found);
+                REQUIRE(registration.offset == QPointF(-3, 2));
+            }
+        }
+        REQUIRE(layer->getBitmapImageAtFrame(5)->loadsFromFile());
+    }
+
+    SECTION("Whole pixels move the bounds, a fraction resamples")
+    {
+        BitmapImage b(QRect(0, 0, 10, 10), Qt::black);
+        PegBarAligner::apply(&b, QPointF(3, -2));
+        REQUIRE(b.bounds() == QRect(3, -2, 10, 10));
+
+        PegBarAligner::apply(&b, QPointF(0.5, 0));
+        REQUIRE(b.bounds() == QRect(3, -2, 11, 10));
+        REQUIRE(qAlpha(b.pixel(3, 0)) == 127);
+        REQUIRE(qAlpha(b.pixel(4, 0)) == 255);
+    }
+}
+
+TEST_CASE("SmudgeEngine")
+{
+    SmudgeEngine smudge;
+    smudge.setBrush(24, 0, 1.0);
+    smudge.setSpacing(2);
+
+    SECTION("A flat colour stays the same")
+    {
+        BitmapImage b(QRect(0, 0, 64, 64), Qt::red);
+        smudge.setMode(SmudgeEngine::LIQUIFY);
+
+        REQUIRE(smudge.stroke(&b, QPointF(20, 32), QPointF(44, 32)) == QPointF(44, 32));
+        REQUIRE(smudge.dirtyRect().contains(QPoint(44, 32)));
+        REQUIRE(b.pixel(32, 32) == qRgba(255, 0, 0, 255));
+    }
+
+    SECTION("Liquify drags the pixels along the stroke")
+    {
+        BitmapImage b(QRect(0, 0, 20, 40), Qt::blue);
+        smudge.setMode(SmudgeEngine::LIQUIFY);
+        smudge.stroke(&b, QPointF(10, 20), QPointF(30, 20));
+
+        REQUIRE(b.bounds().right() > 19);
+        REQUIRE(b.pixel(24, 20) == qRgba(0, 0, 255, 255));
+        REQUIRE(qAlpha(b.pixel(2, 2)) == 255);
+    }
+
+    SECTION("Smear lays the previous dab over the next one at half strength")
+    {
+        BitmapImage b(QRect(0, 0, 20, 40), Qt::blue);
+        smudge.setMode(SmudgeEngine::SMEAR);
+        smudge.stroke(&b, QPointF(10, 20), QPointF(12, 20));
+
+        REQUIRE(qAlpha(b.pixel(21, 20)) == 127);
+    }
+
+    SECTION("Nothing is done on an empty image or under half a step")
+    {
+        BitmapImage b;
+        REQUIRE(smudge.stroke(&b, QPointF(0, 0), QPointF(10, 0)) == QPointF(10, 0));
+        REQUIRE(smudge.dirtyRect().isEmpty());
+        REQUIRE(smudge.stroke(&b, QPointF(0, 0), QPointF(0.5, 0)) == QPointF(0, 0));
+    }
+}
+
+TEST_CASE("FramePrefetcher")
+{
+    QTemporaryDir testDir("PENCIL_TEST_XXXXXXXX");
+    const QString path = testDir.filePath("001.001.png");
+    QImage png(32, 16, QImage::Format_ARGB32_Premultiplied);
+    png.fill(Qt::green);
+    REQUIRE(png.save(path));
+
+    SECTION("A requested frame is loaded from the decoded image")
+    {
+        BitmapImage b(QPoint(5, 5), path);
+        REQUIRE(b.loadsFromFile());
+
+        FramePrefetcher prefetcher;
+        prefetcher.request(&b);
+        REQUIRE(prefetcher.pendingCount() == 1);
+
+        QElapsedTimer timer;
+        timer.start();
+        while (prefetcher.pendingCount() > 0 && timer.elapsed() < 5000)
+        {
+            QThread::msleep(1);
+            prefetcher.collect();
+        }
+        REQUIRE(prefetcher.pendingCount() == 0);
+        REQUIRE(b.isLoaded());
+        REQUIRE(b.bounds() == QRect(5, 5, 32, 16));
+        REQUIRE(b.image()->pixel(0, 0) == qRgb(0, 255, 0));
+    }
+
+    SECTION("Frames loaded in the meantime are left alone")
+    {
+        BitmapImage b(QPoint(0, 0), path);
+
+        FramePrefetcher prefetcher;
+        prefetcher.request(&b);
+        b.loadFile();
+        b.drawRect(QRectF(0, 0, 32, 16), Qt::NoPen, QBrush(Qt::blue), QPainter::CompositionMode_Source, false);
+
+        REQUIRE_FALSE(prefetcher.finish(&b));
+        REQUIRE(b.image()->pixel(0, 0) == qRgb(0, 0, 255));
+    }
+}
+
+TEST_CASE("ActiveFramePool")
+{
+    // Declared first so the frames are destroyed while the pool still listens to them
+    std::unique_ptr<ActiveFramePool> pool;
+
+    std::vector<std::unique_ptr<BitmapImage>> frames;
+    for (int i = 1; i <= 20; ++i)
+    {
+        frames.emplace_back(new BitmapImage(QRect(0, 0, 100, 100), Qt::red));
+        frames.back()->setPos(i);
+    }
+    auto frame = [&frames](int i) { return frames[static_cast<size_t>(i - 1)].get(); };
+
+    const qint64 frameBytes = frame(1)->memoryUsage();
+    REQUIRE(frameBytes >= 100 * 100 * 4);
+    pool.reset(new ActiveFramePool(frameBytes * 5));
+
+    SECTION("Frames are unloaded to stay within the memory budget")
+    {
+        for (int i = 1; i <= 20; ++i)
+        {
+            pool->setPlayhead(i);
+            pool->put(frame(i));
+        }
+
+        FramePoolStats stats = pool->stats();
+        REQUIRE(stats.frameCount == 5);
+        REQUIRE(stats.residentBytes == frameBytes * 5);
+        REQUIRE(stats.evictions == 15);
+        REQUIRE(stats.hits == 20);
+        REQUIRE(stats.misses == 0);
+        REQUIRE_FALSE(frame(1)->isLoaded());
+
+        pool->setPlayhead(1);
+        pool->put(frame(1));
+        REQUIRE(pool->stats().misses == 1);
+        REQUIRE(frame(1)->isLoaded());
+        REQUIRE(frame(1)->image()->pixel(50, 50) == qRgb(255, 0, 0));
+    }
+
+    SECTION("Frames in the onion skin range are unloaded last")
+    {
+        pool->setOnionSkinRange(8, 0);
+        for (int i : { 2, 15, 16, 17, 18 })
+        {
+            pool->setPlayhead(i);
+            pool->put(frame(i));
+        }
+
+        pool->setPlayhead(10);
+        pool->put(frame(19));
+
+        REQUIRE(pool->isFrameInPool(frame(2)));
+        REQUIRE_FALSE(pool->isFrameInPool(frame(15)));
+        REQUIRE(pool->stats().evictions == 1);
+    }
+
+    SECTION("A smaller budget unloads frames right away")
+    {
+        for (int i = 1; i <= 5; ++i)
+        {
+            pool->setPlayhead(i);
+            pool->put(frame(i));
+        }
+        pool->setMemoryBudget(frameBytes * 2);
+        REQUIRE(pool->stats().frameCount == 2);
+        REQUIRE(pool->stats().residentBytes <= frameBytes * 2);
+    }
 }
@@ -15,9 +15,12 @@ GNU General Public License for more details.
 */
 #include "catch.hpp"
 
+#include <QDir>
+#include <QFileInfo>
 #include <QTemporaryDir>
 #include <QTemporaryFile>
 #include <QImage>
+#include "miniz.h"
 #include "qminiz.h"
 #include "fileformat.h"
 #include "filemanager.h"
@@ -25,6 +28,7 @@ GNU General Public License for more details.
 #include "object.h"
 #include "bitmapimage.h"
 #include "layerbitmap.h"
+#include "projectarchive.h"
 
 
 TEST_CASE("FileManager Initial Test")
@@ -288,7 +292,7 @@ TEST_CASE("FileManager File-saving")
 
         // 2. Load the animation back and then make some frames unloaded by active frame pool
         Object* o2 = fm.load(animationPath);
-        o2->setActiveFramePoolSize(20);
+        o2->setActiveFramePoolBudget(20 * 10 * 10 * 4);
 
         layer = dynamic_cast<LayerBitmap*>(o2->getLayer(2));
         for (int i = 1; i < 150; ++i)
@@ -316,4 +320,177 @@ TEST_CASE("FileManager File-saving")
         }
         delete o3;
     }
+
+    SECTION("Saving over a project keeps the frames that were not modified")
+    {
+        FileManager fm;
+
+        // 1. Create an animation with three red frames & save it
+        Object* o1 = new Object;
+        o1->init();
+        o1->createDefaultLayers();
+
+        LayerBitmap* layer = dynamic_cast<LayerBitmap*>(o1->getLayer(2));
+        for (int i = 2; i <= 4; ++i)
+        {
+            layer->addNewKeyFrameAt(i);
+            auto bitmap = layer->getBitmapImageAtFrame(i);
+            bitmap->drawRect(QRectF(0, 0, 10, 10), QPen(QColor(255, 0, 0)), QBrush(Qt::red), QPainter::CompositionMode_SourceOver, false);
+        }
+
+        QTemporaryDir testDir("PENCIL_TEST_XXXXXXXX");
+        QString animationPath = testDir.path() + "/abc.pclx";
+        REQUIRE(fm.save(o1, animationPath).ok());
+        delete o1;
+
+        // Store every file uncompressed, a file copied raw keeps that method when saved again
+        {
+            QString storedPath = testDir.path() + "/stored.pclx";
+            mz_zip_archive reader;
+            mz_zip_archive writer;
+            mz_zip_zero_struct(&reader);
+            mz_zip_zero_struct(&writer);
+            REQUIRE(mz_zip_reader_init_file(&reader, animationPath.toUtf8().data(), 0));
+            REQUIRE(mz_zip_writer_init_file(&writer, storedPath.toUtf8().data(), 0));
+            for (mz_uint i = 0; i < mz_zip_reader_get_num_files(&reader); ++i)
+            {
+                mz_zip_archive_file_stat stat;
+                REQUIRE(mz_zip_reader_file_stat(&reader, i, &stat));
+                size_t size = 0;
+                void* data = mz_zip_reader_extract_to_heap(&reader, i, &size, 0);
+                REQUIRE(mz_zip_writer_add_mem(&writer, stat.m_filename, data, size, MZ_NO_COMPRESSION));
+                mz_free(data);
+            }
+            mz_zip_reader_end(&reader);
+            REQUIRE(mz_zip_writer_finalize_archive(&writer));
+            mz_zip_writer_end(&writer);
+            REQUIRE(QFile::remove(animationPath));
+            REQUIRE(QFile::rename(storedPath, animationPath));
+        }
+
+        // 2. Load it, paint the middle frame blue and save over the same file
+        Object* o2 = fm.load(animationPath);
+        layer = dynamic_cast<LayerBitmap*>(o2->getLayer(2));
+        BitmapImage* b2 = layer->getBitmapImageAtFrame(3);
+        b2->drawRect(QRectF(0, 0, 10, 10), QPen(QColor(0, 0, 255)), QBrush(Qt::blue), QPainter::CompositionMode_SourceOver, false);
+
+        REQUIRE(fm.save(o2, animationPath).ok());
+        delete o2;
+
+        // 3. Only the middle frame has changed
+        Object* o3 = fm.load(animationPath);
+        layer = dynamic_cast<LayerBitmap*>(o3->getLayer(2));
+
+        // The unchanged frames were copied from the previous archive, the changed one compressed again
+        auto methodOf = [&animationPath, layer](int frame)
+        {
+            const QString name = QString(PFF_OLD_DATA_DIR) + "/" + QFileInfo(layer->getBitmapImageAtFrame(frame)->fileName()).fileName();
+            mz_zip_archive reader;
+            mz_zip_zero_struct(&reader);
+            mz_zip_reader_init_file(&reader, animationPath.toUtf8().data(), 0);
+            mz_zip_archive_file_stat stat;
+            stat.m_method = 0xffff;
+            const int index = mz_zip_reader_locate_file(&reader, name.toUtf8().data(), nullptr, 0);
+            if (index >= 0)
+            {
+                mz_zip_reader_file_stat(&reader, static_cast<mz_uint>(index), &stat);
+            }
+            mz_zip_reader_end(&reader);
+            return stat.m_method;
+        };
+        REQUIRE(methodOf(2) == 0);
+        REQUIRE(methodOf(3) == MZ_DEFLATED);
+        REQUIRE(methodOf(4) == 0);
+
+        auto pixelAt = [layer](int frame)
+        {
+            BitmapImage* bitmap = layer->getBitmapImageAtFrame(frame);
+            bitmap->image(); // the bounds are only known once the key frame is loaded
+            return bitmap->pixel(5, 5);
+        };
+        REQUIRE(pixelAt(2) == qRgb(255, 0, 0));
+        REQUIRE(pixelAt(3) == qRgb(0, 0, 255));
+        REQUIRE(pixelAt(4) == qRgb(255, 0, 0));
+        delete o3;
+    }
+}
+
+TEST_CASE("FileManager failed saves")
+{
+    SECTION("A frame that cannot be written leaves the saved project as it was")
+    {
+        FileManager fm;
+
+        Object* o1 = new Object;
+        o1->init();
+        o1->createDefaultLayers();
+
+        LayerBitmap* layer = dynamic_cast<LayerBitmap*>(o1->getLayer(2));
+        REQUIRE(layer->addNewKeyFrameAt(2));
+        layer->getBitmapImageAtFrame(2)->drawRect(QRectF(0, 0, 10, 10), QPen(QColor(255, 0, 0)), QBrush(Qt::red), QPainter::CompositionMode_SourceOver, false);
+
+        QTemporaryDir testDir("PENCIL_TEST_XXXXXXXX");
+        QString animationPath = testDir.path() + "/abc.pclx";
+        REQUIRE(fm.save(o1, animationPath).ok());
+        delete o1;
+
+        QFile saved(animationPath);
+        REQUIRE(saved.open(QIODevice::ReadOnly));
+        const QByteArray savedBytes = saved.readAll();
+        saved.close();
+
+        Object* o2 = fm.load(animationPath);
+        layer = dynamic_cast<LayerBitmap*>(o2->getLayer(2));
+        BitmapImage* b2 = layer->getBitmapImageAtFrame(2);
+        b2->drawRect(QRectF(0, 0, 10, 10), QPen(QColor(0, 0, 255)), QBrush(Qt::blue), QPainter::CompositionMode_SourceOver, false);
+
+        // A folder in the way of the frame file
+        const QString framePath = b2->fileName();
+        REQUIRE(QFile::remove(framePath));
+        REQUIRE(QDir().mkpath(framePath));
+
+        REQUIRE_FALSE(fm.save(o2, animationPath).ok());
+        delete o2;
+
+        REQUIRE(saved.open(QIODevice::ReadOnly));
+        REQUIRE(saved.readAll() == savedBytes);
+    }
+}
+
+TEST_CASE("FileManager lazy loading")
+{
+    SECTION("Bitmap key frames are extracted when they are loaded")
+    {
+        FileManager fm;
+
+        Object* o1 = new Object;
+        o1->init();
+        o1->createDefaultLayers();
+
+        LayerBitmap* layer = dynamic_cast<LayerBitmap*>(o1->getLayer(2));
+        REQUIRE(layer->addNewKeyFrameAt(2));
+        BitmapImage* b1 = layer->getBitmapImageAtFrame(2);
+        b1->drawRect(QRectF(0, 0, 10, 10), QPen(QColor(255, 0, 0)), QBrush(Qt::red), QPainter::CompositionMode_SourceOver, false);
+
+        QTemporaryDir testDir("PENCIL_TEST_XXXXXXXX");
+        QString animationPath = testDir.path() + "/abc.pclx";
+        REQUIRE(fm.save(o1, animationPath).ok());
+        delete o1;
+
+        Object* o2 = fm.load(animationPath);
+        layer = dynamic_cast<LayerBitmap*>(o2->getLayer(2));
+        BitmapImage* b2 = layer->getBitmapImageAtFrame(2);
+
+        // Opening only extracts main.xml and the small files
+        REQUIRE(QFile::exists(o2->mainXMLFile()));
+        REQUIRE_FALSE(QFile::exists(b2->fileName()));
+        REQUIRE(ProjectArchive::isPending(b2->fileName()));
+
+        b2->image();
+        REQUIRE(b2->pixel(5, 5) == qRgb(255, 0, 0));
+        REQUIRE(QFile::exists(b2->fileName()));
+        REQUIRE_FALSE(ProjectArchive::isPending(b2->fileName()));
+
+        delete o2;
+    }
 }
@@ -0,0 +1,101 @@
+/*
+
+Pencil - Traditional Animation Software
+Copyright (C) 2012-2018 Matthew Chiawen Chang
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+*/
+#include "catch.hpp"
+
+#include <QFile>
+#include <QImage>
+#include <QTemporaryDir>
+#include "frameimporter.h"
+
+
+TEST_CASE("FrameImporter::startImages()")
+{
+    QTemporaryDir dir;
+    REQUIRE(dir.isValid());
+
+    QStringList files;
+    QList<int> positions;
+    for (int i = 0; i < 10; i++)
+    {
+        QImage image(4 + i, 3, QImage::Format_ARGB32);
+        image.fill(qRgba(10 * i, 0, 0, 255));
+
+        const QString fileName = dir.filePath(QString("frame%1.png").arg(i));
+        REQUIRE(image.save(fileName));
+        files.append(fileName);
+        positions.append(1 + i * 2);
+    }
+
+    SECTION("Frames come back in order, converted, at their positions")
+    {
+        FrameImporter frames;
+        frames.setWorkerCount(3);
+        frames.startImages(files, positions);
+        REQUIRE(frames.frameCount() == 10);
+
+        int count = 0;
+        while (frames.hasMoreFrames())
+        {
+            ImportedFrame frame;
+            if (!frames.takeNextFrame(frame, 1000))
+            {
+                continue;
+            }
+            REQUIRE(frame.position == 1 + count * 2);
+            REQUIRE(frame.fileName == files[count]);
+            REQUIRE(frame.image.width() == 4 + count);
+            REQUIRE(frame.image.format() == QImage::Format_ARGB32_Premultiplied);
+            count++;
+        }
+        REQUIRE(count == 10);
+        REQUIRE(frames.failedFiles().isEmpty());
+    }
+
+    SECTION("A file that cannot be read gives a null image and is reported")
+    {
+        QFile broken(files[4]);
+        REQUIRE(broken.open(QFile::WriteOnly | QFile::Truncate));
+        broken.write("not an image");
+        broken.close();
+
+        FrameImporter frames;
+        frames.startImages(files, positions);
+
+        int count = 0;
+        while (frames.hasMoreFrames())
+        {
+            ImportedFrame frame;
+            if (frames.takeNextFrame(frame, 1000))
+            {
+                REQUIRE(frame.image.isNull() == (count == 4));
+                count++;
+            }
+        }
+        REQUIRE(count == 10);
+        REQUIRE(frames.failedFiles() == QStringList(files[4]));
+    }
+
+    SECTION("Nothing comes after cancel")
+    {
+        FrameImporter frames;
+        frames.startImages(files, positions);
+        frames.cancel();
+
+        ImportedFrame frame;
+        REQUIRE_FALSE(frames.hasMoreFrames());
+        REQUIRE_FALSE(frames.takeNextFrame(frame, 10));
+    }
+}
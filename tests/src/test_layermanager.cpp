@@ -92,3 +92,54 @@ TEST_CASE("LayerManager::deleteLayer()")
     }
     delete editor;
 }
+
+TEST_CASE("LayerManager key frames across layers")
+{
+    Object* object = new Object;
+    Editor* editor = new Editor;
+    editor->setObject(object);
+
+    LayerManager* layerMgr = new LayerManager(editor);
+    layerMgr->init();
+
+    Layer* bitmap = layerMgr->createBitmapLayer("Bitmap1");
+    Layer* vector = layerMgr->createVectorLayer("Vector2");
+    bitmap->addNewKeyFrameAt(5);
+    vector->addNewKeyFrameAt(9);
+
+    SECTION("Key frame lookups")
+    {
+        REQUIRE(layerMgr->LastFrameAtFrame(4) == 1);
+        REQUIRE(layerMgr->LastFrameAtFrame(5) == 5);
+        REQUIRE(layerMgr->LastFrameAtFrame(100) == 9);
+        REQUIRE(layerMgr->nextKeyFrameIndex(5) == 9);
+        REQUIRE(layerMgr->previousKeyFrameIndex(5) == 1);
+        REQUIRE(layerMgr->nextKeyFrameIndex(9) == -1);
+        REQUIRE(layerMgr->firstKeyFrameIndex() == 1);
+        REQUIRE(layerMgr->animationLength() == 9);
+    }
+
+    SECTION("Moving and removing key frames")
+    {
+        vector->setFrameSelected(9, true);
+        REQUIRE(vector->moveSelectedFrames(3));
+        REQUIRE(layerMgr->LastFrameAtFrame(11) == 5);
+        REQUIRE(layerMgr->animationLength() == 12);
+
+        bitmap->removeKeyFrame(5);
+        REQUIRE(layerMgr->LastFrameAtFrame(11) == 1);
+
+        layerMgr->deleteLayer(1); // the vector layer
+        REQUIRE(layerMgr->animationLength() == 1);
+        REQUIRE(layerMgr->nextKeyFrameIndex(1) == -1);
+    }
+
+    SECTION("A layer without key frames starts at 0")
+    {
+        Layer* empty = layerMgr->createBitmapLayer("Bitmap3");
+        empty->removeKeyFrame(1);
+        REQUIRE(empty->keyFrameCount() == 0);
+        REQUIRE(layerMgr->firstKeyFrameIndex() == 0);
+    }
+    delete editor;
+}
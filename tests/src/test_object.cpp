@@ -18,11 +18,14 @@ GNU General Public License for more details.
 #include <memory>
 #include <QDomDocument>
 #include <QDomElement>
+#include <QFile>
 #include <QTemporaryDir>
 #include "object.h"
 #include "layerbitmap.h"
 #include "layervector.h"
 #include "layersound.h"
+#include "layercamera.h"
+#include "bitmapimage.h"
 
 
 TEST_CASE("Object::addXXXLayer()")
@@ -119,6 +122,50 @@ TEST_CASE("Object::getUniqueLayerID()")
     }
 }
 
+TEST_CASE("Object::exportFrames()")
+{
+    std::unique_ptr<Object> obj(new Object);
+    obj->init();
+    obj->createDefaultLayers();
+
+    LayerCamera* camera = obj->getLayersByType<LayerCamera>().front();
+    LayerBitmap* layer = dynamic_cast<LayerBitmap*>(obj->getLayer(2));
+    layer->addNewKeyFrameAt(1);
+    layer->getBitmapImageAtFrame(1)->drawRect(QRectF(0, 0, 100, 100), QPen(Qt::red), QBrush(Qt::red), QPainter::CompositionMode_SourceOver, false);
+    layer->addNewKeyFrameAt(3);
+    layer->getBitmapImageAtFrame(3)->drawRect(QRectF(0, 0, 100, 100), QPen(Qt::blue), QBrush(Qt::blue), QPainter::CompositionMode_SourceOver, false);
+
+    QTemporaryDir testDir("PENCIL_TEST_XXXXXXXX");
+    auto contents = [&testDir](int frame)
+    {
+        QFile file(QString("%1/frame%2.png").arg(testDir.path()).arg(frame, 4, 10, QChar('0')));
+        return file.open(QFile::ReadOnly) ? file.readAll() : QByteArray();
+    };
+
+    SECTION("Held frames are copies of their key frame")
+    {
+        REQUIRE(obj->exportFrames(1, 4, camera, QSize(64, 48), testDir.path() + "/frame.png", "PNG",
+                                  false, false, "", true, nullptr, 0));
+
+        REQUIRE_FALSE(contents(1).isEmpty());
+        REQUIRE_FALSE(contents(3).isEmpty());
+        REQUIRE(contents(2) == contents(1));
+        REQUIRE(contents(4) == contents(3));
+        REQUIRE(contents(3) != contents(1));
+    }
+
+    SECTION("Only the key frames of a layer")
+    {
+        REQUIRE(obj->exportFrames(1, 4, camera, QSize(64, 48), testDir.path() + "/frame.png", "PNG",
+                                  false, true, layer->name(), true, nullptr, 0));
+
+        REQUIRE_FALSE(contents(1).isEmpty());
+        REQUIRE(contents(2).isEmpty());
+        REQUIRE_FALSE(contents(3).isEmpty());
+        REQUIRE(contents(4).isEmpty());
+    }
+}
+
 /*
 void TestObject::testMoveLayer()
 {
@@ -0,0 +1,84 @@
+/*
+
+Pencil - Traditional Animation Software
+Copyright (C) 2012-2018 Matthew Chiawen Chang
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+*/
+#include "catch.hpp"
+
+#include <QApplication>
+#include <QMouseEvent>
+#include "pencildef.h"
+#include "editor.h"
+#include "object.h"
+#include "layerbitmap.h"
+#include "bitmapimage.h"
+#include "scribblearea.h"
+#include "layermanager.h"
+#include "toolmanager.h"
+#include "viewmanager.h"
+
+
+TEST_CASE("SmudgeTool")
+{
+    Editor* editor = new Editor;
+    ScribbleArea* scribbleArea = new ScribbleArea(nullptr);
+    editor->setScribbleArea(scribbleArea);
+    editor->init();
+    scribbleArea->setEditor(editor);
+    scribbleArea->init();
+
+    Object* object = new Object;
+    object->init();
+    LayerBitmap* layer = object->addNewBitmapLayer();
+    editor->setObject(object);
+    editor->layers()->setCurrentLayer(layer);
+    editor->scrubTo(1);
+    editor->tools()->setCurrentTool(SMUDGE);
+    editor->tools()->setWidth(24);
+
+    BitmapImage* image = layer->getBitmapImageAtFrame(1);
+    BitmapImage paint(QRect(0, 0, 20, 40), Qt::blue);
+    image->paste(&paint);
+    const QRect boundsBefore = image->bounds();
+    const QImage pixelsBefore = *image->image();
+
+    auto send = [&](QEvent::Type type, QPointF canvasPoint, Qt::MouseButton button, Qt::MouseButtons buttons)
+    {
+        QMouseEvent event(type, editor->view()->mapCanvasToScreen(canvasPoint), button, buttons, Qt::NoModifier);
+        QApplication::sendEvent(scribbleArea, &event);
+    };
+
+    SECTION("A stroke is undone and redone as a whole")
+    {
+        send(QEvent::MouseButtonPress, QPointF(10, 20), Qt::LeftButton, Qt::LeftButton);
+        send(QEvent::MouseMove, QPointF(16, 20), Qt::NoButton, Qt::LeftButton);
+        send(QEvent::MouseMove, QPointF(24, 20), Qt::NoButton, Qt::LeftButton);
+        send(QEvent::MouseMove, QPointF(30, 20), Qt::NoButton, Qt::LeftButton);
+        send(QEvent::MouseButtonRelease, QPointF(30, 20), Qt::LeftButton, Qt::NoButton);
+
+        REQUIRE(image->bounds() != boundsBefore);
+        const QRect boundsSmudged = image->bounds();
+        const QImage pixelsSmudged = *image->image();
+
+        editor->undo();
+        REQUIRE(image->bounds() == boundsBefore);
+        REQUIRE(*image->image() == pixelsBefore);
+
+        editor->redo();
+        REQUIRE(image->bounds() == boundsSmudged);
+        REQUIRE(*image->image() == pixelsSmudged);
+    }
+
+    delete editor;
+    delete scribbleArea;
+}
@@ -0,0 +1,264 @@
+/*
+
+Pencil - Traditional Animation Software
+Copyright (C) 2012-2018 Matthew Chiawen Chang
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; version 2 of the License.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+*/
+#include "catch.hpp"
+
+#include <QFileInfo>
+#include <QTemporaryDir>
+#include "vectorimage.h"
+#include "object.h"
+
+namespace
+{
+    /** Adds a horizontal stroke at height y, from x = 0 to x = 300 */
+    void addLine(VectorImage& image, qreal y)
+    {
+        BezierCurve curve(QList<QPointF>{ QPointF(0, y), QPointF(150, y), QPointF(300, y) });
+        image.addCurve(curve, 1.0, false);
+    }
+
+    /** Whether two points are the same once stored as floats */
+    bool samePoint(const QPointF& a, const QPointF& b)
+    {
+        return qAbs(a.x() - b.x()) < 1e-3 && qAbs(a.y() - b.y()) < 1e-3;
+    }
+}
+
+TEST_CASE("VectorImage curve lookups")
+{
+    VectorImage image;
+    for (int i = 0; i < 5; i++)
+    {
+        addLine(image, i * 100.0);
+    }
+
+    SECTION("Only the curves near the point are found")
+    {
+        REQUIRE(image.getCurvesCloseTo(QPointF(200, 202), 5) == QList<int>{ 2 });
+        REQUIRE(image.getCurvesCloseTo(QPointF(200, 250), 5).isEmpty());
+
+        QList<VertexRef> vertices = image.getVerticesCloseTo(QPointF(298, 401), 5);
+        REQUIRE(vertices.size() == 1);
+        REQUIRE(vertices[0] == VertexRef(4, 1));
+    }
+
+    SECTION("Curve numbers follow removals")
+    {
+        image.removeCurveAt(0);
+        REQUIRE(image.getCurvesCloseTo(QPointF(200, 202), 5) == QList<int>{ 1 });
+
+        addLine(image, 250);
+        REQUIRE(image.getCurvesCloseTo(QPointF(200, 250), 5) == QList<int>{ 4 });
+    }
+
+    SECTION("Moved curves are found where they are")
+    {
+        image.setSelected(0, true);
+        image.setSelectionTransformation(QTransform::fromTranslate(0, 1000));
+        REQUIRE(image.getCurvesCloseTo(QPointF(200, 1000), 5) == QList<int>{ 0 });
+
+        image.applySelectionTransformation();
+        image.deselectAll();
+        REQUIRE(image.getCurvesCloseTo(QPointF(200, 1000), 5) == QList<int>{ 0 });
+        REQUIRE(image.getCurvesCloseTo(QPointF(200, 0), 5).isEmpty());
+    }
+
+    SECTION("Rasterized frames are only painted again after a change")
+    {
+        Object object;
+        object.addColour(QColor(Qt::black));
+        image.setObject(&object);
+
+        const QSize size(400, 500);
+        const QImage first = image.rasterized(size, QTransform(), false, false, true);
+        REQUIRE(image.rasterized(size, QTransform(), false, false, true).cacheKey() == first.cacheKey());
+
+        QImage moved = image.rasterized(size, QTransform::fromTranslate(5, 0), false, false, true);
+        REQUIRE(moved.cacheKey() != first.cacheKey());
+        REQUIRE(image.rasterized(size, QTransform::fromTranslate(5, 0), false, false, true).cacheKey() == moved.cacheKey());
+
+        object.setColour(0, QColor(Qt::red));
+        QImage recoloured = image.rasterized(size, QTransform::fromTranslate(5, 0), false, false, true);
+        REQUIRE(recoloured.cacheKey() != moved.cacheKey());
+
+        image.removeCurveAt(0);
+        REQUIRE(image.rasterized(size, QTransform::fromTranslate(5, 0), false, false, true).cacheKey() != recoloured.cacheKey());
+    }
+
+    SECTION("An assigned copy holds the curves but not the paint caches")
+    {
+        Object object;
+        object.addColour(QColor(Qt::black));
+        image.setObject(&object);
+
+        const qint64 geometryBytes = image.memoryUsage();
+        image.rasterized(QSize(400, 500), QTransform(), false, false, true);
+        REQUIRE(image.memoryUsage() > geometryBytes);
+
+        VectorImage copy;
+        copy = image;
+        REQUIRE(copy.getLastCurveNumber() == image.getLastCurveNumber());
+        REQUIRE(copy.memoryUsage() == geometryBytes);
+
+        // Assigned over, the image gives its raster up
+        image = copy;
+        REQUIRE(image.memoryUsage() == geometryBytes);
+    }
+}
+
+TEST_CASE("VectorImage files")
+{
+    QTemporaryDir testDir("PENCIL_TEST_XXXXXXXX");
+    const QString path = testDir.filePath("001.001.vec");
+
+    VectorImage original;
+    for (int i = 0; i < 3; i++)
+    {
+        addLine(original, i * 100.0);
+    }
+    REQUIRE(original.write(path, "VEC").ok());
+
+    SECTION("Key frames made from a file read it on first use")
+    {
+        VectorImage image(path);
+        REQUIRE_FALSE(image.isLoaded());
+        REQUIRE_FALSE(image.isModified());
+
+        image.loadFile();
+        REQUIRE(image.isLoaded());
+        REQUIRE_FALSE(image.isModified());
+        REQUIRE(image.getLastCurveNumber() == 2);
+        REQUIRE(image.getVertex(1, 1) == QPointF(300, 100));
+    }
+
+    SECTION("Unmodified key frames are dropped when unloaded")
+    {
+        VectorImage image(path);
+        image.loadFile();
+        image.unloadFile();
+        REQUIRE_FALSE(image.isLoaded());
+        REQUIRE(image.memoryUsage() == 0);
+
+        image.loadFile();
+        REQUIRE(image.getLastCurveNumber() == 2);
+    }
+
+    SECTION("Modified key frames stay in memory")
+    {
+        VectorImage image(path);
+        image.loadFile();
+        addLine(image, 300);
+        image.unloadFile();
+        REQUIRE(image.isLoaded());
+        REQUIRE(image.getLastCurveNumber() == 3);
+    }
+}
+
+TEST_CASE("VectorImage binary format")
+{
+    QTemporaryDir testDir("PENCIL_TEST_XXXXXXXX");
+    const QString binaryPath = testDir.filePath("001.001.vecb");
+    const QString xmlPath = testDir.filePath("001.001.vec");
+
+    VectorImage original;
+    for (int i = 0; i < 3; i++)
+    {
+        addLine(original, i * 100.0);
+    }
+    BezierCurve stroke(QList<QPointF>{ QPointF(10, 10), QPointF(60, 90), QPointF(140, 30), QPointF(200, 120) },
+                       QList<qreal>{ 0.25, 0.5, 0.75, 1.0 }, 0.0, true);
+    stroke.setWidth(3.5);
+    stroke.setFeather(2);
+    stroke.setVariableWidth(true);
+    stroke.setColourNumber(2);
+    stroke.setFilled(true);
+    original.addCurve(stroke, 1.0, false);
+
+    original.curve(1).setInvisibility(true);
+    original.setSelected(2, 0, true);
+    original.addArea(BezierArea(QList<VertexRef>{ VertexRef(0, -1), VertexRef(0, 1), VertexRef(1, 1), VertexRef(1, -1) }, 1));
+
+    REQUIRE(original.write(binaryPath, "VECB").ok());
+
+    SECTION("Curves and areas come back as they were written")
+    {
+        VectorImage image;
+        REQUIRE(image.read(binaryPath));
+        REQUIRE(image.getLastCurveNumber() == original.getLastCurveNumber());
+
+        for (int i = 0; i <= original.getLastCurveNumber(); i++)
+        {
+            const BezierCurve& expected = original.curve(i);
+            const BezierCurve& actual = image.curve(i);
+
+            REQUIRE(actual.getVertexSize() == expected.getVertexSize());
+            REQUIRE(actual.getWidth() == expected.getWidth());
+            REQUIRE(actual.getFeather() == expected.getFeather());
+            REQUIRE(actual.getVariableWidth() == expected.getVariableWidth());
+            REQUIRE(actual.getColourNumber() == expected.getColourNumber());
+            REQUIRE(actual.isInvisible() == expected.isInvisible());
+            REQUIRE(actual.isFilled() == expected.isFilled());
+            REQUIRE(samePoint(actual.getOrigin(), expected.getOrigin()));
+            REQUIRE(actual.getPressure(0) == expected.getPressure(0));
+            REQUIRE_FALSE(actual.isSelected(-1));
+
+            for (int j = 0; j < expected.getVertexSize(); j++)
+            {
+                REQUIRE(samePoint(actual.getVertex(j), expected.getVertex(j)));
+                REQUIRE(samePoint(actual.getC1(j), expected.getC1(j)));
+                REQUIRE(samePoint(actual.getC2(j), expected.getC2(j)));
+                REQUIRE(actual.getPressure(j + 1) == expected.getPressure(j + 1));
+                REQUIRE_FALSE(actual.isSelected(j));
+            }
+        }
+
+        REQUIRE(image.mArea.size() == 1);
+        REQUIRE(image.mArea[0].mVertex.size() == original.mArea[0].mVertex.size());
+        for (int j = 0; j < original.mArea[0].mVertex.size(); j++)
+        {
+            REQUIRE(image.mArea[0].mVertex[j].curveNumber == original.mArea[0].mVertex[j].curveNumber);
+            REQUIRE(image.mArea[0].mVertex[j].vertexNumber == original.mArea[0].mVertex[j].vertexNumber);
+        }
+        REQUIRE(image.mArea[0].getColourNumber() == 1);
+        REQUIRE(image.curve(1).isInvisible());
+    }
+
+    SECTION("The selection is not saved")
+    {
+        REQUIRE(original.isSelected(2, 0));
+        original.setAreaSelected(0, true);
+        REQUIRE(original.write(binaryPath, "VECB").ok());
+
+        VectorImage image;
+        REQUIRE(image.read(binaryPath));
+        REQUIRE_FALSE(image.isSelected(2, 0));
+        REQUIRE_FALSE(image.isAreaSelected(0));
+    }
+
+    SECTION("The binary file is smaller than the XML one")
+    {
+        REQUIRE(original.write(xmlPath, "VEC").ok());
+        REQUIRE(QFileInfo(binaryPath).size() * 3 < QFileInfo(xmlPath).size());
+    }
+
+    SECTION("Cut short files are not read")
+    {
+        QFile file(binaryPath);
+        REQUIRE(file.resize(file.size() / 2));
+
+        VectorImage image;
+        REQUIRE_FALSE(image.read(binaryPath));
+    }
+}
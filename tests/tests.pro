@@ -39,6 +39,9 @@ SOURCES += \
     src/test_object.cpp \
     src/test_filemanager.cpp \
     src/test_bitmapimage.cpp \
+    src/test_frameimporter.cpp \
+    src/test_vectorimage.cpp \
+    src/test_smudgetool.cpp \
     src/test_viewmanager.cpp
 
 # --- CoreLib ---